@@ -0,0 +1,324 @@
+#include <iostream>
+#include "BackupMerkleTree.h"
+#include "MetaDataSerializer.h"
+
+//blocks of a partition the tree covers, the last partition of a volume may hold fewer
+static UINT64 PartitionLeafCount(const MerkleTreeRoot& root, UINT64 partId)
+{
+	UINT64 first = partId * root.partitionBlocks;
+
+	return first < root.blocks ? min(root.partitionBlocks, root.blocks - first) : 0;
+}
+
+BackupMerkleTree::BackupMerkleTree(BackupStorage* backupStorage) :
+	m_backupStorage(backupStorage)
+{
+}
+
+int BackupMerkleTree::Build(const VolumeMetaData& volume, string backupId, const BackupMetaData& metadata, bool chainStart, UINT64 capacity)
+{
+	const VolumeGeometry& geometry = metadata.geometry;
+
+	MerkleTreeRoot root;
+	root.blockSize = geometry.blockSize;
+	root.partitionBlocks = geometry.partitionBlocks;
+	root.blocks = geometry.BlockCount(capacity);
+
+	//the restore point before this one, the backup listed before it
+	string parentId;
+	auto self = find(volume.backupIds.begin(), volume.backupIds.end(), backupId);
+
+	if (!chainStart && self != volume.backupIds.begin())
+	{
+		parentId = *(self - 1);
+	}
+
+	MerkleTreeRoot parent;
+	bool hasParent = false;
+	map<UINT64, uint64_t> chainHashes;
+
+	if (!parentId.empty())
+	{
+		if (m_backupStorage->GetMerkleTreeRoot(parentId, parent) == 0 && parent.blockSize == root.blockSize && parent.partitionBlocks == root.partitionBlocks)
+		{
+			hasParent = true;
+		}
+		else
+		{
+			//chains started before trees were built, read once, the trees of later backups extend this one
+			cout << "Merkle tree of " << parentId << " is not available, block hashes are read from its chain" << endl;
+
+			RestoreChain restoreChain(m_backupStorage, "", geometry);
+
+			if (restoreChain.Build(volume, parentId, capacity) != 0 || restoreChain.GetBlockHashes(chainHashes) != 0)
+			{
+				return ERROR_CODE;
+			}
+		}
+	}
+
+	map<uint64_t, BlockHashTable> changed;
+	SplitBlockTable(metadata.blockHashTable, geometry, changed);
+
+	UINT64 partitions = geometry.PartitionCount(capacity);
+	UINT64 storedPartitions = 0;
+
+	for (UINT64 partId = 0; partId < partitions; partId++)
+	{
+		UINT64 leafCount = PartitionLeafCount(root, partId);
+		UINT64 firstBlock = partId * root.partitionBlocks;
+		auto own = changed.find(partId);
+
+		if (hasParent && own == changed.end() && partId < parent.partitionHashes.size() && PartitionLeafCount(parent, partId) == leafCount)
+		{
+			root.partitionHashes.push_back(parent.partitionHashes[partId]);
+			root.partitionOwners.push_back(parent.partitionOwners[partId]);
+			continue;
+		}
+
+		vector<uint64_t> leaves;
+
+		if (hasParent && partId < parent.partitionHashes.size())
+		{
+			if (GetLeaves(parent, partId, leaves) != 0)
+			{
+				return ERROR_CODE;
+			}
+		}
+
+		leaves.resize(leafCount, 0);
+
+		for (auto iter = chainHashes.lower_bound(firstBlock); iter != chainHashes.end() && iter->first < firstBlock + leafCount; iter++)
+		{
+			leaves[iter->first - firstBlock] = iter->second;
+		}
+
+		if (own != changed.end())
+		{
+			for (size_t i = 0; i < own->second.keys.size(); i++)
+			{
+				if (own->second.keys[i] < firstBlock + leafCount)
+				{
+					leaves[own->second.keys[i] - firstBlock] = own->second.values[i];
+				}
+			}
+		}
+
+		root.partitionHashes.push_back(merkle_root(leaves));
+
+		//unwritten partitions are common on thin disks, their leaves follow from the geometry
+		if (count(leaves.begin(), leaves.end(), 0) == (ptrdiff_t)leaves.size())
+		{
+			root.partitionOwners.push_back("");
+			continue;
+		}
+
+		if (m_backupStorage->UploadMerkleTreeLeaves(backupId, partId, leaves) != 0)
+		{
+			return ERROR_CODE;
+		}
+
+		root.partitionOwners.push_back(backupId);
+		storedPartitions++;
+	}
+
+	if (m_backupStorage->UploadMerkleTreeRoot(backupId, root) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	cout << "Merkle tree root " << hex << RootHash(root) << dec << ", leaves of " << storedPartitions << " of " << partitions << " partitions stored" << endl;
+
+	return 0;
+}
+
+int BackupMerkleTree::Diff(string firstBackupId, string secondBackupId, vector<UINT64>& blockIndices)
+{
+	MerkleTreeRoot first;
+	MerkleTreeRoot second;
+
+	blockIndices.clear();
+
+	if (m_backupStorage->GetMerkleTreeRoot(firstBackupId, first) != 0 || m_backupStorage->GetMerkleTreeRoot(secondBackupId, second) != 0)
+	{
+		cout << "Merkle tree is not available" << endl;
+		return ERROR_CODE;
+	}
+
+	if (first.blockSize != second.blockSize || first.partitionBlocks != second.partitionBlocks)
+	{
+		cout << "Restore points of different block geometries cannot be compared" << endl;
+		return ERROR_CODE;
+	}
+
+	//the partition roots are all in the root objects, only partitions whose roots differ are read
+	UINT64 partitions = max(first.partitionHashes.size(), second.partitionHashes.size());
+
+	for (UINT64 partId = 0; partId < partitions; partId++)
+	{
+		UINT64 firstCount = PartitionLeafCount(first, partId);
+		UINT64 secondCount = PartitionLeafCount(second, partId);
+
+		if (firstCount == secondCount && first.partitionHashes[partId] == second.partitionHashes[partId])
+		{
+			continue;
+		}
+
+		vector<uint64_t> firstLeaves;
+		vector<uint64_t> secondLeaves;
+
+		if ((firstCount > 0 && GetLeaves(first, partId, firstLeaves) != 0) || (secondCount > 0 && GetLeaves(second, partId, secondLeaves) != 0))
+		{
+			return ERROR_CODE;
+		}
+
+		//a volume resized between the restore points, blocks past the end of the smaller one count as unwritten
+		firstLeaves.resize(max(firstCount, secondCount), 0);
+		secondLeaves.resize(firstLeaves.size(), 0);
+
+		vector<vector<uint64_t>> firstLevels;
+		vector<vector<uint64_t>> secondLevels;
+		vector<uint64_t> leaves;
+
+		merkle_build_levels(firstLeaves, firstLevels);
+		merkle_build_levels(secondLeaves, secondLevels);
+		merkle_diff(firstLevels, secondLevels, leaves);
+
+		for (uint64_t leaf : leaves)
+		{
+			blockIndices.push_back(partId * first.partitionBlocks + leaf);
+		}
+	}
+
+	return 0;
+}
+
+int BackupMerkleTree::VerifyRange(const RestoreChain& restoreChain, string backupId, UINT64 firstBlock, UINT64 blocks, uint64_t rootHash)
+{
+	MerkleTreeRoot root;
+
+	if (m_backupStorage->GetMerkleTreeRoot(backupId, root) != 0)
+	{
+		cout << "Merkle tree is not available" << endl;
+		return ERROR_CODE;
+	}
+
+	if (blocks == 0 || firstBlock + blocks > root.blocks || root.blockSize != restoreChain.GetGeometry().blockSize)
+	{
+		cout << "Block range is outside the restore point" << endl;
+		return ERROR_CODE;
+	}
+
+	UINT64 firstPart = firstBlock / root.partitionBlocks;
+	UINT64 lastPart = (firstBlock + blocks - 1) / root.partitionBlocks;
+	vector<uint64_t> partitionRoots;
+	vector<char> buffer(root.blockSize);
+	vector<bool> sectorMask;
+	UINT64 mismatchedBlocks = 0;
+
+	for (UINT64 partId = firstPart; partId <= lastPart; partId++)
+	{
+		vector<uint64_t> leaves;
+
+		if (GetLeaves(root, partId, leaves) != 0)
+		{
+			return ERROR_CODE;
+		}
+
+		UINT64 partStart = partId * root.partitionBlocks;
+		UINT64 lo = max(firstBlock, partStart) - partStart;
+		UINT64 hi = min(firstBlock + blocks, partStart + leaves.size()) - partStart;
+		vector<uint64_t> hashes(hi - lo, 0);
+
+		for (UINT64 i = lo; i < hi; i++)
+		{
+			UINT64 blockIndex = partStart + i;
+
+			//hashed as the backup hashed it, the whole block with unwritten sectors zeroed
+			if (restoreChain.ContainsBlock(blockIndex))
+			{
+				fill(buffer.begin(), buffer.end(), 0);
+
+				if (restoreChain.ReadBlock(blockIndex, buffer.data(), sectorMask) != 0)
+				{
+					return ERROR_CODE;
+				}
+
+				hashes[i - lo] = xxhash64(buffer.data(), buffer.size());
+			}
+
+			if (hashes[i - lo] != leaves[i])
+			{
+				cout << "Block hash mismatch, block: " << blockIndex << endl;
+				mismatchedBlocks++;
+			}
+		}
+
+		vector<vector<uint64_t>> levels;
+		vector<uint64_t> proof;
+		uint64_t partitionRoot = 0;
+
+		merkle_build_levels(leaves, levels);
+		merkle_range_proof(levels, lo, hi - lo, proof);
+
+		if (!merkle_range_root(hashes.data(), hi - lo, lo, leaves.size(), proof, partitionRoot))
+		{
+			return ERROR_CODE;
+		}
+
+		partitionRoots.push_back(partitionRoot);
+	}
+
+	vector<vector<uint64_t>> levels;
+	vector<uint64_t> proof;
+	uint64_t computedRoot = 0;
+
+	merkle_build_levels(root.partitionHashes, levels);
+	merkle_range_proof(levels, firstPart, lastPart - firstPart + 1, proof);
+
+	if (!merkle_range_root(partitionRoots.data(), partitionRoots.size(), firstPart, root.partitionHashes.size(), proof, computedRoot))
+	{
+		return ERROR_CODE;
+	}
+
+	uint64_t expectedRoot = rootHash != 0 ? rootHash : RootHash(root);
+
+	if (computedRoot != expectedRoot)
+	{
+		cout << "Blocks " << firstBlock << " to " << firstBlock + blocks - 1 << " do not match root " << hex << expectedRoot << dec
+			 << ", " << mismatchedBlocks << " blocks differ from their recorded hashes" << endl;
+
+		return ERROR_CODE;
+	}
+
+	cout << "Blocks " << firstBlock << " to " << firstBlock + blocks - 1 << " match root " << hex << expectedRoot << dec << endl;
+
+	return 0;
+}
+
+int BackupMerkleTree::GetLeaves(const MerkleTreeRoot& root, UINT64 partId, vector<uint64_t>& leaves)
+{
+	UINT64 leafCount = PartitionLeafCount(root, partId);
+
+	if (partId >= root.partitionOwners.size())
+	{
+		leaves.clear();
+		return ERROR_CODE;
+	}
+
+	if (root.partitionOwners[partId].empty())
+	{
+		leaves.assign(leafCount, 0);
+		return 0;
+	}
+
+	if (m_backupStorage->GetMerkleTreeLeaves(root.partitionOwners[partId], partId, leaves) != 0 || leaves.size() != leafCount)
+	{
+		cout << "Merkle tree leaves of partition " << partId + 1 << " are not available, backup: " << root.partitionOwners[partId] << endl;
+
+		leaves.clear();
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
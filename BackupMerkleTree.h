@@ -0,0 +1,45 @@
+#ifndef BACKUPMERKLETREE_H
+#define BACKUPMERKLETREE_H
+
+#include "BackupStorage.h"
+#include "RestoreChain.h"
+#include "core/merkle_tree.h"
+
+using namespace std;
+
+//Merkle tree over the block hashes of a restore point, split along the partition layout: the root
+//object holds one subtree root per partition and each partition's leaves are the hashes of its
+//blocks, 0 for blocks no backup of the chain wrote. A backup stores only the leaves of the
+//partitions it changed, the others are named in its root with the backup of its chain that stored
+//them, which garbage collection keeps as long as the chain is retained.
+class BackupMerkleTree
+{
+public:
+	BackupMerkleTree(BackupStorage* backupStorage);
+
+	BackupMerkleTree(const BackupMerkleTree&) = delete;
+	BackupMerkleTree& operator = (const BackupMerkleTree&) = delete;
+
+	//builds the tree of backupId from its block hashes and the tree of the restore point before it,
+	//chainStart for full and synthetic full backups, whose block hashes cover their whole restore point
+	int Build(const VolumeMetaData& volume, string backupId, const BackupMetaData& metadata, bool chainStart, UINT64 capacity);
+
+	//blocks whose hashes differ between two restore points of the same geometry, ascending. Partitions
+	//with equal subtree roots are skipped, differing ones are descended into only where they differ.
+	int Diff(string firstBackupId, string secondBackupId, vector<UINT64>& blockIndices);
+
+	//hashes blocks [firstBlock, firstBlock + blocks) of the restore point restoreChain was built for and
+	//recomputes the root from them and the stored hashes around the range, rootHash 0 checks it
+	//against the root recorded with the backup
+	int VerifyRange(const RestoreChain& restoreChain, string backupId, UINT64 firstBlock, UINT64 blocks, uint64_t rootHash);
+
+	static uint64_t RootHash(const MerkleTreeRoot& root) { return merkle_root(root.partitionHashes); }
+
+private:
+	//leaves of a partition, all 0 when no backup stored them
+	int GetLeaves(const MerkleTreeRoot& root, UINT64 partId, vector<uint64_t>& leaves);
+
+	BackupStorage* m_backupStorage;
+};
+
+#endif
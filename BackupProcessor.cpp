@@ -5,31 +5,105 @@
 #include <thread>
 #include <memory>
 #include <map>
+#include <set>
+#include <chrono>
 #include "BackupProcessor.h"
+#include "RestoreChain.h"
+#include "NbdServer.h"
+#include "RestoreTargetFactory.h"
+#include "CompressionController.h"
+#include "PageDeduplicator.h"
+#include "BackupMerkleTree.h"
 #include "core/file_handler.h"
 #include "core/crc32.h"
-#include "core/compression.h"
+#include "core/block_envelope.h"
+#include "core/entropy.h"
+#include "core/dictionary.h"
+#include "core/hash.h"
+#include "core/block_layout.h"
+#include "core/granularity.h"
+#include "core/fastcdc.h"
 
 using namespace std;
 using namespace Aws::Utils::Json;
 
-#define VIXDISKLIB_VERSION_MAJOR 6
-#define VIXDISKLIB_VERSION_MINOR 8
 #define SECTOR_CHUNK 2048
 
-int GetBackupBlockData(BackupStorage *backupStorage, string backupId, int partId, string key, int partIndex, char *buffer)
+//object size the benchmark uses to stand in for small incremental blocks
+const size_t BenchmarkPieceSize = 64 * 1024;
+
+//part of a packed block sealed and uploaded on its own: the whole block object or a chunk the store lacks
+struct BlockPiece
+{
+	size_t offset;
+	size_t size;
+	bool chunk;
+	chunk_id chunkId;
+};
+
+void MapByteRanges(const vector<ByteRange>& ranges, UINT64 capacity, const VolumeGeometry& geometry, vector<UINT64>& blockIndices, map<UINT64, vector<bool>>& sectorMasks, vector<UINT64>& partIds)
+{
+	UINT64 sectorsInBlock = geometry.SectorsPerBlock();
+	set<UINT64> partitions;
+
+	for (const ByteRange& range : ranges)
+	{
+		UINT64 end = min(range.offset + range.length, capacity);
+
+		if (range.offset >= end)
+		{
+			continue;
+		}
+
+		UINT64 firstSector = range.offset / VIXDISKLIB_SECTOR_SIZE;
+		UINT64 lastSector = (end - 1) / VIXDISKLIB_SECTOR_SIZE;
+
+		for (UINT64 sector = firstSector; sector <= lastSector; sector++)
+		{
+			UINT64 blockIndex = sector / sectorsInBlock;
+			vector<bool>& sectorMask = sectorMasks[blockIndex];
+
+			if (sectorMask.empty())
+			{
+				sectorMask.assign(sectorsInBlock, false);
+				partitions.insert(geometry.PartitionOf(blockIndex));
+			}
+
+			sectorMask[sector % sectorsInBlock] = true;
+		}
+	}
+
+	blockIndices.clear();
+
+	for (auto iter = sectorMasks.begin(); iter != sectorMasks.end(); iter++)
+	{
+		blockIndices.push_back(iter->first);
+	}
+
+	partIds.assign(partitions.begin(), partitions.end());
+}
+
+//geometry a job asks for, sizes it leaves out keep their defaults and the partition size is given in bytes
+int GetJobGeometry(const InputParams& params, VolumeGeometry& geometry)
 {
-	size_t cmpBufferSize = 2 * MB_BLOCK_SIZE;
-	char* cmpBuffer = (char*)malloc(cmpBufferSize);
+	geometry = VolumeGeometry();
+
+	if (params.blockSize != 0)
+	{
+		geometry.blockSize = params.blockSize;
+	}
 
-	int size = backupStorage->GetBackupBlockData(backupId, partId, key, { partIndex }, cmpBuffer);
+	UINT64 partitionSize = params.partitionSize != 0 ? params.partitionSize : DATA_BUFFER_SIZE;
+	geometry.partitionBlocks = partitionSize / geometry.blockSize;
 
-	int out_data_size = cmpBufferSize;
-	int bytes = decompress_raw_data(cmpBuffer, size, buffer, out_data_size);
+	if (!geometry.IsValid())
+	{
+		cout << "Invalid block geometry, block size: " << params.blockSize << ", partition size: " << params.partitionSize << endl;
 
-	free(cmpBuffer);
+		return ERROR_CODE;
+	}
 
-	return bytes;
+	return 0;
 }
 
 BackupProcessor::BackupProcessor(BackupStorage* backupStorage,
@@ -151,8 +225,86 @@ int BackupProcessor::QueryAllocatedBlocks(VixDiskLibHandle& handle)
 	return 0;
 }
 
-int BackupProcessor::BackupData(InputParams& params)
+int BackupProcessor::BackupData(InputParams& params, string volumeId)
 {
+	const block_codec* codec = find_codec(params.codec);
+
+	if (codec == NULL)
+	{
+		cout << "Compression codec is not available: " << params.codec << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	int codecLevel = codec_level(codec, params.codecLevel);
+	const block_codec* rawCodec = find_codec(BLOCK_CODEC_RAW);
+
+	//full backups start a chain with the geometry the job asks for, incrementals keep the one of their chain
+	VolumeGeometry geometry;
+
+	if (params.fullBackup)
+	{
+		if (GetJobGeometry(params, geometry) != 0)
+		{
+			return BackupTaskWithError(VIX_E_INVALID_ARG);
+		}
+	}
+	else if (m_backupStorage->GetVolumeGeometry(geometry) != 0)
+	{
+		//volumes backed up before the geometry was recorded
+		geometry = VolumeGeometry();
+	}
+	else if ((params.blockSize != 0 && params.blockSize != geometry.blockSize) ||
+			 (params.partitionSize != 0 && params.partitionSize != geometry.blockSize * geometry.partitionBlocks))
+	{
+		cout << "Block geometry only changes with a full backup, keeping " << geometry.blockSize << " byte blocks" << endl;
+	}
+
+	UINT64 blockSize = geometry.blockSize;
+
+	//granule the changed areas are rounded to and blocks are packed in, chosen per job
+	const granularity_kernels* kernels = find_granularity(params.trackingGranularity);
+
+	if (kernels == NULL || kernels->granule_size > blockSize)
+	{
+		cout << "Tracking granularity is not supported: " << params.trackingGranularity << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	if (params.chunkStore && params.chunking != "fixed" && params.chunking != "cdc")
+	{
+		cout << "Chunking mode is not supported: " << params.chunking << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	//chunks are read by other volumes, which cannot resolve references into this volume's backups
+	if (params.pageDedup && params.chunkStore)
+	{
+		cout << "Page deduplication and the chunk store cannot be combined" << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	bool keyed = !m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>()).encryptionKey.empty();
+
+	//chunks are shared by every volume of the client and stored without a backup key
+	if (params.chunkStore && keyed)
+	{
+		cout << "Volumes with an encryption key cannot use the chunk store" << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	//dictionaries are volume objects stored without a backup key and would expose samples of the blocks
+	bool useDictionary = params.useDictionary && !keyed;
+
+	if (params.useDictionary && keyed)
+	{
+		cout << "Volumes with an encryption key are compressed without a dictionary" << endl;
+	}
+
 	VixError vixError = VixDiskLib_InitEx(VIXDISKLIB_VERSION_MAJOR,
 										  VIXDISKLIB_VERSION_MINOR,
 										  NULL, NULL, NULL,
@@ -220,6 +372,88 @@ int BackupProcessor::BackupData(InputParams& params)
 		return BackupTaskWithError(VIX_E_FAIL);
 	}
 
+	VixDiskLibInfo* diskInfo = NULL;
+	vixError = VixDiskLib_GetInfo(handle, &diskInfo);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "Disk GetInfo error, code: " << vixError << endl;
+		VixDiskLib_Close(handle);
+		VixDiskLib_Disconnect(connection);
+		VixDiskLib_Exit();
+
+		return BackupTaskWithError(vixError);
+	}
+
+	UINT64 capacitySectors = diskInfo->capacity;
+	VixDiskLib_FreeInfo(diskInfo);
+
+	//full backups train a fresh dictionary for the volume, incrementals reuse the current one
+	uint32_t dictionaryId = 0;
+	string dictionaryData;
+
+	if (useDictionary && params.fullBackup)
+	{
+		vector<char> samples;
+
+		if (ReadSampleBlocks(handle, capacitySectors, blockSize, params.dictionarySamples > 0 ? params.dictionarySamples : 64, samples) != 0)
+		{
+			VixDiskLib_Close(handle);
+			VixDiskLib_Disconnect(connection);
+			VixDiskLib_Exit();
+
+			return BackupTaskWithError(VIX_E_FAIL);
+		}
+
+		dictionaryData = train_dictionary(samples.data(), samples.size() / blockSize, blockSize);
+
+		if (!dictionaryData.empty())
+		{
+			dictionaryId = dictionary_id(dictionaryData.data(), dictionaryData.size());
+
+			if (m_backupStorage->UploadVolumeDictionary(dictionaryId, dictionaryData) != 0)
+			{
+				dictionaryData.clear();
+			}
+			else
+			{
+				cout << "Compression dictionary " << dictionaryId << " of " << dictionaryData.size() << " bytes trained on " << samples.size() / blockSize << " blocks" << endl;
+			}
+		}
+	}
+	else if (useDictionary && m_backupStorage->GetVolumeDictionary(dictionaryId, dictionaryData) != 0)
+	{
+		dictionaryData.clear();
+	}
+
+	block_dictionary dictionary = { dictionaryId, dictionaryData.data(), dictionaryData.size() };
+	const block_dictionary* blockDictionary = dictionaryData.empty() ? NULL : &dictionary;
+
+	//chunks already in the client chunk store, blocks that match one are referenced instead of uploaded
+	ChunkIndex chunkIndex;
+	vector<chunk_id> newChunks;
+	bool useCdc = params.chunkStore && params.chunking == "cdc";
+	fastcdc_params cdcParams = fastcdc_setup(max(params.averageChunkSize, (UINT64)FASTCDC_MIN_AVG_SIZE));
+
+	if (params.chunkStore)
+	{
+		if (m_backupStorage->GetChunkIndex(chunkIndex) != 0)
+		{
+			cout << "Chunk index not available, every block is uploaded" << endl;
+		}
+
+		//other volumes have no access to this volume's dictionary
+		blockDictionary = NULL;
+	}
+
+	//pages stored by the earlier backups of the volume, blocks reference them instead of storing them again
+	PageDeduplicator pageDeduplicator(m_backupStorage, m_backupId, (size_t)params.pageIndexEntries);
+
+	if (params.pageDedup)
+	{
+		pageDeduplicator.Load(m_backupStorage->GetVolumeMetaData(volumeId), geometry);
+	}
+
 	UINT64 lastSectorOffset = 0;
 
 	for (UINT64 i = 0; i < m_changedDiskAreas.size(); i++)
@@ -228,34 +462,77 @@ int BackupProcessor::BackupData(InputParams& params)
 		lastSectorOffset = max(lastSectorOffset, entry.start + entry.length);
 	}
 
-	UINT64 blockCount = (UINT64)ceil((float)lastSectorOffset / (float)MB_BLOCK_SIZE);
-	UINT16 sectorSize = VIXDISKLIB_SECTOR_SIZE;
-	size_t blockDataMetadataSize = 2 * sizeof(UINT16) + (MB_BLOCK_SIZE / sectorSize) * sizeof(UINT16);
-	size_t blockDataSize = blockDataMetadataSize + MB_BLOCK_SIZE;
+	UINT64 blockCount = geometry.BlockCount(lastSectorOffset);
+	UINT32 granuleSize = kernels->granule_size;
+	UINT64 granulesInBlock = blockSize / granuleSize;
+	UINT64 sectorsInBlock = blockSize / VIXDISKLIB_SECTOR_SIZE;
+	size_t blockDataMetadataSize = compact_block_header_max_size((UINT32)granulesInBlock);
+	size_t blockDataSize = blockDataMetadataSize + blockSize;
 
 	char* blockBuffer = (char*)malloc(blockDataSize);
 	memset(blockBuffer, 0, blockDataSize);
-	memcpy(blockBuffer, (void*)&sectorSize, sizeof(UINT16));
 
-	size_t cmpBufferSize = MB_BLOCK_SIZE + blockDataMetadataSize + CMP_SIZE;
+	//changed granules of the current block, one bit per granule
+	vector<uint64_t> granuleMap(bitmap_words((UINT32)granulesInBlock));
+
+	//block content at its disk position, hashed so restore can compare it with a target disk
+	char* blockImage = (char*)malloc(blockSize);
+
+	//page deduplicated layout of the current block, built from the block image
+	UINT64 pagesInBlock = blockSize / DEDUP_PAGE_SIZE;
+	size_t pageBlockSize = params.pageDedup ? page_block_max_size((uint32_t)pagesInBlock) : 0;
+	char* pageBuffer = params.pageDedup ? (char*)malloc(pageBlockSize) : NULL;
+	vector<bool> presentPages(pagesInBlock);
+
+	size_t cmpBufferSize = block_envelope_bound(max(blockDataSize, pageBlockSize));
 	char* cmpBlockBuffer = (char*)malloc(cmpBufferSize * UploadBatchSize);
 	memset(cmpBlockBuffer, 0, cmpBufferSize * UploadBatchSize);
 	int cmpBufferOffsetIndex = -1;
 
-	BackupMetaData backupMetaData = m_backupStorage->GetBackupMetaData(m_backupId);
+	//status and key only, block hashes are rebuilt from the blocks this job reads
+	BackupMetaData backupMetaData = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>());
+	backupMetaData.geometry = geometry;
+
+	//incrementals write the blocks they read to a standby image that holds their parent, the disk
+	//is opened only now since VixDiskLib serves the backup. Other standbys catch up afterwards.
+	StandbyReplica standby(m_backupStorage, params.standbyId);
+	bool standbyLoaded = params.standby && standby.Load(params) == 0;
+	bool standbyInFlight = false;
+
+	if (standbyLoaded && !params.fullBackup && params.standbyType == "raw" && standby.HoldsParentOf(m_backupStorage->GetVolumeMetaData(volumeId), m_backupId))
+	{
+		standbyInFlight = standby.BeginApply(params, m_backupId, (UINT64)params.volumeSize * VOLUME_SIZE_UNIT, blockSize, true) == 0;
+	}
+
+	CompressionController controller(codec, codecLevel, params.minCodecLevel, params.maxCodecLevel, UploadBatchSize);
+
+	//blocks stored raw because sampling predicted the codec would not shrink them
+	UINT64 sealedBlocks = 0;
+	UINT64 skippedBlocks = 0;
+	UINT64 skippedBytes = 0;
+	UINT64 rawBytes = 0;
+	UINT64 storedBytes = 0;
+	UINT64 chunkCount = 0;
+	UINT64 dedupedChunks = 0;
+	UINT64 dedupedBytes = 0;
+	UINT64 chunkedBytes = 0;
+	double chunkingSeconds = 0;
 
 	for (UINT64 i = 0; i < blockCount; i++)
 	{
-		UINT64 start = i * MB_BLOCK_SIZE;
-		UINT64 end = (i + 1) * MB_BLOCK_SIZE;
+		auto cycleStart = chrono::steady_clock::now();
+		UINT64 start = i * blockSize;
+		UINT64 end = (i + 1) * blockSize;
 
 		if (i + 1 == blockCount)
 		{
 			end = lastSectorOffset;
 		}
 
-		vector<UINT64> sectorIndices;
-		UINT64 sectorBufferOffset = 0;
+		UINT64 blockSectorStart = i * sectorsInBlock;
+		vector<ChangedDiskArea> sectorAreas;
+
+		fill(granuleMap.begin(), granuleMap.end(), 0);
 
 		for (UINT64 j = 0; j < m_changedDiskAreas.size(); j++)
 		{
@@ -271,334 +548,1328 @@ int BackupProcessor::BackupData(InputParams& params)
 
 			UINT64 intersectionStart = max(start, areaStart);
 			UINT64 intersectionEnd = min(end, areaEnd);
-			UINT64 startSector = intersectionStart / sectorSize;
-			UINT64 endSector = intersectionEnd / sectorSize;
-			UINT64 sectorNum = endSector - startSector;
-		
-			UINT64 blockSectorStart = i * MB_BLOCK_SIZE / sectorSize;
-			UINT64 blockSectorOffset = startSector - blockSectorStart;
-
-			for (UINT64 k = 0; k < sectorNum; k++)
+
+			if (intersectionEnd <= intersectionStart)
 			{
-				sectorIndices.push_back(blockSectorOffset + k);
+				continue;
 			}
 
-			char *ptr = blockBuffer + blockDataMetadataSize + sectorBufferOffset;
+			UINT32 firstGranule = 0;
+			UINT32 granuleNum = 0;
 
-			vixError = VixDiskLib_Read(handle, startSector, sectorNum, (uint8 *)ptr);
+			kernels->mark_range(granuleMap.data(), start, intersectionStart, intersectionEnd, firstGranule, granuleNum);
 
-			sectorBufferOffset += (sectorNum * sectorSize);
-
-			if (vixError != VIX_OK)
-			{
-				VixDiskLib_Close(handle);
-				VixDiskLib_Disconnect(connection);
-				VixDiskLib_Exit();
-
-				return BackupTaskWithError(vixError);
-			}
+			//whole granules are read, the last one of the disk may be partial
+			ChangedDiskArea sectorArea;
+			sectorArea.start = blockSectorStart + (UINT64)firstGranule * granuleSize / VIXDISKLIB_SECTOR_SIZE;
+			sectorArea.length = min((UINT64)granuleNum * granuleSize / VIXDISKLIB_SECTOR_SIZE, capacitySectors - sectorArea.start);
+			sectorAreas.push_back(sectorArea);
 		}
 
-		UINT16 sectorCount = sectorIndices.size();
+		UINT32 granuleCount = count_bitmap_bits(granuleMap.data(), (UINT32)granulesInBlock);
 
-		if (sectorCount == 0)
+		if (granuleCount == 0)
 		{
 			continue;
 		}
 
-		memcpy(blockBuffer + sizeof(UINT16), (void*)&sectorCount, sizeof(UINT16));
+		memset(blockImage, 0, blockSize);
 
-		for (UINT64 k = 0; k < sectorIndices.size(); k++)
+		if (!params.fullBackup && granuleCount < granulesInBlock)
 		{
-			UINT16 sectorId = sectorIndices[k];
-			memcpy(blockBuffer + 2 * sizeof(UINT16) + k * sizeof(UINT16), (void*)&sectorId, sizeof(UINT16));
+			//unchanged sectors are needed for the block hash, one read of the block is cheaper than one per area
+			UINT64 blockSectors = min(sectorsInBlock, capacitySectors - blockSectorStart);
+			sectorAreas.clear();
+
+			ChangedDiskArea sectorArea;
+			sectorArea.start = blockSectorStart;
+			sectorArea.length = blockSectors;
+			sectorAreas.push_back(sectorArea);
 		}
 
-		UINT64 position = i * MB_BLOCK_SIZE;
-		UINT64 partId = position / DATA_BUFFER_SIZE;
-		UINT64 blockId = (position - partId * DATA_BUFFER_SIZE) / MB_BLOCK_SIZE;
-		size_t blockUploadSize = blockDataMetadataSize + (uint64_t)sectorCount * sectorSize;
+		for (UINT64 j = 0; j < sectorAreas.size(); j++)
+		{
+			char *ptr = blockImage + (sectorAreas[j].start - blockSectorStart) * VIXDISKLIB_SECTOR_SIZE;
 
-		char* dataPtr = blockBuffer + blockDataMetadataSize;
-		size_t dataSize = (uint64_t)sectorCount * sectorSize;
-		uint64_t crc = sse42_crc32((uint64_t *)dataPtr, dataSize);
-		string item = to_string(partId + 1) + "/" + to_string(blockId + 1);
+			vixError = VixDiskLib_Read(handle, sectorAreas[j].start, sectorAreas[j].length, (uint8 *)ptr);
 
-		if (crc == 0)
-		{
-			sectorCount = 0;
-			blockUploadSize = 2 * sizeof(UINT16);
-			memcpy(blockBuffer + sizeof(UINT16), (void*)&sectorCount, sizeof(UINT16));
+			if (vixError != VIX_OK)
+			{
+				VixDiskLib_Close(handle);
+				VixDiskLib_Disconnect(connection);
+				VixDiskLib_Exit();
+
+				return BackupTaskWithError(vixError);
+			}
 		}
 
-		cmpBufferOffsetIndex = m_backupStorage->GetFreeBufferOffsetIndex();
-		char* bufferOffset = cmpBlockBuffer + cmpBufferOffsetIndex * cmpBufferSize;
+		size_t headerSize = encode_block_header(blockBuffer, granuleSize, (UINT32)granulesInBlock, granuleMap.data());
+		char* dataPtr = blockBuffer + headerSize;
+		size_t dataSize = kernels->pack(dataPtr, blockImage, granuleMap.data(), (UINT32)granulesInBlock);
 
-		size_t out_data_size = 0;
-		compress_raw_data(blockBuffer, blockUploadSize + CMP_SIZE, (void*)bufferOffset, out_data_size);
+		backupMetaData.blockHashTable.Set(i, xxhash64(blockImage, blockSize));
 
-		m_backupStorage->UploadBackupSectorDataAsync(m_backupId, item, backupMetaData.encryptionKey, bufferOffset, cmpBufferOffsetIndex, out_data_size);
-	}
+		if (standbyInFlight && standby.WriteBlock(i, blockImage) != 0)
+		{
+			cout << "Standby write failed, it catches up once the backup is complete" << endl;
 
-	m_backupStorage->WaitForAllUploadTasksToComplete();
+			standby.AbortApply();
+			standbyInFlight = false;
+		}
 
-	free(blockBuffer);
-	free(cmpBlockBuffer);
+		UINT64 partId = geometry.PartitionOf(i);
+		UINT64 blockId = geometry.PartitionIndexOf(i);
+		size_t blockUploadSize = headerSize + dataSize;
+		string item = to_string(partId + 1) + "/" + to_string(blockId + 1);
 
-	VixDiskLib_Close(handle);
-	VixDiskLib_Disconnect(connection);
-	VixDiskLib_Exit();
+		const char* pieceSource = blockBuffer;
 
-	backupMetaData.status = BackupStatus::Complete;
-	backupMetaData.encryptionKey = "";
-	m_backupStorage->UploadBackupMetaData(m_backupId, backupMetaData);
+		if (params.pageDedup)
+		{
+			//every page a changed granule touches, the block image holds all of them
+			fill(presentPages.begin(), presentPages.end(), false);
 
-	return 0;
-}
+			UINT32 runFirst = 0;
+			UINT32 runCount = 0;
 
-VixError BackupProcessor::BackupTaskWithError(VixError vixError)
-{
-	BackupMetaData backupMetaData;
-	backupMetaData.encryptionKey = "";
-	backupMetaData.status = BackupStatus::Error;
-	m_backupStorage->UploadBackupMetaData(m_backupId, backupMetaData);
+			for (UINT32 position = 0; next_bitmap_run(granuleMap.data(), (UINT32)granulesInBlock, position, runFirst, runCount); position = runFirst + runCount)
+			{
+				UINT64 lastPage = ((UINT64)(runFirst + runCount) * granuleSize - 1) / DEDUP_PAGE_SIZE;
 
-	return vixError;
-}
+				for (UINT64 page = (UINT64)runFirst * granuleSize / DEDUP_PAGE_SIZE; page <= lastPage; page++)
+				{
+					presentPages[page] = true;
+				}
+			}
 
-VixError BackupProcessor::RestoreTaskWithError(VixError vixError)
-{
-	RestoreTaskMetaData restoreMetadata;
-	restoreMetadata.encryptionKey = "";
-	restoreMetadata.status = RestoreStatus::RestoreError;
-	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+			blockUploadSize = pageDeduplicator.BuildBlock(i, blockImage, presentPages, pageBuffer);
+			pieceSource = pageBuffer;
+		}
 
-	return vixError;
-}
+		//parts of the packed block sealed and uploaded on their own
+		vector<BlockPiece> pieces;
 
-int BackupProcessor::RestoreData(InputParams& params, string volumeId, string restoreId)
-{
-	VixError vixError = VixDiskLib_InitEx(VIXDISKLIB_VERSION_MAJOR, 
-										  VIXDISKLIB_VERSION_MINOR,
-										  NULL, NULL, NULL,
-										  params.libDir.c_str(),
-										  params.cfgFile.c_str());
+		if (!params.chunkStore)
+		{
+			pieces.push_back({ 0, blockUploadSize, false, chunk_id() });
+		}
+		else
+		{
+			//named by content, so clones of one template produce the same chunks
+			vector<chunk_id> blockChunks;
+			size_t offset = 0;
+			auto chunkingStart = chrono::steady_clock::now();
 
-	if (vixError != VIX_OK)
-	{
-		cout << "VixDiskLib init error, code: " << vixError << endl;
+			while (offset < blockUploadSize)
+			{
+				size_t length = blockUploadSize - offset;
 
-		return RestoreTaskWithError(vixError);
-	}
+				if (useCdc)
+				{
+					length = fastcdc_cut((const uint8_t*)blockBuffer + offset, length, cdcParams);
+				}
 
-	VixDiskLibConnection connection;
+				chunk_id chunkId = compute_chunk_id(blockBuffer + offset, length);
+				blockChunks.push_back(chunkId);
 
-	vixError = VixDiskLib_Connect(&params.cnxParams, &connection);
+				if (chunkIndex.Insert(chunkId))
+				{
+					pieces.push_back({ offset, length, true, chunkId });
+					newChunks.push_back(chunkId);
+				}
+				else
+				{
+					dedupedChunks++;
+					dedupedBytes += length;
+				}
 
-	if (vixError != VIX_OK)
-	{
-		cout << "VixDiskLib connect error, code: " << vixError << endl;
-		VixDiskLib_Exit();
+				offset += length;
+			}
 
-		return RestoreTaskWithError(vixError);
-	}
+			chunkingSeconds += chrono::duration<double>(chrono::steady_clock::now() - chunkingStart).count();
+			chunkedBytes += blockUploadSize;
+			chunkCount += blockChunks.size();
 
-	VixDiskLibHandle handle;
+			if (useCdc)
+			{
+				backupMetaData.chunkListTable.Append(i, blockChunks.data(), blockChunks.size());
+			}
+			else
+			{
+				backupMetaData.chunkTable.Set(i, blockChunks[0]);
+			}
+		}
 
-	uint32 flags = VIXDISKLIB_FLAG_OPEN_UNBUFFERED;
+		double compressSeconds = 0;
 
-	vixError = VixDiskLib_Open(connection, params.vmdk.c_str(), flags, &handle);
+		for (const BlockPiece& piece : pieces)
+		{
+			const char* pieceData = pieceSource + piece.offset;
 
-	if (vixError != VIX_OK)
-	{
-		cout << "VixDiskLib open error, code: " << vixError << endl;
-		VixDiskLib_Disconnect(connection);
-		VixDiskLib_Exit();
+			cmpBufferOffsetIndex = m_backupStorage->GetFreeBufferOffsetIndex();
+			char* bufferOffset = cmpBlockBuffer + cmpBufferOffsetIndex * cmpBufferSize;
 
-		return RestoreTaskWithError(vixError);
-	}
+			const block_codec* blockCodec = codec;
 
-	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+			if (params.skipIncompressible && codec != rawCodec && !is_likely_compressible(pieceData, piece.size))
+			{
+				blockCodec = rawCodec;
+				skippedBlocks++;
+				skippedBytes += piece.size;
+			}
 
-	map<int, map<uint32_t, vector<string>>> partitionIndices;
+			sealedBlocks++;
 
-	for (int i = 0; i < metadata.backupIds.size(); i++)
-	{
-		string backupId = metadata.backupIds[i];
+			int blockLevel = params.adaptiveCompression ? controller.GetLevel() : codecLevel;
+			auto compressStart = chrono::steady_clock::now();
 
-		for (int partId = 0; partId < params.volumeSize; partId++)
-		{
-			vector<int> objects;
+			size_t out_data_size = seal_block(pieceData, piece.size, bufferOffset, cmpBufferSize, blockCodec, blockLevel, blockDictionary);
 
-			int result = m_backupStorage->ListObjects(backupId, partId, objects);
+			compressSeconds += chrono::duration<double>(chrono::steady_clock::now() - compressStart).count();
 
-			if (result != 0)
+			if (piece.chunk)
 			{
-				VixDiskLib_Close(handle);
-				VixDiskLib_Disconnect(connection);
-				VixDiskLib_Exit();
-
-				return RestoreTaskWithError(result);
+				m_backupStorage->UploadChunkDataAsync(piece.chunkId, bufferOffset, cmpBufferOffsetIndex, out_data_size);
 			}
-
-			for (auto iter = objects.begin(); iter != objects.end(); iter++)
+			else
 			{
-				partitionIndices[partId][*iter].push_back(backupId);
+				m_backupStorage->UploadBackupSectorDataAsync(m_backupId, item, backupMetaData.encryptionKey, bufferOffset, cmpBufferOffsetIndex, out_data_size);
 			}
+
+			rawBytes += piece.size;
+			storedBytes += out_data_size;
 		}
 
-		if (backupId == m_backupId)
+		if (params.adaptiveCompression && !pieces.empty())
 		{
-			break;
+			controller.Update(compressSeconds,
+							  chrono::duration<double>(chrono::steady_clock::now() - cycleStart).count(),
+							  m_backupStorage->GetPendingUploadCount());
 		}
 	}
 
-	const int concurrentThreads = 10;
-	size_t bufferSize = 2 * MB_BLOCK_SIZE;
-	char* buffer = (char*)malloc(bufferSize * concurrentThreads);
-	UINT16 sectorSize = VIXDISKLIB_SECTOR_SIZE;
-	UINT16 sectorsInMbBlock = MB_BLOCK_SIZE / sectorSize;
-	size_t blockDataMetadataSize = 2 * sizeof(UINT16) + sectorsInMbBlock * sizeof(UINT16);
-
-	RestoreTaskMetaData restoreMetadata = m_backupStorage->GetRestoreTaskMetaData(restoreId);
-	string encryptionKey = restoreMetadata.encryptionKey;
-
-	for (int partId = 0; partId < params.volumeSize; partId++)
+	//blocks or chunks that were not stored must not be referenced by the index or a complete backup
+	if (m_backupStorage->WaitForAllUploadTasksToComplete() != 0)
 	{
-		auto item = partitionIndices.find(partId);
+		cout << "Block upload failed" << endl;
 
-		if (item == partitionIndices.end())
-		{
-			continue;
-		}
+		free(blockBuffer);
+		free(blockImage);
+		free(pageBuffer);
+		free(cmpBlockBuffer);
 
-		auto blocks = partitionIndices[partId];
+		VixDiskLib_Close(handle);
+		VixDiskLib_Disconnect(connection);
+		VixDiskLib_Exit();
 
-		map<string, vector<int>> backupBlockIndices;
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
 
-		for (auto iter = blocks.begin(); iter != blocks.end(); iter++)
-		{
-			auto backupIds = iter->second;
+	if (sealedBlocks > 0)
+	{
+		cout << "Compression skipped for " << skippedBlocks << " of " << sealedBlocks << " blocks ("
+			 << skippedBlocks * 100 / sealedBlocks << "%), " << skippedBytes << " bytes stored raw" << endl;
+		cout << "Stored " << storedBytes << " of " << rawBytes << " block bytes" << (blockDictionary != NULL ? " with dictionary " + to_string(dictionaryId) : "") << endl;
+	}
 
-			for (int i = 0; i < backupIds.size(); i++)
-			{
-				string backupId = backupIds[i];
-				backupBlockIndices[backupId].push_back(iter->first);
-			}
+	if (params.adaptiveCompression)
+	{
+		cout << "Compression level ended at " << controller.GetLevel() << " after " << controller.GetAdjustments() << " adjustments" << endl;
+	}
+
+	if (params.chunkStore && chunkCount > 0)
+	{
+		cout << "Chunk store held " << dedupedChunks << " of " << chunkCount << " " << (useCdc ? "content defined" : "block") << " chunks, "
+			 << dedupedBytes << " of " << chunkedBytes << " bytes (" << dedupedBytes * 100 / max(chunkedBytes, (UINT64)1) << "%) not uploaded" << endl;
+		cout << "Chunking and hashing ran at " << (UINT64)(chunkedBytes / (1024 * 1024) / max(chunkingSeconds, 0.001)) << " MB/s" << endl;
+	}
+
+	if (params.pageDedup && pageDeduplicator.GetPages() > 0)
+	{
+		UINT64 pages = pageDeduplicator.GetPages();
+
+		cout << "Page deduplication stored " << pageDeduplicator.GetStoredPages() << " of " << pages << " pages, "
+			 << pageDeduplicator.GetReferencedPages() << " referenced (" << pageDeduplicator.GetReferencedPages() * 100 / pages << "%), "
+			 << pageDeduplicator.GetZeroPages() << " zero, " << pageDeduplicator.GetIndexedPages() << " pages indexed" << endl;
+	}
+
+	//pages this backup stored become visible to later backups of the volume, the pages it
+	//references must be recorded or garbage collection could delete the blocks holding them
+	if (params.pageDedup && pageDeduplicator.UploadIndex() != 0)
+	{
+		cout << "Page index upload failed" << endl;
+
+		free(blockBuffer);
+		free(blockImage);
+		free(pageBuffer);
+		free(cmpBlockBuffer);
+
+		VixDiskLib_Close(handle);
+		VixDiskLib_Disconnect(connection);
+		VixDiskLib_Exit();
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	//chunks this backup added become visible to later backups of every volume of the client. A segment
+	//without chunks still registers the volume, garbage collection waits for the references of every volume listed.
+	if (params.chunkStore && m_backupStorage->UploadChunkIndexSegment(m_backupId, newChunks) != 0)
+	{
+		cout << "Chunk index segment upload failed, its chunks will be uploaded again by later backups" << endl;
+	}
+
+	free(blockBuffer);
+	free(blockImage);
+	free(pageBuffer);
+	free(cmpBlockBuffer);
+
+	VixDiskLib_Close(handle);
+	VixDiskLib_Disconnect(connection);
+	VixDiskLib_Exit();
+
+	//recorded only once the chain it starts holds a complete backup
+	if (params.fullBackup && m_backupStorage->UploadVolumeGeometry(geometry) != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	//the tree of this restore point extends the one before it, without it the next backup reads the chain instead
+	BackupMerkleTree merkleTree(m_backupStorage);
+
+	if (merkleTree.Build(m_backupStorage->GetVolumeMetaData(volumeId), m_backupId, backupMetaData, params.fullBackup, (UINT64)params.volumeSize * VOLUME_SIZE_UNIT) != 0)
+	{
+		cout << "Merkle tree upload failed" << endl;
+	}
+
+	string encryptionKey = backupMetaData.encryptionKey;
+
+	backupMetaData.status = BackupStatus::Complete;
+	backupMetaData.encryptionKey = "";
+
+	if (m_backupStorage->UploadBackupMetaData(m_backupId, backupMetaData) != 0)
+	{
+		cout << "Backup metadata upload failed" << endl;
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	//the standby moves to this restore point only now that it is complete, a failed update leaves
+	//the backup listed as being applied and the next backup or update job catches up
+	if (standbyInFlight)
+	{
+		if (standby.CompleteApply() != 0)
+		{
+			cout << "Standby update failed" << endl;
 		}
+	}
+	else if (standbyLoaded && CatchUpStandby(standby, params, m_backupStorage->GetVolumeMetaData(volumeId), m_backupId, encryptionKey) != 0)
+	{
+		cout << "Standby update failed" << endl;
+	}
+
+	return 0;
+}
+
+int BackupProcessor::SynthesizeFullBackup(InputParams& params, string volumeId)
+{
+	const block_codec* codec = find_codec(params.codec);
+
+	if (codec == NULL)
+	{
+		cout << "Compression codec is not available: " << params.codec << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	int codecLevel = codec_level(codec, params.codecLevel);
+
+	//status and key of this backup, the chain is read and written with the key every backup of the volume shares
+	BackupMetaData backupMetaData = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>());
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(params.syntheticSourceId, vector<UINT64>()).geometry;
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	UINT64 capacity = (UINT64)params.volumeSize * VOLUME_SIZE_UNIT;
 
-		for (auto iter = backupBlockIndices.begin(); iter != backupBlockIndices.end(); iter++)
+	RestoreChain restoreChain(m_backupStorage, backupMetaData.encryptionKey, geometry);
+	map<UINT64, uint64_t> blockHashes;
+
+	if (restoreChain.Build(metadata, params.syntheticSourceId, capacity) != 0 || restoreChain.GetBlockHashes(blockHashes) != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	backupMetaData.geometry = geometry;
+
+	//listed before any block is stored, so restores never apply a partial merge as an incremental backup
+	vector<SyntheticFullInfo> syntheticFulls;
+	SyntheticFullInfo info;
+	info.backupId = m_backupId;
+	info.sourceBackupId = params.syntheticSourceId;
+	info.complete = false;
+
+	//every backup listed up to the restore point, restores of backups not among them can start from this one
+	auto source = find(metadata.backupIds.begin(), metadata.backupIds.end(), params.syntheticSourceId);
+
+	if (source == metadata.backupIds.end())
+	{
+		cout << "Restore point not found in the volume backups" << endl;
+
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	info.mergedBackupIds.assign(metadata.backupIds.begin(), source + 1);
+
+	if (m_backupStorage->GetSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	syntheticFulls.erase(remove_if(syntheticFulls.begin(), syntheticFulls.end(), [this](const SyntheticFullInfo& item) { return item.backupId == m_backupId; }), syntheticFulls.end());
+	syntheticFulls.push_back(info);
+
+	if (m_backupStorage->UploadSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	//blocks with a single version are taken over as they are stored, chunk references
+	//are copied into the metadata and block objects are copied by the storage itself,
+	//blocks written by several backups are composed from their versions and stored again
+	const map<UINT64, vector<string>>& blocks = restoreChain.GetBlockIndex();
+	vector<UINT64> composedBlocks;
+	map<string, set<UINT64>> copiedBlocksBySource;
+	UINT64 copiedBlocks = 0;
+	UINT64 referencedBlocks = 0;
+
+	for (auto iter = blocks.begin(); iter != blocks.end(); iter++)
+	{
+		UINT64 blockIndex = iter->first;
+		vector<chunk_id> chunkIds;
+		bool chunkList = false;
+
+		if (iter->second.size() > 1)
 		{
-			string backupId = iter->first;
-			vector<int> partIndices = iter->second;
+			composedBlocks.push_back(blockIndex);
+			continue;
+		}
 
-			if (partIndices.size() == 0)
+		if (restoreChain.GetChunkReferences(iter->second[0], blockIndex, chunkIds, chunkList))
+		{
+			if (chunkList)
 			{
-				continue;
+				backupMetaData.chunkListTable.Append(blockIndex, chunkIds.data(), chunkIds.size());
+			}
+			else
+			{
+				backupMetaData.chunkTable.Set(blockIndex, chunkIds[0]);
 			}
 
-			size_t offset = 0;
-			size_t threadGroups = (partIndices.size() + concurrentThreads - 1) / concurrentThreads;
+			referencedBlocks++;
+		}
+		else
+		{
+			m_backupStorage->CopyBackupBlockDataAsync(iter->second[0], m_backupId, geometry.PartitionOf(blockIndex), geometry.PartitionIndexOf(blockIndex), backupMetaData.encryptionKey);
+			copiedBlocksBySource[iter->second[0]].insert(blockIndex);
+			copiedBlocks++;
+		}
+	}
+
+	//copied page deduplicated blocks keep their references, which garbage collection has to see as this backup's
+	vector<page_source_reference> pageReferences;
+
+	for (auto iter = copiedBlocksBySource.begin(); iter != copiedBlocksBySource.end(); iter++)
+	{
+		vector<page_index_entry> sourcePages;
+		vector<page_source_reference> sourceReferences;
+
+		if (m_backupStorage->GetPageIndexSegment(iter->first, sourcePages, sourceReferences) != 0)
+		{
+			continue;
+		}
 
-			for (int i = 0; i < threadGroups; i++)
+		for (const page_source_reference& reference : sourceReferences)
+		{
+			if (iter->second.count(reference.block_index) > 0)
 			{
-				memset(buffer, 0, bufferSize * concurrentThreads);
+				pageReferences.push_back(reference);
+			}
+		}
+	}
 
-				size_t indexNum = min((size_t)(partIndices.size() - offset), concurrentThreads);
-				vector<future<int>> tasks;
+	//composed blocks are stored with every sector any version wrote, one granule per sector
+	const granularity_kernels* kernels = find_granularity(VIXDISKLIB_SECTOR_SIZE);
+	int concurrentThreads = params.syntheticConcurrency > 0 ? params.syntheticConcurrency : UploadBatchSize;
+	size_t blockSize = (size_t)geometry.blockSize;
+	UINT32 sectorsInBlock = (UINT32)geometry.SectorsPerBlock();
+	size_t blockDataSize = compact_block_header_max_size(sectorsInBlock) + blockSize;
+	size_t cmpBufferSize = block_envelope_bound(blockDataSize);
 
-				for (int k = 0; k < indexNum; k++)
-				{
-					char *bufferOffset = buffer + k * bufferSize;
-					int partIndex = partIndices[offset + k];
-					tasks.push_back(async(GetBackupBlockData, m_backupStorage, backupId, partId, encryptionKey, partIndex, bufferOffset));
-				}
+	char* buffer = (char*)malloc(blockSize * concurrentThreads);
+	char* blockBuffer = (char*)malloc(blockDataSize);
+	char* cmpBlockBuffer = (char*)malloc(cmpBufferSize * UploadBatchSize);
+	vector<vector<bool>> sectorMasks(concurrentThreads);
+	vector<uint64_t> sectorMap(bitmap_words(sectorsInBlock));
+	UINT64 rawBytes = 0;
+	UINT64 storedBytes = 0;
+	int result = 0;
 
-				for (auto &task : tasks)
-				{
-					task.get();
-				}
+	for (size_t offset = 0; offset < composedBlocks.size() && result == 0; offset += concurrentThreads)
+	{
+		size_t indexNum = min(composedBlocks.size() - offset, (size_t)concurrentThreads);
+		vector<future<int>> tasks;
+
+		memset(buffer, 0, blockSize * indexNum);
+
+		for (size_t k = 0; k < indexNum; k++)
+		{
+			char *bufferOffset = buffer + k * blockSize;
+			tasks.push_back(async(&RestoreChain::ReadBlock, &restoreChain, composedBlocks[offset + k], bufferOffset, ref(sectorMasks[k])));
+		}
+
+		for (auto &task : tasks)
+		{
+			if (task.get() != 0)
+			{
+				result = ERROR_CODE;
+			}
+		}
 
-				for (int j = 0; j < indexNum; j++)
+		for (size_t k = 0; k < indexNum && result == 0; k++)
+		{
+			UINT64 blockIndex = composedBlocks[offset + k];
+			const char* image = buffer + k * blockSize;
+
+			fill(sectorMap.begin(), sectorMap.end(), 0);
+
+			for (UINT32 sector = 0; sector < sectorsInBlock; sector++)
+			{
+				if (sectorMasks[k][sector])
 				{
-					char *bufferOffset = buffer + j * bufferSize;
-					int partIndex = partIndices[offset + j];
-
-					UINT16 sectorNum = *(UINT16*)(bufferOffset + sizeof(UINT16));
-
-					UINT64 numSectorsToWrite = 0;
-					UINT16 lastSectorIndex = 0;
-					INT64 startSector = -1;
-					char* dataBlockPtr = bufferOffset + blockDataMetadataSize;
-
-					for (UINT16 k = 0; k < sectorNum; k++)
-					{
-						char* ptr = bufferOffset + 2 * sizeof(UINT16) + k * sizeof(UINT16);
-						UINT16 sectorIndex = *(UINT16*)ptr;
-
-						if (startSector < 0)
-						{
-							startSector = sectorIndex;
-						}
-
-						if (sectorIndex - lastSectorIndex > 1)
-						{
-							if (numSectorsToWrite > 0)
-							{
-								UINT64 startSectorToWrite = (partId * 1024 + partIndex) * sectorsInMbBlock + startSector;
-								vixError = VixDiskLib_Write(handle, startSectorToWrite, numSectorsToWrite, (uint8 *)(dataBlockPtr + startSector * sectorSize));
-								ProcessWriteResult(vixError, buffer, handle, connection);
-								numSectorsToWrite = 0;
-							}
-
-							startSector = sectorIndex;
-						}
-
-						numSectorsToWrite++;
-
-						lastSectorIndex = sectorIndex;
-					}
-
-					if (numSectorsToWrite > 0)
-					{
-						UINT64 startSectorToWrite = (partId * 1024 + partIndex) * sectorsInMbBlock + startSector;
-						vixError = VixDiskLib_Write(handle, startSectorToWrite, numSectorsToWrite, (uint8 *)(dataBlockPtr + startSector * sectorSize));
-						ProcessWriteResult(vixError, buffer, handle, connection);
-					}
+					sectorMap[sector / 64] |= 1ULL << (sector % 64);
 				}
-
-				offset += indexNum;
 			}
+
+			size_t headerSize = encode_block_header(blockBuffer, VIXDISKLIB_SECTOR_SIZE, sectorsInBlock, sectorMap.data());
+			size_t dataSize = kernels->pack(blockBuffer + headerSize, image, sectorMap.data(), sectorsInBlock);
+			string item = to_string(geometry.PartitionOf(blockIndex) + 1) + "/" + to_string(geometry.PartitionIndexOf(blockIndex) + 1);
+
+			int cmpBufferOffsetIndex = m_backupStorage->GetFreeBufferOffsetIndex();
+			char* bufferOffset = cmpBlockBuffer + cmpBufferOffsetIndex * cmpBufferSize;
+
+			size_t out_data_size = seal_block(blockBuffer, headerSize + dataSize, bufferOffset, cmpBufferSize, codec, codecLevel, NULL);
+
+			m_backupStorage->UploadBackupSectorDataAsync(m_backupId, item, backupMetaData.encryptionKey, bufferOffset, cmpBufferOffsetIndex, out_data_size);
+
+			rawBytes += headerSize + dataSize;
+			storedBytes += out_data_size;
 		}
 	}
 
+	if (m_backupStorage->WaitForAllUploadTasksToComplete() != 0)
+	{
+		cout << "Block upload failed" << endl;
+
+		result = ERROR_CODE;
+	}
+
 	free(buffer);
+	free(blockBuffer);
+	free(cmpBlockBuffer);
 
-	restoreMetadata.encryptionKey = "";
-	restoreMetadata.restoreId = restoreId;
-	restoreMetadata.status = RestoreStatus::RestoreComplete;
-	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+	if (result == 0 && !pageReferences.empty() && m_backupStorage->UploadPageIndexSegment(m_backupId, vector<page_index_entry>(), pageReferences) != 0)
+	{
+		result = ERROR_CODE;
+	}
 
-	VixDiskLib_Close(handle);
-	VixDiskLib_Disconnect(connection);
-	VixDiskLib_Exit();
+	//taken over chunk references keep the volume registered with the chunk store once the merged backups are collected
+	if (result == 0 && referencedBlocks > 0 && m_backupStorage->UploadChunkIndexSegment(m_backupId, vector<chunk_id>()) != 0)
+	{
+		result = ERROR_CODE;
+	}
+
+	if (result != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	for (auto iter = blockHashes.begin(); iter != blockHashes.end(); iter++)
+	{
+		backupMetaData.blockHashTable.Set(iter->first, iter->second);
+	}
+
+	cout << "Synthetic full backup of " << blocks.size() << " blocks: " << copiedBlocks << " copied, " << referencedBlocks << " chunk references, "
+		 << composedBlocks.size() << " composed and stored in " << storedBytes << " of " << rawBytes << " bytes" << endl;
+
+	BackupMerkleTree merkleTree(m_backupStorage);
+
+	if (merkleTree.Build(metadata, m_backupId, backupMetaData, true, capacity) != 0)
+	{
+		cout << "Merkle tree upload failed" << endl;
+	}
+
+	backupMetaData.status = BackupStatus::Complete;
+	backupMetaData.encryptionKey = "";
+
+	if (m_backupStorage->UploadBackupMetaData(m_backupId, backupMetaData) != 0)
+	{
+		cout << "Backup metadata upload failed" << endl;
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	//restores of later backups start from here from now on. Left incomplete in the list the backup is
+	//never used as a base, so it is marked failed rather than complete.
+	if (m_backupStorage->GetSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		cout << "Synthetic full backup list not available" << endl;
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	for (SyntheticFullInfo& item : syntheticFulls)
+	{
+		if (item.backupId == m_backupId)
+		{
+			item.complete = true;
+		}
+	}
+
+	if (m_backupStorage->UploadSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		cout << "Synthetic full backup list upload failed" << endl;
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
 
 	return 0;
 }
 
-VixError BackupProcessor::ProcessWriteResult(VixError vixError, char* buffer, VixDiskLibHandle handle, VixDiskLibConnection connection)
+int BackupProcessor::BenchmarkCodecs(InputParams& params)
 {
+	//blocks of the size the job asks for, so block sizes can be compared as well
+	VolumeGeometry geometry;
+
+	if (GetJobGeometry(params, geometry) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	UINT64 blockSize = geometry.blockSize;
+
+	VixError vixError = VixDiskLib_InitEx(VIXDISKLIB_VERSION_MAJOR,
+										  VIXDISKLIB_VERSION_MINOR,
+										  NULL, NULL, NULL,
+										  params.libDir.c_str(),
+										  params.cfgFile.c_str());
+
 	if (vixError != VIX_OK)
 	{
-		cout << "VixDiskLib_Write block error, code: " << vixError << endl;
-		free(buffer);
+		cout << "VixDiskLib init error, code: " << vixError << endl;
 
-		VixDiskLib_Close(handle);
+		return ERROR_CODE;
+	}
+
+	char *snapRef = NULL;
+
+	if (!params.snapshotRef.empty())
+	{
+		snapRef = (char *)params.snapshotRef.c_str();
+	}
+
+	VixDiskLibConnection connection;
+
+	vixError = VixDiskLib_ConnectEx(&params.cnxParams, TRUE, snapRef, NULL, &connection);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib connect error, code: " << vixError << endl;
+		VixDiskLib_Exit();
+
+		return ERROR_CODE;
+	}
+
+	VixDiskLibHandle handle;
+
+	vixError = VixDiskLib_Open(connection, params.vmdk.c_str(), VIXDISKLIB_FLAG_OPEN_UNBUFFERED | VIXDISKLIB_FLAG_OPEN_READ_ONLY, &handle);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib open error, code: " << vixError << endl;
 		VixDiskLib_Disconnect(connection);
 		VixDiskLib_Exit();
 
-		return RestoreTaskWithError(vixError);
+		return ERROR_CODE;
 	}
 
-	return vixError;
+	//sample allocated blocks only, free space would flatter every codec
+	int result = QueryAllocatedBlocks(handle);
+	UINT64 capacitySectors = 0;
+	VixDiskLibInfo* diskInfo = NULL;
+
+	if (result == 0 && VixDiskLib_GetInfo(handle, &diskInfo) == VIX_OK)
+	{
+		capacitySectors = diskInfo->capacity;
+		VixDiskLib_FreeInfo(diskInfo);
+	}
+
+	vector<char> samples;
+
+	if (result == 0)
+	{
+		result = ReadSampleBlocks(handle, capacitySectors, blockSize, params.benchmarkBlocks > 0 ? params.benchmarkBlocks : 256, samples);
+	}
+
+	VixDiskLib_Close(handle);
+	VixDiskLib_Disconnect(connection);
+	VixDiskLib_Exit();
+
+	size_t sampleCount = samples.size() / blockSize;
+	double sampleMegabytes = (double)samples.size() / (1024 * 1024);
+
+	if (result != 0 || sampleCount == 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//dictionary trained on every other sample, the rest shows how it carries over to unseen blocks
+	string dictionaryData;
+
+	if (params.useDictionary)
+	{
+		vector<char> trainingBlocks;
+
+		for (size_t i = 0; i < sampleCount; i += 2)
+		{
+			trainingBlocks.insert(trainingBlocks.end(), samples.begin() + i * blockSize, samples.begin() + (i + 1) * blockSize);
+		}
+
+		dictionaryData = train_dictionary(trainingBlocks.data(), trainingBlocks.size() / blockSize, blockSize);
+	}
+
+	block_dictionary dictionary = { dictionary_id(dictionaryData.data(), dictionaryData.size()), dictionaryData.data(), dictionaryData.size() };
+
+	vector<char> stored;
+	vector<char> decoded(blockSize);
+	size_t codecCount = 0;
+	const block_codec* codecs = codec_table(codecCount);
+
+	//pieceSize below a block approximates the small objects incremental backups store
+	auto runBenchmark = [&](const block_codec* codec, int level, const block_dictionary* blockDictionary, size_t pieceSize) -> int
+	{
+		size_t pieceCount = samples.size() / pieceSize;
+		size_t slotSize = block_envelope_bound(pieceSize);
+		vector<size_t> storedSizes(pieceCount);
+		size_t storedTotal = 0;
+
+		stored.resize(slotSize * pieceCount);
+
+		auto compressStart = chrono::steady_clock::now();
+
+		for (size_t i = 0; i < pieceCount; i++)
+		{
+			storedSizes[i] = seal_block(&samples[i * pieceSize], pieceSize, &stored[i * slotSize], slotSize, codec, level, blockDictionary);
+			storedTotal += storedSizes[i];
+		}
+
+		auto decompressStart = chrono::steady_clock::now();
+
+		for (size_t i = 0; i < pieceCount; i++)
+		{
+			if (open_block(&stored[i * slotSize], storedSizes[i], decoded.data(), decoded.size(), blockDictionary) != (long)pieceSize ||
+				memcmp(decoded.data(), &samples[i * pieceSize], pieceSize) != 0)
+			{
+				cout << "Codec " << codec->name << " level " << level << " failed to round trip piece " << i << endl;
+				return ERROR_CODE;
+			}
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		double compressSeconds = chrono::duration<double>(decompressStart - compressStart).count();
+		double decompressSeconds = chrono::duration<double>(end - decompressStart).count();
+
+		cout << codec->name << " " << level << " " << (blockDictionary != NULL ? "yes" : "no") << " " << pieceSize / 1024 << " "
+			 << (double)samples.size() / storedTotal << " "
+			 << sampleMegabytes / max(compressSeconds, 1e-9) << " "
+			 << sampleMegabytes / max(decompressSeconds, 1e-9) << endl;
+
+		return 0;
+	};
+
+	cout << "Codec benchmark, " << sampleCount << " allocated blocks of " << blockSize / 1024 << " KB" << endl;
+
+	if (params.useDictionary)
+	{
+		cout << "Dictionary of " << dictionaryData.size() << " bytes trained on " << (sampleCount + 1) / 2 << " blocks" << endl;
+	}
+
+	cout << "codec level dictionary piece_kb ratio compress_mb_s decompress_mb_s" << endl;
+
+	for (size_t c = 0; c < codecCount; c++)
+	{
+		const block_codec* codec = &codecs[c];
+		set<int> levels = { codec->min_level, codec->default_level, codec->max_level };
+
+		for (int level : levels)
+		{
+			if (runBenchmark(codec, level, NULL, blockSize) != 0)
+			{
+				return ERROR_CODE;
+			}
+		}
+
+		if (params.useDictionary && !dictionaryData.empty() && codec->id != BLOCK_CODEC_RAW)
+		{
+			if (runBenchmark(codec, codec->default_level, NULL, BenchmarkPieceSize) != 0 ||
+				runBenchmark(codec, codec->default_level, &dictionary, BenchmarkPieceSize) != 0 ||
+				runBenchmark(codec, codec->default_level, &dictionary, blockSize) != 0)
+			{
+				return ERROR_CODE;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int BackupProcessor::ReadSampleBlocks(VixDiskLibHandle& handle, UINT64 capacitySectors, UINT64 blockSize, size_t sampleLimit, vector<char>& samples)
+{
+	set<UINT64> blocks;
+
+	for (UINT64 i = 0; i < m_changedDiskAreas.size(); i++)
+	{
+		if (m_changedDiskAreas[i].length == 0)
+		{
+			continue;
+		}
+
+		UINT64 first = m_changedDiskAreas[i].start / blockSize;
+		UINT64 last = (m_changedDiskAreas[i].start + m_changedDiskAreas[i].length - 1) / blockSize;
+
+		for (UINT64 block = first; block <= last; block++)
+		{
+			blocks.insert(block);
+		}
+	}
+
+	//spread the samples over the whole disk rather than its first allocated blocks
+	vector<UINT64> candidates(blocks.begin(), blocks.end());
+	size_t sampleCount = min(sampleLimit, candidates.size());
+	UINT64 sectorsInBlock = blockSize / VIXDISKLIB_SECTOR_SIZE;
+
+	samples.assign(sampleCount * blockSize, 0);
+
+	for (size_t i = 0; i < sampleCount; i++)
+	{
+		UINT64 startSector = candidates[i * candidates.size() / sampleCount] * sectorsInBlock;
+
+		if (startSector >= capacitySectors)
+		{
+			samples.resize(i * blockSize);
+			break;
+		}
+
+		VixError vixError = VixDiskLib_Read(handle, startSector, min(sectorsInBlock, capacitySectors - startSector), (uint8 *)&samples[i * blockSize]);
+
+		if (vixError != VIX_OK)
+		{
+			cout << "VixDiskLib read error, code: " << vixError << endl;
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+VixError BackupProcessor::BackupTaskWithError(VixError vixError)
+{
+	BackupMetaData backupMetaData;
+	backupMetaData.encryptionKey = "";
+	backupMetaData.status = BackupStatus::Error;
+	m_backupStorage->UploadBackupMetaData(m_backupId, backupMetaData);
+
+	return vixError;
+}
+
+VixError BackupProcessor::RestoreTaskWithError(VixError vixError)
+{
+	RestoreTaskMetaData restoreMetadata;
+	restoreMetadata.encryptionKey = "";
+	restoreMetadata.status = RestoreStatus::RestoreError;
+	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+
+	return vixError;
+}
+
+int BackupProcessor::RestoreData(InputParams& params, string volumeId, string restoreId)
+{
+	RestoreTargetFactory targetFactory(params.targetType);
+	RestoreTarget* target = targetFactory.GetTarget();
+
+	UINT64 capacity = (UINT64)params.volumeSize * VOLUME_SIZE_UNIT;
+
+	//the restore point keeps the geometry its chain was written with
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>()).geometry;
+
+	int result = target->Open(params, capacity, geometry.blockSize);
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	RestoreTaskMetaData restoreMetadata = m_backupStorage->GetRestoreTaskMetaData(restoreId);
+
+	RestoreChain restoreChain(m_backupStorage, restoreMetadata.encryptionKey, geometry);
+
+	vector<UINT64> blockIndices;
+	map<UINT64, vector<bool>> writeMasks;
+	bool rangeRestore = !params.restoreRanges.empty();
+	bool rollback = !params.currentBackupId.empty() && !rangeRestore;
+
+	if (rangeRestore)
+	{
+		//only the partitions under the requested ranges are listed
+		vector<UINT64> partIds;
+		MapByteRanges(params.restoreRanges, capacity, geometry, blockIndices, writeMasks, partIds);
+
+		result = restoreChain.BuildPartitions(metadata, m_backupId, partIds);
+	}
+	else
+	{
+		result = restoreChain.Build(metadata, m_backupId, capacity);
+	}
+
+	if (result != 0)
+	{
+		target->Close();
+
+		return RestoreTaskWithError(result);
+	}
+
+	if (rollback)
+	{
+		//the target holds the current restore point, only blocks whose hashes differ between the two are written.
+		//Restore points without Merkle trees fall back to the blocks written in between.
+		BackupMerkleTree merkleTree(m_backupStorage);
+
+		result = merkleTree.Diff(params.currentBackupId, m_backupId, blockIndices);
+
+		if (result != 0)
+		{
+			blockIndices.clear();
+			result = restoreChain.GetBlocksChangedBetween(metadata, params.currentBackupId, m_backupId, capacity, blockIndices);
+		}
+
+		if (result != 0)
+		{
+			target->Close();
+
+			return RestoreTaskWithError(result);
+		}
+
+		//sectors no backup of the chain holds were unallocated at the restore point, blocks are written whole
+		for (UINT64 blockIndex : blockIndices)
+		{
+			writeMasks[blockIndex].assign(geometry.SectorsPerBlock(), true);
+		}
+	}
+	else if (!rangeRestore)
+	{
+		auto blocks = restoreChain.GetBlockIndex();
+
+		for (auto iter = blocks.begin(); iter != blocks.end(); iter++)
+		{
+			blockIndices.push_back(iter->first);
+		}
+	}
+
+	if (params.compareTarget && !rollback)
+	{
+		result = SelectDifferingBlocks(restoreChain, target, blockIndices);
+
+		if (result != 0)
+		{
+			target->Close();
+
+			return RestoreTaskWithError(result);
+		}
+	}
+
+	result = WriteRestoreBlocks(restoreChain, blockIndices, target, writeMasks, false);
+
+	int closeResult = target->Close();
+
+	if (result != 0 || closeResult != 0)
+	{
+		return RestoreTaskWithError(result != 0 ? result : closeResult);
+	}
+
+	restoreMetadata.encryptionKey = "";
+	restoreMetadata.restoreId = restoreId;
+	restoreMetadata.status = RestoreStatus::RestoreComplete;
+	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+
+	return 0;
+}
+
+int BackupProcessor::VerifyRestorePoint(InputParams& params, string volumeId, string restoreId)
+{
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	RestoreTaskMetaData restoreMetadata = m_backupStorage->GetRestoreTaskMetaData(restoreId);
+
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>()).geometry;
+	UINT64 blockCount = geometry.BlockCount((UINT64)params.volumeSize * VOLUME_SIZE_UNIT);
+	UINT64 blocks = params.verifyBlocks != 0 ? params.verifyBlocks : blockCount - min(params.verifyFirstBlock, blockCount);
+
+	if (blocks == 0)
+	{
+		cout << "Block range is outside the restore point" << endl;
+
+		return RestoreTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	//only the partitions under the range are listed
+	vector<UINT64> partIds;
+
+	for (UINT64 partId = geometry.PartitionOf(params.verifyFirstBlock); partId <= geometry.PartitionOf(params.verifyFirstBlock + blocks - 1); partId++)
+	{
+		partIds.push_back(partId);
+	}
+
+	RestoreChain restoreChain(m_backupStorage, restoreMetadata.encryptionKey, geometry);
+
+	int result = restoreChain.BuildPartitions(metadata, m_backupId, partIds);
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	uint64_t rootHash = params.verifyRootHash.empty() ? 0 : strtoull(params.verifyRootHash.c_str(), NULL, 16);
+	BackupMerkleTree merkleTree(m_backupStorage);
+
+	result = merkleTree.VerifyRange(restoreChain, m_backupId, params.verifyFirstBlock, blocks, rootHash);
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	restoreMetadata.encryptionKey = "";
+	restoreMetadata.restoreId = restoreId;
+	restoreMetadata.status = RestoreStatus::RestoreComplete;
+	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+
+	return 0;
+}
+
+int BackupProcessor::SelectDifferingBlocks(const RestoreChain& restoreChain, RestoreTarget* target, vector<UINT64>& blockIndices)
+{
+	map<UINT64, uint64_t> blockHashes;
+
+	int result = restoreChain.GetBlockHashes(blockHashes);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	const int concurrentThreads = 10;
+	size_t blockSize = (size_t)restoreChain.GetGeometry().blockSize;
+	char* buffer = (char*)malloc(blockSize * concurrentThreads);
+	vector<UINT64> differingBlocks;
+
+	for (size_t offset = 0; offset < blockIndices.size(); offset += concurrentThreads)
+	{
+		size_t indexNum = min(blockIndices.size() - offset, (size_t)concurrentThreads);
+		vector<future<bool>> tasks;
+
+		for (size_t k = 0; k < indexNum; k++)
+		{
+			char *bufferOffset = buffer + k * blockSize;
+			UINT64 blockIndex = blockIndices[offset + k];
+			auto hash = blockHashes.find(blockIndex);
+
+			if (hash == blockHashes.end())
+			{
+				tasks.push_back(async(launch::deferred, []() { return true; }));
+				continue;
+			}
+
+			uint64_t blockHash = hash->second;
+
+			tasks.push_back(async(launch::async, [target, blockIndex, bufferOffset, blockSize, blockHash]()
+			{
+				if (target->ReadBlock(blockIndex, bufferOffset) != 0)
+				{
+					return true;
+				}
+
+				return xxhash64(bufferOffset, blockSize) != blockHash;
+			}));
+		}
+
+		for (size_t k = 0; k < indexNum; k++)
+		{
+			if (tasks[k].get())
+			{
+				differingBlocks.push_back(blockIndices[offset + k]);
+			}
+		}
+	}
+
+	free(buffer);
+
+	cout << "Blocks differing from the target: " << differingBlocks.size() << " of " << blockIndices.size() << endl;
+
+	blockIndices = differingBlocks;
+
+	return 0;
+}
+
+int BackupProcessor::WriteRestoreBlocks(const RestoreChain& restoreChain, const vector<UINT64>& blockIndices, RestoreTarget* target, const map<UINT64, vector<bool>>& writeMasks, bool wholeBlocks)
+{
+	const int concurrentThreads = 10;
+	size_t blockSize = (size_t)restoreChain.GetGeometry().blockSize;
+	char* buffer = (char*)malloc(blockSize * concurrentThreads);
+	vector<vector<bool>> sectorMasks(concurrentThreads);
+	int result = 0;
+
+	for (size_t offset = 0; offset < blockIndices.size() && result == 0; offset += concurrentThreads)
+	{
+		size_t indexNum = min(blockIndices.size() - offset, (size_t)concurrentThreads);
+		vector<future<int>> tasks;
+
+		memset(buffer, 0, blockSize * indexNum);
+
+		for (size_t k = 0; k < indexNum; k++)
+		{
+			char *bufferOffset = buffer + k * blockSize;
+			tasks.push_back(async(&RestoreChain::ReadBlock, &restoreChain, blockIndices[offset + k], bufferOffset, ref(sectorMasks[k])));
+		}
+
+		for (auto &task : tasks)
+		{
+			if (task.get() != 0)
+			{
+				result = ERROR_CODE;
+			}
+		}
+
+		for (size_t k = 0; k < indexNum && result == 0; k++)
+		{
+			auto writeMask = writeMasks.find(blockIndices[offset + k]);
+
+			if (wholeBlocks)
+			{
+				sectorMasks[k].assign(sectorMasks[k].size(), true);
+			}
+
+			const vector<bool>& sectorMask = writeMask != writeMasks.end() ? writeMask->second : sectorMasks[k];
+
+			result = target->WriteBlock(blockIndices[offset + k], buffer + k * blockSize, sectorMask);
+		}
+	}
+
+	free(buffer);
+
+	return result;
+}
+
+int BackupProcessor::CatchUpStandby(StandbyReplica& standby, const InputParams& params, const VolumeMetaData& metadata, string backupId, string encryptionKey)
+{
+	const StandbyState& state = standby.GetState();
+
+	if (state.currentBackupId == backupId && state.applyingBackupIds.empty())
+	{
+		cout << "Standby holds restore point " << backupId << " already" << endl;
+
+		return 0;
+	}
+
+	UINT64 capacity = (UINT64)params.volumeSize * VOLUME_SIZE_UNIT;
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(backupId, vector<UINT64>()).geometry;
+
+	RestoreChain restoreChain(m_backupStorage, encryptionKey, geometry);
+
+	int result = restoreChain.Build(metadata, backupId, capacity);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	//blocks differing from the restore point the disk holds, at this one or at a backup partly applied over it.
+	//Backups applied while they ran may have written blocks they never stored unless they completed.
+	bool inPlace = !state.currentBackupId.empty() && m_backupStorage->GetBackupMetaData(state.currentBackupId, vector<UINT64>()).geometry == geometry;
+	vector<string> applied(state.applyingBackupIds);
+	set<UINT64> changedBlocks;
+
+	applied.push_back(backupId);
+
+	for (size_t k = 0; k < applied.size() && inPlace; k++)
+	{
+		if (m_backupStorage->GetBackupMetaData(applied[k], vector<UINT64>()).status != BackupStatus::Complete)
+		{
+			inPlace = false;
+			break;
+		}
+
+		BackupMerkleTree merkleTree(m_backupStorage);
+		vector<UINT64> blockIndices;
+
+		if (merkleTree.Diff(state.currentBackupId, applied[k], blockIndices) != 0)
+		{
+			blockIndices.clear();
+
+			if (restoreChain.GetBlocksChangedBetween(metadata, state.currentBackupId, applied[k], capacity, blockIndices) != 0)
+			{
+				inPlace = false;
+			}
+		}
+
+		changedBlocks.insert(blockIndices.begin(), blockIndices.end());
+	}
+
+	vector<UINT64> blockIndices;
+	map<UINT64, vector<bool>> writeMasks;
+
+	//image files are created anew, a VMDK keeps what it held, so blocks the chain lacks are written as zeros
+	//and every block is written whole when the disk cannot be updated in place
+	bool vmdk = params.standbyType != "raw" && params.standbyType != "qcow2";
+
+	if (inPlace)
+	{
+		blockIndices.assign(changedBlocks.begin(), changedBlocks.end());
+
+		for (UINT64 blockIndex : blockIndices)
+		{
+			writeMasks[blockIndex].assign(geometry.SectorsPerBlock(), true);
+		}
+
+		cout << "Standby catches up from " << state.currentBackupId << " to " << backupId << ", " << blockIndices.size() << " blocks differ" << endl;
+	}
+	else if (vmdk)
+	{
+		UINT64 blockCount = geometry.BlockCount(capacity);
+
+		for (UINT64 blockIndex = 0; blockIndex < blockCount; blockIndex++)
+		{
+			blockIndices.push_back(blockIndex);
+		}
+
+		cout << "Standby disk is overwritten at " << backupId << ", " << blockIndices.size() << " blocks" << endl;
+	}
+	else
+	{
+		auto blocks = restoreChain.GetBlockIndex();
+
+		for (auto iter = blocks.begin(); iter != blocks.end(); iter++)
+		{
+			blockIndices.push_back(iter->first);
+		}
+
+		cout << "Standby is written anew at " << backupId << ", " << blockIndices.size() << " blocks" << endl;
+	}
+
+	result = standby.BeginApply(params, backupId, capacity, geometry.blockSize, inPlace);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	result = WriteRestoreBlocks(restoreChain, blockIndices, standby.GetTarget(), writeMasks, vmdk && !inPlace);
+
+	if (result != 0)
+	{
+		standby.AbortApply();
+
+		return result;
+	}
+
+	return standby.CompleteApply();
+}
+
+int BackupProcessor::UpdateStandby(InputParams& params, string volumeId)
+{
+	StandbyReplica standby(m_backupStorage, params.standbyId);
+
+	if (standby.Load(params) != 0)
+	{
+		return BackupTaskWithError(VIX_E_INVALID_ARG);
+	}
+
+	string encryptionKey = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>()).encryptionKey;
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+
+	//backups still running are listed already, every backup missed since the last update is applied at once
+	auto newest = find_if(metadata.backupIds.rbegin(), metadata.backupIds.rend(), [&](const string& backupId)
+	{
+		return m_backupStorage->GetBackupMetaData(backupId, vector<UINT64>()).status == BackupStatus::Complete;
+	});
+
+	if (newest == metadata.backupIds.rend())
+	{
+		cout << "Volume has no complete restore point" << endl;
+
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	if (CatchUpStandby(standby, params, metadata, *newest, encryptionKey) != 0)
+	{
+		return BackupTaskWithError(VIX_E_FAIL);
+	}
+
+	BackupMetaData task;
+	task.status = BackupStatus::Complete;
+	task.encryptionKey = "";
+	m_backupStorage->UploadBackupMetaData(m_backupId, task);
+
+	return 0;
+}
+
+int BackupProcessor::ExportRestorePoint(InputParams& params, string volumeId, string restoreId)
+{
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	RestoreTaskMetaData restoreMetadata = m_backupStorage->GetRestoreTaskMetaData(restoreId);
+
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(m_backupId, vector<UINT64>()).geometry;
+	UINT64 exportSize = (UINT64)params.volumeSize * VOLUME_SIZE_UNIT;
+
+	RestoreChain restoreChain(m_backupStorage, restoreMetadata.encryptionKey, geometry);
+
+	int result = restoreChain.Build(metadata, m_backupId, exportSize);
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	NbdServer server(&restoreChain, exportSize, params.overlayFile, params.cacheBlocks, params.prefetchBlocks);
+
+	result = server.Listen(params.nbdSocket, params.nbdPort);
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	restoreMetadata.encryptionKey = "";
+	restoreMetadata.restoreId = restoreId;
+	restoreMetadata.status = RestoreStatus::RestoreRunning;
+	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+
+	result = server.Serve();
+
+	if (result != 0)
+	{
+		return RestoreTaskWithError(result);
+	}
+
+	restoreMetadata.status = RestoreStatus::RestoreComplete;
+	m_backupStorage->UploadRestoreTaskMetaData(restoreMetadata);
+
+	return 0;
 }
\ No newline at end of file
@@ -1,12 +1,13 @@
 #include "BackupStorage.h"
+#include "RestoreChain.h"
+#include "RestoreTarget.h"
+#include "StandbyReplica.h"
 #include <aws/core/utils/json/JsonSerializer.h>
 #include "vixDiskLib.h"
 #include "vixMntapi.h"
 
 using namespace std;
 
-#define ERROR_CODE 1
-
 struct ChangedDiskArea
 {
 	UINT64 length;
@@ -23,16 +24,34 @@ public:
 	BackupProcessor(BackupProcessor&&) = delete;
 	BackupProcessor& operator = (BackupProcessor&&) = delete;
 
-	int BackupData(InputParams& params);
+	int BackupData(InputParams& params, string volumeId);
 	int RestoreData(InputParams& params, string volumeId, string restoreId);
+	int ExportRestorePoint(InputParams& params, string volumeId, string restoreId);
+	int BenchmarkCodecs(InputParams& params);
+
+	//merges the chain of params.syntheticSourceId into this backup without reading the disk
+	int SynthesizeFullBackup(InputParams& params, string volumeId);
+
+	//checks blocks params.verifyFirstBlock on of this restore point against the root of its Merkle tree
+	int VerifyRestorePoint(InputParams& params, string volumeId, string restoreId);
+
+	//brings the standby params.standbyId to the newest complete restore point of the volume
+	int UpdateStandby(InputParams& params, string volumeId);
 
 private:
 	int QueryAllocatedBlocks(VixDiskLibHandle& handle);
 	int ReadChangedDiskAreas();
+	int ReadSampleBlocks(VixDiskLibHandle& handle, UINT64 capacitySectors, UINT64 blockSize, size_t sampleLimit, vector<char>& samples);
 
 	VixError BackupTaskWithError(VixError vixError);
 	VixError RestoreTaskWithError(VixError vixError);
-	VixError ProcessWriteResult(VixError vixError, char* buffer, VixDiskLibHandle handle, VixDiskLibConnection connection);
+
+	int SelectDifferingBlocks(const RestoreChain& restoreChain, RestoreTarget* target, vector<UINT64>& blockIndices);
+	//blocks without a write mask write the sectors the chain holds, or every sector when wholeBlocks is set
+	int WriteRestoreBlocks(const RestoreChain& restoreChain, const vector<UINT64>& blockIndices, RestoreTarget* target, const map<UINT64, vector<bool>>& writeMasks, bool wholeBlocks);
+
+	//writes the blocks that differ between the restore point the standby holds and backupId in one pass
+	int CatchUpStandby(StandbyReplica& standby, const InputParams& params, const VolumeMetaData& metadata, string backupId, string encryptionKey);
 
 	BackupStorage* m_backupStorage;
 
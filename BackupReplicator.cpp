@@ -0,0 +1,564 @@
+#include <iostream>
+#include <future>
+#include "BackupReplicator.h"
+#include "core/block_envelope.h"
+
+const string ReplicationStateName = "state";
+
+BackupReplicator::BackupReplicator(BackupStorage* source, BackupStorage* destination, string taskId) :
+	m_source(source),
+	m_destination(destination),
+	m_taskId(taskId),
+	m_slotSize(0),
+	m_chunkIndexLoaded(false),
+	m_backups(0),
+	m_copiedBlocks(0),
+	m_copiedChunks(0),
+	m_copiedBytes(0)
+{
+}
+
+int BackupReplicator::Replicate(InputParams& params, string volumeId)
+{
+	m_encryptionKey = m_source->GetBackupMetaData(m_taskId, vector<UINT64>()).encryptionKey;
+
+	ReplicationState state;
+	string data;
+
+	//no state yet is the first replication of the volume
+	if (m_destination->GetReplicationObject(ReplicationStateName, data) == 0 && !DeserializeReplicationState(data.data(), data.size(), state))
+	{
+		cout << "Replication state is corrupt" << endl;
+
+		return TaskWithError();
+	}
+
+	VolumeMetaData metadata = m_source->GetVolumeMetaData(volumeId);
+	set<string> listed(metadata.backupIds.begin(), metadata.backupIds.end());
+	set<string> replicated(state.replicatedBackupIds.begin(), state.replicatedBackupIds.end());
+
+	//backups the replica lists are there whole, whoever copied them
+	for (const string& backupId : m_destination->GetVolumeMetaData(params.replicaVolumeId).backupIds)
+	{
+		replicated.insert(backupId);
+	}
+
+	UINT64 skipped = 0;
+
+	for (const string& backupId : metadata.backupIds)
+	{
+		if (replicated.count(backupId) > 0)
+		{
+			skipped++;
+			continue;
+		}
+
+		BackupMetaData backup;
+
+		if (m_source->GetBackupMetaData(backupId, backup) != 0)
+		{
+			return TaskWithError();
+		}
+
+		//a backup still running is copied by the next replication
+		if (backup.status != BackupStatus::Complete)
+		{
+			cout << "Backup " << backupId << " is not complete, it is not replicated" << endl;
+			continue;
+		}
+
+		if (state.currentBackupId != backupId)
+		{
+			state.currentBackupId = backupId;
+			state.nextPartId = 0;
+		}
+		else
+		{
+			cout << "Resuming replication of " << backupId << " at partition " << state.nextPartId + 1 << endl;
+		}
+
+		if (ReplicateBackup(params, volumeId, listed, backup, backupId, state) != 0 || CopyDictionaries(state) != 0)
+		{
+			return TaskWithError();
+		}
+
+		replicated.insert(backupId);
+		state.replicatedBackupIds.push_back(backupId);
+		state.currentBackupId = "";
+		state.nextPartId = 0;
+
+		//the replica lists what the source lists, as far as it was copied
+		VolumeMetaData replica;
+
+		for (const string& id : metadata.backupIds)
+		{
+			if (replicated.count(id) > 0)
+			{
+				replica.backupIds.push_back(id);
+			}
+		}
+
+		if (m_destination->UploadVolumeMetaData(replica) != 0 || SaveState(state) != 0)
+		{
+			return TaskWithError();
+		}
+
+		m_backups++;
+	}
+
+	if (CopyDictionaries(state) != 0 || CopyVolumeObjects(replicated) != 0)
+	{
+		return TaskWithError();
+	}
+
+	//backups the source no longer lists leave the state, the replica's list no longer names them either
+	state.replicatedBackupIds.erase(remove_if(state.replicatedBackupIds.begin(), state.replicatedBackupIds.end(), [&listed](const string& backupId)
+	{
+		return listed.count(backupId) == 0;
+	}), state.replicatedBackupIds.end());
+
+	if (SaveState(state) != 0)
+	{
+		return TaskWithError();
+	}
+
+	cout << "Replicated " << m_backups << " backups, " << skipped << " were on the replica: " << m_copiedBlocks << " blocks, "
+		 << m_copiedChunks << " chunks, " << m_copiedBytes << " bytes copied" << endl;
+
+	BackupMetaData task;
+	task.status = BackupStatus::Complete;
+	task.encryptionKey = "";
+	m_source->UploadBackupMetaData(m_taskId, task);
+
+	return 0;
+}
+
+int BackupReplicator::ReplicateBackup(const InputParams& params, string volumeId, const set<string>& listed, const BackupMetaData& metadata, string backupId, ReplicationState& state)
+{
+	const VolumeGeometry& geometry = metadata.geometry;
+
+	m_slotSize = 2 * (size_t)geometry.blockSize;
+	m_uploadBuffer.resize(m_slotSize * UploadBatchSize);
+
+	//every hashed block has its object, except the blocks the backup stored in the chunk store
+	set<UINT64> chunkBlocks(metadata.chunkTable.keys.begin(), metadata.chunkTable.keys.end());
+	chunkBlocks.insert(metadata.chunkListTable.keys.begin(), metadata.chunkListTable.keys.end());
+
+	map<UINT64, vector<UINT64>> partitions;
+
+	for (UINT64 blockIndex : metadata.blockHashTable.keys)
+	{
+		if (chunkBlocks.count(blockIndex) == 0)
+		{
+			partitions[geometry.PartitionOf(blockIndex)].push_back(blockIndex);
+		}
+	}
+
+	for (auto iter = partitions.lower_bound(state.nextPartId); iter != partitions.end(); iter++)
+	{
+		if (CopyBlocks(params, backupId, geometry, iter->second, state) != 0)
+		{
+			return ERROR_CODE;
+		}
+
+		state.nextPartId = iter->first + 1;
+
+		if (SaveState(state) != 0)
+		{
+			return ERROR_CODE;
+		}
+	}
+
+	if (CopyChunks(params, volumeId, backupId, metadata) != 0 || CopyPageSources(params, listed, backupId, geometry, state) != 0 ||
+		CopyMerkleTree(listed, backupId) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//the metadata names the backup's objects, so it goes last
+	BackupMetaData copy = metadata;
+
+	if (m_destination->UploadBackupMetaData(backupId, copy) != 0)
+	{
+		cout << "Replica metadata upload failed, backup: " << backupId << endl;
+
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int BackupReplicator::CopyObjects(const InputParams& params, size_t count, const function<int(size_t, vector<char>&)>& read, const function<void(size_t, const char*, int, size_t)>& upload)
+{
+	size_t concurrency = (size_t)max(params.replicaConcurrency, 1);
+	int result = 0;
+
+	for (size_t offset = 0; offset < count && result == 0; offset += concurrency)
+	{
+		size_t readNum = min(count - offset, concurrency);
+		vector<vector<char>> objects(readNum);
+		vector<future<int>> tasks;
+
+		for (size_t k = 0; k < readNum; k++)
+		{
+			tasks.push_back(async(launch::async, read, offset + k, ref(objects[k])));
+		}
+
+		for (size_t k = 0; k < readNum; k++)
+		{
+			if (tasks[k].get() != 0 || objects[k].size() > m_slotSize)
+			{
+				result = ERROR_CODE;
+				continue;
+			}
+
+			int bufferOffsetIndex = m_destination->GetFreeBufferOffsetIndex();
+			char* bufferOffset = m_uploadBuffer.data() + bufferOffsetIndex * m_slotSize;
+
+			memcpy(bufferOffset, objects[k].data(), objects[k].size());
+			upload(offset + k, bufferOffset, bufferOffsetIndex, objects[k].size());
+
+			m_copiedBytes += objects[k].size();
+		}
+	}
+
+	//an object the replica does not hold leaves the backup to be copied again
+	if (m_destination->WaitForAllUploadTasksToComplete() != 0)
+	{
+		cout << "Replica upload failed" << endl;
+		result = ERROR_CODE;
+	}
+
+	return result;
+}
+
+int BackupReplicator::CopyBlocks(const InputParams& params, string backupId, const VolumeGeometry& geometry, const vector<UINT64>& blockIndices, ReplicationState& state)
+{
+	set<uint32_t> dictionaryIds(state.dictionaryIds.begin(), state.dictionaryIds.end());
+	mutex dictionaryMutex;
+
+	auto read = [&](size_t k, vector<char>& block)
+	{
+		block.resize(m_slotSize);
+
+		int size = m_source->GetBackupBlockData(backupId, geometry.PartitionOf(blockIndices[k]), m_encryptionKey, { geometry.PartitionIndexOf(blockIndices[k]) }, block.data());
+
+		if (size <= 0)
+		{
+			cout << "Block data error, backup: " << backupId << ", block: " << blockIndices[k] << endl;
+			return ERROR_CODE;
+		}
+
+		block.resize(size);
+
+		uint32_t dictionaryId = stored_block_dictionary_id(block.data(), block.size());
+
+		if (dictionaryId != 0)
+		{
+			lock_guard<mutex> lock(dictionaryMutex);
+			dictionaryIds.insert(dictionaryId);
+		}
+
+		return 0;
+	};
+
+	auto upload = [&](size_t k, const char* bufferOffset, int bufferOffsetIndex, size_t size)
+	{
+		string item = to_string(geometry.PartitionOf(blockIndices[k]) + 1) + "/" + to_string(geometry.PartitionIndexOf(blockIndices[k]) + 1);
+
+		m_destination->UploadBackupSectorDataAsync(backupId, item, m_encryptionKey, bufferOffset, bufferOffsetIndex, size);
+		m_copiedBlocks++;
+	};
+
+	int result = CopyObjects(params, blockIndices.size(), read, upload);
+
+	state.dictionaryIds.assign(dictionaryIds.begin(), dictionaryIds.end());
+
+	return result;
+}
+
+int BackupReplicator::CopyChunks(const InputParams& params, string volumeId, string backupId, const BackupMetaData& metadata)
+{
+	if (metadata.chunkTable.Size() == 0 && metadata.chunkListTable.Size() == 0)
+	{
+		return 0;
+	}
+
+	if (!m_chunkIndexLoaded)
+	{
+		if (m_destination->GetChunkIndex(m_destinationChunks) != 0)
+		{
+			return ERROR_CODE;
+		}
+
+		m_chunkIndexLoaded = true;
+	}
+
+	vector<chunk_id> missing;
+
+	for (const chunk_id& chunkId : metadata.chunkTable.values)
+	{
+		missing.push_back(chunkId);
+	}
+
+	for (const chunk_id& chunkId : metadata.chunkListTable.chunks)
+	{
+		missing.push_back(chunkId);
+	}
+
+	sort(missing.begin(), missing.end());
+	missing.erase(unique(missing.begin(), missing.end()), missing.end());
+	missing.erase(remove_if(missing.begin(), missing.end(), [this](const chunk_id& chunkId) { return m_destinationChunks.Contains(chunkId); }), missing.end());
+
+	auto read = [&](size_t k, vector<char>& chunk)
+	{
+		chunk.resize(m_slotSize);
+
+		int size = m_source->GetChunkData(missing[k], chunk.data());
+
+		if (size <= 0)
+		{
+			cout << "Chunk data error, chunk: " << chunk_id_hex(missing[k]) << endl;
+			return ERROR_CODE;
+		}
+
+		chunk.resize(size);
+
+		return 0;
+	};
+
+	auto upload = [&](size_t k, const char* bufferOffset, int bufferOffsetIndex, size_t size)
+	{
+		m_destination->UploadChunkDataAsync(missing[k], bufferOffset, bufferOffsetIndex, size);
+		m_copiedChunks++;
+	};
+
+	if (CopyObjects(params, missing.size(), read, upload) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//chunks another volume added to the source store are indexed on the replica by the backup that copied them
+	vector<chunk_id> segment;
+
+	if (m_source->GetChunkIndexSegment(volumeId, backupId, segment) != 0)
+	{
+		segment.clear();
+	}
+
+	set<chunk_id> indexed(segment.begin(), segment.end());
+
+	for (const chunk_id& chunkId : missing)
+	{
+		if (indexed.count(chunkId) == 0)
+		{
+			segment.push_back(chunkId);
+		}
+
+		m_destinationChunks.Insert(chunkId);
+	}
+
+	if (!segment.empty() && m_destination->UploadChunkIndexSegment(backupId, segment) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int BackupReplicator::CopyPageSources(const InputParams& params, const set<string>& listed, string backupId, const VolumeGeometry& geometry, ReplicationState& state)
+{
+	bool exists = false;
+	vector<page_index_entry> pages;
+	vector<page_source_reference> references;
+
+	if (m_source->HasPageIndexSegment(backupId, exists) != 0 || (exists && m_source->GetPageIndexSegment(backupId, pages, references) != 0))
+	{
+		cout << "Page index segment is not available, backup: " << backupId << endl;
+		return ERROR_CODE;
+	}
+
+	if (!exists)
+	{
+		return 0;
+	}
+
+	//blocks of listed backups are copied with their backup, those of backups garbage collection keeps for their pages are not
+	set<string> copied(state.pageSourceBlocks.begin(), state.pageSourceBlocks.end());
+	vector<pair<string, UINT64>> blocks;
+
+	for (const page_source_reference& reference : references)
+	{
+		string sourceId(reference.source_id, PAGE_SOURCE_ID_SIZE);
+		string name = sourceId + "/" + to_string(reference.source_block);
+
+		if (listed.count(sourceId) == 0 && copied.insert(name).second)
+		{
+			blocks.push_back(make_pair(sourceId, reference.source_block));
+		}
+	}
+
+	auto read = [&](size_t k, vector<char>& block)
+	{
+		block.resize(m_slotSize);
+
+		int size = m_source->GetBackupBlockData(blocks[k].first, geometry.PartitionOf(blocks[k].second), m_encryptionKey, { geometry.PartitionIndexOf(blocks[k].second) }, block.data());
+
+		if (size <= 0)
+		{
+			cout << "Referenced page block not available, backup: " << blocks[k].first << ", block: " << blocks[k].second << endl;
+			return ERROR_CODE;
+		}
+
+		block.resize(size);
+
+		return 0;
+	};
+
+	auto upload = [&](size_t k, const char* bufferOffset, int bufferOffsetIndex, size_t size)
+	{
+		string item = to_string(geometry.PartitionOf(blocks[k].second) + 1) + "/" + to_string(geometry.PartitionIndexOf(blocks[k].second) + 1);
+
+		m_destination->UploadBackupSectorDataAsync(blocks[k].first, item, m_encryptionKey, bufferOffset, bufferOffsetIndex, size);
+		m_copiedBlocks++;
+	};
+
+	if (CopyObjects(params, blocks.size(), read, upload) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	for (const pair<string, UINT64>& block : blocks)
+	{
+		state.pageSourceBlocks.push_back(block.first + "/" + to_string(block.second));
+	}
+
+	if (!blocks.empty() && SaveState(state) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	return m_destination->UploadPageIndexSegment(backupId, pages, references);
+}
+
+int BackupReplicator::CopyMerkleTree(const set<string>& listed, string backupId)
+{
+	MerkleTreeRoot root;
+
+	//backups made before trees were built have none
+	if (m_source->GetMerkleTreeRoot(backupId, root) != 0)
+	{
+		return 0;
+	}
+
+	for (UINT64 partId = 0; partId < root.partitionOwners.size(); partId++)
+	{
+		const string& owner = root.partitionOwners[partId];
+		vector<uint64_t> leaves;
+
+		//leaves of listed backups are copied with them, the replica may have those of others already
+		if (owner.empty() || (owner != backupId && (listed.count(owner) > 0 || m_destination->GetMerkleTreeLeaves(owner, partId, leaves) == 0)))
+		{
+			continue;
+		}
+
+		if (m_source->GetMerkleTreeLeaves(owner, partId, leaves) != 0 || m_destination->UploadMerkleTreeLeaves(owner, partId, leaves) != 0)
+		{
+			cout << "Merkle tree leaves of partition " << partId + 1 << " could not be copied, backup: " << owner << endl;
+			return ERROR_CODE;
+		}
+	}
+
+	return m_destination->UploadMerkleTreeRoot(backupId, root);
+}
+
+int BackupReplicator::CopyDictionaries(ReplicationState& state)
+{
+	for (uint32_t dictionaryId : state.dictionaryIds)
+	{
+		uint32_t id = dictionaryId;
+		string dictionary;
+
+		if (m_copiedDictionaries.count(dictionaryId) > 0 || m_destination->GetVolumeDictionary(id, dictionary) == 0)
+		{
+			m_copiedDictionaries.insert(dictionaryId);
+			continue;
+		}
+
+		//the upload makes it the replica's current dictionary too, until CopyVolumeObjects sets the source's
+		if (m_source->GetVolumeDictionary(id, dictionary) != 0 || m_destination->UploadVolumeDictionary(dictionaryId, dictionary) != 0)
+		{
+			cout << "Dictionary " << dictionaryId << " could not be copied" << endl;
+			return ERROR_CODE;
+		}
+
+		m_copiedDictionaries.insert(dictionaryId);
+	}
+
+	return 0;
+}
+
+int BackupReplicator::CopyVolumeObjects(const set<string>& replicated)
+{
+	VolumeGeometry geometry;
+
+	//volumes whose full backups predate recorded geometries have none
+	if (m_source->GetVolumeGeometry(geometry) == 0 && m_destination->UploadVolumeGeometry(geometry) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	uint32_t sourceId = 0;
+	uint32_t destinationId = 0;
+	string dictionary;
+	string current;
+
+	if (m_source->GetVolumeDictionary(sourceId, dictionary) == 0 &&
+		(m_destination->GetVolumeDictionary(destinationId, current) != 0 || destinationId != sourceId) &&
+		m_destination->UploadVolumeDictionary(sourceId, dictionary) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	vector<SyntheticFullInfo> syntheticFulls;
+	vector<RecompressedBackupInfo> recompressed;
+
+	if (m_source->GetSyntheticFullBackups(syntheticFulls) != 0 || m_source->GetRecompressedBackups(recompressed) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	syntheticFulls.erase(remove_if(syntheticFulls.begin(), syntheticFulls.end(), [&replicated](const SyntheticFullInfo& info)
+	{
+		return replicated.count(info.backupId) == 0;
+	}), syntheticFulls.end());
+
+	recompressed.erase(remove_if(recompressed.begin(), recompressed.end(), [&replicated](const RecompressedBackupInfo& info)
+	{
+		return replicated.count(info.backupId) == 0;
+	}), recompressed.end());
+
+	if (m_destination->UploadSyntheticFullBackups(syntheticFulls) != 0 || m_destination->UploadRecompressedBackups(recompressed) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int BackupReplicator::SaveState(const ReplicationState& state)
+{
+	string data = SerializeReplicationState(state);
+
+	return m_destination->UploadReplicationObject(ReplicationStateName, data);
+}
+
+int BackupReplicator::TaskWithError()
+{
+	BackupMetaData metadata;
+	metadata.encryptionKey = "";
+	metadata.status = BackupStatus::Error;
+	m_source->UploadBackupMetaData(m_taskId, metadata);
+
+	return ERROR_CODE;
+}
@@ -0,0 +1,77 @@
+#ifndef BACKUPREPLICATOR_H
+#define BACKUPREPLICATOR_H
+
+#include <functional>
+#include <set>
+#include "BackupStorage.h"
+#include "MetaDataSerializer.h"
+
+using namespace std;
+
+//copies the restore points of a volume to a replica in another storage, of the same type or not. What
+//to copy follows from the backup metadata rather than from listings: the block objects its block
+//hashes name, the chunks it references that the replica's chunk index lacks, the Merkle tree leaves
+//and page source blocks it needs. Backups are listed on the replica once all their objects are there,
+//backups the source no longer lists leave the replica's list, their objects stay until its own
+//garbage collection deletes them. No garbage collection of either volume may run meanwhile.
+class BackupReplicator
+{
+public:
+	//the task id names the status object the job reports to in the source storage, its key reads and writes every backup of the volume
+	BackupReplicator(BackupStorage* source, BackupStorage* destination, string taskId);
+
+	BackupReplicator(const BackupReplicator&) = delete;
+	BackupReplicator& operator = (const BackupReplicator&) = delete;
+
+	//resumes an interrupted replication with the partition it was copying
+	int Replicate(InputParams& params, string volumeId);
+
+private:
+	int ReplicateBackup(const InputParams& params, string volumeId, const set<string>& listed, const BackupMetaData& metadata, string backupId, ReplicationState& state);
+
+	//reads up to params.replicaConcurrency objects at once from the source, uploads are queued to
+	//the destination as the reads complete and waited for before returning
+	int CopyObjects(const InputParams& params, size_t count, const function<int(size_t, vector<char>&)>& read, const function<void(size_t, const char*, int, size_t)>& upload);
+
+	int CopyBlocks(const InputParams& params, string backupId, const VolumeGeometry& geometry, const vector<UINT64>& blockIndices, ReplicationState& state);
+
+	//copies the referenced chunks the replica lacks and the chunk index segment of the backup, which lists them too
+	int CopyChunks(const InputParams& params, string volumeId, string backupId, const BackupMetaData& metadata);
+
+	//page index segment of the backup and the blocks it reads pages from in backups no longer listed
+	int CopyPageSources(const InputParams& params, const set<string>& listed, string backupId, const VolumeGeometry& geometry, ReplicationState& state);
+
+	//root of the backup and the leaves it stored, leaves of owners no longer listed are copied with it
+	int CopyMerkleTree(const set<string>& listed, string backupId);
+
+	//dictionaries the copied blocks need that the replica lacks, before the backups are listed there
+	int CopyDictionaries(ReplicationState& state);
+
+	//geometry, current dictionary, synthetic full and recompressed lists of the replicated backups
+	int CopyVolumeObjects(const set<string>& replicated);
+
+	int SaveState(const ReplicationState& state);
+
+	int TaskWithError();
+
+	BackupStorage* m_source;
+	BackupStorage* m_destination;
+
+	string m_taskId;
+	string m_encryptionKey;
+
+	//upload slots of the destination index this buffer
+	vector<char> m_uploadBuffer;
+	size_t m_slotSize;
+
+	ChunkIndex m_destinationChunks;
+	bool m_chunkIndexLoaded;
+	set<uint32_t> m_copiedDictionaries;
+
+	UINT64 m_backups;
+	UINT64 m_copiedBlocks;
+	UINT64 m_copiedChunks;
+	UINT64 m_copiedBytes;
+};
+
+#endif
@@ -18,25 +18,144 @@ public:
 	{
 	}
 
+	virtual ~BackupStorage() {};
+
 	virtual int GetFreeBufferOffsetIndex() = 0;
 
 	virtual void UploadBackupSectorDataAsync(string backupId, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) = 0;
 
-	virtual void WaitForAllUploadTasksToComplete() = 0;
+	//fails when an upload or copy queued since the last wait failed
+	virtual int WaitForAllUploadTasksToComplete() = 0;
+
+	//uploads queued or in flight, the backup path uses it to tell whether storage is the bottleneck
+	virtual int GetPendingUploadCount() = 0;
 
-	virtual void UploadBackupMetaData(string backupId, BackupMetaData &metadata) = 0;
+	//fails when the root or a metadata shard was not uploaded
+	virtual int UploadBackupMetaData(string backupId, BackupMetaData &metadata) = 0;
 
 	virtual VolumeMetaData GetVolumeMetaData(string volumeId) = 0;
 
+	//backup list of the volume, which the orchestrator writes for backups it runs, replication writes the replica's
+	virtual int UploadVolumeMetaData(const VolumeMetaData& metadata) = 0;
+
+	//metadata that cannot be read whole comes back with status Error
 	virtual BackupMetaData GetBackupMetaData(string backupId) = 0;
 
+	//loads block hashes of the given partitions only, an empty list loads status and key alone
+	virtual BackupMetaData GetBackupMetaData(string backupId, const vector<UINT64>& partIds) = 0;
+
+	//as above, fails when the metadata or a shard of the requested partitions is missing or corrupt
+	virtual int GetBackupMetaData(string backupId, BackupMetaData& metadata) = 0;
+
+	virtual int GetBackupMetaData(string backupId, const vector<UINT64>& partIds, BackupMetaData& metadata) = 0;
+
+	//blocks of the given partitions the backup stored in the chunk store, as single chunks or
+	//as lists of content defined chunks, without block hashes
+	virtual int GetBackupChunkTable(string backupId, const vector<UINT64>& partIds, BlockChunkTable& chunks, BlockChunkListTable& chunkLists) = 0;
+
+	//partitions the backup stored blocks of in the chunk store, sorted, from its shard index or its tables
+	virtual int GetBackupChunkPartitions(string backupId, vector<UINT64>& partIds) = 0;
+
 	virtual void UploadRestoreTaskMetaData(const RestoreTaskMetaData &metadata) = 0;
 
 	virtual RestoreTaskMetaData GetRestoreTaskMetaData(string restoreId) = 0;
 
-	virtual int GetBackupBlockData(string backupId, int partId, string key, const vector<int>& indices, char* buffer) = 0;
+	virtual int GetBackupBlockData(string backupId, UINT64 partId, string key, const vector<UINT64>& indices, char* buffer) = 0;
+
+	virtual int ListObjects(string backupId, UINT64 partId, vector<UINT64>& objects) = 0;
+
+	//block and partition layout new backups of the volume use, written by full backups
+	virtual int UploadVolumeGeometry(const VolumeGeometry& geometry) = 0;
+
+	//fails when the volume has no recorded geometry, its backups then use the default one
+	virtual int GetVolumeGeometry(VolumeGeometry& geometry) = 0;
+
+	//trained compression dictionaries, kept per id so blocks of older backups stay readable
+	virtual int UploadVolumeDictionary(uint32_t dictionaryId, const string& dictionary) = 0;
+
+	//dictionaryId 0 requests the dictionary new backups of the volume use and returns its id
+	virtual int GetVolumeDictionary(uint32_t& dictionaryId, string& dictionary) = 0;
+
+	//content addressed chunk store shared by every volume of the client, chunks outlive the
+	//backup that wrote them and are read by other volumes, so no backup key applies to them and
+	//volumes with an encryption key do not use the store
+	virtual void UploadChunkDataAsync(const chunk_id& chunkId, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) = 0;
+
+	//returns the chunk size, 0 if it is missing
+	virtual int GetChunkData(const chunk_id& chunkId, char* buffer) = 0;
+
+	//ids of the chunks a backup added to the store, one segment per backup
+	virtual int UploadChunkIndexSegment(string backupId, const vector<chunk_id>& chunkIds) = 0;
+
+	//rebuilds the index of the chunk store from the segments of every volume of the client
+	virtual int GetChunkIndex(ChunkIndex& index) = 0;
+
+	//pages a backup stored in page deduplicated blocks, later backups of the volume reference them,
+	//and the pages it references, garbage collection keeps the blocks holding those
+	virtual int UploadPageIndexSegment(string backupId, const vector<page_index_entry>& pages, const vector<page_source_reference>& references) = 0;
+
+	//fails when the backup stored and referenced no pages
+	virtual int GetPageIndexSegment(string backupId, vector<page_index_entry>& pages, vector<page_source_reference>& references) = 0;
+
+	//server side copy of a block object of one backup into another, waits for a free upload slot
+	//so copies and uploads share one bound, WaitForAllUploadTasksToComplete waits for both
+	virtual void CopyBackupBlockDataAsync(string sourceBackupId, string backupId, UINT64 partId, UINT64 partIndex, string key) = 0;
+
+	//synthetic full backups of the volume, empty when none was made
+	virtual int UploadSyntheticFullBackups(const vector<SyntheticFullInfo>& syntheticFulls) = 0;
+
+	virtual int GetSyntheticFullBackups(vector<SyntheticFullInfo>& syntheticFulls) = 0;
+
+	//time the backup metadata was last written, which is when the backup completed
+	virtual int GetBackupCompletedTime(string backupId, time_t& completedTime) = 0;
+
+	//backups of the volume recompressed for the cold tier, empty when none was
+	virtual int UploadRecompressedBackups(const vector<RecompressedBackupInfo>& backups) = 0;
+
+	virtual int GetRecompressedBackups(vector<RecompressedBackupInfo>& backups) = 0;
+
+	//Merkle tree of the restore point a backup completes, its root and the block hashes of the partitions it changed
+	virtual int UploadMerkleTreeRoot(string backupId, const MerkleTreeRoot& root) = 0;
+
+	virtual int GetMerkleTreeRoot(string backupId, MerkleTreeRoot& root) = 0;
+
+	virtual int UploadMerkleTreeLeaves(string backupId, UINT64 partId, const vector<uint64_t>& leaves) = 0;
+
+	virtual int GetMerkleTreeLeaves(string backupId, UINT64 partId, vector<uint64_t>& leaves) = 0;
+
+	//every object a backup wrote, block data and metadata, as keys DeleteObjects accepts
+	virtual int ListBackupObjectKeys(string backupId, vector<string>& keys) = 0;
+
+	//tells a backup without page index segment from one whose segment failed to load
+	virtual int HasPageIndexSegment(string backupId, bool& exists) = 0;
+
+	//keys of single objects, equal to the keys listings return for them
+	virtual string GetBlockObjectKey(string backupId, UINT64 partId, UINT64 partIndex) = 0;
+
+	virtual string GetChunkObjectKey(const chunk_id& chunkId) = 0;
+
+	virtual string GetChunkIndexSegmentKey(string backupId) = 0;
+
+	//deletes one batch of objects, objects already gone count as deleted
+	virtual int DeleteObjects(const vector<string>& keys) = 0;
+
+	//every chunk index segment of the client as the volume and the backup that wrote it
+	virtual int ListChunkIndexSegments(vector<pair<string, string>>& segments) = 0;
+
+	//chunk ids one backup added to the store, fails when the segment is missing or corrupt
+	virtual int GetChunkIndexSegment(string volumeId, string backupId, vector<chunk_id>& chunkIds) = 0;
+
+	//garbage collection state of a volume, the chunk references it publishes are read by the collections of other volumes
+	virtual int UploadCollectorObject(string name, const string& data) = 0;
+
+	virtual int GetCollectorObject(string volumeId, string name, string& data) = 0;
+
+	virtual string GetCollectorObjectKey(string name) = 0;
+
+	//replication state of the volume, kept with the replica it describes
+	virtual int UploadReplicationObject(string name, const string& data) = 0;
 
-	virtual int ListObjects(string backupId, int partId, vector<int>& objects) = 0;
+	virtual int GetReplicationObject(string name, string& data) = 0;
 
 protected:
 	string m_clientId;
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <future>
+#include <thread>
+#include "ColdTierRecompressor.h"
+#include "RestoreChain.h"
+#include "core/block_envelope.h"
+#include "core/process_priority.h"
+
+ColdTierRecompressor::ColdTierRecompressor(BackupStorage* backupStorage, string taskId) :
+	m_backupStorage(backupStorage),
+	m_dictionaries(backupStorage),
+	m_taskId(taskId),
+	m_codec(NULL),
+	m_codecLevel(0),
+	m_readBytes(0),
+	m_blocks(0),
+	m_rewrittenBlocks(0),
+	m_storedBytes(0),
+	m_recompressedBytes(0)
+{
+}
+
+int ColdTierRecompressor::Recompress(InputParams& params, string volumeId)
+{
+	//cold tier work never competes with backups and restores on the same proxy
+	if (!lower_process_priority())
+	{
+		cout << "Process priority could not be lowered" << endl;
+	}
+
+	m_codec = find_codec(params.recompressCodec);
+
+	if (m_codec == NULL)
+	{
+		cout << "Compression codec is not available: " << params.recompressCodec << endl;
+
+		return TaskWithError();
+	}
+
+	//level 0 selects the strongest level, the job trades CPU for storage
+	m_codecLevel = params.recompressLevel != 0 ? codec_level(m_codec, params.recompressLevel) : m_codec->max_level;
+	m_encryptionKey = m_backupStorage->GetBackupMetaData(m_taskId, vector<UINT64>()).encryptionKey;
+	m_startTime = chrono::steady_clock::now();
+
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	vector<RecompressedBackupInfo> recompressed;
+
+	if (m_backupStorage->GetRecompressedBackups(recompressed) != 0)
+	{
+		return TaskWithError();
+	}
+
+	time_t cutoff = time(NULL) - (time_t)params.recompressAfterDays * 24 * 60 * 60;
+	UINT64 backups = 0;
+
+	for (const string& backupId : metadata.backupIds)
+	{
+		//backups tried with the same codec at this level or a stronger one are left as they are
+		auto done = find_if(recompressed.begin(), recompressed.end(), [&](const RecompressedBackupInfo& info)
+		{
+			return info.backupId == backupId && info.codec == m_codec->name && info.level >= m_codecLevel;
+		});
+
+		time_t completedTime = 0;
+
+		if (done != recompressed.end() || m_backupStorage->GetBackupCompletedTime(backupId, completedTime) != 0 || completedTime > cutoff)
+		{
+			continue;
+		}
+
+		if (m_backupStorage->GetBackupMetaData(backupId, vector<UINT64>()).status != BackupStatus::Complete)
+		{
+			continue;
+		}
+
+		if (RecompressBackup(params, backupId) != 0)
+		{
+			return TaskWithError();
+		}
+
+		//recorded per backup, an interrupted job starts over with the backup it was working on
+		recompressed.erase(remove_if(recompressed.begin(), recompressed.end(), [&backupId](const RecompressedBackupInfo& info) { return info.backupId == backupId; }), recompressed.end());
+
+		RecompressedBackupInfo info;
+		info.backupId = backupId;
+		info.codec = m_codec->name;
+		info.level = m_codecLevel;
+		recompressed.push_back(info);
+
+		if (m_backupStorage->UploadRecompressedBackups(recompressed) != 0)
+		{
+			return TaskWithError();
+		}
+
+		backups++;
+	}
+
+	//backups no longer listed leave the list
+	recompressed.erase(remove_if(recompressed.begin(), recompressed.end(), [&metadata](const RecompressedBackupInfo& info)
+	{
+		return find(metadata.backupIds.begin(), metadata.backupIds.end(), info.backupId) == metadata.backupIds.end();
+	}), recompressed.end());
+
+	if (m_backupStorage->UploadRecompressedBackups(recompressed) != 0)
+	{
+		return TaskWithError();
+	}
+
+	cout << "Recompressed " << backups << " backups with " << m_codec->name << " level " << m_codecLevel << ": " << m_rewrittenBlocks << " of " << m_blocks
+		 << " blocks rewritten, " << m_recompressedBytes << " of " << m_storedBytes << " stored bytes" << endl;
+
+	BackupMetaData task;
+	task.status = BackupStatus::Complete;
+	task.encryptionKey = "";
+	m_backupStorage->UploadBackupMetaData(m_taskId, task);
+
+	return 0;
+}
+
+int ColdTierRecompressor::RecompressBackup(const InputParams& params, string backupId)
+{
+	VolumeGeometry geometry = m_backupStorage->GetBackupMetaData(backupId, vector<UINT64>()).geometry;
+	UINT64 capacity = (UINT64)params.volumeSize * VOLUME_SIZE_UNIT;
+	UINT64 partitions = geometry.PartitionCount(capacity);
+	size_t concurrency = (size_t)max(params.recompressConcurrency, 1);
+
+	//one upload slot per block at most, a recompressed block never outgrows the bound of its raw size
+	size_t cmpBufferSize = block_envelope_bound(2 * (size_t)geometry.blockSize);
+	char* cmpBlockBuffer = (char*)malloc(cmpBufferSize * UploadBatchSize);
+	int result = 0;
+
+	for (UINT64 partId = 0; partId < partitions && result == 0; partId++)
+	{
+		vector<UINT64> objects;
+
+		if (m_backupStorage->ListObjects(backupId, partId, objects) != 0)
+		{
+			result = ERROR_CODE;
+			break;
+		}
+
+		for (size_t offset = 0; offset < objects.size() && result == 0; offset += concurrency)
+		{
+			size_t indexNum = min(objects.size() - offset, concurrency);
+			vector<vector<char>> blocks(indexNum);
+			vector<size_t> storedSizes(indexNum);
+			vector<future<int>> tasks;
+			UINT64 readBytes = 0;
+
+			for (size_t k = 0; k < indexNum; k++)
+			{
+				tasks.push_back(async(launch::async, &ColdTierRecompressor::RecompressBlock, this, backupId, partId, objects[offset + k], geometry.blockSize, ref(blocks[k]), ref(storedSizes[k])));
+			}
+
+			for (size_t k = 0; k < indexNum; k++)
+			{
+				if (tasks[k].get() != 0)
+				{
+					cout << "Block data error, backup: " << backupId << ", block: " << geometry.BlockIndex(partId, objects[offset + k]) << endl;
+					result = ERROR_CODE;
+					continue;
+				}
+
+				m_blocks++;
+				m_storedBytes += storedSizes[k];
+				readBytes += storedSizes[k];
+
+				if (blocks[k].empty())
+				{
+					m_recompressedBytes += storedSizes[k];
+					continue;
+				}
+
+				//the object is replaced as a whole under its own key, readers get either version
+				string item = to_string(partId + 1) + "/" + to_string(objects[offset + k] + 1);
+				int cmpBufferOffsetIndex = m_backupStorage->GetFreeBufferOffsetIndex();
+				char* bufferOffset = cmpBlockBuffer + cmpBufferOffsetIndex * cmpBufferSize;
+
+				memcpy(bufferOffset, blocks[k].data(), blocks[k].size());
+				m_backupStorage->UploadBackupSectorDataAsync(backupId, item, m_encryptionKey, bufferOffset, cmpBufferOffsetIndex, blocks[k].size());
+
+				m_rewrittenBlocks++;
+				m_recompressedBytes += blocks[k].size();
+			}
+
+			Throttle(params, readBytes);
+		}
+	}
+
+	//a backup with blocks left in the old codec must not be recorded as recompressed
+	if (m_backupStorage->WaitForAllUploadTasksToComplete() != 0)
+	{
+		cout << "Block upload failed, backup: " << backupId << endl;
+
+		result = ERROR_CODE;
+	}
+
+	free(cmpBlockBuffer);
+
+	return result;
+}
+
+int ColdTierRecompressor::RecompressBlock(string backupId, UINT64 partId, UINT64 partIndex, UINT64 blockSize, vector<char>& out, size_t& storedSize)
+{
+	size_t cmpBufferSize = 2 * (size_t)blockSize;
+	vector<char> stored(cmpBufferSize);
+	vector<char> raw;
+
+	out.clear();
+
+	int size = m_backupStorage->GetBackupBlockData(backupId, partId, m_encryptionKey, { partIndex }, stored.data());
+
+	if (size <= 0 || DecodeStoredBlock(stored.data(), size, cmpBufferSize, raw, &m_dictionaries) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	storedSize = (size_t)size;
+
+	//the dictionary stays with the block, decoding it succeeded so it is at hand
+	uint32_t dictionaryId = stored_block_dictionary_id(stored.data(), size);
+	const block_dictionary* dictionary = dictionaryId != 0 ? m_dictionaries.Get(dictionaryId) : NULL;
+
+	out.resize(block_envelope_bound(raw.size()));
+
+	size_t outSize = seal_block(raw.data(), raw.size(), out.data(), out.size(), m_codec, m_codecLevel, dictionary);
+
+	if (outSize == 0 || outSize >= storedSize)
+	{
+		out.clear();
+		return 0;
+	}
+
+	out.resize(outSize);
+
+	return 0;
+}
+
+void ColdTierRecompressor::Throttle(const InputParams& params, UINT64 bytes)
+{
+	m_readBytes += bytes;
+
+	if (params.recompressMaxMBps <= 0)
+	{
+		return;
+	}
+
+	double allowedSeconds = (double)m_readBytes / ((double)params.recompressMaxMBps * 1024 * 1024);
+	double elapsedSeconds = chrono::duration<double>(chrono::steady_clock::now() - m_startTime).count();
+
+	if (allowedSeconds > elapsedSeconds)
+	{
+		this_thread::sleep_for(chrono::duration<double>(allowedSeconds - elapsedSeconds));
+	}
+}
+
+int ColdTierRecompressor::TaskWithError()
+{
+	BackupMetaData metadata;
+	metadata.encryptionKey = "";
+	metadata.status = BackupStatus::Error;
+	m_backupStorage->UploadBackupMetaData(m_taskId, metadata);
+
+	return ERROR_CODE;
+}
@@ -0,0 +1,54 @@
+#ifndef COLDTIERRECOMPRESSOR_H
+#define COLDTIERRECOMPRESSOR_H
+
+#include <chrono>
+#include "BackupStorage.h"
+#include "VolumeDictionaries.h"
+#include "core/codec.h"
+
+using namespace std;
+
+//recompresses the blocks of backups older than a given age with a stronger codec or level, for
+//restore points kept for long and rarely read. Every block object is replaced as a whole under its
+//own key, so restores running meanwhile read either version. Runs at background priority next to
+//backup and restore jobs, but not next to garbage collection of the same volume.
+class ColdTierRecompressor
+{
+public:
+	//the task id names the status object the job reports to, its key reads and writes every backup of the volume
+	ColdTierRecompressor(BackupStorage* backupStorage, string taskId);
+
+	ColdTierRecompressor(const ColdTierRecompressor&) = delete;
+	ColdTierRecompressor& operator = (const ColdTierRecompressor&) = delete;
+
+	int Recompress(InputParams& params, string volumeId);
+
+private:
+	int RecompressBackup(const InputParams& params, string backupId);
+
+	//fetches and recompresses one block, out is left empty when the block would not shrink
+	int RecompressBlock(string backupId, UINT64 partId, UINT64 partIndex, UINT64 blockSize, vector<char>& out, size_t& storedSize);
+
+	//sleeps as long as reading bytes more would exceed the bandwidth limit
+	void Throttle(const InputParams& params, UINT64 bytes);
+
+	int TaskWithError();
+
+	BackupStorage* m_backupStorage;
+	VolumeDictionaries m_dictionaries;
+
+	string m_taskId;
+	string m_encryptionKey;
+	const block_codec* m_codec;
+	int m_codecLevel;
+
+	chrono::steady_clock::time_point m_startTime;
+	UINT64 m_readBytes;
+
+	UINT64 m_blocks;
+	UINT64 m_rewrittenBlocks;
+	UINT64 m_storedBytes;
+	UINT64 m_recompressedBytes;
+};
+
+#endif
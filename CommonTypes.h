@@ -4,16 +4,27 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <basetsd.h>
 #include <initguid.h>
 #include <guiddef.h>
 #include "vixDiskLib.h"
+#include "core/chunk_index.h"
+#include "core/page_index.h"
+
+#define ERROR_CODE 1
+
+#define VIXDISKLIB_VERSION_MAJOR 6
+#define VIXDISKLIB_VERSION_MINOR 8
 
 constexpr auto BACKUP_UUID_SIZE = 32;
 constexpr auto DATA_BUFFER_SIZE = 1024 * 1024 * 1024;
 constexpr auto MB_BLOCK_SIZE = 1024 * 1024;
-constexpr auto CMP_SIZE = 1024;
 constexpr auto SECTOR_NUM = 2048;
+constexpr auto PARTITION_BLOCK_COUNT = DATA_BUFFER_SIZE / MB_BLOCK_SIZE;
+constexpr UINT64 MIN_BLOCK_SIZE = 64 * 1024;
+constexpr UINT64 MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+constexpr UINT64 VOLUME_SIZE_UNIT = 1024ULL * 1024 * 1024; //volumeSize is given in GB
 
 using namespace std;
 
@@ -31,12 +42,205 @@ struct VolumeMetaData
 	vector<string> backupIds;
 };
 
+//restore point merged from a chain, holds every block the chain held at sourceBackupId,
+//restores of later backups start from it instead of the start of the chain once complete.
+//Listed from the start of the merge, so its blocks are never applied as an incremental backup.
+struct SyntheticFullInfo
+{
+	string backupId;
+	string sourceBackupId;
+	bool complete;
+
+	//backups whose changes it holds, these are left out of the chains that start from it
+	vector<string> mergedBackupIds;
+};
+
+//root of the Merkle tree of a restore point, the block hashes of each partition are a subtree whose
+//leaves are stored once per change: with the backup of the chain that last changed the partition,
+//named by its owner, or nowhere when every block of the partition is unwritten
+struct MerkleTreeRoot
+{
+	UINT64 blockSize;
+	UINT64 partitionBlocks;
+	UINT64 blocks;
+
+	vector<uint64_t> partitionHashes;
+	vector<string> partitionOwners;
+};
+
+//backup whose blocks the cold tier job recompressed, with the codec and level they were tried with
+struct RecompressedBackupInfo
+{
+	string backupId;
+	string codec;
+	int level;
+};
+
+//block index -> value, kept as parallel arrays sorted by block index
+//so it loads as two bulk copies and is searched in place
+template <typename T>
+struct SortedBlockTable
+{
+	vector<uint64_t> keys;
+	vector<T> values;
+
+	void Set(uint64_t key, const T& value)
+	{
+		if (keys.empty() || keys.back() < key)
+		{
+			keys.push_back(key);
+			values.push_back(value);
+			return;
+		}
+
+		auto iter = lower_bound(keys.begin(), keys.end(), key);
+		size_t index = iter - keys.begin();
+
+		if (iter != keys.end() && *iter == key)
+		{
+			values[index] = value;
+			return;
+		}
+
+		keys.insert(iter, key);
+		values.insert(values.begin() + index, value);
+	}
+
+	bool Find(uint64_t key, T& value) const
+	{
+		auto iter = lower_bound(keys.begin(), keys.end(), key);
+
+		if (iter == keys.end() || *iter != key)
+		{
+			return false;
+		}
+
+		value = values[iter - keys.begin()];
+		return true;
+	}
+
+	//appends a table whose keys all follow the keys of this one
+	void AppendTable(const SortedBlockTable& other)
+	{
+		keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+		values.insert(values.end(), other.values.begin(), other.values.end());
+	}
+
+	size_t Size() const { return keys.size(); }
+};
+
+//block index -> content hash
+typedef SortedBlockTable<uint64_t> BlockHashTable;
+
+//block index -> chunk of the client chunk store holding the stored block
+typedef SortedBlockTable<chunk_id> BlockChunkTable;
+
+//block index -> chunks whose concatenation is the stored block, written by content defined chunking.
+//ends[i] is one past the last chunk of keys[i] in chunks, its list starts at the previous end
+struct BlockChunkListTable
+{
+	vector<uint64_t> keys;
+	vector<uint64_t> ends;
+	vector<chunk_id> chunks;
+
+	//keys must ascend, as they do when a backup reads its blocks
+	void Append(uint64_t key, const chunk_id* list, size_t count)
+	{
+		keys.push_back(key);
+		chunks.insert(chunks.end(), list, list + count);
+		ends.push_back(chunks.size());
+	}
+
+	//appends a table whose keys all follow the keys of this one
+	void AppendTable(const BlockChunkListTable& other)
+	{
+		uint64_t base = chunks.size();
+
+		keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+		chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+
+		for (uint64_t end : other.ends)
+		{
+			ends.push_back(base + end);
+		}
+	}
+
+	bool Find(uint64_t key, const chunk_id*& list, size_t& count) const
+	{
+		auto iter = lower_bound(keys.begin(), keys.end(), key);
+
+		if (iter == keys.end() || *iter != key)
+		{
+			return false;
+		}
+
+		size_t index = iter - keys.begin();
+		uint64_t begin = index > 0 ? ends[index - 1] : 0;
+
+		list = chunks.data() + begin;
+		count = (size_t)(ends[index] - begin);
+		return true;
+	}
+
+	//ends must ascend and cover every chunk, anything else is corrupt
+	bool IsValid() const
+	{
+		uint64_t previous = 0;
+
+		if (keys.size() != ends.size())
+		{
+			return false;
+		}
+
+		for (uint64_t end : ends)
+		{
+			if (end < previous || end > chunks.size())
+			{
+				return false;
+			}
+
+			previous = end;
+		}
+
+		return previous == chunks.size();
+	}
+
+	size_t Size() const { return keys.size(); }
+};
+
+//block and partition layout of a backup chain, chosen by the full backup that starts it,
+//defaults to the layout of backups made before it was configurable
+struct VolumeGeometry
+{
+	UINT64 blockSize = MB_BLOCK_SIZE;
+	UINT64 partitionBlocks = PARTITION_BLOCK_COUNT;
+
+	UINT64 PartitionOf(UINT64 blockIndex) const { return blockIndex / partitionBlocks; }
+	UINT64 PartitionIndexOf(UINT64 blockIndex) const { return blockIndex % partitionBlocks; }
+	UINT64 BlockIndex(UINT64 partId, UINT64 partIndex) const { return partId * partitionBlocks + partIndex; }
+	UINT64 BlockCount(UINT64 capacity) const { return (capacity + blockSize - 1) / blockSize; }
+	UINT64 PartitionCount(UINT64 capacity) const { return (BlockCount(capacity) + partitionBlocks - 1) / partitionBlocks; }
+	UINT64 SectorsPerBlock() const { return blockSize / VIXDISKLIB_SECTOR_SIZE; }
+
+	//block sizes are powers of two so blocks stay aligned to every sector and qcow2 cluster size
+	bool IsValid() const
+	{
+		return blockSize >= MIN_BLOCK_SIZE && blockSize <= MAX_BLOCK_SIZE && (blockSize & (blockSize - 1)) == 0 && partitionBlocks > 0;
+	}
+
+	bool operator ==(const VolumeGeometry& other) const { return blockSize == other.blockSize && partitionBlocks == other.partitionBlocks; }
+	bool operator !=(const VolumeGeometry& other) const { return !(*this == other); }
+};
+
 struct BackupMetaData
 {
 	BackupStatus status;
 	string encryptionKey;
-	map<uint32_t, uint64_t> blockHashTable;
-	vector<uint32_t> emptyBlocks;
+	BlockHashTable blockHashTable;
+	BlockChunkTable chunkTable;
+	BlockChunkListTable chunkListTable;
+	vector<uint64_t> emptyBlocks;
+	VolumeGeometry geometry;
 };
 
 enum RestoreStatus
@@ -53,6 +257,12 @@ struct RestoreTaskMetaData
 	string encryptionKey;
 };
 
+struct ByteRange
+{
+	UINT64 offset;
+	UINT64 length;
+};
+
 struct InputParams
 {
 	VixDiskLibConnectParams cnxParams;
@@ -65,9 +275,72 @@ struct InputParams
 	bool fullBackup;
 	bool restore;
 	int volumeSize;
+	UINT64 blockSize;
+	UINT64 partitionSize;
 	string changedDiskAreasFilePath;
 
 	string vmdk;
+	int trackingGranularity;
+
+	string codec;
+	int codecLevel;
+	bool skipIncompressible;
+	bool adaptiveCompression;
+	int minCodecLevel;
+	int maxCodecLevel;
+	bool useDictionary;
+	int dictionarySamples;
+	bool chunkStore;
+	string chunking;
+	UINT64 averageChunkSize;
+	bool pageDedup;
+	UINT64 pageIndexEntries;
+	bool syntheticFull;
+	string syntheticSourceId;
+	int syntheticConcurrency;
+	bool collectGarbage;
+	vector<string> expiredBackupIds;
+	double compactBelow;
+	int deleteBatchSize;
+	int deleteConcurrency;
+	UINT64 collectorMemoryLimit;
+	bool recompress;
+	int recompressAfterDays;
+	string recompressCodec;
+	int recompressLevel;
+	int recompressConcurrency;
+	int recompressMaxMBps;
+	bool benchmarkCodecs;
+	int benchmarkBlocks;
+	bool verifyRange;
+	UINT64 verifyFirstBlock;
+	UINT64 verifyBlocks;
+	string verifyRootHash;
+	bool replicate;
+	string replicaType;
+	string replicaClientId;
+	string replicaVolumeId;
+	string replicaRegion;
+	string replicaPath;
+	int replicaConcurrency;
+	bool standby;
+	bool standbyUpdate;
+	string standbyId;
+	string standbyType;
+	string standbyPath;
+
+	string targetType;
+	string targetPath;
+	bool compareTarget;
+	string currentBackupId;
+	vector<ByteRange> restoreRanges;
+
+	bool instantRestore;
+	string nbdSocket;
+	int nbdPort;
+	string overlayFile;
+	int cacheBlocks;
+	int prefetchBlocks;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include "CompressionController.h"
+
+//blocks per decision, long enough to smooth out single slow reads or uploads
+const int ControllerWindow = 16;
+
+//upload queue fill ratios that count as storage bound and storage starved
+const double QueueHighWatermark = 0.75;
+const double QueueLowWatermark = 0.25;
+
+//share of the loop spent compressing above which the level is worth lowering
+const double CompressionBoundOccupancy = 0.5;
+
+CompressionController::CompressionController(const block_codec* codec, int level, int minLevel, int maxLevel, int uploadSlots) :
+	m_level(level),
+	m_minLevel(codec_level(codec, minLevel == 0 ? codec->min_level : minLevel)),
+	m_maxLevel(codec_level(codec, maxLevel == 0 ? codec->max_level : maxLevel)),
+	m_uploadSlots(uploadSlots > 0 ? uploadSlots : 1),
+	m_adjustments(0),
+	m_samples(0),
+	m_compressSeconds(0),
+	m_cycleSeconds(0),
+	m_queueDepth(0)
+{
+	m_level = max(m_minLevel, min(m_maxLevel, m_level));
+}
+
+void CompressionController::Update(double compressSeconds, double cycleSeconds, int pendingUploads)
+{
+	m_compressSeconds += compressSeconds;
+	m_cycleSeconds += cycleSeconds;
+	m_queueDepth += (double)pendingUploads / m_uploadSlots;
+	m_samples++;
+
+	if (m_samples < ControllerWindow)
+	{
+		return;
+	}
+
+	double occupancy = m_cycleSeconds > 0 ? m_compressSeconds / m_cycleSeconds : 0;
+	double queueDepth = m_queueDepth / m_samples;
+
+	if (queueDepth >= QueueHighWatermark && m_level < m_maxLevel)
+	{
+		m_level++;
+		m_adjustments++;
+	}
+	else if (queueDepth <= QueueLowWatermark && occupancy >= CompressionBoundOccupancy && m_level > m_minLevel)
+	{
+		m_level--;
+		m_adjustments++;
+	}
+
+	m_samples = 0;
+	m_compressSeconds = 0;
+	m_cycleSeconds = 0;
+	m_queueDepth = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef COMPRESSIONCONTROLLER_H
+#define COMPRESSIONCONTROLLER_H
+
+#include "core/codec.h"
+
+using namespace std;
+
+//moves the codec level between configured bounds at block granularity:
+//uploads backing up means there is CPU to spare for a stronger level,
+//an idle upload queue while compression dominates the loop means the level is too expensive
+class CompressionController
+{
+public:
+	CompressionController(const block_codec* codec, int level, int minLevel, int maxLevel, int uploadSlots);
+
+	int GetLevel() const { return m_level; }
+	int GetAdjustments() const { return m_adjustments; }
+
+	//compressSeconds is the time spent sealing the block, cycleSeconds the whole per-block loop,
+	//pendingUploads the upload queue depth once the block was queued
+	void Update(double compressSeconds, double cycleSeconds, int pendingUploads);
+
+private:
+	int m_level;
+	int m_minLevel;
+	int m_maxLevel;
+	int m_uploadSlots;
+	int m_adjustments;
+
+	int m_samples;
+	double m_compressSeconds;
+	double m_cycleSeconds;
+	double m_queueDepth;
+};
+
+#endif
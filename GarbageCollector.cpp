@@ -0,0 +1,939 @@
+#include <iostream>
+#include <future>
+#include <ctime>
+#include "GarbageCollector.h"
+#include "RestoreChain.h"
+#include "core/block_envelope.h"
+#include "core/codec.h"
+#include "core/page_block.h"
+#include "core/page_index.h"
+
+//object keys per plan part and chunk ids per list part, one object each
+const size_t PlanPartKeys = 100000;
+const size_t ChunkListPartEntries = 1024 * 1024;
+
+//partitions whose chunk references are loaded at once
+const UINT64 ChunkTablePartitions = 16;
+
+const string CollectorStateName = "state";
+const string PlanListName = "plan";
+const string ChunkReferencesListName = "chunkrefs";
+const string PendingChunksListName = "pending";
+
+string CollectorObjectName(const string& list, uint64_t generation, uint64_t part)
+{
+	return list + "-" + to_string(generation) + "-" + to_string(part);
+}
+
+//writes a sorted chunk list as numbered parts of the volume's collector objects
+class ChunkListWriter
+{
+public:
+	ChunkListWriter(BackupStorage* backupStorage, string list, uint64_t generation) :
+		m_backupStorage(backupStorage),
+		m_list(list),
+		m_generation(generation),
+		m_parts(0),
+		m_failed(false)
+	{
+	}
+
+	void Add(const chunk_id& chunkId)
+	{
+		m_part.push_back(chunkId);
+
+		if (m_part.size() >= ChunkListPartEntries)
+		{
+			Flush();
+		}
+	}
+
+	//false once a part failed to upload
+	bool Finish()
+	{
+		if (!m_part.empty())
+		{
+			Flush();
+		}
+
+		return !m_failed;
+	}
+
+	uint64_t Parts() const { return m_parts; }
+
+private:
+	void Flush()
+	{
+		if (m_backupStorage->UploadCollectorObject(CollectorObjectName(m_list, m_generation, m_parts), SerializeChunkIndexSegment(m_part)) != 0)
+		{
+			m_failed = true;
+		}
+
+		m_parts++;
+		m_part.clear();
+	}
+
+	BackupStorage* m_backupStorage;
+	string m_list;
+	uint64_t m_generation;
+	uint64_t m_parts;
+	bool m_failed;
+	vector<chunk_id> m_part;
+};
+
+//reads a chunk list the collection of any volume of the client wrote, one part at a time
+class ChunkListReader
+{
+public:
+	ChunkListReader(BackupStorage* backupStorage, string volumeId, string list, uint64_t generation, uint64_t parts) :
+		m_backupStorage(backupStorage),
+		m_volumeId(volumeId),
+		m_list(list),
+		m_generation(generation),
+		m_parts(parts),
+		m_nextPart(0),
+		m_position(0),
+		m_failed(false)
+	{
+	}
+
+	//false at the end of the list or once a part failed to load, Failed tells them apart
+	bool Next(chunk_id& chunkId)
+	{
+		while (m_position >= m_part.size())
+		{
+			string data;
+
+			if (m_failed || m_nextPart >= m_parts)
+			{
+				return false;
+			}
+
+			if (m_backupStorage->GetCollectorObject(m_volumeId, CollectorObjectName(m_list, m_generation, m_nextPart), data) != 0 ||
+				!DeserializeChunkIndexSegment(data.data(), data.size(), m_part))
+			{
+				m_failed = true;
+				return false;
+			}
+
+			m_nextPart++;
+			m_position = 0;
+		}
+
+		chunkId = m_part[m_position++];
+
+		return true;
+	}
+
+	bool Failed() const { return m_failed; }
+
+private:
+	BackupStorage* m_backupStorage;
+	string m_volumeId;
+	string m_list;
+	uint64_t m_generation;
+	uint64_t m_parts;
+	uint64_t m_nextPart;
+	size_t m_position;
+	bool m_failed;
+	vector<chunk_id> m_part;
+};
+
+GarbageCollector::GarbageCollector(BackupStorage* backupStorage, string taskId) :
+	m_backupStorage(backupStorage),
+	m_dictionaries(backupStorage),
+	m_taskId(taskId),
+	m_memoryLimit(0),
+	m_generation(0),
+	m_planParts(0),
+	m_planFailed(false),
+	m_deletedObjects(0),
+	m_compactedBlocks(0),
+	m_droppedPages(0),
+	m_deletedChunks(0),
+	m_pendingChunks(0)
+{
+}
+
+int GarbageCollector::Collect(InputParams& params, string volumeId)
+{
+	m_volumeId = volumeId;
+	m_encryptionKey = m_backupStorage->GetBackupMetaData(m_taskId, vector<UINT64>()).encryptionKey;
+	m_memoryLimit = (size_t)max(params.collectorMemoryLimit, (UINT64)1) * 1024 * 1024;
+
+	//a job without the volume size is malformed, collecting on its word could delete what live backups reference
+	if (params.volumeSize <= 0)
+	{
+		cout << "Volume size is missing or invalid: " << params.volumeSize << endl;
+
+		return TaskWithError();
+	}
+
+	if (params.compactBelow > 0 && find_codec(params.codec) == NULL)
+	{
+		cout << "Compression codec is not available: " << params.codec << endl;
+
+		return TaskWithError();
+	}
+
+	CollectorState state;
+	string data;
+
+	//no state yet is the first collection of the volume
+	if (m_backupStorage->GetCollectorObject(volumeId, CollectorStateName, data) == 0 && !DeserializeCollectorState(data.data(), data.size(), state))
+	{
+		cout << "Garbage collection state is corrupt" << endl;
+
+		return TaskWithError();
+	}
+
+	//what an interrupted collection planned is unreferenced for good, it is deleted before anything else
+	if (state.nextPlanPart < state.planParts)
+	{
+		cout << "Resuming garbage collection at plan part " << state.nextPlanPart + 1 << " of " << state.planParts << endl;
+
+		if (ExecutePlan(params, state) != 0)
+		{
+			return TaskWithError();
+		}
+	}
+
+	VolumeMetaData metadata = m_backupStorage->GetVolumeMetaData(volumeId);
+	vector<SyntheticFullInfo> syntheticFulls;
+
+	if (m_backupStorage->GetSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		return TaskWithError();
+	}
+
+	//backups collected before stay retired even while the volume still lists them
+	set<string> retired(params.expiredBackupIds.begin(), params.expiredBackupIds.end());
+
+	retired.insert(state.retiredBackupIds.begin(), state.retiredBackupIds.end());
+
+	for (const PinnedBackupInfo& pinned : state.pinnedBackups)
+	{
+		retired.insert(pinned.backupId);
+	}
+
+	set<string> live;
+	ResolveLiveBackups(metadata, syntheticFulls, retired, live);
+
+	//dead backups with the geometry their block objects are named by, pinned ones no longer have metadata
+	map<string, VolumeGeometry> dead;
+	set<string> newlyDead;
+
+	for (const PinnedBackupInfo& pinned : state.pinnedBackups)
+	{
+		dead[pinned.backupId] = pinned.geometry;
+	}
+
+	for (const string& backupId : params.expiredBackupIds)
+	{
+		if (live.count(backupId) > 0)
+		{
+			cout << "Expired backup kept, retained restore points still need it: " << backupId << endl;
+			continue;
+		}
+
+		if (dead.count(backupId) == 0)
+		{
+			dead[backupId] = m_backupStorage->GetBackupMetaData(backupId, vector<UINT64>()).geometry;
+			newlyDead.insert(backupId);
+		}
+	}
+
+	if (AdoptMerkleTreeLeaves(live, newlyDead) != 0)
+	{
+		return TaskWithError();
+	}
+
+	m_generation = state.generation + 1;
+
+	CollectorState next;
+	next.generation = m_generation;
+
+	//their metadata is deleted with them, later collections must not read them as retained
+	for (const string& backupId : metadata.backupIds)
+	{
+		if (dead.count(backupId) > 0 || find(state.retiredBackupIds.begin(), state.retiredBackupIds.end(), backupId) != state.retiredBackupIds.end())
+		{
+			next.retiredBackupIds.push_back(backupId);
+		}
+	}
+
+	map<string, set<UINT64>> pinnedBlocks;
+
+	if (PinReferencedBlocks(params, live, dead, newlyDead, pinnedBlocks) != 0 || CollectChunks(params, live, newlyDead, state, next) != 0)
+	{
+		return TaskWithError();
+	}
+
+	//every object of a dead backup but the blocks live backups read pages from
+	UINT64 pinnedBlockCount = 0;
+
+	for (auto iter = dead.begin(); iter != dead.end(); iter++)
+	{
+		const VolumeGeometry& geometry = iter->second;
+		vector<string> keys;
+		set<string> kept;
+
+		auto pinned = pinnedBlocks.find(iter->first);
+
+		if (pinned != pinnedBlocks.end())
+		{
+			for (UINT64 blockIndex : pinned->second)
+			{
+				kept.insert(m_backupStorage->GetBlockObjectKey(iter->first, geometry.PartitionOf(blockIndex), geometry.PartitionIndexOf(blockIndex)));
+			}
+
+			PinnedBackupInfo info;
+			info.backupId = iter->first;
+			info.geometry = geometry;
+			next.pinnedBackups.push_back(info);
+
+			pinnedBlockCount += pinned->second.size();
+		}
+
+		if (m_backupStorage->ListBackupObjectKeys(iter->first, keys) != 0)
+		{
+			return TaskWithError();
+		}
+
+		for (const string& key : keys)
+		{
+			if (kept.count(key) == 0)
+			{
+				AddPlanKey(key);
+			}
+		}
+
+		if (newlyDead.count(iter->first) > 0)
+		{
+			AddPlanKey(m_backupStorage->GetChunkIndexSegmentKey(iter->first));
+		}
+	}
+
+	//lists of the previous collection, other volumes read the new ones once the state names them
+	if (state.generation > 0)
+	{
+		for (uint64_t part = 0; part < state.chunkReferenceParts; part++)
+		{
+			AddPlanKey(m_backupStorage->GetCollectorObjectKey(CollectorObjectName(ChunkReferencesListName, state.generation, part)));
+		}
+
+		for (uint64_t part = 0; part < state.pendingChunkParts; part++)
+		{
+			AddPlanKey(m_backupStorage->GetCollectorObjectKey(CollectorObjectName(PendingChunksListName, state.generation, part)));
+		}
+
+		for (uint64_t part = 0; part < state.planParts; part++)
+		{
+			AddPlanKey(m_backupStorage->GetCollectorObjectKey(CollectorObjectName(PlanListName, state.generation, part)));
+		}
+	}
+
+	FlushPlanPart();
+
+	if (m_planFailed)
+	{
+		cout << "Garbage collection plan upload failed" << endl;
+
+		return TaskWithError();
+	}
+
+	next.planParts = m_planParts;
+	next.nextPlanPart = 0;
+
+	//the collection takes effect here, one interrupted before leaves only unnamed lists that the next one overwrites
+	if (m_backupStorage->UploadCollectorObject(CollectorStateName, SerializeCollectorState(next)) != 0 || ExecutePlan(params, next) != 0)
+	{
+		return TaskWithError();
+	}
+
+	//synthetic full backups are unlisted once their objects are gone, restores could pick them as a chain base before
+	size_t syntheticCount = syntheticFulls.size();
+
+	syntheticFulls.erase(remove_if(syntheticFulls.begin(), syntheticFulls.end(), [&dead](const SyntheticFullInfo& info) { return dead.count(info.backupId) > 0; }), syntheticFulls.end());
+
+	if (syntheticFulls.size() != syntheticCount && m_backupStorage->UploadSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		return TaskWithError();
+	}
+
+	cout << "Garbage collection of " << newlyDead.size() << " expired backups deleted " << m_deletedObjects << " objects, " << m_deletedChunks << " of them chunks, "
+		 << m_pendingChunks << " chunks pending" << endl;
+	cout << next.pinnedBackups.size() << " collected backups keep " << pinnedBlockCount << " blocks with pages of retained backups, "
+		 << m_compactedBlocks << " blocks rewritten without " << m_droppedPages << " dead pages" << endl;
+
+	BackupMetaData task;
+	task.status = BackupStatus::Complete;
+	task.encryptionKey = "";
+	m_backupStorage->UploadBackupMetaData(m_taskId, task);
+
+	return 0;
+}
+
+void GarbageCollector::ResolveLiveBackups(const VolumeMetaData& metadata, const vector<SyntheticFullInfo>& syntheticFulls, const set<string>& retired, set<string>& live)
+{
+	for (const string& backupId : metadata.backupIds)
+	{
+		vector<string> chain;
+
+		if (retired.count(backupId) > 0)
+		{
+			continue;
+		}
+
+		//a synthetic full backup still being merged has no chain yet, its own objects are kept
+		if (RestoreChain::ResolveChain(metadata, syntheticFulls, backupId, chain) != 0)
+		{
+			live.insert(backupId);
+			continue;
+		}
+
+		live.insert(chain.begin(), chain.end());
+	}
+}
+
+int GarbageCollector::PinReferencedBlocks(const InputParams& params, const set<string>& live, const map<string, VolumeGeometry>& dead, const set<string>& newlyDead,
+										  map<string, set<UINT64>>& pinnedBlocks)
+{
+	//block layouts name source backups in fixed size fields
+	set<string> deadSources;
+
+	for (auto iter = dead.begin(); iter != dead.end(); iter++)
+	{
+		string id = iter->first;
+		id.resize(PAGE_SOURCE_ID_SIZE, '\0');
+		deadSources.insert(id);
+	}
+
+	//references into dead backups sorted by block, so the references into one block are adjacent
+	ExternalSorter<page_source_reference> references(m_memoryLimit);
+
+	for (const string& backupId : live)
+	{
+		vector<page_index_entry> pages;
+		vector<page_source_reference> backupReferences;
+		bool exists = false;
+
+		if (m_backupStorage->HasPageIndexSegment(backupId, exists) != 0 || (exists && m_backupStorage->GetPageIndexSegment(backupId, pages, backupReferences) != 0))
+		{
+			cout << "Page index segment not available, backup: " << backupId << endl;
+			return ERROR_CODE;
+		}
+
+		for (const page_source_reference& reference : backupReferences)
+		{
+			if (deadSources.count(string(reference.source_id, PAGE_SOURCE_ID_SIZE)) > 0)
+			{
+				references.Add(reference);
+			}
+		}
+	}
+
+	vector<pair<string, UINT64>> blocks;
+	vector<vector<uint32_t>> liveSlots;
+	size_t concurrency = (size_t)max(params.deleteConcurrency, 1);
+	page_source_reference reference;
+	bool more = references.Next(reference);
+
+	if (references.Failed())
+	{
+		cout << "Sorting page references failed" << endl;
+		return ERROR_CODE;
+	}
+
+	while (more)
+	{
+		page_source_reference first = reference;
+		vector<uint32_t> slots;
+
+		while (more && memcmp(reference.source_id, first.source_id, PAGE_SOURCE_ID_SIZE) == 0 && reference.source_block == first.source_block)
+		{
+			if (slots.empty() || slots.back() != reference.slot)
+			{
+				slots.push_back(reference.slot);
+			}
+
+			more = references.Next(reference);
+		}
+
+		//a run cut short would leave slots and blocks of later references unpinned
+		if (references.Failed())
+		{
+			cout << "Sorting page references failed" << endl;
+			return ERROR_CODE;
+		}
+
+		string source(first.source_id, strnlen(first.source_id, PAGE_SOURCE_ID_SIZE));
+		pinnedBlocks[source].insert(first.source_block);
+
+		//blocks pinned by earlier collections were compacted then and are left as they are
+		if (params.compactBelow > 0 && newlyDead.count(source) > 0)
+		{
+			blocks.push_back(make_pair(source, first.source_block));
+			liveSlots.push_back(slots);
+		}
+
+		if (blocks.size() >= concurrency || (!more && !blocks.empty()))
+		{
+			CompactBlocks(params, blocks, liveSlots, dead);
+
+			blocks.clear();
+			liveSlots.clear();
+		}
+	}
+
+	return 0;
+}
+
+void GarbageCollector::CompactBlocks(const InputParams& params, const vector<pair<string, UINT64>>& blocks, const vector<vector<uint32_t>>& liveSlots, const map<string, VolumeGeometry>& dead)
+{
+	const block_codec* codec = find_codec(params.codec);
+	int codecLevel = codec_level(codec, params.codecLevel);
+
+	vector<vector<char>> images(blocks.size());
+	vector<future<int>> tasks;
+	UINT64 maxBlockSize = 0;
+
+	for (size_t k = 0; k < blocks.size(); k++)
+	{
+		const VolumeGeometry& geometry = dead.at(blocks[k].first);
+		UINT64 blockIndex = blocks[k].second;
+
+		tasks.push_back(async(GetBackupBlockData, m_backupStorage, blocks[k].first, geometry.PartitionOf(blockIndex), m_encryptionKey,
+							  geometry.PartitionIndexOf(blockIndex), geometry.blockSize, ref(images[k]), &m_dictionaries));
+
+		maxBlockSize = max(maxBlockSize, geometry.blockSize);
+	}
+
+	size_t cmpBufferSize = block_envelope_bound(page_block_max_size((uint32_t)(maxBlockSize / DEDUP_PAGE_SIZE)));
+	char* cmpBlockBuffer = (char*)malloc(cmpBufferSize * UploadBatchSize);
+	vector<char> layout;
+	vector<char> pageData;
+
+	for (size_t k = 0; k < blocks.size(); k++)
+	{
+		const VolumeGeometry& geometry = dead.at(blocks[k].first);
+		const vector<uint32_t>& slots = liveSlots[k];
+		UINT64 blockIndex = blocks[k].second;
+		page_block_view view;
+
+		if (tasks[k].get() != 0 || !parse_page_block(images[k].data(), images[k].size(), view) || slots.back() >= view.stored)
+		{
+			cout << "Pinned block not readable, kept as it is, backup: " << blocks[k].first << ", block: " << blockIndex << endl;
+			continue;
+		}
+
+		if (slots.size() >= params.compactBelow * view.stored)
+		{
+			continue;
+		}
+
+		//slots keep their numbers so the references stay valid, dead pages are zeroed and compress to nearly nothing.
+		//Live backups only read stored slots of the block, its own page entries and references are dropped.
+		uint32_t stored = slots.back() + 1;
+
+		pageData.assign((size_t)stored * DEDUP_PAGE_SIZE, 0);
+
+		for (uint32_t slot : slots)
+		{
+			memcpy(pageData.data() + (size_t)slot * DEDUP_PAGE_SIZE, view.page_data + (size_t)slot * DEDUP_PAGE_SIZE, DEDUP_PAGE_SIZE);
+		}
+
+		vector<uint32_t> entries(view.pages, PAGE_ABSENT);
+		layout.resize(page_block_max_size(view.pages));
+
+		size_t layoutSize = write_page_block(layout.data(), view.pages, entries.data(), string(), vector<page_reference>(), pageData.data(), stored);
+		string item = to_string(geometry.PartitionOf(blockIndex) + 1) + "/" + to_string(geometry.PartitionIndexOf(blockIndex) + 1);
+
+		int cmpBufferOffsetIndex = m_backupStorage->GetFreeBufferOffsetIndex();
+		char* bufferOffset = cmpBlockBuffer + cmpBufferOffsetIndex * cmpBufferSize;
+
+		size_t out_data_size = seal_block(layout.data(), layoutSize, bufferOffset, cmpBufferSize, codec, codecLevel, NULL);
+
+		//the object is replaced as a whole, a failed upload leaves the block as it was
+		m_backupStorage->UploadBackupSectorDataAsync(blocks[k].first, item, m_encryptionKey, bufferOffset, cmpBufferOffsetIndex, out_data_size);
+
+		m_compactedBlocks++;
+		m_droppedPages += view.stored - slots.size();
+	}
+
+	m_backupStorage->WaitForAllUploadTasksToComplete();
+
+	free(cmpBlockBuffer);
+}
+
+int GarbageCollector::AdoptMerkleTreeLeaves(const set<string>& live, const set<string>& newlyDead)
+{
+	for (const string& backupId : live)
+	{
+		MerkleTreeRoot root;
+
+		//backups written before trees were built have none
+		if (m_backupStorage->GetMerkleTreeRoot(backupId, root) != 0)
+		{
+			continue;
+		}
+
+		bool adopted = false;
+
+		for (UINT64 partId = 0; partId < root.partitionOwners.size(); partId++)
+		{
+			if (newlyDead.count(root.partitionOwners[partId]) == 0)
+			{
+				continue;
+			}
+
+			vector<uint64_t> leaves;
+
+			if (m_backupStorage->GetMerkleTreeLeaves(root.partitionOwners[partId], partId, leaves) != 0 ||
+				m_backupStorage->UploadMerkleTreeLeaves(backupId, partId, leaves) != 0)
+			{
+				cout << "Merkle tree leaves could not be moved, backup: " << backupId << endl;
+				return ERROR_CODE;
+			}
+
+			root.partitionOwners[partId] = backupId;
+			adopted = true;
+		}
+
+		if (adopted && m_backupStorage->UploadMerkleTreeRoot(backupId, root) != 0)
+		{
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+int GarbageCollector::CollectChunks(const InputParams& params, const set<string>& live, const set<string>& newlyDead, const CollectorState& previous, CollectorState& state)
+{
+	vector<pair<string, string>> segments;
+
+	if (m_backupStorage->ListChunkIndexSegments(segments) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	state.publishedAt = (uint64_t)time(NULL);
+
+	//without segments no volume uses the chunk store, there is nothing to publish or delete
+	if (segments.empty() && previous.pendingChunkParts == 0)
+	{
+		return 0;
+	}
+
+	//chunks the live backups reference, published for the collections of every volume of the client
+	ExternalSorter<chunk_id> references(m_memoryLimit);
+
+	for (const string& backupId : live)
+	{
+		//the partitions the backup stored chunks of, a volume grown since keeps its later ones
+		vector<UINT64> stored;
+
+		if (m_backupStorage->GetBackupChunkPartitions(backupId, stored) != 0)
+		{
+			cout << "Chunk references not available, backup: " << backupId << endl;
+			return ERROR_CODE;
+		}
+
+		for (size_t first = 0; first < stored.size(); first += ChunkTablePartitions)
+		{
+			vector<UINT64> partIds(stored.begin() + first, stored.begin() + min(stored.size(), first + (size_t)ChunkTablePartitions));
+			BlockChunkTable chunks;
+			BlockChunkListTable chunkLists;
+
+			if (m_backupStorage->GetBackupChunkTable(backupId, partIds, chunks, chunkLists) != 0)
+			{
+				cout << "Chunk references not available, backup: " << backupId << endl;
+				return ERROR_CODE;
+			}
+
+			for (const chunk_id& chunkId : chunks.values)
+			{
+				references.Add(chunkId);
+			}
+
+			for (const chunk_id& chunkId : chunkLists.chunks)
+			{
+				references.Add(chunkId);
+			}
+		}
+	}
+
+	ChunkListWriter published(m_backupStorage, ChunkReferencesListName, m_generation);
+	chunk_id chunkId;
+
+	while (references.Next(chunkId))
+	{
+		published.Add(chunkId);
+	}
+
+	if (references.Failed() || !published.Finish())
+	{
+		cout << "Publishing chunk references failed" << endl;
+		return ERROR_CODE;
+	}
+
+	state.chunkReferenceParts = published.Parts();
+
+	//chunks the segments of newly dead backups list become pending, no later backup can find them in the index.
+	//They stay pending while referenced, backups that found them before keep referencing them.
+	ExternalSorter<chunk_id> deadChunks(m_memoryLimit / 2);
+	set<pair<string, string>> listed(segments.begin(), segments.end());
+
+	for (const string& backupId : newlyDead)
+	{
+		vector<chunk_id> chunkIds;
+
+		if (listed.count(make_pair(m_volumeId, backupId)) == 0)
+		{
+			continue;
+		}
+
+		if (m_backupStorage->GetChunkIndexSegment(m_volumeId, backupId, chunkIds) != 0)
+		{
+			cout << "Chunk index segment not available, backup: " << backupId << endl;
+			return ERROR_CODE;
+		}
+
+		for (const chunk_id& id : chunkIds)
+		{
+			deadChunks.Add(id);
+		}
+	}
+
+	//chunks any volume references or any remaining segment lists. Pending chunks are only deleted once every
+	//volume using the chunk store published its references after they became pending, backups running while
+	//they became pending could still have found them in the index.
+	ExternalSorter<chunk_id> liveChunks(m_memoryLimit / 2);
+	bool deletable = previous.pendingChunkParts > 0;
+	set<string> volumes;
+
+	volumes.insert(m_volumeId);
+
+	for (const pair<string, string>& segment : segments)
+	{
+		vector<chunk_id> chunkIds;
+
+		volumes.insert(segment.first);
+
+		if (!deletable || (segment.first == m_volumeId && newlyDead.count(segment.second) > 0))
+		{
+			continue;
+		}
+
+		//a segment another collection deleted meanwhile only postpones the deletion
+		if (m_backupStorage->GetChunkIndexSegment(segment.first, segment.second, chunkIds) != 0)
+		{
+			deletable = false;
+			continue;
+		}
+
+		for (const chunk_id& id : chunkIds)
+		{
+			liveChunks.Add(id);
+		}
+	}
+
+	for (auto iter = volumes.begin(); iter != volumes.end() && deletable; iter++)
+	{
+		CollectorState volumeState = state;
+		string data;
+
+		if (*iter != m_volumeId && (m_backupStorage->GetCollectorObject(*iter, CollectorStateName, data) != 0 || !DeserializeCollectorState(data.data(), data.size(), volumeState)))
+		{
+			cout << "Pending chunks kept, volume " << *iter << " has not published its chunk references" << endl;
+			deletable = false;
+			break;
+		}
+
+		if (volumeState.publishedAt <= previous.pendingSince)
+		{
+			cout << "Pending chunks kept, volume " << *iter << " has not published its chunk references since they became pending" << endl;
+			deletable = false;
+			break;
+		}
+
+		ChunkListReader reader(m_backupStorage, *iter, ChunkReferencesListName, volumeState.generation, volumeState.chunkReferenceParts);
+
+		while (reader.Next(chunkId))
+		{
+			liveChunks.Add(chunkId);
+		}
+
+		if (reader.Failed())
+		{
+			deletable = false;
+		}
+	}
+
+	//one pass over the previous pending chunks and the new ones merged, against the live chunks
+	ChunkListReader previousPending(m_backupStorage, m_volumeId, PendingChunksListName, previous.generation, previous.pendingChunkParts);
+	ChunkListWriter pending(m_backupStorage, PendingChunksListName, m_generation);
+	chunk_id pendingId, deadId, liveId;
+
+	bool hasPending = previousPending.Next(pendingId);
+	bool hasDead = deadChunks.Next(deadId);
+	bool hasLive = deletable && liveChunks.Next(liveId);
+
+	if (deadChunks.Failed() || liveChunks.Failed())
+	{
+		cout << "Sorting chunk ids failed" << endl;
+		return ERROR_CODE;
+	}
+
+	while (hasPending || hasDead)
+	{
+		bool fromPending = hasPending && (!hasDead || !(deadId < pendingId));
+		bool fromBoth = fromPending && hasDead && deadId == pendingId;
+		chunk_id id = fromPending ? pendingId : deadId;
+
+		while (hasLive && liveId < id)
+		{
+			hasLive = liveChunks.Next(liveId);
+		}
+
+		//live chunks cut short would have chunks still referenced deleted
+		if (liveChunks.Failed())
+		{
+			cout << "Sorting chunk ids failed" << endl;
+			return ERROR_CODE;
+		}
+
+		if (deletable && fromPending && !(hasLive && liveId == id))
+		{
+			AddPlanKey(m_backupStorage->GetChunkObjectKey(id));
+			m_deletedChunks++;
+		}
+		else
+		{
+			pending.Add(id);
+			m_pendingChunks++;
+		}
+
+		if (fromPending)
+		{
+			hasPending = previousPending.Next(pendingId);
+		}
+
+		if (!fromPending || fromBoth)
+		{
+			hasDead = deadChunks.Next(deadId);
+		}
+	}
+
+	if (deadChunks.Failed())
+	{
+		cout << "Sorting chunk ids failed" << endl;
+		return ERROR_CODE;
+	}
+
+	//a lost pending list would leave its chunks in the store for good
+	if (previousPending.Failed() || !pending.Finish())
+	{
+		cout << "Pending chunk list not available" << endl;
+		return ERROR_CODE;
+	}
+
+	state.pendingChunkParts = pending.Parts();
+	state.pendingSince = (uint64_t)time(NULL);
+
+	return 0;
+}
+
+void GarbageCollector::AddPlanKey(const string& key)
+{
+	m_planPart.push_back(key);
+
+	if (m_planPart.size() >= PlanPartKeys)
+	{
+		FlushPlanPart();
+	}
+}
+
+void GarbageCollector::FlushPlanPart()
+{
+	if (m_planPart.empty())
+	{
+		return;
+	}
+
+	if (m_backupStorage->UploadCollectorObject(CollectorObjectName(PlanListName, m_generation, m_planParts), SerializeKeyList(m_planPart)) != 0)
+	{
+		m_planFailed = true;
+	}
+
+	m_planParts++;
+	m_planPart.clear();
+}
+
+int GarbageCollector::ExecutePlan(const InputParams& params, CollectorState& state)
+{
+	size_t batchSize = (size_t)max(params.deleteBatchSize, 1);
+	size_t concurrency = (size_t)max(params.deleteConcurrency, 1);
+
+	while (state.nextPlanPart < state.planParts)
+	{
+		string data;
+		vector<string> keys;
+		int result = 0;
+
+		if (m_backupStorage->GetCollectorObject(m_volumeId, CollectorObjectName(PlanListName, state.generation, state.nextPlanPart), data) != 0 ||
+			!DeserializeKeyList(data.data(), data.size(), keys))
+		{
+			cout << "Garbage collection plan part not available: " << state.nextPlanPart + 1 << endl;
+			return ERROR_CODE;
+		}
+
+		//concurrency batches in flight at once, objects already gone count as deleted
+		for (size_t offset = 0; offset < keys.size() && result == 0; offset += batchSize * concurrency)
+		{
+			vector<future<int>> tasks;
+
+			for (size_t batch = offset; batch < min(keys.size(), offset + batchSize * concurrency); batch += batchSize)
+			{
+				vector<string> batchKeys(keys.begin() + batch, keys.begin() + min(keys.size(), batch + batchSize));
+
+				tasks.push_back(async(launch::async, [this, batchKeys]() { return m_backupStorage->DeleteObjects(batchKeys); }));
+			}
+
+			for (auto& task : tasks)
+			{
+				if (task.get() != 0)
+				{
+					result = ERROR_CODE;
+				}
+			}
+		}
+
+		if (result != 0)
+		{
+			cout << "Deleting objects failed, the next collection resumes at plan part " << state.nextPlanPart + 1 << endl;
+			return ERROR_CODE;
+		}
+
+		m_deletedObjects += keys.size();
+		state.nextPlanPart++;
+
+		if (m_backupStorage->UploadCollectorObject(CollectorStateName, SerializeCollectorState(state)) != 0)
+		{
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+int GarbageCollector::TaskWithError()
+{
+	BackupMetaData metadata;
+	metadata.encryptionKey = "";
+	metadata.status = BackupStatus::Error;
+	m_backupStorage->UploadBackupMetaData(m_taskId, metadata);
+
+	return ERROR_CODE;
+}
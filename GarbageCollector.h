@@ -0,0 +1,75 @@
+#ifndef GARBAGECOLLECTOR_H
+#define GARBAGECOLLECTOR_H
+
+#include <set>
+#include "BackupStorage.h"
+#include "MetaDataSerializer.h"
+#include "VolumeDictionaries.h"
+#include "core/external_sort.h"
+
+using namespace std;
+
+//deletes what expired backups leave unreferenced: their block and metadata objects, the chunk index
+//segments they wrote and, one collection later, the store chunks no volume references any more.
+//Expired backups the chains of retained backups still need are kept, blocks retained backups read
+//pages from are kept and rewritten without their dead pages. No backup of the volume may run meanwhile.
+class GarbageCollector
+{
+public:
+	//the task id names the status object the job reports to, its key reads and writes every backup of the volume
+	GarbageCollector(BackupStorage* backupStorage, string taskId);
+
+	GarbageCollector(const GarbageCollector&) = delete;
+	GarbageCollector& operator = (const GarbageCollector&) = delete;
+
+	//finishes an interrupted collection first, then collects params.expiredBackupIds
+	int Collect(InputParams& params, string volumeId);
+
+private:
+	//backups whose objects the listed restore points not retired need, retired ones included
+	void ResolveLiveBackups(const VolumeMetaData& metadata, const vector<SyntheticFullInfo>& syntheticFulls, const set<string>& retired, set<string>& live);
+
+	//blocks of dead backups that live backups reference pages in, the blocks of newly dead backups are compacted
+	int PinReferencedBlocks(const InputParams& params, const set<string>& live, const map<string, VolumeGeometry>& dead, const set<string>& newlyDead,
+							map<string, set<UINT64>>& pinnedBlocks);
+
+	//rewrites the blocks with fewer live pages than params.compactBelow of their stored pages, blocks that fail to load are kept as they are
+	void CompactBlocks(const InputParams& params, const vector<pair<string, UINT64>>& blocks, const vector<vector<uint32_t>>& liveSlots, const map<string, VolumeGeometry>& dead);
+
+	//Merkle tree leaves of live backups stored with newly dead ones, which synthetic full backups cut out
+	//of the chains of backups built before them, are copied to the live backups before anything is deleted
+	int AdoptMerkleTreeLeaves(const set<string>& live, const set<string>& newlyDead);
+
+	//publishes the chunks the live backups reference and plans the deletion of the pending chunks no volume references
+	int CollectChunks(const InputParams& params, const set<string>& live, const set<string>& newlyDead, const CollectorState& previous, CollectorState& state);
+
+	//plan keys are uploaded in parts as they are added, nothing is deleted before the state names the plan
+	void AddPlanKey(const string& key);
+	void FlushPlanPart();
+
+	//deletes the plan parts from state.nextPlanPart on, recording each finished part
+	int ExecutePlan(const InputParams& params, CollectorState& state);
+
+	int TaskWithError();
+
+	BackupStorage* m_backupStorage;
+	VolumeDictionaries m_dictionaries;
+
+	string m_taskId;
+	string m_volumeId;
+	string m_encryptionKey;
+	size_t m_memoryLimit;
+
+	uint64_t m_generation;
+	vector<string> m_planPart;
+	uint64_t m_planParts;
+	bool m_planFailed;
+
+	UINT64 m_deletedObjects;
+	UINT64 m_compactedBlocks;
+	UINT64 m_droppedPages;
+	UINT64 m_deletedChunks;
+	UINT64 m_pendingChunks;
+};
+
+#endif
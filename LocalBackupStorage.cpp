@@ -0,0 +1,726 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include "LocalBackupStorage.h"
+
+namespace fs = std::filesystem;
+
+LocalBackupStorage::LocalBackupStorage(string clientId, string volumeId, string rootPath) :
+	BackupStorage(clientId, volumeId, ""),
+	m_rootPath(rootPath),
+	m_failedUploads(0)
+{
+	for (int i = 0; i < UploadBatchSize; i++)
+	{
+		m_uploadSlots.enqueue(i);
+	}
+}
+
+string LocalBackupStorage::GetObjectPath(const string& key) const
+{
+	return (fs::path(m_rootPath) / m_clientId / key).string();
+}
+
+string LocalBackupStorage::GetBackupPrefix(string backupId) const
+{
+	return m_volumeId + "/backups/" + backupId + "/";
+}
+
+int LocalBackupStorage::PutObjectData(const string& key, const char* data, size_t size)
+{
+	fs::path path = GetObjectPath(key);
+	fs::path partial = path.string() + ".part";
+	error_code error;
+
+	fs::create_directories(path.parent_path(), error);
+
+	{
+		ofstream file(partial, ios::binary | ios::trunc);
+
+		if (!file.write(data, size))
+		{
+			cout << "Error: object could not be written: " << path.string() << endl;
+			return ERROR_CODE;
+		}
+	}
+
+	fs::rename(partial, path, error);
+
+	if (error)
+	{
+		cout << "Error: object could not be written: " << path.string() << " - " << error.message() << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::GetObjectData(const string& key, string& data)
+{
+	ifstream file(GetObjectPath(key), ios::binary);
+
+	if (!file)
+	{
+		return ERROR_CODE;
+	}
+
+	data.assign((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	return file.bad() ? ERROR_CODE : 0;
+}
+
+int LocalBackupStorage::ListObjectKeys(const string& prefix, vector<string>& keys)
+{
+	fs::path client = fs::path(m_rootPath) / m_clientId;
+	fs::path directory = client / prefix;
+	error_code error;
+
+	if (!fs::exists(directory, error))
+	{
+		return 0;
+	}
+
+	for (fs::recursive_directory_iterator iter(directory, error), end; !error && iter != end; iter.increment(error))
+	{
+		//files still being written are not objects yet
+		if (iter->is_regular_file() && iter->path().extension() != ".part")
+		{
+			keys.push_back(iter->path().lexically_relative(client).generic_string());
+		}
+	}
+
+	if (error)
+	{
+		cout << "Error: " << directory.string() << " could not be listed - " << error.message() << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::GetFreeBufferOffsetIndex()
+{
+	return m_uploadSlots.dequeue();
+}
+
+void LocalBackupStorage::UploadBackupSectorDataAsync(string backupId, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize)
+{
+	if (PutObjectData(GetBackupPrefix(backupId) + "blockdata/" + item, bufferOffset, bufferSize) != 0)
+	{
+		m_failedUploads++;
+	}
+
+	m_uploadSlots.enqueue(bufferOffsetIndex);
+}
+
+int LocalBackupStorage::WaitForAllUploadTasksToComplete()
+{
+	return m_failedUploads.exchange(0) == 0 ? 0 : ERROR_CODE;
+}
+
+int LocalBackupStorage::GetPendingUploadCount()
+{
+	return 0;
+}
+
+int LocalBackupStorage::UploadBackupMetaData(string backupId, BackupMetaData &metadata)
+{
+	string data = SerializeBackupMetaData(metadata);
+
+	return PutObjectData(GetBackupPrefix(backupId) + "metadata/metadata", data.data(), data.size());
+}
+
+VolumeMetaData LocalBackupStorage::GetVolumeMetaData(string volumeId)
+{
+	VolumeMetaData metadata;
+	string data;
+
+	if (GetObjectData(volumeId + "/metadata/metadata", data) != 0 || data.size() < sizeof(uint32_t))
+	{
+		cout << "Error: volume metadata not found, volume: " << volumeId << endl;
+		return metadata;
+	}
+
+	uint32_t num = 0;
+	memcpy(&num, data.data(), sizeof(uint32_t));
+
+	for (size_t pos = sizeof(uint32_t); num > 0 && data.size() - pos >= BACKUP_UUID_SIZE; pos += BACKUP_UUID_SIZE, num--)
+	{
+		metadata.backupIds.push_back(data.substr(pos, BACKUP_UUID_SIZE));
+	}
+
+	return metadata;
+}
+
+int LocalBackupStorage::UploadVolumeMetaData(const VolumeMetaData& metadata)
+{
+	//[UINT32 count][count x BACKUP_UUID_SIZE chars]
+	uint32_t num = (uint32_t)metadata.backupIds.size();
+	string data((const char*)&num, sizeof(uint32_t));
+
+	for (const string& backupId : metadata.backupIds)
+	{
+		data.append(backupId, 0, BACKUP_UUID_SIZE);
+	}
+
+	return PutObjectData(m_volumeId + "/metadata/metadata", data.data(), data.size());
+}
+
+int LocalBackupStorage::LoadBackupMetaData(string backupId, const vector<UINT64>* partIds, BackupMetaData& metadata)
+{
+	string data;
+
+	if (GetObjectData(GetBackupPrefix(backupId) + "metadata/metadata", data) != 0)
+	{
+		cout << "Error: backup metadata not found, backup: " << backupId << endl;
+		return ERROR_CODE;
+	}
+
+	if (!DeserializeBackupMetaData(data.data(), data.size(), metadata))
+	{
+		cout << "Error: backup metadata is corrupt, backup: " << backupId << endl;
+		metadata = BackupMetaData();
+		return ERROR_CODE;
+	}
+
+	if (partIds != NULL)
+	{
+		set<uint64_t> requested(partIds->begin(), partIds->end());
+
+		KeepPartitions(metadata.blockHashTable, metadata.geometry, requested);
+		KeepPartitions(metadata.chunkTable, metadata.geometry, requested);
+		KeepPartitions(metadata.chunkListTable, metadata.geometry, requested);
+	}
+
+	return 0;
+}
+
+BackupMetaData LocalBackupStorage::GetBackupMetaData(string backupId)
+{
+	BackupMetaData metadata;
+
+	if (LoadBackupMetaData(backupId, NULL, metadata) != 0)
+	{
+		metadata.status = BackupStatus::Error;
+	}
+
+	return metadata;
+}
+
+BackupMetaData LocalBackupStorage::GetBackupMetaData(string backupId, const vector<UINT64>& partIds)
+{
+	BackupMetaData metadata;
+
+	if (LoadBackupMetaData(backupId, &partIds, metadata) != 0)
+	{
+		metadata.status = BackupStatus::Error;
+	}
+
+	return metadata;
+}
+
+int LocalBackupStorage::GetBackupMetaData(string backupId, BackupMetaData& metadata)
+{
+	return LoadBackupMetaData(backupId, NULL, metadata);
+}
+
+int LocalBackupStorage::GetBackupMetaData(string backupId, const vector<UINT64>& partIds, BackupMetaData& metadata)
+{
+	return LoadBackupMetaData(backupId, &partIds, metadata);
+}
+
+int LocalBackupStorage::GetBackupChunkTable(string backupId, const vector<UINT64>& partIds, BlockChunkTable& chunks, BlockChunkListTable& chunkLists)
+{
+	BackupMetaData metadata;
+
+	if (LoadBackupMetaData(backupId, &partIds, metadata) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	chunks = metadata.chunkTable;
+	chunkLists = metadata.chunkListTable;
+
+	return 0;
+}
+
+int LocalBackupStorage::GetBackupChunkPartitions(string backupId, vector<UINT64>& partIds)
+{
+	BackupMetaData metadata;
+	set<uint64_t> found;
+
+	if (LoadBackupMetaData(backupId, NULL, metadata) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	AddPartitions(metadata.chunkTable, metadata.geometry, found);
+	AddPartitions(metadata.chunkListTable, metadata.geometry, found);
+
+	partIds.assign(found.begin(), found.end());
+
+	return 0;
+}
+
+void LocalBackupStorage::UploadRestoreTaskMetaData(const RestoreTaskMetaData &metadata)
+{
+	//[UINT32 status][UINT32 key length][key]
+	uint32_t status = (uint32_t)metadata.status;
+	uint32_t keyLength = (uint32_t)metadata.encryptionKey.length();
+
+	string data((const char*)&status, sizeof(uint32_t));
+	data.append((const char*)&keyLength, sizeof(uint32_t));
+	data.append(metadata.encryptionKey);
+
+	PutObjectData(m_volumeId + "/restore/" + metadata.restoreId, data.data(), data.size());
+}
+
+RestoreTaskMetaData LocalBackupStorage::GetRestoreTaskMetaData(string restoreId)
+{
+	RestoreTaskMetaData metadata;
+	metadata.restoreId = restoreId;
+	metadata.status = RestoreError;
+
+	string data;
+	uint32_t status = 0;
+	uint32_t keyLength = 0;
+
+	if (GetObjectData(m_volumeId + "/restore/" + restoreId, data) != 0 || data.size() < 2 * sizeof(uint32_t))
+	{
+		cout << "Error: restore task metadata not found, restore: " << restoreId << endl;
+		return metadata;
+	}
+
+	memcpy(&status, data.data(), sizeof(uint32_t));
+	memcpy(&keyLength, data.data() + sizeof(uint32_t), sizeof(uint32_t));
+
+	metadata.status = (RestoreStatus)status;
+	metadata.encryptionKey = data.substr(2 * sizeof(uint32_t), keyLength);
+
+	return metadata;
+}
+
+int LocalBackupStorage::GetBackupBlockData(string backupId, UINT64 partId, string key, const vector<UINT64>& indices, char* buffer)
+{
+	int size = 0;
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		string data;
+
+		if (GetObjectData(GetBlockObjectKey(backupId, partId, indices[i]), data) != 0)
+		{
+			cout << "Error: block object not found, backup: " << backupId << ", partition: " << partId + 1 << ", object: " << indices[i] + 1 << endl;
+			continue;
+		}
+
+		memcpy(buffer, data.data(), data.size());
+		size += (int)data.size();
+	}
+
+	return size;
+}
+
+int LocalBackupStorage::ListObjects(string backupId, UINT64 partId, vector<UINT64>& objects)
+{
+	vector<string> keys;
+	string prefix = GetBackupPrefix(backupId) + "blockdata/" + to_string(partId + 1) + "/";
+
+	if (ListObjectKeys(prefix, keys) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	for (const string& key : keys)
+	{
+		UINT64 object = strtoull(key.c_str() + prefix.length(), NULL, 10) - 1;
+
+		if (find(objects.begin(), objects.end(), object) == objects.end())
+		{
+			objects.push_back(object);
+		}
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadVolumeDictionary(uint32_t dictionaryId, const string& dictionary)
+{
+	string prefix = m_volumeId + "/metadata/";
+
+	if (PutObjectData(prefix + "dictionaries/" + to_string(dictionaryId), dictionary.data(), dictionary.size()) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//current dictionary: [UINT32 id][dictionary]
+	string current((const char*)&dictionaryId, sizeof(uint32_t));
+	current += dictionary;
+
+	return PutObjectData(prefix + "dictionary", current.data(), current.size());
+}
+
+int LocalBackupStorage::GetVolumeDictionary(uint32_t& dictionaryId, string& dictionary)
+{
+	string prefix = m_volumeId + "/metadata/";
+
+	if (dictionaryId != 0)
+	{
+		return GetObjectData(prefix + "dictionaries/" + to_string(dictionaryId), dictionary);
+	}
+
+	string current;
+
+	if (GetObjectData(prefix + "dictionary", current) != 0 || current.size() < sizeof(uint32_t))
+	{
+		return ERROR_CODE;
+	}
+
+	memcpy(&dictionaryId, current.data(), sizeof(uint32_t));
+	dictionary = current.substr(sizeof(uint32_t));
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadVolumeGeometry(const VolumeGeometry& geometry)
+{
+	//[UINT64 block size][UINT64 blocks per partition]
+	uint64_t data[2] = { geometry.blockSize, geometry.partitionBlocks };
+
+	return PutObjectData(m_volumeId + "/metadata/geometry", (const char*)data, sizeof(data));
+}
+
+int LocalBackupStorage::GetVolumeGeometry(VolumeGeometry& geometry)
+{
+	string data;
+
+	if (GetObjectData(m_volumeId + "/metadata/geometry", data) != 0 || data.size() < 2 * sizeof(uint64_t))
+	{
+		return ERROR_CODE;
+	}
+
+	memcpy(&geometry.blockSize, data.data(), sizeof(uint64_t));
+	memcpy(&geometry.partitionBlocks, data.data() + sizeof(uint64_t), sizeof(uint64_t));
+
+	return geometry.IsValid() ? 0 : ERROR_CODE;
+}
+
+void LocalBackupStorage::UploadChunkDataAsync(const chunk_id& chunkId, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize)
+{
+	if (PutObjectData(GetChunkObjectKey(chunkId), bufferOffset, bufferSize) != 0)
+	{
+		m_failedUploads++;
+	}
+
+	m_uploadSlots.enqueue(bufferOffsetIndex);
+}
+
+int LocalBackupStorage::GetChunkData(const chunk_id& chunkId, char* buffer)
+{
+	string data;
+
+	if (GetObjectData(GetChunkObjectKey(chunkId), data) != 0)
+	{
+		cout << "Error: chunk not found: " << chunk_id_hex(chunkId) << endl;
+		return 0;
+	}
+
+	memcpy(buffer, data.data(), data.size());
+
+	return (int)data.size();
+}
+
+int LocalBackupStorage::UploadChunkIndexSegment(string backupId, const vector<chunk_id>& chunkIds)
+{
+	string data = SerializeChunkIndexSegment(chunkIds);
+
+	return PutObjectData(GetChunkIndexSegmentKey(backupId), data.data(), data.size());
+}
+
+int LocalBackupStorage::GetChunkIndex(ChunkIndex& index)
+{
+	vector<pair<string, string>> segments;
+
+	if (ListChunkIndexSegments(segments) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	for (const pair<string, string>& segment : segments)
+	{
+		vector<chunk_id> chunkIds;
+
+		//a chunk missing from the index is only uploaded again, never lost
+		if (GetChunkIndexSegment(segment.first, segment.second, chunkIds) != 0)
+		{
+			cout << "Error: chunk index segment is missing or corrupt: " << segment.first << "-" << segment.second << endl;
+			continue;
+		}
+
+		index.Reserve(index.Size() + chunkIds.size());
+
+		for (const chunk_id& chunkId : chunkIds)
+		{
+			index.Insert(chunkId);
+		}
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadPageIndexSegment(string backupId, const vector<page_index_entry>& pages, const vector<page_source_reference>& references)
+{
+	string data = SerializePageIndexSegment(pages, references);
+
+	return PutObjectData(GetBackupPrefix(backupId) + "metadata/pages", data.data(), data.size());
+}
+
+int LocalBackupStorage::GetPageIndexSegment(string backupId, vector<page_index_entry>& pages, vector<page_source_reference>& references)
+{
+	string data;
+
+	if (GetObjectData(GetBackupPrefix(backupId) + "metadata/pages", data) != 0 || !DeserializePageIndexSegment(data.data(), data.size(), pages, references))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+void LocalBackupStorage::CopyBackupBlockDataAsync(string sourceBackupId, string backupId, UINT64 partId, UINT64 partIndex, string key)
+{
+	string data;
+
+	if (GetObjectData(GetBlockObjectKey(sourceBackupId, partId, partIndex), data) != 0)
+	{
+		cout << "Error: block object not found, backup: " << sourceBackupId << ", partition: " << partId + 1 << ", object: " << partIndex + 1 << endl;
+		m_failedUploads++;
+		return;
+	}
+
+	if (PutObjectData(GetBlockObjectKey(backupId, partId, partIndex), data.data(), data.size()) != 0)
+	{
+		m_failedUploads++;
+	}
+}
+
+int LocalBackupStorage::UploadSyntheticFullBackups(const vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string data = SerializeSyntheticFulls(syntheticFulls);
+
+	return PutObjectData(m_volumeId + "/metadata/syntheticfulls", data.data(), data.size());
+}
+
+int LocalBackupStorage::GetSyntheticFullBackups(vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string data;
+
+	syntheticFulls.clear();
+
+	//volumes without synthetic full backups have no list
+	if (GetObjectData(m_volumeId + "/metadata/syntheticfulls", data) != 0)
+	{
+		return 0;
+	}
+
+	if (!DeserializeSyntheticFulls(data.data(), data.size(), syntheticFulls))
+	{
+		cout << "Error: synthetic full backup list is corrupt" << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::GetBackupCompletedTime(string backupId, time_t& completedTime)
+{
+	error_code error;
+	fs::file_time_type written = fs::last_write_time(GetObjectPath(GetBackupPrefix(backupId) + "metadata/metadata"), error);
+
+	if (error)
+	{
+		cout << "Error: backup metadata not found, backup: " << backupId << endl;
+		return ERROR_CODE;
+	}
+
+	//the file clock has no portable epoch before C++20, both clocks are read now to translate
+	auto systemTime = chrono::system_clock::now() + chrono::duration_cast<chrono::system_clock::duration>(written - fs::file_time_type::clock::now());
+	completedTime = chrono::system_clock::to_time_t(systemTime);
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadRecompressedBackups(const vector<RecompressedBackupInfo>& backups)
+{
+	string data = SerializeRecompressedBackups(backups);
+
+	return PutObjectData(m_volumeId + "/metadata/recompressed", data.data(), data.size());
+}
+
+int LocalBackupStorage::GetRecompressedBackups(vector<RecompressedBackupInfo>& backups)
+{
+	string data;
+
+	backups.clear();
+
+	//volumes never recompressed have no list
+	if (GetObjectData(m_volumeId + "/metadata/recompressed", data) != 0)
+	{
+		return 0;
+	}
+
+	if (!DeserializeRecompressedBackups(data.data(), data.size(), backups))
+	{
+		cout << "Error: recompressed backup list is corrupt" << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadMerkleTreeRoot(string backupId, const MerkleTreeRoot& root)
+{
+	string data = SerializeMerkleTreeRoot(root);
+
+	return PutObjectData(GetBackupPrefix(backupId) + "metadata/merkle", data.data(), data.size());
+}
+
+int LocalBackupStorage::GetMerkleTreeRoot(string backupId, MerkleTreeRoot& root)
+{
+	string data;
+
+	if (GetObjectData(GetBackupPrefix(backupId) + "metadata/merkle", data) != 0 || !DeserializeMerkleTreeRoot(data.data(), data.size(), root))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadMerkleTreeLeaves(string backupId, UINT64 partId, const vector<uint64_t>& leaves)
+{
+	string data = SerializeMerkleTreeLeaves(leaves);
+
+	return PutObjectData(GetBackupPrefix(backupId) + "metadata/merkleleaves/" + to_string(partId + 1), data.data(), data.size());
+}
+
+int LocalBackupStorage::GetMerkleTreeLeaves(string backupId, UINT64 partId, vector<uint64_t>& leaves)
+{
+	string data;
+
+	if (GetObjectData(GetBackupPrefix(backupId) + "metadata/merkleleaves/" + to_string(partId + 1), data) != 0 ||
+		!DeserializeMerkleTreeLeaves(data.data(), data.size(), leaves))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::ListBackupObjectKeys(string backupId, vector<string>& keys)
+{
+	return ListObjectKeys(GetBackupPrefix(backupId), keys);
+}
+
+int LocalBackupStorage::HasPageIndexSegment(string backupId, bool& exists)
+{
+	error_code error;
+
+	exists = fs::exists(GetObjectPath(GetBackupPrefix(backupId) + "metadata/pages"), error);
+
+	return error ? ERROR_CODE : 0;
+}
+
+string LocalBackupStorage::GetBlockObjectKey(string backupId, UINT64 partId, UINT64 partIndex)
+{
+	return GetBackupPrefix(backupId) + "blockdata/" + to_string(partId + 1) + "/" + to_string(partIndex + 1);
+}
+
+string LocalBackupStorage::GetChunkObjectKey(const chunk_id& chunkId)
+{
+	return "chunks/" + chunk_id_hex(chunkId);
+}
+
+string LocalBackupStorage::GetChunkIndexSegmentKey(string backupId)
+{
+	return "chunkindex/" + m_volumeId + "-" + backupId;
+}
+
+int LocalBackupStorage::DeleteObjects(const vector<string>& keys)
+{
+	for (const string& key : keys)
+	{
+		error_code error;
+
+		//a missing file is an object already deleted
+		fs::remove(GetObjectPath(key), error);
+
+		if (error)
+		{
+			cout << "Error: object could not be deleted: " << key << " - " << error.message() << endl;
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::ListChunkIndexSegments(vector<pair<string, string>>& segments)
+{
+	vector<string> keys;
+	string prefix = "chunkindex/";
+
+	if (ListObjectKeys(prefix, keys) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//segments are named <volume id>-<backup id>, volume ids may contain dashes themselves
+	for (const string& key : keys)
+	{
+		if (key.size() > prefix.size() + BACKUP_UUID_SIZE + 1)
+		{
+			size_t volumeLength = key.size() - prefix.size() - BACKUP_UUID_SIZE - 1;
+			segments.push_back(make_pair(key.substr(prefix.size(), volumeLength), key.substr(key.size() - BACKUP_UUID_SIZE)));
+		}
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::GetChunkIndexSegment(string volumeId, string backupId, vector<chunk_id>& chunkIds)
+{
+	string data;
+
+	if (GetObjectData("chunkindex/" + volumeId + "-" + backupId, data) != 0 || !DeserializeChunkIndexSegment(data.data(), data.size(), chunkIds))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int LocalBackupStorage::UploadCollectorObject(string name, const string& data)
+{
+	return PutObjectData(GetCollectorObjectKey(name), data.data(), data.size());
+}
+
+int LocalBackupStorage::GetCollectorObject(string volumeId, string name, string& data)
+{
+	return GetObjectData(volumeId + "/gc/" + name, data);
+}
+
+string LocalBackupStorage::GetCollectorObjectKey(string name)
+{
+	return m_volumeId + "/gc/" + name;
+}
+
+int LocalBackupStorage::UploadReplicationObject(string name, const string& data)
+{
+	return PutObjectData(m_volumeId + "/replication/" + name, data.data(), data.size());
+}
+
+int LocalBackupStorage::GetReplicationObject(string name, string& data)
+{
+	return GetObjectData(m_volumeId + "/replication/" + name, data);
+}
@@ -0,0 +1,148 @@
+#ifndef LOCALBACKUPSTORAGE_H
+#define LOCALBACKUPSTORAGE_H
+
+#include <set>
+#include <atomic>
+#include "core/thread_safe_queue.h"
+#include "BackupStorage.h"
+#include "MetaDataSerializer.h"
+
+using namespace std;
+
+//backup storage in a local directory, for replicas on attached disks or file shares and for testing.
+//Objects are files under <root>/<client id> named by the keys S3 uses, except that Merkle tree leaves
+//live under merkleleaves/ since a file cannot be a directory too. Backup metadata is written whole,
+//uploads complete before the call returns and keys are not applied, the directory is not encrypted.
+class LocalBackupStorage : public BackupStorage
+{
+public:
+	LocalBackupStorage(string clientId, string volumeId, string rootPath);
+
+	LocalBackupStorage() = delete;
+	LocalBackupStorage(const LocalBackupStorage&) = delete;
+	LocalBackupStorage& operator =(const LocalBackupStorage&) = delete;
+
+	int GetFreeBufferOffsetIndex() override;
+
+	void UploadBackupSectorDataAsync(string backupId, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) override;
+
+	int WaitForAllUploadTasksToComplete() override;
+
+	int GetPendingUploadCount() override;
+
+	int UploadBackupMetaData(string backupId, BackupMetaData &metadata) override;
+
+	VolumeMetaData GetVolumeMetaData(string volumeId) override;
+
+	int UploadVolumeMetaData(const VolumeMetaData& metadata) override;
+
+	BackupMetaData GetBackupMetaData(string backupId) override;
+
+	BackupMetaData GetBackupMetaData(string backupId, const vector<UINT64>& partIds) override;
+
+	int GetBackupMetaData(string backupId, BackupMetaData& metadata) override;
+
+	int GetBackupMetaData(string backupId, const vector<UINT64>& partIds, BackupMetaData& metadata) override;
+
+	int GetBackupChunkTable(string backupId, const vector<UINT64>& partIds, BlockChunkTable& chunks, BlockChunkListTable& chunkLists) override;
+
+	int GetBackupChunkPartitions(string backupId, vector<UINT64>& partIds) override;
+
+	void UploadRestoreTaskMetaData(const RestoreTaskMetaData &metadata) override;
+
+	RestoreTaskMetaData GetRestoreTaskMetaData(string restoreId) override;
+
+	int GetBackupBlockData(string backupId, UINT64 partId, string key, const vector<UINT64>& indices, char* buffer) override;
+
+	int ListObjects(string backupId, UINT64 partId, vector<UINT64>& objects) override;
+
+	int UploadVolumeDictionary(uint32_t dictionaryId, const string& dictionary) override;
+
+	int GetVolumeDictionary(uint32_t& dictionaryId, string& dictionary) override;
+
+	int UploadVolumeGeometry(const VolumeGeometry& geometry) override;
+
+	int GetVolumeGeometry(VolumeGeometry& geometry) override;
+
+	void UploadChunkDataAsync(const chunk_id& chunkId, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) override;
+
+	int GetChunkData(const chunk_id& chunkId, char* buffer) override;
+
+	int UploadChunkIndexSegment(string backupId, const vector<chunk_id>& chunkIds) override;
+
+	int GetChunkIndex(ChunkIndex& index) override;
+
+	int UploadPageIndexSegment(string backupId, const vector<page_index_entry>& pages, const vector<page_source_reference>& references) override;
+
+	int GetPageIndexSegment(string backupId, vector<page_index_entry>& pages, vector<page_source_reference>& references) override;
+
+	void CopyBackupBlockDataAsync(string sourceBackupId, string backupId, UINT64 partId, UINT64 partIndex, string key) override;
+
+	int UploadSyntheticFullBackups(const vector<SyntheticFullInfo>& syntheticFulls) override;
+
+	int GetSyntheticFullBackups(vector<SyntheticFullInfo>& syntheticFulls) override;
+
+	int GetBackupCompletedTime(string backupId, time_t& completedTime) override;
+
+	int UploadRecompressedBackups(const vector<RecompressedBackupInfo>& backups) override;
+
+	int GetRecompressedBackups(vector<RecompressedBackupInfo>& backups) override;
+
+	int UploadMerkleTreeRoot(string backupId, const MerkleTreeRoot& root) override;
+
+	int GetMerkleTreeRoot(string backupId, MerkleTreeRoot& root) override;
+
+	int UploadMerkleTreeLeaves(string backupId, UINT64 partId, const vector<uint64_t>& leaves) override;
+
+	int GetMerkleTreeLeaves(string backupId, UINT64 partId, vector<uint64_t>& leaves) override;
+
+	int ListBackupObjectKeys(string backupId, vector<string>& keys) override;
+
+	int HasPageIndexSegment(string backupId, bool& exists) override;
+
+	string GetBlockObjectKey(string backupId, UINT64 partId, UINT64 partIndex) override;
+
+	string GetChunkObjectKey(const chunk_id& chunkId) override;
+
+	string GetChunkIndexSegmentKey(string backupId) override;
+
+	int DeleteObjects(const vector<string>& keys) override;
+
+	int ListChunkIndexSegments(vector<pair<string, string>>& segments) override;
+
+	int GetChunkIndexSegment(string volumeId, string backupId, vector<chunk_id>& chunkIds) override;
+
+	int UploadCollectorObject(string name, const string& data) override;
+
+	int GetCollectorObject(string volumeId, string name, string& data) override;
+
+	string GetCollectorObjectKey(string name) override;
+
+	int UploadReplicationObject(string name, const string& data) override;
+
+	int GetReplicationObject(string name, string& data) override;
+
+private:
+	//keys are relative to the client directory like the keys of S3BackupStorage
+	string GetObjectPath(const string& key) const;
+	string GetBackupPrefix(string backupId) const;
+
+	//objects are written to a temporary file first and renamed over the old one, readers see either version
+	int PutObjectData(const string& key, const char* data, size_t size);
+	int GetObjectData(const string& key, string& data);
+
+	//keys of every object below the prefix, which names a directory
+	int ListObjectKeys(const string& prefix, vector<string>& keys);
+
+	int LoadBackupMetaData(string backupId, const vector<UINT64>* partIds, BackupMetaData& metadata);
+
+	string m_rootPath;
+
+	//slots only bound the buffers callers fill, every upload is written before it returns its slot
+	SafeQueue<int> m_uploadSlots;
+
+	//uploads and copies that failed since the last wait
+	atomic_int m_failedUploads;
+};
+
+#endif
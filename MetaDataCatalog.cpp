@@ -0,0 +1,139 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <set>
+#include "MetaDataCatalog.h"
+#include "MetaDataSerializer.h"
+
+namespace fs = std::filesystem;
+
+MetaDataCatalog::MetaDataCatalog(string path, string clientId, string volumeId)
+{
+	if (!path.empty())
+	{
+		m_clientPath = (fs::path(path) / clientId).string();
+		m_path = (fs::path(m_clientPath) / volumeId).string();
+	}
+}
+
+string MetaDataCatalog::GetEntryPath(const string& key) const
+{
+	//keys name both objects and prefixes of other objects, entries must not collide with directories
+	return (fs::path(m_path) / key).string() + ".entry";
+}
+
+int MetaDataCatalog::Get(const string& key, string& data, string& etag) const
+{
+	if (!Enabled())
+	{
+		return ERROR_CODE;
+	}
+
+	ifstream file(GetEntryPath(key), ios::binary);
+
+	if (!file)
+	{
+		return ERROR_CODE;
+	}
+
+	string entry((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	if (file.bad() || !DeserializeCatalogEntry(entry.data(), entry.size(), etag, data))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int MetaDataCatalog::Put(const string& key, const string& data, const string& etag)
+{
+	if (!Enabled())
+	{
+		return ERROR_CODE;
+	}
+
+	fs::path path = GetEntryPath(key);
+	error_code error;
+
+	//writers of the same entry in other threads or jobs each rename their own file over it
+	fs::path partial = path.string() + "." + to_string(random_device()()) + ".part";
+	string entry = SerializeCatalogEntry(etag, data);
+
+	//entries name the backups of the client and their layout, only the owner of the catalog reads them.
+	//The directory of the client is the catalog's own, the path given may be shared with others.
+	fs::create_directories(m_clientPath, error);
+	fs::permissions(m_clientPath, fs::perms::owner_all, fs::perm_options::replace, error);
+
+	fs::create_directories(path.parent_path(), error);
+
+	{
+		ofstream file(partial, ios::binary | ios::trunc);
+
+		if (!file.write(entry.data(), entry.size()))
+		{
+			file.close();
+			fs::remove(partial, error);
+
+			return ERROR_CODE;
+		}
+	}
+
+	fs::rename(partial, path, error);
+
+	if (error)
+	{
+		fs::remove(partial, error);
+
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+void MetaDataCatalog::Remove(const string& key)
+{
+	if (Enabled())
+	{
+		error_code error;
+		fs::remove(GetEntryPath(key), error);
+	}
+}
+
+void MetaDataCatalog::RemoveBackup(string backupId)
+{
+	if (Enabled())
+	{
+		error_code error;
+		fs::remove_all(fs::path(m_path) / "backups" / backupId, error);
+	}
+}
+
+void MetaDataCatalog::Prune(const VolumeMetaData& volume)
+{
+	fs::path backups = fs::path(m_path) / "backups";
+	error_code error;
+
+	if (!Enabled() || !fs::exists(backups, error))
+	{
+		return;
+	}
+
+	set<string> listed(volume.backupIds.begin(), volume.backupIds.end());
+	vector<fs::path> unlisted;
+
+	for (fs::directory_iterator iter(backups, error), end; !error && iter != end; iter.increment(error))
+	{
+		if (listed.count(iter->path().filename().string()) == 0)
+		{
+			unlisted.push_back(iter->path());
+		}
+	}
+
+	//entries other jobs hold open are left for the next prune
+	for (const fs::path& path : unlisted)
+	{
+		fs::remove_all(path, error);
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef METADATACATALOG_H
+#define METADATACATALOG_H
+
+#include "CommonTypes.h"
+
+using namespace std;
+
+//copies of the metadata objects of a volume on the proxy, so jobs plan from local files and read only
+//what changed since the last job. Entries are files under <path>/<client id>/<volume id> named by the
+//object key within the volume, each holding the object as stored and the entity tag it had when read.
+//Entries are replaced whole, jobs of the volume running side by side on the proxy read either version.
+//Objects that carry an encryption key are not cached, the directory of the client is readable by its owner only.
+class MetaDataCatalog
+{
+public:
+	//an empty path disables the catalog, every lookup misses
+	MetaDataCatalog(string path, string clientId, string volumeId);
+
+	MetaDataCatalog(const MetaDataCatalog&) = delete;
+	MetaDataCatalog& operator = (const MetaDataCatalog&) = delete;
+
+	bool Enabled() const { return !m_path.empty(); }
+
+	//entries that cannot be read or fail their checksum are missing
+	int Get(const string& key, string& data, string& etag) const;
+
+	int Put(const string& key, const string& data, const string& etag);
+
+	void Remove(const string& key);
+
+	//drops the entries of a backup, whose objects changed or were deleted
+	void RemoveBackup(string backupId);
+
+	//drops the entries of backups the volume no longer lists
+	void Prune(const VolumeMetaData& volume);
+
+private:
+	string GetEntryPath(const string& key) const;
+
+	string m_clientPath;
+	string m_path;
+};
+
+#endif
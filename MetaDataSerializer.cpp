@@ -0,0 +1,936 @@
+#include "MetaDataSerializer.h"
+#include "core/metadata_format.h"
+#include "core/hash.h"
+
+//section ids of the backup metadata body, never renumber them
+const uint32_t BackupInfoSection = 1;
+const uint32_t BlockKeysSection = 2;
+const uint32_t BlockHashesSection = 3;
+const uint32_t EmptyBlocksSection = 4;
+const uint32_t ShardIndexSection = 5;
+const uint32_t GeometrySection = 6;
+const uint32_t EmptyBlockIdsSection = 7;
+const uint32_t ChunkKeysSection = 8;
+const uint32_t ChunkIdsSection = 9;
+const uint32_t ChunkShardIndexSection = 10;
+const uint32_t ChunkListKeysSection = 11;
+const uint32_t ChunkListEndsSection = 12;
+const uint32_t ChunkListIdsSection = 13;
+const uint32_t ChunkListShardIndexSection = 14;
+const uint32_t PageIndexSection = 15;
+const uint32_t SyntheticFullsSection = 16;
+const uint32_t PageReferencesSection = 17;
+const uint32_t CollectorStateSection = 18;
+const uint32_t PinnedBackupsSection = 19;
+const uint32_t KeyListSection = 20;
+const uint32_t RecompressedBackupsSection = 21;
+const uint32_t MerkleTreeSection = 22;
+const uint32_t MerklePartitionHashesSection = 23;
+const uint32_t MerklePartitionOwnersSection = 24;
+const uint32_t MerkleLeavesSection = 25;
+const uint32_t ReplicationStateSection = 26;
+const uint32_t ReplicatedBackupsSection = 27;
+const uint32_t ReplicatedPageSourcesSection = 28;
+const uint32_t ReplicatedDictionariesSection = 29;
+const uint32_t StandbyStateSection = 30;
+const uint32_t StandbyApplyingSection = 31;
+const uint32_t CatalogEntrySection = 32;
+const uint32_t CatalogDataSection = 33;
+const uint32_t RetiredBackupsSection = 34;
+
+template <typename T>
+bool ReadArraySection(const string& body, uint32_t id, vector<T>& values)
+{
+	const char* data = NULL;
+	size_t length = 0;
+
+	if (!find_metadata_section(body, id, data, length))
+	{
+		values.clear();
+		return true;
+	}
+
+	if (length % sizeof(T) != 0)
+	{
+		return false;
+	}
+
+	values.resize(length / sizeof(T));
+
+	if (length > 0)
+	{
+		memcpy(values.data(), data, length);
+	}
+
+	return true;
+}
+
+string SerializeBackupInfo(const BackupMetaData& metadata)
+{
+	string info;
+	uint32_t status = (uint32_t)metadata.status;
+	uint32_t keyLength = (uint32_t)metadata.encryptionKey.length();
+
+	info.append((const char*)&status, sizeof(uint32_t));
+	info.append((const char*)&keyLength, sizeof(uint32_t));
+	info.append(metadata.encryptionKey);
+
+	return info;
+}
+
+//geometry and empty block ids, written by the monolithic and the sharded layouts alike
+void AppendVolumeSections(string& body, const BackupMetaData& metadata)
+{
+	uint64_t geometry[2] = { metadata.geometry.blockSize, metadata.geometry.partitionBlocks };
+
+	append_metadata_section(body, GeometrySection, geometry, sizeof(geometry));
+	append_metadata_section(body, EmptyBlockIdsSection, metadata.emptyBlocks.data(), metadata.emptyBlocks.size() * sizeof(uint64_t));
+}
+
+void AppendBlockHashSections(string& body, const BlockHashTable& hashes)
+{
+	append_metadata_section(body, BlockKeysSection, hashes.keys.data(), hashes.keys.size() * sizeof(uint64_t));
+	append_metadata_section(body, BlockHashesSection, hashes.values.data(), hashes.values.size() * sizeof(uint64_t));
+}
+
+void AppendBlockChunkSections(string& body, const BlockChunkTable& chunks)
+{
+	append_metadata_section(body, ChunkKeysSection, chunks.keys.data(), chunks.keys.size() * sizeof(uint64_t));
+	append_metadata_section(body, ChunkIdsSection, chunks.values.data(), chunks.values.size() * sizeof(chunk_id));
+}
+
+void AppendBlockChunkListSections(string& body, const BlockChunkListTable& chunkLists)
+{
+	append_metadata_section(body, ChunkListKeysSection, chunkLists.keys.data(), chunkLists.keys.size() * sizeof(uint64_t));
+	append_metadata_section(body, ChunkListEndsSection, chunkLists.ends.data(), chunkLists.ends.size() * sizeof(uint64_t));
+	append_metadata_section(body, ChunkListIdsSection, chunkLists.chunks.data(), chunkLists.chunks.size() * sizeof(chunk_id));
+}
+
+bool ReadBlockChunkListSections(const string& body, BlockChunkListTable& chunkLists)
+{
+	return ReadArraySection(body, ChunkListKeysSection, chunkLists.keys) &&
+		   ReadArraySection(body, ChunkListEndsSection, chunkLists.ends) &&
+		   ReadArraySection(body, ChunkListIdsSection, chunkLists.chunks) &&
+		   chunkLists.IsValid();
+}
+
+string SerializeBackupMetaData(const BackupMetaData& metadata)
+{
+	string info = SerializeBackupInfo(metadata);
+
+	string body;
+	append_metadata_section(body, BackupInfoSection, info.data(), info.size());
+	AppendBlockHashSections(body, metadata.blockHashTable);
+	AppendVolumeSections(body, metadata);
+
+	if (metadata.chunkTable.Size() > 0)
+	{
+		AppendBlockChunkSections(body, metadata.chunkTable);
+	}
+
+	if (metadata.chunkListTable.Size() > 0)
+	{
+		AppendBlockChunkListSections(body, metadata.chunkListTable);
+	}
+
+	return seal_metadata(body);
+}
+
+string SerializeBackupMetaDataRoot(const BackupMetaData& metadata, const MetaDataShardIndex& shards)
+{
+	string info = SerializeBackupInfo(metadata);
+
+	string body;
+	append_metadata_section(body, BackupInfoSection, info.data(), info.size());
+	AppendVolumeSections(body, metadata);
+	append_metadata_section(body, ShardIndexSection, shards.hashes.data(), shards.hashes.size() * sizeof(MetaDataShardInfo));
+
+	if (!shards.chunks.empty())
+	{
+		append_metadata_section(body, ChunkShardIndexSection, shards.chunks.data(), shards.chunks.size() * sizeof(MetaDataShardInfo));
+	}
+
+	if (!shards.chunkLists.empty())
+	{
+		append_metadata_section(body, ChunkListShardIndexSection, shards.chunkLists.data(), shards.chunkLists.size() * sizeof(MetaDataShardInfo));
+	}
+
+	return seal_metadata(body);
+}
+
+string SerializeBlockHashShard(const BlockHashTable& hashes)
+{
+	string body;
+	AppendBlockHashSections(body, hashes);
+
+	return seal_metadata(body);
+}
+
+bool DeserializeBlockHashShard(const char* data, size_t size, BlockHashTable& hashes)
+{
+	string body;
+
+	if (!open_metadata(data, size, body) ||
+		!ReadArraySection(body, BlockKeysSection, hashes.keys) ||
+		!ReadArraySection(body, BlockHashesSection, hashes.values))
+	{
+		return false;
+	}
+
+	return hashes.keys.size() == hashes.values.size();
+}
+
+uint64_t GetBlockHashShardHash(const BlockHashTable& hashes)
+{
+	uint64_t keysHash = xxhash64(hashes.keys.data(), hashes.keys.size() * sizeof(uint64_t));
+
+	return xxhash64(hashes.values.data(), hashes.values.size() * sizeof(uint64_t), keysHash);
+}
+
+string SerializeBlockChunkShard(const BlockChunkTable& chunks)
+{
+	string body;
+	AppendBlockChunkSections(body, chunks);
+
+	return seal_metadata(body);
+}
+
+bool DeserializeBlockChunkShard(const char* data, size_t size, BlockChunkTable& chunks)
+{
+	string body;
+
+	if (!open_metadata(data, size, body) ||
+		!ReadArraySection(body, ChunkKeysSection, chunks.keys) ||
+		!ReadArraySection(body, ChunkIdsSection, chunks.values))
+	{
+		return false;
+	}
+
+	return chunks.keys.size() == chunks.values.size();
+}
+
+uint64_t GetBlockChunkShardHash(const BlockChunkTable& chunks)
+{
+	uint64_t keysHash = xxhash64(chunks.keys.data(), chunks.keys.size() * sizeof(uint64_t));
+
+	return xxhash64(chunks.values.data(), chunks.values.size() * sizeof(chunk_id), keysHash);
+}
+
+string SerializeBlockChunkListShard(const BlockChunkListTable& chunkLists)
+{
+	string body;
+	AppendBlockChunkListSections(body, chunkLists);
+
+	return seal_metadata(body);
+}
+
+bool DeserializeBlockChunkListShard(const char* data, size_t size, BlockChunkListTable& chunkLists)
+{
+	string body;
+
+	return open_metadata(data, size, body) && ReadBlockChunkListSections(body, chunkLists);
+}
+
+uint64_t GetBlockChunkListShardHash(const BlockChunkListTable& chunkLists)
+{
+	uint64_t keysHash = xxhash64(chunkLists.keys.data(), chunkLists.keys.size() * sizeof(uint64_t));
+	uint64_t endsHash = xxhash64(chunkLists.ends.data(), chunkLists.ends.size() * sizeof(uint64_t), keysHash);
+
+	return xxhash64(chunkLists.chunks.data(), chunkLists.chunks.size() * sizeof(chunk_id), endsHash);
+}
+
+void SplitBlockTable(const BlockChunkListTable& chunkLists, const VolumeGeometry& geometry, map<uint64_t, BlockChunkListTable>& shards)
+{
+	for (size_t i = 0; i < chunkLists.keys.size(); i++)
+	{
+		uint64_t begin = i > 0 ? chunkLists.ends[i - 1] : 0;
+
+		shards[geometry.PartitionOf(chunkLists.keys[i])].Append(chunkLists.keys[i], chunkLists.chunks.data() + begin, (size_t)(chunkLists.ends[i] - begin));
+	}
+}
+
+string SerializeChunkIndexSegment(const vector<chunk_id>& chunkIds)
+{
+	string body;
+	append_metadata_section(body, ChunkIdsSection, chunkIds.data(), chunkIds.size() * sizeof(chunk_id));
+
+	return seal_metadata(body);
+}
+
+bool DeserializeChunkIndexSegment(const char* data, size_t size, vector<chunk_id>& chunkIds)
+{
+	string body;
+
+	return open_metadata(data, size, body) && ReadArraySection(body, ChunkIdsSection, chunkIds);
+}
+
+string SerializePageIndexSegment(const vector<page_index_entry>& pages, const vector<page_source_reference>& references)
+{
+	string body;
+	append_metadata_section(body, PageIndexSection, pages.data(), pages.size() * sizeof(page_index_entry));
+	append_metadata_section(body, PageReferencesSection, references.data(), references.size() * sizeof(page_source_reference));
+
+	return seal_metadata(body);
+}
+
+bool DeserializePageIndexSegment(const char* data, size_t size, vector<page_index_entry>& pages, vector<page_source_reference>& references)
+{
+	string body;
+
+	return open_metadata(data, size, body) && ReadArraySection(body, PageIndexSection, pages) && ReadArraySection(body, PageReferencesSection, references);
+}
+
+void AppendString(string& out, const string& value)
+{
+	uint32_t length = (uint32_t)value.length();
+
+	out.append((const char*)&length, sizeof(uint32_t));
+	out.append(value);
+}
+
+bool ReadString(const char* data, size_t size, size_t& pos, string& value)
+{
+	uint32_t length = 0;
+
+	if (size - pos < sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	memcpy(&length, data + pos, sizeof(uint32_t));
+	pos += sizeof(uint32_t);
+
+	if (size - pos < length)
+	{
+		return false;
+	}
+
+	value.assign(data + pos, length);
+	pos += length;
+
+	return true;
+}
+
+//strings of a list section, false when the section is corrupt, true with no strings when it is missing
+bool ReadStringSection(const string& body, uint32_t id, vector<string>& values)
+{
+	const char* list = NULL;
+	size_t length = 0;
+
+	values.clear();
+
+	if (!find_metadata_section(body, id, list, length))
+	{
+		return true;
+	}
+
+	for (size_t pos = 0; pos < length;)
+	{
+		string value;
+
+		if (!ReadString(list, length, pos, value))
+		{
+			values.clear();
+			return false;
+		}
+
+		values.push_back(value);
+	}
+
+	return true;
+}
+
+string SerializeSyntheticFulls(const vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string list;
+
+	for (const SyntheticFullInfo& info : syntheticFulls)
+	{
+		uint32_t complete = info.complete ? 1 : 0;
+		uint32_t merged = (uint32_t)info.mergedBackupIds.size();
+
+		AppendString(list, info.backupId);
+		AppendString(list, info.sourceBackupId);
+		list.append((const char*)&complete, sizeof(uint32_t));
+		list.append((const char*)&merged, sizeof(uint32_t));
+
+		for (const string& backupId : info.mergedBackupIds)
+		{
+			AppendString(list, backupId);
+		}
+	}
+
+	string body;
+	append_metadata_section(body, SyntheticFullsSection, list.data(), list.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeSyntheticFulls(const char* data, size_t size, vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string body;
+	const char* list = NULL;
+	size_t length = 0;
+
+	syntheticFulls.clear();
+
+	if (!open_metadata(data, size, body))
+	{
+		return false;
+	}
+
+	if (!find_metadata_section(body, SyntheticFullsSection, list, length))
+	{
+		return true;
+	}
+
+	for (size_t pos = 0; pos < length;)
+	{
+		SyntheticFullInfo info;
+		uint32_t complete = 0;
+		uint32_t merged = 0;
+
+		if (!ReadString(list, length, pos, info.backupId) || !ReadString(list, length, pos, info.sourceBackupId) || length - pos < 2 * sizeof(uint32_t))
+		{
+			syntheticFulls.clear();
+			return false;
+		}
+
+		memcpy(&complete, list + pos, sizeof(uint32_t));
+		memcpy(&merged, list + pos + sizeof(uint32_t), sizeof(uint32_t));
+		pos += 2 * sizeof(uint32_t);
+
+		info.complete = complete != 0;
+		info.mergedBackupIds.resize(merged);
+
+		for (uint32_t i = 0; i < merged; i++)
+		{
+			if (!ReadString(list, length, pos, info.mergedBackupIds[i]))
+			{
+				syntheticFulls.clear();
+				return false;
+			}
+		}
+
+		syntheticFulls.push_back(info);
+	}
+
+	return true;
+}
+
+string SerializeRecompressedBackups(const vector<RecompressedBackupInfo>& backups)
+{
+	string list;
+
+	for (const RecompressedBackupInfo& info : backups)
+	{
+		int32_t level = info.level;
+
+		AppendString(list, info.backupId);
+		AppendString(list, info.codec);
+		list.append((const char*)&level, sizeof(int32_t));
+	}
+
+	string body;
+	append_metadata_section(body, RecompressedBackupsSection, list.data(), list.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeRecompressedBackups(const char* data, size_t size, vector<RecompressedBackupInfo>& backups)
+{
+	string body;
+	const char* list = NULL;
+	size_t length = 0;
+
+	backups.clear();
+
+	if (!open_metadata(data, size, body))
+	{
+		return false;
+	}
+
+	if (!find_metadata_section(body, RecompressedBackupsSection, list, length))
+	{
+		return true;
+	}
+
+	for (size_t pos = 0; pos < length;)
+	{
+		RecompressedBackupInfo info;
+		int32_t level = 0;
+
+		if (!ReadString(list, length, pos, info.backupId) || !ReadString(list, length, pos, info.codec) || length - pos < sizeof(int32_t))
+		{
+			backups.clear();
+			return false;
+		}
+
+		memcpy(&level, list + pos, sizeof(int32_t));
+		pos += sizeof(int32_t);
+
+		info.level = level;
+		backups.push_back(info);
+	}
+
+	return true;
+}
+
+string SerializeMerkleTreeRoot(const MerkleTreeRoot& root)
+{
+	uint64_t shape[3] = { root.blockSize, root.partitionBlocks, root.blocks };
+	string owners;
+
+	for (const string& owner : root.partitionOwners)
+	{
+		AppendString(owners, owner);
+	}
+
+	string body;
+	append_metadata_section(body, MerkleTreeSection, shape, sizeof(shape));
+	append_metadata_section(body, MerklePartitionHashesSection, root.partitionHashes.data(), root.partitionHashes.size() * sizeof(uint64_t));
+	append_metadata_section(body, MerklePartitionOwnersSection, owners.data(), owners.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeMerkleTreeRoot(const char* data, size_t size, MerkleTreeRoot& root)
+{
+	string body;
+	vector<uint64_t> shape;
+	const char* owners = NULL;
+	size_t length = 0;
+
+	root.partitionOwners.clear();
+
+	if (!open_metadata(data, size, body) || !ReadArraySection(body, MerkleTreeSection, shape) || shape.size() < 3 ||
+		!ReadArraySection(body, MerklePartitionHashesSection, root.partitionHashes))
+	{
+		return false;
+	}
+
+	find_metadata_section(body, MerklePartitionOwnersSection, owners, length);
+
+	root.blockSize = shape[0];
+	root.partitionBlocks = shape[1];
+	root.blocks = shape[2];
+
+	for (size_t pos = 0; pos < length;)
+	{
+		string owner;
+
+		if (!ReadString(owners, length, pos, owner))
+		{
+			return false;
+		}
+
+		root.partitionOwners.push_back(owner);
+	}
+
+	return root.partitionOwners.size() == root.partitionHashes.size();
+}
+
+string SerializeMerkleTreeLeaves(const vector<uint64_t>& leaves)
+{
+	string body;
+	append_metadata_section(body, MerkleLeavesSection, leaves.data(), leaves.size() * sizeof(uint64_t));
+
+	return seal_metadata(body);
+}
+
+bool DeserializeMerkleTreeLeaves(const char* data, size_t size, vector<uint64_t>& leaves)
+{
+	string body;
+
+	return open_metadata(data, size, body) && ReadArraySection(body, MerkleLeavesSection, leaves);
+}
+
+string SerializeCollectorState(const CollectorState& state)
+{
+	uint64_t counters[7] = { state.generation, state.planParts, state.nextPlanPart, state.chunkReferenceParts, state.pendingChunkParts, state.publishedAt, state.pendingSince };
+	string pinned;
+	string retired;
+
+	for (const PinnedBackupInfo& info : state.pinnedBackups)
+	{
+		uint64_t geometry[2] = { info.geometry.blockSize, info.geometry.partitionBlocks };
+
+		AppendString(pinned, info.backupId);
+		pinned.append((const char*)geometry, sizeof(geometry));
+	}
+
+	for (const string& backupId : state.retiredBackupIds)
+	{
+		AppendString(retired, backupId);
+	}
+
+	string body;
+	append_metadata_section(body, CollectorStateSection, counters, sizeof(counters));
+	append_metadata_section(body, PinnedBackupsSection, pinned.data(), pinned.size());
+	append_metadata_section(body, RetiredBackupsSection, retired.data(), retired.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeCollectorState(const char* data, size_t size, CollectorState& state)
+{
+	string body;
+	vector<uint64_t> counters;
+	const char* pinned = NULL;
+	size_t length = 0;
+
+	state = CollectorState();
+
+	if (!open_metadata(data, size, body) || !ReadArraySection(body, CollectorStateSection, counters) || counters.size() < 7)
+	{
+		return false;
+	}
+
+	state.generation = counters[0];
+	state.planParts = counters[1];
+	state.nextPlanPart = counters[2];
+	state.chunkReferenceParts = counters[3];
+	state.pendingChunkParts = counters[4];
+	state.publishedAt = counters[5];
+	state.pendingSince = counters[6];
+
+	//states written before collected backups were remembered have no list
+	if (!ReadStringSection(body, RetiredBackupsSection, state.retiredBackupIds))
+	{
+		return false;
+	}
+
+	if (!find_metadata_section(body, PinnedBackupsSection, pinned, length))
+	{
+		return true;
+	}
+
+	for (size_t pos = 0; pos < length;)
+	{
+		PinnedBackupInfo info;
+		uint64_t geometry[2];
+
+		if (!ReadString(pinned, length, pos, info.backupId) || length - pos < sizeof(geometry))
+		{
+			return false;
+		}
+
+		memcpy(geometry, pinned + pos, sizeof(geometry));
+		pos += sizeof(geometry);
+
+		info.geometry.blockSize = geometry[0];
+		info.geometry.partitionBlocks = geometry[1];
+		state.pinnedBackups.push_back(info);
+	}
+
+	return true;
+}
+
+string SerializeReplicationState(const ReplicationState& state)
+{
+	string current;
+	string backups;
+	string sources;
+
+	AppendString(current, state.currentBackupId);
+	current.append((const char*)&state.nextPartId, sizeof(uint64_t));
+
+	for (const string& backupId : state.replicatedBackupIds)
+	{
+		AppendString(backups, backupId);
+	}
+
+	for (const string& block : state.pageSourceBlocks)
+	{
+		AppendString(sources, block);
+	}
+
+	string body;
+	append_metadata_section(body, ReplicationStateSection, current.data(), current.size());
+	append_metadata_section(body, ReplicatedBackupsSection, backups.data(), backups.size());
+	append_metadata_section(body, ReplicatedPageSourcesSection, sources.data(), sources.size());
+	append_metadata_section(body, ReplicatedDictionariesSection, state.dictionaryIds.data(), state.dictionaryIds.size() * sizeof(uint32_t));
+
+	return seal_metadata(body);
+}
+
+bool DeserializeReplicationState(const char* data, size_t size, ReplicationState& state)
+{
+	string body;
+	const char* current = NULL;
+	size_t length = 0;
+	size_t pos = 0;
+
+	state = ReplicationState();
+
+	if (!open_metadata(data, size, body) || !find_metadata_section(body, ReplicationStateSection, current, length) ||
+		!ReadString(current, length, pos, state.currentBackupId) || length - pos < sizeof(uint64_t))
+	{
+		return false;
+	}
+
+	memcpy(&state.nextPartId, current + pos, sizeof(uint64_t));
+
+	return ReadStringSection(body, ReplicatedBackupsSection, state.replicatedBackupIds) &&
+		   ReadStringSection(body, ReplicatedPageSourcesSection, state.pageSourceBlocks) &&
+		   ReadArraySection(body, ReplicatedDictionariesSection, state.dictionaryIds);
+}
+
+string SerializeStandbyState(const StandbyState& state)
+{
+	string fields;
+	string applying;
+
+	AppendString(fields, state.targetType);
+	AppendString(fields, state.targetPath);
+	AppendString(fields, state.currentBackupId);
+
+	for (const string& backupId : state.applyingBackupIds)
+	{
+		AppendString(applying, backupId);
+	}
+
+	string body;
+	append_metadata_section(body, StandbyStateSection, fields.data(), fields.size());
+	append_metadata_section(body, StandbyApplyingSection, applying.data(), applying.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeStandbyState(const char* data, size_t size, StandbyState& state)
+{
+	string body;
+	vector<string> fields;
+
+	state = StandbyState();
+
+	if (!open_metadata(data, size, body) || !ReadStringSection(body, StandbyStateSection, fields) || fields.size() != 3)
+	{
+		return false;
+	}
+
+	state.targetType = fields[0];
+	state.targetPath = fields[1];
+	state.currentBackupId = fields[2];
+
+	return ReadStringSection(body, StandbyApplyingSection, state.applyingBackupIds);
+}
+
+string SerializeCatalogEntry(const string& etag, const string& data)
+{
+	string tag;
+	AppendString(tag, etag);
+
+	string body;
+	append_metadata_section(body, CatalogEntrySection, tag.data(), tag.size());
+	append_metadata_section(body, CatalogDataSection, data.data(), data.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeCatalogEntry(const char* entry, size_t size, string& etag, string& data)
+{
+	string body;
+	const char* tag = NULL;
+	const char* content = NULL;
+	size_t tagLength = 0;
+	size_t length = 0;
+	size_t pos = 0;
+
+	if (!open_metadata(entry, size, body) || !find_metadata_section(body, CatalogEntrySection, tag, tagLength) ||
+		!ReadString(tag, tagLength, pos, etag) || !find_metadata_section(body, CatalogDataSection, content, length))
+	{
+		return false;
+	}
+
+	data.assign(content, length);
+
+	return true;
+}
+
+string SerializeKeyList(const vector<string>& keys)
+{
+	string list;
+
+	for (const string& key : keys)
+	{
+		AppendString(list, key);
+	}
+
+	string body;
+	append_metadata_section(body, KeyListSection, list.data(), list.size());
+
+	return seal_metadata(body);
+}
+
+bool DeserializeKeyList(const char* data, size_t size, vector<string>& keys)
+{
+	string body;
+	const char* list = NULL;
+	size_t length = 0;
+
+	keys.clear();
+
+	if (!open_metadata(data, size, body))
+	{
+		return false;
+	}
+
+	if (!find_metadata_section(body, KeyListSection, list, length))
+	{
+		return true;
+	}
+
+	for (size_t pos = 0; pos < length;)
+	{
+		string key;
+
+		if (!ReadString(list, length, pos, key))
+		{
+			keys.clear();
+			return false;
+		}
+
+		keys.push_back(key);
+	}
+
+	return true;
+}
+
+bool DeserializeLegacyBackupMetaData(const char* data, size_t size, BackupMetaData& metadata)
+{
+	uint32_t status = 0;
+	uint32_t num = 0;
+	uint32_t emptyBlocks = 0;
+	uint32_t encryptionKeyLength = 0;
+	size_t pos = 4 * sizeof(uint32_t);
+
+	if (size < pos)
+	{
+		return false;
+	}
+
+	memcpy(&status, data, sizeof(uint32_t));
+	memcpy(&num, data + sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(&emptyBlocks, data + 2 * sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(&encryptionKeyLength, data + 3 * sizeof(uint32_t), sizeof(uint32_t));
+
+	if (size - pos < encryptionKeyLength + (size_t)num * (sizeof(uint32_t) + sizeof(uint64_t)) + (size_t)emptyBlocks * sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	metadata.status = (BackupStatus)status;
+	metadata.encryptionKey = string(data + pos, encryptionKeyLength);
+	pos += encryptionKeyLength;
+
+	//entries were written from a map, so they are already sorted
+	metadata.blockHashTable.keys.resize(num);
+	metadata.blockHashTable.values.resize(num);
+
+	for (uint32_t i = 0; i < num; i++)
+	{
+		uint32_t key = 0;
+		memcpy(&key, data + pos, sizeof(uint32_t));
+		memcpy(&metadata.blockHashTable.values[i], data + pos + sizeof(uint32_t), sizeof(uint64_t));
+
+		metadata.blockHashTable.keys[i] = key;
+		pos += sizeof(uint32_t) + sizeof(uint64_t);
+	}
+
+	metadata.emptyBlocks.resize(emptyBlocks);
+
+	for (uint32_t i = 0; i < emptyBlocks; i++)
+	{
+		uint32_t blockId = 0;
+		memcpy(&blockId, data + pos + i * sizeof(uint32_t), sizeof(uint32_t));
+
+		metadata.emptyBlocks[i] = blockId;
+	}
+
+	metadata.geometry = VolumeGeometry();
+
+	return true;
+}
+
+bool DeserializeBackupMetaData(const char* data, size_t size, BackupMetaData& metadata)
+{
+	MetaDataShardIndex shards;
+
+	return DeserializeBackupMetaData(data, size, metadata, shards);
+}
+
+bool DeserializeBackupMetaData(const char* data, size_t size, BackupMetaData& metadata, MetaDataShardIndex& shards)
+{
+	shards = MetaDataShardIndex();
+
+	if (!is_metadata_container(data, size))
+	{
+		return DeserializeLegacyBackupMetaData(data, size, metadata);
+	}
+
+	string body;
+
+	if (!open_metadata(data, size, body))
+	{
+		return false;
+	}
+
+	const char* info = NULL;
+	size_t infoLength = 0;
+	uint32_t status = 0;
+	uint32_t keyLength = 0;
+
+	if (!find_metadata_section(body, BackupInfoSection, info, infoLength) || infoLength < 2 * sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	memcpy(&status, info, sizeof(uint32_t));
+	memcpy(&keyLength, info + sizeof(uint32_t), sizeof(uint32_t));
+
+	if (infoLength - 2 * sizeof(uint32_t) < keyLength)
+	{
+		return false;
+	}
+
+	metadata.status = (BackupStatus)status;
+	metadata.encryptionKey = string(info + 2 * sizeof(uint32_t), keyLength);
+
+	vector<uint32_t> narrowEmptyBlocks;
+	vector<uint64_t> geometry;
+
+	if (!ReadArraySection(body, BlockKeysSection, metadata.blockHashTable.keys) ||
+		!ReadArraySection(body, BlockHashesSection, metadata.blockHashTable.values) ||
+		!ReadArraySection(body, EmptyBlocksSection, narrowEmptyBlocks) ||
+		!ReadArraySection(body, EmptyBlockIdsSection, metadata.emptyBlocks) ||
+		!ReadArraySection(body, ChunkKeysSection, metadata.chunkTable.keys) ||
+		!ReadArraySection(body, ChunkIdsSection, metadata.chunkTable.values) ||
+		!ReadBlockChunkListSections(body, metadata.chunkListTable) ||
+		!ReadArraySection(body, ShardIndexSection, shards.hashes) ||
+		!ReadArraySection(body, ChunkShardIndexSection, shards.chunks) ||
+		!ReadArraySection(body, ChunkListShardIndexSection, shards.chunkLists) ||
+		!ReadArraySection(body, GeometrySection, geometry))
+	{
+		return false;
+	}
+
+	//containers written before block ids were widened
+	metadata.emptyBlocks.insert(metadata.emptyBlocks.end(), narrowEmptyBlocks.begin(), narrowEmptyBlocks.end());
+
+	metadata.geometry = VolumeGeometry();
+
+	if (geometry.size() >= 2)
+	{
+		metadata.geometry.blockSize = geometry[0];
+		metadata.geometry.partitionBlocks = geometry[1];
+	}
+
+	if (!metadata.geometry.IsValid())
+	{
+		return false;
+	}
+
+	return metadata.blockHashTable.keys.size() == metadata.blockHashTable.values.size() &&
+		   metadata.chunkTable.keys.size() == metadata.chunkTable.values.size();
+}
@@ -0,0 +1,198 @@
+#ifndef METADATASERIALIZER_H
+#define METADATASERIALIZER_H
+
+#include <set>
+#include "CommonTypes.h"
+
+using namespace std;
+
+//one partition worth of block hashes or chunk references stored as its own object
+struct MetaDataShardInfo
+{
+	uint64_t partId;
+	uint64_t hash;
+	uint64_t entries;
+};
+
+//shards of every table a sharded backup metadata root lists
+struct MetaDataShardIndex
+{
+	vector<MetaDataShardInfo> hashes;
+	vector<MetaDataShardInfo> chunks;
+	vector<MetaDataShardInfo> chunkLists;
+
+	bool Empty() const { return hashes.empty() && chunks.empty() && chunkLists.empty(); }
+};
+
+//backup metadata in the versioned container of core/metadata_format.h, block hashes included
+string SerializeBackupMetaData(const BackupMetaData& metadata);
+
+//root object of sharded metadata: status, key and the shard indexes, block hashes and chunk references live in the shards
+string SerializeBackupMetaDataRoot(const BackupMetaData& metadata, const MetaDataShardIndex& shards);
+
+//reads the root of sharded metadata, a monolithic container or the unversioned layout older
+//backups were written with, the shard index is left empty unless the metadata is sharded
+bool DeserializeBackupMetaData(const char* data, size_t size, BackupMetaData& metadata, MetaDataShardIndex& shards);
+bool DeserializeBackupMetaData(const char* data, size_t size, BackupMetaData& metadata);
+
+string SerializeBlockHashShard(const BlockHashTable& hashes);
+bool DeserializeBlockHashShard(const char* data, size_t size, BlockHashTable& hashes);
+
+//content hash of a shard, equal hashes mean an upload can be skipped
+uint64_t GetBlockHashShardHash(const BlockHashTable& hashes);
+
+string SerializeBlockChunkShard(const BlockChunkTable& chunks);
+bool DeserializeBlockChunkShard(const char* data, size_t size, BlockChunkTable& chunks);
+
+uint64_t GetBlockChunkShardHash(const BlockChunkTable& chunks);
+
+string SerializeBlockChunkListShard(const BlockChunkListTable& chunkLists);
+bool DeserializeBlockChunkListShard(const char* data, size_t size, BlockChunkListTable& chunkLists);
+
+uint64_t GetBlockChunkListShardHash(const BlockChunkListTable& chunkLists);
+
+void SplitBlockTable(const BlockChunkListTable& chunkLists, const VolumeGeometry& geometry, map<uint64_t, BlockChunkListTable>& shards);
+
+//ids of the chunks one backup added to the client chunk store
+string SerializeChunkIndexSegment(const vector<chunk_id>& chunkIds);
+bool DeserializeChunkIndexSegment(const char* data, size_t size, vector<chunk_id>& chunkIds);
+
+//pages one backup stored in its page deduplicated blocks and the pages it references in blocks of other backups
+string SerializePageIndexSegment(const vector<page_index_entry>& pages, const vector<page_source_reference>& references);
+bool DeserializePageIndexSegment(const char* data, size_t size, vector<page_index_entry>& pages, vector<page_source_reference>& references);
+
+//synthetic full backups of a volume with the restore point each one was merged from
+string SerializeSyntheticFulls(const vector<SyntheticFullInfo>& syntheticFulls);
+bool DeserializeSyntheticFulls(const char* data, size_t size, vector<SyntheticFullInfo>& syntheticFulls);
+
+//backups the cold tier job recompressed
+string SerializeRecompressedBackups(const vector<RecompressedBackupInfo>& backups);
+bool DeserializeRecompressedBackups(const char* data, size_t size, vector<RecompressedBackupInfo>& backups);
+
+//Merkle tree root of a restore point and the block hashes of one of its partitions
+string SerializeMerkleTreeRoot(const MerkleTreeRoot& root);
+bool DeserializeMerkleTreeRoot(const char* data, size_t size, MerkleTreeRoot& root);
+
+string SerializeMerkleTreeLeaves(const vector<uint64_t>& leaves);
+bool DeserializeMerkleTreeLeaves(const char* data, size_t size, vector<uint64_t>& leaves);
+
+//expired backup whose blocks are kept while retained backups still reference pages stored in them
+struct PinnedBackupInfo
+{
+	string backupId;
+	VolumeGeometry geometry;
+};
+
+//state of the garbage collection of a volume, the lists a collection writes are named by its generation
+struct CollectorState
+{
+	uint64_t generation = 0;
+
+	//objects to delete, persisted in parts so an interrupted collection resumes with the next part
+	uint64_t planParts = 0;
+	uint64_t nextPlanPart = 0;
+
+	//sorted chunk ids the retained backups reference and chunk ids waiting one collection before they are deleted
+	uint64_t chunkReferenceParts = 0;
+	uint64_t pendingChunkParts = 0;
+
+	//seconds since the epoch, pending chunks are deleted once every volume published its references after they became pending
+	uint64_t publishedAt = 0;
+	uint64_t pendingSince = 0;
+
+	vector<PinnedBackupInfo> pinnedBackups;
+
+	//collected backups the volume still lists, they stay retired until it no longer does
+	vector<string> retiredBackupIds;
+};
+
+string SerializeCollectorState(const CollectorState& state);
+bool DeserializeCollectorState(const char* data, size_t size, CollectorState& state);
+
+//object keys of a collection plan part
+string SerializeKeyList(const vector<string>& keys);
+bool DeserializeKeyList(const char* data, size_t size, vector<string>& keys);
+
+//progress of the replication of a volume to a replica, backups are copied in list order and
+//partition by partition, so an interrupted replication resumes with the partition it was copying
+struct ReplicationState
+{
+	//backups whose objects are all on the replica
+	vector<string> replicatedBackupIds;
+
+	//backup being copied and the first partition of it not copied yet
+	string currentBackupId;
+	uint64_t nextPartId = 0;
+
+	//blocks of backups no longer listed that replicated backups reference pages in, as <backup id>/<block index>
+	vector<string> pageSourceBlocks;
+
+	//dictionaries the copied blocks were compressed with
+	vector<uint32_t> dictionaryIds;
+};
+
+string SerializeReplicationState(const ReplicationState& state);
+bool DeserializeReplicationState(const char* data, size_t size, ReplicationState& state);
+
+//restore point a standby disk holds. The blocks of a backup being applied are written over it in any
+//order, until they all are the disk also holds blocks of every backup listed as being applied.
+struct StandbyState
+{
+	string targetType;
+	string targetPath;
+
+	string currentBackupId;
+	vector<string> applyingBackupIds;
+};
+
+string SerializeStandbyState(const StandbyState& state);
+bool DeserializeStandbyState(const char* data, size_t size, StandbyState& state);
+
+//entry of the proxy's metadata catalog, an object as read from storage with the entity tag it had
+string SerializeCatalogEntry(const string& etag, const string& data);
+bool DeserializeCatalogEntry(const char* entry, size_t size, string& etag, string& data);
+
+//splits the table by partition, keys keep their global block index
+template <typename T>
+void SplitBlockTable(const SortedBlockTable<T>& table, const VolumeGeometry& geometry, map<uint64_t, SortedBlockTable<T>>& shards)
+{
+	for (size_t i = 0; i < table.keys.size(); i++)
+	{
+		SortedBlockTable<T>& shard = shards[geometry.PartitionOf(table.keys[i])];
+
+		shard.keys.push_back(table.keys[i]);
+		shard.values.push_back(table.values[i]);
+	}
+}
+
+//keeps the entries of the requested partitions of a table read from monolithic metadata
+template <typename Table>
+void KeepPartitions(Table& table, const VolumeGeometry& geometry, const set<uint64_t>& requested)
+{
+	map<uint64_t, Table> shards;
+	Table kept;
+
+	SplitBlockTable(table, geometry, shards);
+
+	for (auto iter = shards.begin(); iter != shards.end(); iter++)
+	{
+		if (requested.count(iter->first) > 0)
+		{
+			kept.AppendTable(iter->second);
+		}
+	}
+
+	table = kept;
+}
+
+//partitions a table read from monolithic metadata holds entries of
+template <typename Table>
+void AddPartitions(const Table& table, const VolumeGeometry& geometry, set<uint64_t>& partIds)
+{
+	for (uint64_t block : table.keys)
+	{
+		partIds.insert(geometry.PartitionOf(block));
+	}
+}
+
+#endif
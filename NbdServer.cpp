@@ -0,0 +1,676 @@
+#include <csignal>
+#include "NbdServer.h"
+#include "core/byte_order.h"
+
+using namespace std;
+
+#define NBD_MAGIC 0x4e42444d41474943ULL
+#define NBD_OPTS_MAGIC 0x49484156454F5054ULL
+#define NBD_REP_MAGIC 0x0003e889045565a9ULL
+#define NBD_REQUEST_MAGIC 0x25609513
+#define NBD_SIMPLE_REPLY_MAGIC 0x67446698
+
+#define NBD_FLAG_FIXED_NEWSTYLE (1 << 0)
+#define NBD_FLAG_NO_ZEROES (1 << 1)
+#define NBD_FLAG_C_NO_ZEROES (1 << 1)
+
+#define NBD_FLAG_HAS_FLAGS (1 << 0)
+#define NBD_FLAG_SEND_FLUSH (1 << 2)
+
+#define NBD_OPT_EXPORT_NAME 1
+#define NBD_OPT_ABORT 2
+#define NBD_OPT_LIST 3
+#define NBD_OPT_INFO 6
+#define NBD_OPT_GO 7
+
+#define NBD_REP_ACK 1
+#define NBD_REP_SERVER 2
+#define NBD_REP_INFO 3
+#define NBD_REP_ERR_UNSUP 0x80000001
+#define NBD_INFO_EXPORT 0
+
+#define NBD_CMD_READ 0
+#define NBD_CMD_WRITE 1
+#define NBD_CMD_DISC 2
+#define NBD_CMD_FLUSH 3
+
+#define NBD_EIO 5
+#define NBD_EINVAL 22
+
+const UINT32 NbdMaxOptionLength = 4096;
+const UINT32 NbdMaxRequestLength = 32 * 1024 * 1024;
+const int PrefetchThreads = 4;
+
+//how often waits for clients and requests look for a stop request
+const int StopPollMs = 500;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int)
+{
+	stop_requested = 1;
+}
+
+NbdServer::NbdServer(const RestoreChain* restoreChain, UINT64 exportSize, string overlayFile, int cacheBlocks, int prefetchBlocks) :
+	m_restoreChain(restoreChain),
+	m_exportSize(exportSize),
+	m_blockSize(restoreChain->GetGeometry().blockSize),
+	m_overlayFile(overlayFile),
+	m_cacheBlocks(max(cacheBlocks, 1)),
+	m_prefetchBlocks(prefetchBlocks),
+	m_lastBlock(-1),
+	m_socketsInitialized(false),
+	m_listenSocket(INVALID_SOCKET_HANDLE)
+{
+	m_zeroBlock = make_shared<vector<char>>(m_blockSize, 0);
+	m_overlay = create_new_file_data(m_overlayFile.c_str());
+
+	for (int i = 0; i < PrefetchThreads; i++)
+	{
+		m_prefetchThreads.push_back(thread(&NbdServer::PrefetchWorker, this));
+	}
+}
+
+NbdServer::~NbdServer()
+{
+	for (size_t i = 0; i < m_prefetchThreads.size(); i++)
+	{
+		m_prefetchQueue.enqueue(-1);
+	}
+
+	for (auto &worker : m_prefetchThreads)
+	{
+		worker.join();
+	}
+
+	if (m_listenSocket != INVALID_SOCKET_HANDLE)
+	{
+		close_socket(m_listenSocket);
+	}
+
+	//the sectors written are known to this server only, the overlay means nothing without them
+	if (is_file_open(&m_overlay))
+	{
+		close_file(&m_overlay);
+		remove(m_overlayFile.c_str());
+	}
+
+	if (m_socketsInitialized)
+	{
+		cleanup_sockets();
+	}
+}
+
+int NbdServer::Listen(string socketPath, int port)
+{
+	if (!is_file_open(&m_overlay))
+	{
+		cout << "Overlay file error, it must not exist yet: " << m_overlayFile << endl;
+		return ERROR_CODE;
+	}
+
+	if (init_sockets() != 0)
+	{
+		cout << "Socket init error" << endl;
+		return ERROR_CODE;
+	}
+
+	m_socketsInitialized = true;
+
+	m_listenSocket = listen_socket(socketPath.c_str(), port);
+
+	if (m_listenSocket == INVALID_SOCKET_HANDLE)
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int NbdServer::Serve()
+{
+	stop_requested = 0;
+
+	//the job's own handlers are put back once the export ends
+	void (*previousInt)(int) = signal(SIGINT, RequestStop);
+	void (*previousTerm)(int) = signal(SIGTERM, RequestStop);
+
+	int result = ServeClients();
+
+	if (previousInt != SIG_ERR)
+	{
+		signal(SIGINT, previousInt);
+	}
+
+	if (previousTerm != SIG_ERR)
+	{
+		signal(SIGTERM, previousTerm);
+	}
+
+	return result;
+}
+
+int NbdServer::ServeClients()
+{
+	while (!stop_requested)
+	{
+		int ready = wait_socket(m_listenSocket, StopPollMs);
+
+		if (ready == 0)
+		{
+			continue;
+		}
+
+		socket_handle client = ready > 0 ? accept_socket(m_listenSocket) : INVALID_SOCKET_HANDLE;
+
+		if (client == INVALID_SOCKET_HANDLE)
+		{
+			cout << "Socket accept error" << endl;
+			return ERROR_CODE;
+		}
+
+		//clients that only list or probe the export end in negotiation, the export ends with the first session
+		if (Negotiate(client) != 0)
+		{
+			close_socket(client);
+			continue;
+		}
+
+		int result = Transmit(client);
+
+		close_socket(client);
+
+		return result;
+	}
+
+	return 0;
+}
+
+bool NbdServer::SendOptionReply(socket_handle client, UINT32 option, UINT32 replyType, const char* data, UINT32 length)
+{
+	char header[20];
+	store_be64(header, NBD_REP_MAGIC);
+	store_be32(header + 8, option);
+	store_be32(header + 12, replyType);
+	store_be32(header + 16, length);
+
+	if (!send_all(client, header, sizeof(header)))
+	{
+		return false;
+	}
+
+	return length == 0 || send_all(client, data, length);
+}
+
+bool NbdServer::SendReply(socket_handle client, UINT32 error, const char* handle, const char* data, UINT32 length)
+{
+	char header[16];
+	store_be32(header, NBD_SIMPLE_REPLY_MAGIC);
+	store_be32(header + 4, error);
+	memcpy(header + 8, handle, 8);
+
+	if (!send_all(client, header, sizeof(header)))
+	{
+		return false;
+	}
+
+	return length == 0 || send_all(client, data, length);
+}
+
+int NbdServer::Negotiate(socket_handle client)
+{
+	char greeting[18];
+	store_be64(greeting, NBD_MAGIC);
+	store_be64(greeting + 8, NBD_OPTS_MAGIC);
+	store_be16(greeting + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+
+	char clientFlags[4];
+
+	if (!send_all(client, greeting, sizeof(greeting)) || !recv_all(client, clientFlags, sizeof(clientFlags)))
+	{
+		return ERROR_CODE;
+	}
+
+	bool noZeroes = (load_be32(clientFlags) & NBD_FLAG_C_NO_ZEROES) != 0;
+	UINT16 transmissionFlags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH;
+	vector<char> data(NbdMaxOptionLength);
+
+	while (true)
+	{
+		char header[16];
+
+		if (!recv_all(client, header, sizeof(header)) || load_be64(header) != NBD_OPTS_MAGIC)
+		{
+			return ERROR_CODE;
+		}
+
+		UINT32 option = load_be32(header + 8);
+		UINT32 length = load_be32(header + 12);
+
+		if (length > NbdMaxOptionLength || (length > 0 && !recv_all(client, data.data(), length)))
+		{
+			return ERROR_CODE;
+		}
+
+		switch (option)
+		{
+			case NBD_OPT_EXPORT_NAME:
+			{
+				char reply[10 + 124] = { 0 };
+				store_be64(reply, m_exportSize);
+				store_be16(reply + 8, transmissionFlags);
+
+				return send_all(client, reply, noZeroes ? 10 : sizeof(reply)) ? 0 : ERROR_CODE;
+			}
+			case NBD_OPT_INFO:
+			case NBD_OPT_GO:
+			{
+				char info[12];
+				store_be16(info, NBD_INFO_EXPORT);
+				store_be64(info + 2, m_exportSize);
+				store_be16(info + 10, transmissionFlags);
+
+				if (!SendOptionReply(client, option, NBD_REP_INFO, info, sizeof(info)) ||
+					!SendOptionReply(client, option, NBD_REP_ACK, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				if (option == NBD_OPT_GO)
+				{
+					return 0;
+				}
+
+				break;
+			}
+			case NBD_OPT_LIST:
+			{
+				char name[4] = { 0 };
+
+				if (!SendOptionReply(client, option, NBD_REP_SERVER, name, sizeof(name)) ||
+					!SendOptionReply(client, option, NBD_REP_ACK, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+			case NBD_OPT_ABORT:
+			{
+				SendOptionReply(client, option, NBD_REP_ACK, NULL, 0);
+
+				return ERROR_CODE;
+			}
+			default:
+			{
+				if (!SendOptionReply(client, option, NBD_REP_ERR_UNSUP, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+		}
+	}
+}
+
+int NbdServer::Transmit(socket_handle client)
+{
+	vector<char> buffer;
+
+	while (true)
+	{
+		char request[28];
+		int ready = wait_socket(client, StopPollMs);
+
+		if (ready == 0)
+		{
+			if (stop_requested)
+			{
+				flush_file(&m_overlay);
+
+				return 0;
+			}
+
+			continue;
+		}
+
+		if (ready < 0 || !recv_all(client, request, sizeof(request)) || load_be32(request) != NBD_REQUEST_MAGIC)
+		{
+			return ERROR_CODE;
+		}
+
+		UINT16 type = load_be16(request + 6);
+		const char* handle = request + 8;
+		UINT64 offset = load_be64(request + 16);
+		UINT32 length = load_be32(request + 24);
+
+		bool inRange = length <= NbdMaxRequestLength && offset <= m_exportSize && length <= m_exportSize - offset;
+
+		switch (type)
+		{
+			case NBD_CMD_READ:
+			{
+				if (!inRange)
+				{
+					if (!SendReply(client, NBD_EINVAL, handle, NULL, 0))
+					{
+						return ERROR_CODE;
+					}
+
+					break;
+				}
+
+				buffer.resize(length);
+				UINT32 error = ReadExport(offset, length, buffer.data()) == 0 ? 0 : NBD_EIO;
+
+				if (!SendReply(client, error, handle, buffer.data(), error == 0 ? length : 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+			case NBD_CMD_WRITE:
+			{
+				if (length > NbdMaxRequestLength)
+				{
+					return ERROR_CODE;
+				}
+
+				buffer.resize(length);
+
+				if (!recv_all(client, buffer.data(), length))
+				{
+					return ERROR_CODE;
+				}
+
+				UINT32 error = !inRange ? NBD_EINVAL : (WriteExport(offset, length, buffer.data()) == 0 ? 0 : NBD_EIO);
+
+				if (!SendReply(client, error, handle, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+			case NBD_CMD_FLUSH:
+			{
+				flush_file(&m_overlay);
+
+				if (!SendReply(client, 0, handle, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+			case NBD_CMD_DISC:
+			{
+				flush_file(&m_overlay);
+
+				return 0;
+			}
+			default:
+			{
+				if (!SendReply(client, NBD_EINVAL, handle, NULL, 0))
+				{
+					return ERROR_CODE;
+				}
+
+				break;
+			}
+		}
+	}
+}
+
+int NbdServer::ReadExport(UINT64 offset, UINT32 length, char* buffer)
+{
+	UINT64 end = offset + length;
+	UINT64 firstBlock = offset / m_blockSize;
+	UINT64 lastBlock = (end - 1) / m_blockSize;
+
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	for (UINT64 blockIndex = firstBlock; blockIndex <= lastBlock; blockIndex++)
+	{
+		UINT64 blockStart = blockIndex * m_blockSize;
+		UINT64 sliceStart = max(offset, blockStart);
+		UINT64 sliceEnd = min(end, blockStart + m_blockSize);
+		char* dst = buffer + (sliceStart - offset);
+
+		auto block = GetBlock(blockIndex);
+
+		if (!block)
+		{
+			return ERROR_CODE;
+		}
+
+		memcpy(dst, block->data() + (sliceStart - blockStart), sliceEnd - sliceStart);
+
+		vector<bool> overlaySectors;
+
+		{
+			lock_guard<mutex> lock(m_cacheMutex);
+			auto item = m_overlaySectors.find(blockIndex);
+
+			if (item != m_overlaySectors.end())
+			{
+				overlaySectors = item->second;
+			}
+		}
+
+		if (overlaySectors.empty())
+		{
+			continue;
+		}
+
+		UINT64 sector = (sliceStart - blockStart) / VIXDISKLIB_SECTOR_SIZE;
+		UINT64 lastSector = (sliceEnd - blockStart - 1) / VIXDISKLIB_SECTOR_SIZE;
+
+		while (sector <= lastSector)
+		{
+			if (!overlaySectors[sector])
+			{
+				sector++;
+				continue;
+			}
+
+			UINT64 runStart = sector;
+
+			while (sector <= lastSector && overlaySectors[sector])
+			{
+				sector++;
+			}
+
+			UINT64 runOffset = max(sliceStart, blockStart + runStart * VIXDISKLIB_SECTOR_SIZE);
+			UINT64 runEnd = min(sliceEnd, blockStart + sector * VIXDISKLIB_SECTOR_SIZE);
+			int runLength = (int)(runEnd - runOffset);
+
+			if (read_file_data_at(&m_overlay, buffer + (runOffset - offset), runLength, runOffset) != runLength)
+			{
+				return ERROR_CODE;
+			}
+		}
+	}
+
+	if (m_prefetchBlocks > 0 && (firstBlock == (UINT64)(m_lastBlock + 1) || firstBlock == (UINT64)m_lastBlock))
+	{
+		SchedulePrefetch(lastBlock + 1);
+	}
+
+	m_lastBlock = lastBlock;
+
+	return 0;
+}
+
+int NbdServer::WriteExport(UINT64 offset, UINT32 length, const char* buffer)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	UINT64 alignedStart = offset / VIXDISKLIB_SECTOR_SIZE * VIXDISKLIB_SECTOR_SIZE;
+	UINT64 alignedEnd = (offset + length + VIXDISKLIB_SECTOR_SIZE - 1) / VIXDISKLIB_SECTOR_SIZE * VIXDISKLIB_SECTOR_SIZE;
+	const char* data = buffer;
+	vector<char> merged;
+
+	if (alignedStart != offset || alignedEnd != offset + length)
+	{
+		merged.resize(alignedEnd - alignedStart);
+
+		if (ReadExport(alignedStart, (UINT32)merged.size(), merged.data()) != 0)
+		{
+			return ERROR_CODE;
+		}
+
+		memcpy(merged.data() + (offset - alignedStart), buffer, length);
+		data = merged.data();
+	}
+
+	int size = (int)(alignedEnd - alignedStart);
+
+	if (write_file_data_at(&m_overlay, data, size, alignedStart) != size)
+	{
+		return ERROR_CODE;
+	}
+
+	lock_guard<mutex> lock(m_cacheMutex);
+
+	for (UINT64 sector = alignedStart / VIXDISKLIB_SECTOR_SIZE; sector < alignedEnd / VIXDISKLIB_SECTOR_SIZE; sector++)
+	{
+		UINT64 blockIndex = sector * VIXDISKLIB_SECTOR_SIZE / m_blockSize;
+		vector<bool>& sectors = m_overlaySectors[blockIndex];
+
+		if (sectors.empty())
+		{
+			sectors.assign(m_blockSize / VIXDISKLIB_SECTOR_SIZE, false);
+		}
+
+		sectors[sector - blockIndex * m_blockSize / VIXDISKLIB_SECTOR_SIZE] = true;
+	}
+
+	return 0;
+}
+
+shared_ptr<vector<char>> NbdServer::GetBlock(UINT64 blockIndex)
+{
+	if (!m_restoreChain->ContainsBlock(blockIndex))
+	{
+		return m_zeroBlock;
+	}
+
+	unique_lock<mutex> lock(m_cacheMutex);
+
+	while (true)
+	{
+		auto item = m_cache.find(blockIndex);
+
+		if (item != m_cache.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, item->second.second);
+
+			return item->second.first;
+		}
+
+		if (m_pending.find(blockIndex) == m_pending.end())
+		{
+			break;
+		}
+
+		m_cacheCondition.wait(lock);
+	}
+
+	m_pending.insert(blockIndex);
+	lock.unlock();
+
+	auto block = LoadBlock(blockIndex);
+
+	lock.lock();
+	m_pending.erase(blockIndex);
+
+	if (block)
+	{
+		InsertBlock(blockIndex, block);
+	}
+
+	m_cacheCondition.notify_all();
+
+	return block;
+}
+
+shared_ptr<vector<char>> NbdServer::LoadBlock(UINT64 blockIndex)
+{
+	auto block = make_shared<vector<char>>(m_blockSize, 0);
+	vector<bool> sectorMask;
+
+	if (m_restoreChain->ReadBlock(blockIndex, block->data(), sectorMask) != 0)
+	{
+		return nullptr;
+	}
+
+	return block;
+}
+
+void NbdServer::InsertBlock(UINT64 blockIndex, shared_ptr<vector<char>> block)
+{
+	if (m_cache.find(blockIndex) != m_cache.end())
+	{
+		return;
+	}
+
+	while (m_cache.size() >= m_cacheBlocks)
+	{
+		m_cache.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+
+	m_lru.push_front(blockIndex);
+	m_cache[blockIndex] = make_pair(block, m_lru.begin());
+}
+
+void NbdServer::SchedulePrefetch(UINT64 blockIndex)
+{
+	UINT64 blockCount = m_exportSize / m_blockSize;
+	lock_guard<mutex> lock(m_cacheMutex);
+
+	for (UINT64 i = blockIndex; i < blockIndex + m_prefetchBlocks && i < blockCount; i++)
+	{
+		if (m_cache.find(i) != m_cache.end() || m_pending.find(i) != m_pending.end() || !m_restoreChain->ContainsBlock(i))
+		{
+			continue;
+		}
+
+		m_pending.insert(i);
+		m_prefetchQueue.enqueue((INT64)i);
+	}
+}
+
+void NbdServer::PrefetchWorker()
+{
+	while (true)
+	{
+		INT64 blockIndex = m_prefetchQueue.dequeue();
+
+		if (blockIndex < 0)
+		{
+			break;
+		}
+
+		auto block = LoadBlock((UINT64)blockIndex);
+
+		lock_guard<mutex> lock(m_cacheMutex);
+		m_pending.erase((UINT64)blockIndex);
+
+		if (block)
+		{
+			InsertBlock((UINT64)blockIndex, block);
+		}
+
+		m_cacheCondition.notify_all();
+	}
+}
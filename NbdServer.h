@@ -0,0 +1,84 @@
+#ifndef NBDSERVER_H
+#define NBDSERVER_H
+
+#include "core/socket.h"
+#include <list>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+#include "core/file_handler.h"
+#include "core/thread_safe_queue.h"
+#include "RestoreChain.h"
+
+using namespace std;
+
+//exports a restore point as a network block device (fixed newstyle NBD protocol),
+//blocks are fetched from the backup storage on first access and kept in an LRU cache,
+//writes are redirected to a local overlay file so the backup itself is never modified.
+//The overlay is scratch space of one export: it must not exist yet and is deleted when the export ends.
+class NbdServer
+{
+public:
+	NbdServer(const RestoreChain* restoreChain, UINT64 exportSize, string overlayFile, int cacheBlocks, int prefetchBlocks);
+
+	NbdServer(const NbdServer&) = delete;
+	NbdServer& operator = (const NbdServer&) = delete;
+	NbdServer(NbdServer&&) = delete;
+	NbdServer& operator = (NbdServer&&) = delete;
+
+	~NbdServer();
+
+	int Listen(string socketPath, int port);
+
+	//serves the first client that reaches transmission until it disconnects or the job is
+	//stopped with SIGINT or SIGTERM, fails when the connection is lost before
+	int Serve();
+
+private:
+	int ServeClients();
+
+	int Negotiate(socket_handle client);
+	int Transmit(socket_handle client);
+
+	bool SendOptionReply(socket_handle client, UINT32 option, UINT32 replyType, const char* data, UINT32 length);
+	bool SendReply(socket_handle client, UINT32 error, const char* handle, const char* data, UINT32 length);
+
+	int ReadExport(UINT64 offset, UINT32 length, char* buffer);
+	int WriteExport(UINT64 offset, UINT32 length, const char* buffer);
+
+	shared_ptr<vector<char>> GetBlock(UINT64 blockIndex);
+	shared_ptr<vector<char>> LoadBlock(UINT64 blockIndex);
+	void InsertBlock(UINT64 blockIndex, shared_ptr<vector<char>> block);
+
+	void SchedulePrefetch(UINT64 blockIndex);
+	void PrefetchWorker();
+
+	const RestoreChain* m_restoreChain;
+	UINT64 m_exportSize;
+	UINT64 m_blockSize;
+
+	string m_overlayFile;
+	file_handler m_overlay;
+	map<UINT64, vector<bool>> m_overlaySectors;
+
+	size_t m_cacheBlocks;
+	int m_prefetchBlocks;
+	INT64 m_lastBlock;
+
+	list<UINT64> m_lru;
+	map<UINT64, pair<shared_ptr<vector<char>>, list<UINT64>::iterator>> m_cache;
+	set<UINT64> m_pending;
+	shared_ptr<vector<char>> m_zeroBlock;
+	mutex m_cacheMutex;
+	condition_variable m_cacheCondition;
+
+	SafeQueue<INT64> m_prefetchQueue;
+	vector<thread> m_prefetchThreads;
+
+	bool m_socketsInitialized;
+	socket_handle m_listenSocket;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include <iostream>
+#include "PageDeduplicator.h"
+#include "core/block_layout.h"
+
+PageDeduplicator::PageDeduplicator(BackupStorage* backupStorage, string backupId, size_t indexLimit) :
+	m_backupStorage(backupStorage),
+	m_backupId(backupId),
+	m_index(indexLimit),
+	m_pages(0),
+	m_storedPages(0),
+	m_referencedPages(0),
+	m_zeroPages(0)
+{
+	m_sources.push_back(backupId);
+}
+
+int PageDeduplicator::Load(const VolumeMetaData& metadata, const VolumeGeometry& geometry)
+{
+	for (auto iter = metadata.backupIds.rbegin(); iter != metadata.backupIds.rend() && !m_index.IsFull(); iter++)
+	{
+		//block layouts name source backups in fixed size fields
+		if (*iter == m_backupId || iter->size() > PAGE_SOURCE_ID_SIZE)
+		{
+			continue;
+		}
+
+		VolumeGeometry sourceGeometry = m_backupStorage->GetBackupMetaData(*iter, vector<UINT64>()).geometry;
+
+		if (sourceGeometry.blockSize != geometry.blockSize || sourceGeometry.partitionBlocks != geometry.partitionBlocks)
+		{
+			continue;
+		}
+
+		vector<page_index_entry> pages;
+		vector<page_source_reference> references;
+
+		if (m_backupStorage->GetPageIndexSegment(*iter, pages, references) != 0)
+		{
+			continue;
+		}
+
+		page_location location;
+		location.source = (uint32_t)m_sources.size();
+		m_sources.push_back(*iter);
+
+		for (const page_index_entry& page : pages)
+		{
+			location.block_index = page.block_index;
+			location.slot = page.slot;
+
+			if (!m_index.Insert(page.key, location) && m_index.IsFull())
+			{
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+size_t PageDeduplicator::BuildBlock(UINT64 blockIndex, const char* image, const vector<bool>& presentPages, char* out)
+{
+	uint32_t pageCount = (uint32_t)presentPages.size();
+	bool indexOwnPages = m_backupId.size() <= PAGE_SOURCE_ID_SIZE;
+
+	//global source index -> index in the source table of this block
+	map<uint32_t, uint32_t> blockSources;
+	string sourceIds;
+
+	m_entries.assign(pageCount, PAGE_ABSENT);
+	m_references.clear();
+	m_storedPageData.resize((size_t)pageCount * DEDUP_PAGE_SIZE);
+
+	uint32_t stored = 0;
+
+	for (uint32_t page = 0; page < pageCount; page++)
+	{
+		if (!presentPages[page])
+		{
+			continue;
+		}
+
+		const char* data = image + (size_t)page * DEDUP_PAGE_SIZE;
+		m_pages++;
+
+		if (is_zero_data(data, DEDUP_PAGE_SIZE))
+		{
+			m_entries[page] = PAGE_ZERO;
+			m_zeroPages++;
+			continue;
+		}
+
+		page_key key = page_hash(data);
+		page_location location;
+
+		if (m_index.Find(key, location))
+		{
+			m_referencedPages++;
+
+			//a page repeated within the block points at the slot already stored
+			if (location.source == 0 && location.block_index == blockIndex)
+			{
+				m_entries[page] = location.slot;
+				continue;
+			}
+
+			auto source = blockSources.find(location.source);
+
+			if (source == blockSources.end())
+			{
+				string id = m_sources[location.source];
+				id.resize(PAGE_SOURCE_ID_SIZE, '\0');
+				sourceIds += id;
+
+				source = blockSources.insert(make_pair(location.source, (uint32_t)blockSources.size())).first;
+			}
+
+			page_reference reference;
+			reference.block_index = location.block_index;
+			reference.slot = location.slot;
+			reference.source = source->second;
+
+			page_source_reference sourceReference;
+			memcpy(sourceReference.source_id, sourceIds.data() + (size_t)source->second * PAGE_SOURCE_ID_SIZE, PAGE_SOURCE_ID_SIZE);
+			sourceReference.source_block = location.block_index;
+			sourceReference.block_index = blockIndex;
+			sourceReference.slot = location.slot;
+			sourceReference.reserved = 0;
+			m_newReferences.push_back(sourceReference);
+
+			m_entries[page] = PAGE_REFERENCE_FLAG | (uint32_t)m_references.size();
+			m_references.push_back(reference);
+			continue;
+		}
+
+		memcpy(m_storedPageData.data() + (size_t)stored * DEDUP_PAGE_SIZE, data, DEDUP_PAGE_SIZE);
+		m_entries[page] = stored;
+
+		if (indexOwnPages)
+		{
+			location.block_index = blockIndex;
+			location.slot = stored;
+			location.source = 0;
+			m_index.Insert(key, location);
+
+			//every stored page is listed, later backups may have room in their index for more
+			page_index_entry entry;
+			entry.key = key;
+			entry.block_index = blockIndex;
+			entry.slot = stored;
+			entry.reserved = 0;
+			m_newPages.push_back(entry);
+		}
+
+		stored++;
+		m_storedPages++;
+	}
+
+	return write_page_block(out, pageCount, m_entries.data(), sourceIds, m_references, m_storedPageData.data(), stored);
+}
+
+int PageDeduplicator::UploadIndex()
+{
+	if (m_newPages.empty() && m_newReferences.empty())
+	{
+		return 0;
+	}
+
+	return m_backupStorage->UploadPageIndexSegment(m_backupId, m_newPages, m_newReferences);
+}
@@ -0,0 +1,62 @@
+#ifndef PAGEDEDUPLICATOR_H
+#define PAGEDEDUPLICATOR_H
+
+#include "BackupStorage.h"
+#include "core/page_block.h"
+#include "core/page_index.h"
+
+using namespace std;
+
+//splits the blocks of a backup into 4 KB pages and stores each page once per volume:
+//pages an earlier backup of the volume or an earlier block of this backup stored become
+//references, the rest are stored in the block and indexed for the blocks that follow
+class PageDeduplicator
+{
+public:
+	//indexLimit bounds the pages kept in memory, the newest backups are indexed first
+	PageDeduplicator(BackupStorage* backupStorage, string backupId, size_t indexLimit);
+
+	PageDeduplicator(const PageDeduplicator&) = delete;
+	PageDeduplicator& operator = (const PageDeduplicator&) = delete;
+
+	//indexes the pages stored by the earlier backups of the volume, backups without a page index are skipped
+	//and so are backups of another geometry, whose block indices map to other objects
+	int Load(const VolumeMetaData& metadata, const VolumeGeometry& geometry);
+
+	//writes the page block of image, the whole block at its disk position, to out which has room for
+	//page_block_max_size of the block's pages. presentPages marks the pages the backup writes.
+	size_t BuildBlock(UINT64 blockIndex, const char* image, const vector<bool>& presentPages, char* out);
+
+	//pages this backup stored and the pages it references, once every block is built
+	int UploadIndex();
+
+	UINT64 GetPages() const { return m_pages; }
+	UINT64 GetStoredPages() const { return m_storedPages; }
+	UINT64 GetReferencedPages() const { return m_referencedPages; }
+	UINT64 GetZeroPages() const { return m_zeroPages; }
+	size_t GetIndexedPages() const { return m_index.Size(); }
+
+private:
+	BackupStorage* m_backupStorage;
+	string m_backupId;
+
+	PageIndex m_index;
+
+	//backup ids page locations refer to, this backup first
+	vector<string> m_sources;
+
+	vector<page_index_entry> m_newPages;
+	vector<page_source_reference> m_newReferences;
+
+	//scratch of the block being built
+	vector<uint32_t> m_entries;
+	vector<page_reference> m_references;
+	vector<char> m_storedPageData;
+
+	UINT64 m_pages;
+	UINT64 m_storedPages;
+	UINT64 m_referencedPages;
+	UINT64 m_zeroPages;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include <iostream>
+#include "Qcow2RestoreTarget.h"
+#include "core/block_layout.h"
+#include "core/byte_order.h"
+
+using namespace std;
+
+#define QCOW2_MAGIC 0x514649fb
+#define QCOW2_VERSION 3
+#define QCOW2_CLUSTER_BITS 16
+#define QCOW2_REFCOUNT_ORDER 4
+#define QCOW2_HEADER_LENGTH 104
+#define QCOW2_OFLAG_COPIED (1ULL << 63)
+
+const UINT64 Qcow2ClusterSize = 1ULL << QCOW2_CLUSTER_BITS;
+const UINT64 Qcow2L2Entries = Qcow2ClusterSize / sizeof(UINT64);
+const UINT64 Qcow2RefcountEntries = Qcow2ClusterSize / sizeof(UINT16);
+const size_t Qcow2BatchSize = 32 * 1024 * 1024;
+
+Qcow2RestoreTarget::Qcow2RestoreTarget() :
+	m_open(false),
+	m_blockSize(MB_BLOCK_SIZE),
+	m_capacity(0),
+	m_nextCluster(1),
+	m_batchBuffer(NULL),
+	m_batchCluster(0),
+	m_batchLength(0)
+{
+}
+
+Qcow2RestoreTarget::~Qcow2RestoreTarget()
+{
+	Close();
+}
+
+int Qcow2RestoreTarget::Open(InputParams& params, UINT64 capacity, UINT64 blockSize)
+{
+	if (params.compareTarget || !params.currentBackupId.empty())
+	{
+		cout << "qcow2 images can't be updated in place" << endl;
+
+		return ERROR_CODE;
+	}
+
+	//clusters are allocated whole in a fresh image, a range would leave the rest of the disk empty
+	if (!params.restoreRanges.empty())
+	{
+		cout << "qcow2 images can't be restored by range, restore to a raw or vmdk target" << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_file = create_file_data(params.targetPath.c_str());
+
+	if (!is_file_open(&m_file))
+	{
+		cout << "Image file create error: " << params.targetPath << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_open = true;
+	m_blockSize = blockSize;
+	m_capacity = capacity;
+	m_nextCluster = 1;
+	m_l2Tables.clear();
+	m_batchBuffer = (char*)malloc(Qcow2BatchSize);
+
+	return 0;
+}
+
+int Qcow2RestoreTarget::WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask)
+{
+	UINT64 offset = blockIndex * m_blockSize;
+
+	for (UINT64 clusterOffset = 0; clusterOffset < m_blockSize; clusterOffset += Qcow2ClusterSize)
+	{
+		const char* data = buffer + clusterOffset;
+
+		if (is_zero_data(data, Qcow2ClusterSize))
+		{
+			continue;
+		}
+
+		int result = WriteCluster(offset + clusterOffset, data);
+
+		if (result != 0)
+		{
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+int Qcow2RestoreTarget::WriteCluster(UINT64 guestOffset, const char* data)
+{
+	UINT64 guestCluster = guestOffset / Qcow2ClusterSize;
+	vector<UINT64>& l2Table = m_l2Tables[guestCluster / Qcow2L2Entries];
+
+	if (l2Table.empty())
+	{
+		l2Table.assign(Qcow2L2Entries, 0);
+	}
+
+	UINT64& entry = l2Table[guestCluster % Qcow2L2Entries];
+
+	if (entry != 0)
+	{
+		int result = FlushBatch();
+
+		if (result != 0)
+		{
+			return result;
+		}
+
+		UINT64 hostOffset = entry & ~QCOW2_OFLAG_COPIED;
+
+		return write_file_data_at(&m_file, data, (int)Qcow2ClusterSize, hostOffset) == (int)Qcow2ClusterSize ? 0 : ERROR_CODE;
+	}
+
+	if (m_batchLength + Qcow2ClusterSize > Qcow2BatchSize)
+	{
+		int result = FlushBatch();
+
+		if (result != 0)
+		{
+			return result;
+		}
+	}
+
+	if (m_batchLength == 0)
+	{
+		m_batchCluster = m_nextCluster;
+	}
+
+	memcpy(m_batchBuffer + m_batchLength, data, Qcow2ClusterSize);
+	m_batchLength += Qcow2ClusterSize;
+
+	entry = (m_nextCluster * Qcow2ClusterSize) | QCOW2_OFLAG_COPIED;
+	m_nextCluster++;
+
+	return 0;
+}
+
+int Qcow2RestoreTarget::FlushBatch()
+{
+	if (m_batchLength == 0)
+	{
+		return 0;
+	}
+
+	int bytes = write_file_data_at(&m_file, m_batchBuffer, (int)m_batchLength, m_batchCluster * Qcow2ClusterSize);
+
+	if (bytes != (int)m_batchLength)
+	{
+		cout << "Image file write error, cluster: " << m_batchCluster << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_batchLength = 0;
+
+	return 0;
+}
+
+int Qcow2RestoreTarget::WriteMetadata()
+{
+	int result = FlushBatch();
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	UINT64 l1Size = (m_capacity + Qcow2L2Entries * Qcow2ClusterSize - 1) / (Qcow2L2Entries * Qcow2ClusterSize);
+	vector<char> table(Qcow2ClusterSize);
+	vector<UINT64> l1Table(l1Size, 0);
+
+	for (auto iter = m_l2Tables.begin(); iter != m_l2Tables.end(); iter++)
+	{
+		for (UINT64 i = 0; i < Qcow2L2Entries; i++)
+		{
+			store_be64(table.data() + i * sizeof(UINT64), iter->second[i]);
+		}
+
+		UINT64 l2Offset = m_nextCluster * Qcow2ClusterSize;
+
+		if (write_file_data_at(&m_file, table.data(), (int)Qcow2ClusterSize, l2Offset) != (int)Qcow2ClusterSize)
+		{
+			return ERROR_CODE;
+		}
+
+		l1Table[iter->first] = l2Offset | QCOW2_OFLAG_COPIED;
+		m_nextCluster++;
+	}
+
+	UINT64 l1Clusters = (l1Size * sizeof(UINT64) + Qcow2ClusterSize - 1) / Qcow2ClusterSize;
+	UINT64 l1Offset = m_nextCluster * Qcow2ClusterSize;
+	vector<char> l1Buffer(max(l1Clusters, (UINT64)1) * Qcow2ClusterSize, 0);
+
+	for (UINT64 i = 0; i < l1Size; i++)
+	{
+		store_be64(l1Buffer.data() + i * sizeof(UINT64), l1Table[i]);
+	}
+
+	if (write_file_data_at(&m_file, l1Buffer.data(), (int)l1Buffer.size(), l1Offset) != (int)l1Buffer.size())
+	{
+		return ERROR_CODE;
+	}
+
+	m_nextCluster += max(l1Clusters, (UINT64)1);
+
+	//the refcount structures have to cover themselves, grow them until the layout is stable
+	UINT64 refcountBlocks = 0;
+	UINT64 refcountTableClusters = 0;
+	UINT64 totalClusters = 0;
+
+	while (true)
+	{
+		totalClusters = m_nextCluster + refcountTableClusters + refcountBlocks;
+
+		UINT64 blocks = (totalClusters + Qcow2RefcountEntries - 1) / Qcow2RefcountEntries;
+		UINT64 tableClusters = (blocks * sizeof(UINT64) + Qcow2ClusterSize - 1) / Qcow2ClusterSize;
+
+		if (blocks == refcountBlocks && tableClusters == refcountTableClusters)
+		{
+			break;
+		}
+
+		refcountBlocks = blocks;
+		refcountTableClusters = tableClusters;
+	}
+
+	UINT64 refcountTableOffset = m_nextCluster * Qcow2ClusterSize;
+	UINT64 refcountBlockCluster = m_nextCluster + refcountTableClusters;
+	vector<char> refcountTable(refcountTableClusters * Qcow2ClusterSize, 0);
+
+	for (UINT64 i = 0; i < refcountBlocks; i++)
+	{
+		store_be64(refcountTable.data() + i * sizeof(UINT64), (refcountBlockCluster + i) * Qcow2ClusterSize);
+
+		for (UINT64 k = 0; k < Qcow2RefcountEntries; k++)
+		{
+			UINT64 cluster = i * Qcow2RefcountEntries + k;
+			store_be16(table.data() + k * sizeof(UINT16), cluster < totalClusters ? 1 : 0);
+		}
+
+		if (write_file_data_at(&m_file, table.data(), (int)Qcow2ClusterSize, (refcountBlockCluster + i) * Qcow2ClusterSize) != (int)Qcow2ClusterSize)
+		{
+			return ERROR_CODE;
+		}
+	}
+
+	if (write_file_data_at(&m_file, refcountTable.data(), (int)refcountTable.size(), refcountTableOffset) != (int)refcountTable.size())
+	{
+		return ERROR_CODE;
+	}
+
+	vector<char> header(Qcow2ClusterSize, 0);
+	store_be32(header.data(), QCOW2_MAGIC);
+	store_be32(header.data() + 4, QCOW2_VERSION);
+	store_be32(header.data() + 20, QCOW2_CLUSTER_BITS);
+	store_be64(header.data() + 24, m_capacity);
+	store_be32(header.data() + 36, (UINT32)l1Size);
+	store_be64(header.data() + 40, l1Offset);
+	store_be64(header.data() + 48, refcountTableOffset);
+	store_be32(header.data() + 56, (UINT32)refcountTableClusters);
+	store_be32(header.data() + 96, QCOW2_REFCOUNT_ORDER);
+	store_be32(header.data() + 100, QCOW2_HEADER_LENGTH);
+
+	if (write_file_data_at(&m_file, header.data(), (int)header.size(), 0) != (int)header.size())
+	{
+		return ERROR_CODE;
+	}
+
+	return set_file_size(&m_file, totalClusters * Qcow2ClusterSize);
+}
+
+int Qcow2RestoreTarget::Close()
+{
+	int result = 0;
+
+	if (m_open)
+	{
+		result = WriteMetadata();
+
+		if (result != 0)
+		{
+			cout << "Image metadata write error" << endl;
+		}
+
+		flush_file(&m_file);
+		close_file(&m_file);
+		m_open = false;
+	}
+
+	if (m_batchBuffer != NULL)
+	{
+		free(m_batchBuffer);
+		m_batchBuffer = NULL;
+	}
+
+	return result;
+}
@@ -0,0 +1,45 @@
+#ifndef QCOW2RESTORETARGET_H
+#define QCOW2RESTORETARGET_H
+
+#include "RestoreTarget.h"
+#include "core/file_handler.h"
+
+using namespace std;
+
+//writes a qcow2 (version 3) image holding only the clusters that contain data,
+//data clusters are appended in batches and the L1/L2 and refcount tables are written on close
+class Qcow2RestoreTarget : public RestoreTarget
+{
+public:
+	Qcow2RestoreTarget();
+
+	Qcow2RestoreTarget(const Qcow2RestoreTarget&) = delete;
+	Qcow2RestoreTarget& operator =(const Qcow2RestoreTarget&) = delete;
+
+	~Qcow2RestoreTarget();
+
+	int Open(InputParams& params, UINT64 capacity, UINT64 blockSize) override;
+
+	int WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask) override;
+
+	int Close() override;
+
+private:
+	int WriteCluster(UINT64 guestOffset, const char* data);
+	int FlushBatch();
+	int WriteMetadata();
+
+	file_handler m_file;
+	bool m_open;
+	UINT64 m_blockSize;
+
+	UINT64 m_capacity;
+	UINT64 m_nextCluster;
+	map<UINT64, vector<UINT64>> m_l2Tables;
+
+	char* m_batchBuffer;
+	UINT64 m_batchCluster;
+	size_t m_batchLength;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <iostream>
+#include "RangeFileRestoreTarget.h"
+
+using namespace std;
+
+RangeFileRestoreTarget::RangeFileRestoreTarget() :
+	m_open(false),
+	m_blockSize(MB_BLOCK_SIZE)
+{
+}
+
+RangeFileRestoreTarget::~RangeFileRestoreTarget()
+{
+	Close();
+}
+
+int RangeFileRestoreTarget::Open(InputParams& params, UINT64 capacity, UINT64 blockSize)
+{
+	if (params.restoreRanges.empty())
+	{
+		cout << "Extract target requires restoreRanges" << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_file = create_file_data(params.targetPath.c_str());
+
+	if (!is_file_open(&m_file))
+	{
+		cout << "Extract file create error: " << params.targetPath << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_open = true;
+	m_blockSize = blockSize;
+
+	UINT64 fileSize = 0;
+
+	for (const ByteRange& range : params.restoreRanges)
+	{
+		ByteRange clamped = range;
+		clamped.length = range.offset < capacity ? min(range.length, capacity - range.offset) : 0;
+
+		m_ranges.push_back(clamped);
+		m_fileOffsets.push_back(fileSize);
+
+		fileSize += clamped.length;
+	}
+
+	return set_file_size(&m_file, fileSize);
+}
+
+int RangeFileRestoreTarget::WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask)
+{
+	UINT64 blockStart = blockIndex * m_blockSize;
+	UINT64 blockEnd = blockStart + m_blockSize;
+
+	for (size_t i = 0; i < m_ranges.size(); i++)
+	{
+		UINT64 start = max(blockStart, m_ranges[i].offset);
+		UINT64 end = min(blockEnd, m_ranges[i].offset + m_ranges[i].length);
+
+		if (start >= end)
+		{
+			continue;
+		}
+
+		int size = (int)(end - start);
+		UINT64 fileOffset = m_fileOffsets[i] + (start - m_ranges[i].offset);
+
+		if (write_file_data_at(&m_file, buffer + (start - blockStart), size, fileOffset) != size)
+		{
+			cout << "Extract file write error, offset: " << fileOffset << endl;
+
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+int RangeFileRestoreTarget::Close()
+{
+	if (m_open)
+	{
+		flush_file(&m_file);
+		close_file(&m_file);
+		m_open = false;
+	}
+
+	return 0;
+}
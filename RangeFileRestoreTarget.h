@@ -0,0 +1,36 @@
+#ifndef RANGEFILERESTORETARGET_H
+#define RANGEFILERESTORETARGET_H
+
+#include "RestoreTarget.h"
+#include "core/file_handler.h"
+
+using namespace std;
+
+//extracts the requested byte ranges of a restore point into a local file,
+//ranges are stored back to back in the order they were requested
+class RangeFileRestoreTarget : public RestoreTarget
+{
+public:
+	RangeFileRestoreTarget();
+
+	RangeFileRestoreTarget(const RangeFileRestoreTarget&) = delete;
+	RangeFileRestoreTarget& operator =(const RangeFileRestoreTarget&) = delete;
+
+	~RangeFileRestoreTarget();
+
+	int Open(InputParams& params, UINT64 capacity, UINT64 blockSize) override;
+
+	int WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask) override;
+
+	int Close() override;
+
+private:
+	file_handler m_file;
+	bool m_open;
+	UINT64 m_blockSize;
+
+	vector<ByteRange> m_ranges;
+	vector<UINT64> m_fileOffsets;
+};
+
+#endif
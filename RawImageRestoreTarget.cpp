@@ -0,0 +1,193 @@
+#include <iostream>
+#include <algorithm>
+#include "RawImageRestoreTarget.h"
+#include "core/block_layout.h"
+
+using namespace std;
+
+//holds at least two blocks of the largest size
+const size_t RawImageBatchSize = 32 * 1024 * 1024;
+
+RawImageRestoreTarget::RawImageRestoreTarget() :
+	m_open(false),
+	m_blockSize(MB_BLOCK_SIZE),
+	m_batchBuffer(NULL),
+	m_batchOffset(0),
+	m_batchLength(0)
+{
+}
+
+RawImageRestoreTarget::~RawImageRestoreTarget()
+{
+	Close();
+}
+
+int RawImageRestoreTarget::Open(InputParams& params, UINT64 capacity, UINT64 blockSize)
+{
+	//compare, rollback and range restores update an existing image in place
+	bool inPlace = params.compareTarget || !params.currentBackupId.empty() || !params.restoreRanges.empty();
+	m_file = inPlace ? open_file_data(params.targetPath.c_str(), "wb") : create_file_data(params.targetPath.c_str());
+
+	if (!is_file_open(&m_file))
+	{
+		cout << "Image file open error: " << params.targetPath << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_open = true;
+	m_blockSize = blockSize;
+
+	if (set_file_size(&m_file, capacity) != 0)
+	{
+		cout << "Image file resize error: " << params.targetPath << endl;
+		Close();
+
+		return ERROR_CODE;
+	}
+
+	m_batchBuffer = (char*)malloc(RawImageBatchSize);
+
+	return 0;
+}
+
+int RawImageRestoreTarget::WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask)
+{
+	UINT64 offset = blockIndex * m_blockSize;
+
+	//sectors outside the mask keep what the image holds, like on VDDK targets
+	if (count(sectorMask.begin(), sectorMask.end(), true) < (ptrdiff_t)(m_blockSize / VIXDISKLIB_SECTOR_SIZE))
+	{
+		return WriteSectors(offset, buffer, sectorMask);
+	}
+
+	if (is_zero_data(buffer, m_blockSize))
+	{
+		int result = FlushBatch();
+
+		if (result != 0)
+		{
+			return result;
+		}
+
+		//file systems without sparse files cannot punch holes, the zeros are written instead
+		if (punch_hole(&m_file, offset, m_blockSize) != 0 && write_file_data_at(&m_file, buffer, (int)m_blockSize, offset) != (int)m_blockSize)
+		{
+			cout << "Image file write error, offset: " << offset << endl;
+
+			return ERROR_CODE;
+		}
+
+		return 0;
+	}
+
+	if (m_batchLength > 0 && (m_batchOffset + m_batchLength != offset || m_batchLength + m_blockSize > RawImageBatchSize))
+	{
+		int result = FlushBatch();
+
+		if (result != 0)
+		{
+			return result;
+		}
+	}
+
+	if (m_batchLength == 0)
+	{
+		m_batchOffset = offset;
+	}
+
+	memcpy(m_batchBuffer + m_batchLength, buffer, m_blockSize);
+	m_batchLength += m_blockSize;
+
+	return 0;
+}
+
+int RawImageRestoreTarget::WriteSectors(UINT64 offset, const char* buffer, const vector<bool>& sectorMask)
+{
+	int result = FlushBatch();
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	size_t sector = 0;
+
+	while (sector < sectorMask.size())
+	{
+		if (!sectorMask[sector])
+		{
+			sector++;
+			continue;
+		}
+
+		size_t startSector = sector;
+
+		while (sector < sectorMask.size() && sectorMask[sector])
+		{
+			sector++;
+		}
+
+		int length = (int)((sector - startSector) * VIXDISKLIB_SECTOR_SIZE);
+		UINT64 runOffset = offset + startSector * VIXDISKLIB_SECTOR_SIZE;
+
+		if (write_file_data_at(&m_file, buffer + startSector * VIXDISKLIB_SECTOR_SIZE, length, runOffset) != length)
+		{
+			cout << "Image file write error, offset: " << runOffset << endl;
+
+			return ERROR_CODE;
+		}
+	}
+
+	return 0;
+}
+
+int RawImageRestoreTarget::ReadBlock(UINT64 blockIndex, char* buffer)
+{
+	int bytes = read_file_data_at(&m_file, buffer, (int)m_blockSize, blockIndex * m_blockSize);
+
+	return bytes == (int)m_blockSize ? 0 : ERROR_CODE;
+}
+
+int RawImageRestoreTarget::FlushBatch()
+{
+	if (m_batchLength == 0)
+	{
+		return 0;
+	}
+
+	int bytes = write_file_data_at(&m_file, m_batchBuffer, (int)m_batchLength, m_batchOffset);
+
+	if (bytes != (int)m_batchLength)
+	{
+		cout << "Image file write error, offset: " << m_batchOffset << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_batchLength = 0;
+
+	return 0;
+}
+
+int RawImageRestoreTarget::Close()
+{
+	int result = 0;
+
+	if (m_open)
+	{
+		result = FlushBatch();
+
+		flush_file(&m_file);
+		close_file(&m_file);
+		m_open = false;
+	}
+
+	if (m_batchBuffer != NULL)
+	{
+		free(m_batchBuffer);
+		m_batchBuffer = NULL;
+	}
+
+	return result;
+}
@@ -0,0 +1,44 @@
+#ifndef RAWIMAGERESTORETARGET_H
+#define RAWIMAGERESTORETARGET_H
+
+#include "RestoreTarget.h"
+#include "core/file_handler.h"
+
+using namespace std;
+
+//writes a sparse raw disk image, adjacent blocks are batched into large positional writes
+//and blocks without data are left as holes
+class RawImageRestoreTarget : public RestoreTarget
+{
+public:
+	RawImageRestoreTarget();
+
+	RawImageRestoreTarget(const RawImageRestoreTarget&) = delete;
+	RawImageRestoreTarget& operator =(const RawImageRestoreTarget&) = delete;
+
+	~RawImageRestoreTarget();
+
+	int Open(InputParams& params, UINT64 capacity, UINT64 blockSize) override;
+
+	int WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask) override;
+
+	int ReadBlock(UINT64 blockIndex, char* buffer) override;
+
+	int Close() override;
+
+private:
+	int FlushBatch();
+
+	//writes the sectors of a block the mask selects, after the pending batch
+	int WriteSectors(UINT64 offset, const char* buffer, const vector<bool>& sectorMask);
+
+	file_handler m_file;
+	bool m_open;
+	UINT64 m_blockSize;
+
+	char* m_batchBuffer;
+	UINT64 m_batchOffset;
+	size_t m_batchLength;
+};
+
+#endif
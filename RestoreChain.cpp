@@ -0,0 +1,561 @@
+#include <iostream>
+#include <set>
+#include <algorithm>
+#include <iterator>
+#include "RestoreChain.h"
+#include "core/block_envelope.h"
+#include "core/block_layout.h"
+#include "core/granularity.h"
+#include "core/page_block.h"
+
+using namespace std;
+
+//source blocks kept decoded across ReadBlock calls
+const size_t PageSourceCacheBlocks = 64;
+
+int DecodeStoredBlock(const char* cmpBuffer, int size, size_t cmpBufferSize, vector<char>& block, VolumeDictionaries* dictionaries)
+{
+	block.resize(stored_block_raw_length(cmpBuffer, size, cmpBufferSize));
+
+	uint32_t dictionaryId = stored_block_dictionary_id(cmpBuffer, size);
+	const block_dictionary* dictionary = NULL;
+
+	if (dictionaryId != 0 && dictionaries != NULL)
+	{
+		dictionary = dictionaries->Get(dictionaryId);
+	}
+
+	long bytes = open_block(cmpBuffer, size, block.data(), block.size(), dictionary);
+
+	if (bytes < 0)
+	{
+		block.clear();
+		return ERROR_CODE;
+	}
+
+	block.resize(bytes);
+
+	return 0;
+}
+
+int GetBackupBlockData(BackupStorage *backupStorage, string backupId, UINT64 partId, string key, UINT64 partIndex, UINT64 blockSize, vector<char>& block, VolumeDictionaries* dictionaries)
+{
+	size_t cmpBufferSize = 2 * (size_t)blockSize;
+	char* cmpBuffer = (char*)malloc(cmpBufferSize);
+
+	int size = backupStorage->GetBackupBlockData(backupId, partId, key, { partIndex }, cmpBuffer);
+	int result = DecodeStoredBlock(cmpBuffer, size, cmpBufferSize, block, dictionaries);
+
+	free(cmpBuffer);
+
+	return result;
+}
+
+int GetChunkBlockData(BackupStorage *backupStorage, const chunk_id& chunkId, UINT64 blockSize, vector<char>& block)
+{
+	size_t cmpBufferSize = 2 * (size_t)blockSize;
+	char* cmpBuffer = (char*)malloc(cmpBufferSize);
+
+	int size = backupStorage->GetChunkData(chunkId, cmpBuffer);
+
+	//chunks are shared across volumes, so they are never compressed with a volume dictionary
+	int result = size > 0 ? DecodeStoredBlock(cmpBuffer, size, cmpBufferSize, block, NULL) : ERROR_CODE;
+
+	free(cmpBuffer);
+
+	return result;
+}
+
+int GetChunkListBlockData(BackupStorage *backupStorage, const chunk_id* chunkIds, size_t count, UINT64 blockSize, vector<char>& block)
+{
+	vector<char> chunk;
+
+	block.clear();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (GetChunkBlockData(backupStorage, chunkIds[i], blockSize, chunk) != 0)
+		{
+			block.clear();
+			return ERROR_CODE;
+		}
+
+		block.insert(block.end(), chunk.begin(), chunk.end());
+	}
+
+	return 0;
+}
+
+RestoreChain::RestoreChain(BackupStorage* backupStorage, string encryptionKey, const VolumeGeometry& geometry) :
+	m_backupStorage(backupStorage),
+	m_encryptionKey(encryptionKey),
+	m_geometry(geometry),
+	m_dictionaries(backupStorage)
+{
+}
+
+int RestoreChain::Build(const VolumeMetaData& metadata, string backupId, UINT64 capacity)
+{
+	vector<UINT64> partIds;
+	UINT64 partCount = m_geometry.PartitionCount(capacity);
+
+	for (UINT64 partId = 0; partId < partCount; partId++)
+	{
+		partIds.push_back(partId);
+	}
+
+	return BuildPartitions(metadata, backupId, partIds);
+}
+
+int RestoreChain::ResolveChain(const VolumeMetaData& metadata, string backupId, vector<string>& chain) const
+{
+	vector<SyntheticFullInfo> syntheticFulls;
+
+	chain.clear();
+
+	if (m_backupStorage->GetSyntheticFullBackups(syntheticFulls) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	return ResolveChain(metadata, syntheticFulls, backupId, chain);
+}
+
+int RestoreChain::ResolveChain(const VolumeMetaData& metadata, const vector<SyntheticFullInfo>& syntheticFulls, string backupId, vector<string>& chain)
+{
+	chain.clear();
+
+	set<string> synthetic;
+
+	for (const SyntheticFullInfo& info : syntheticFulls)
+	{
+		synthetic.insert(info.backupId);
+
+		//a synthetic full backup holds every block of its restore point
+		if (info.backupId == backupId && !info.complete)
+		{
+			cout << "Synthetic full backup is not complete: " << backupId << endl;
+			return ERROR_CODE;
+		}
+	}
+
+	if (synthetic.count(backupId) > 0)
+	{
+		chain.push_back(backupId);
+		return 0;
+	}
+
+	auto target = find(metadata.backupIds.begin(), metadata.backupIds.end(), backupId);
+	auto end = target != metadata.backupIds.end() ? target + 1 : metadata.backupIds.end();
+
+	//the synthetic full backup that merged the most backups, of those not newer than the restore point.
+	//Merged backups are matched by id, so the chain stays intact once they are deleted.
+	const SyntheticFullInfo* base = NULL;
+	set<string> merged;
+
+	for (const SyntheticFullInfo& info : syntheticFulls)
+	{
+		bool listed = find(metadata.backupIds.begin(), metadata.backupIds.end(), info.backupId) != metadata.backupIds.end();
+		bool newer = info.sourceBackupId != backupId && find(info.mergedBackupIds.begin(), info.mergedBackupIds.end(), backupId) != info.mergedBackupIds.end();
+
+		if (info.complete && listed && !newer && (base == NULL || info.mergedBackupIds.size() > base->mergedBackupIds.size()))
+		{
+			base = &info;
+		}
+	}
+
+	if (base != NULL)
+	{
+		chain.push_back(base->backupId);
+		merged.insert(base->mergedBackupIds.begin(), base->mergedBackupIds.end());
+	}
+
+	for (auto iter = metadata.backupIds.begin(); iter != end; iter++)
+	{
+		if (synthetic.count(*iter) == 0 && merged.count(*iter) == 0)
+		{
+			chain.push_back(*iter);
+		}
+	}
+
+	return 0;
+}
+
+int RestoreChain::BuildPartitions(const VolumeMetaData& metadata, string backupId, const vector<UINT64>& partIds)
+{
+	m_blocks.clear();
+	m_backupIds.clear();
+	m_chunks.clear();
+	m_chunkLists.clear();
+
+	vector<string> chain;
+
+	int chainResult = ResolveChain(metadata, backupId, chain);
+
+	if (chainResult != 0)
+	{
+		return chainResult;
+	}
+
+	for (const string& chainBackupId : chain)
+	{
+		m_backupIds.push_back(chainBackupId);
+
+		for (UINT64 partId : partIds)
+		{
+			vector<UINT64> objects;
+
+			int result = m_backupStorage->ListObjects(chainBackupId, partId, objects);
+
+			if (result != 0)
+			{
+				return result;
+			}
+
+			for (auto iter = objects.begin(); iter != objects.end(); iter++)
+			{
+				UINT64 blockIndex = m_geometry.BlockIndex(partId, *iter);
+				m_blocks[blockIndex].push_back(chainBackupId);
+			}
+		}
+
+		BlockChunkTable chunks;
+		BlockChunkListTable chunkLists;
+
+		int result = m_backupStorage->GetBackupChunkTable(chainBackupId, partIds, chunks, chunkLists);
+
+		if (result != 0)
+		{
+			return result;
+		}
+
+		if (chunks.Size() > 0)
+		{
+			for (uint64_t blockIndex : chunks.keys)
+			{
+				m_blocks[blockIndex].push_back(chainBackupId);
+			}
+
+			m_chunks[chainBackupId] = chunks;
+		}
+
+		if (chunkLists.Size() > 0)
+		{
+			for (uint64_t blockIndex : chunkLists.keys)
+			{
+				m_blocks[blockIndex].push_back(chainBackupId);
+			}
+
+			m_chunkLists[chainBackupId] = chunkLists;
+		}
+	}
+
+	return 0;
+}
+
+int RestoreChain::GetBlocksChangedBetween(const VolumeMetaData& metadata, string firstBackupId, string secondBackupId, UINT64 capacity, vector<UINT64>& blockIndices) const
+{
+	auto first = find(metadata.backupIds.begin(), metadata.backupIds.end(), firstBackupId);
+	auto second = find(metadata.backupIds.begin(), metadata.backupIds.end(), secondBackupId);
+
+	if (first == metadata.backupIds.end() || second == metadata.backupIds.end())
+	{
+		cout << "Restore point not found in the volume backups" << endl;
+		return ERROR_CODE;
+	}
+
+	vector<string> firstChain;
+	vector<string> secondChain;
+
+	if (ResolveChain(metadata, firstBackupId, firstChain) != 0 || ResolveChain(metadata, secondBackupId, secondChain) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//both restore points apply the backups their chains share in the same order,
+	//a block differs only if a backup in one chain and not the other wrote it
+	set<string> firstBackups(firstChain.begin(), firstChain.end());
+	set<string> secondBackups(secondChain.begin(), secondChain.end());
+	vector<string> differing;
+
+	set_symmetric_difference(firstBackups.begin(), firstBackups.end(), secondBackups.begin(), secondBackups.end(), back_inserter(differing));
+
+	set<UINT64> changedBlocks;
+	UINT64 partCount = m_geometry.PartitionCount(capacity);
+
+	for (const string& backupId : differing)
+	{
+		vector<UINT64> partIds;
+
+		for (UINT64 partId = 0; partId < partCount; partId++)
+		{
+			vector<UINT64> objects;
+
+			int result = m_backupStorage->ListObjects(backupId, partId, objects);
+
+			if (result != 0)
+			{
+				return result;
+			}
+
+			for (auto object = objects.begin(); object != objects.end(); object++)
+			{
+				changedBlocks.insert(m_geometry.BlockIndex(partId, *object));
+			}
+
+			partIds.push_back(partId);
+		}
+
+		BlockChunkTable chunks;
+		BlockChunkListTable chunkLists;
+
+		int result = m_backupStorage->GetBackupChunkTable(backupId, partIds, chunks, chunkLists);
+
+		if (result != 0)
+		{
+			return result;
+		}
+
+		changedBlocks.insert(chunks.keys.begin(), chunks.keys.end());
+		changedBlocks.insert(chunkLists.keys.begin(), chunkLists.keys.end());
+	}
+
+	blockIndices.assign(changedBlocks.begin(), changedBlocks.end());
+
+	return 0;
+}
+
+bool RestoreChain::ContainsBlock(UINT64 blockIndex) const
+{
+	return m_blocks.find(blockIndex) != m_blocks.end();
+}
+
+int RestoreChain::GetBlockHashes(map<UINT64, uint64_t>& blockHashes) const
+{
+	//partitions each backup owns the newest version of, only those metadata shards are loaded
+	map<string, vector<UINT64>> backupParts;
+
+	for (auto iter = m_blocks.begin(); iter != m_blocks.end(); iter++)
+	{
+		vector<UINT64>& partIds = backupParts[iter->second.back()];
+		UINT64 partId = m_geometry.PartitionOf(iter->first);
+
+		if (partIds.empty() || partIds.back() != partId)
+		{
+			partIds.push_back(partId);
+		}
+	}
+
+	map<string, BackupMetaData> backups;
+
+	for (auto iter = backupParts.begin(); iter != backupParts.end(); iter++)
+	{
+		if (m_backupStorage->GetBackupMetaData(iter->first, iter->second, backups[iter->first]) != 0)
+		{
+			return ERROR_CODE;
+		}
+	}
+
+	for (auto iter = m_blocks.begin(); iter != m_blocks.end(); iter++)
+	{
+		const BackupMetaData& metadata = backups[iter->second.back()];
+		uint64_t hash = 0;
+
+		if (metadata.blockHashTable.Find(iter->first, hash))
+		{
+			blockHashes[iter->first] = hash;
+		}
+	}
+
+	return 0;
+}
+
+bool RestoreChain::GetChunkReferences(const string& backupId, UINT64 blockIndex, vector<chunk_id>& chunkIds, bool& chunkList) const
+{
+	chunk_id chunkId;
+	const chunk_id* ids = NULL;
+	size_t count = 0;
+	auto chunks = m_chunks.find(backupId);
+	auto chunkLists = m_chunkLists.find(backupId);
+
+	if (chunks != m_chunks.end() && chunks->second.Find(blockIndex, chunkId))
+	{
+		chunkIds.assign(1, chunkId);
+		chunkList = false;
+		return true;
+	}
+
+	if (chunkLists != m_chunkLists.end() && chunkLists->second.Find(blockIndex, ids, count))
+	{
+		chunkIds.assign(ids, ids + count);
+		chunkList = true;
+		return true;
+	}
+
+	return false;
+}
+
+int RestoreChain::ReadBlock(UINT64 blockIndex, char* buffer, vector<bool>& sectorMask) const
+{
+	sectorMask.assign(m_geometry.SectorsPerBlock(), false);
+
+	auto item = m_blocks.find(blockIndex);
+
+	if (item == m_blocks.end())
+	{
+		return 0;
+	}
+
+	UINT64 partId = m_geometry.PartitionOf(blockIndex);
+	UINT64 partIndex = m_geometry.PartitionIndexOf(blockIndex);
+
+	vector<char> block;
+	vector<sector_run> runs;
+
+	for (const string& backupId : item->second)
+	{
+		UINT32 sectorSize = 0;
+		const granularity_kernels* kernels = NULL;
+		int result = 0;
+		chunk_id chunkId;
+		const chunk_id* chunkList = NULL;
+		size_t chunkCount = 0;
+		auto chunks = m_chunks.find(backupId);
+		auto chunkLists = m_chunkLists.find(backupId);
+
+		if (chunks != m_chunks.end() && chunks->second.Find(blockIndex, chunkId))
+		{
+			result = GetChunkBlockData(m_backupStorage, chunkId, m_geometry.blockSize, block);
+		}
+		else if (chunkLists != m_chunkLists.end() && chunkLists->second.Find(blockIndex, chunkList, chunkCount))
+		{
+			result = GetChunkListBlockData(m_backupStorage, chunkList, chunkCount, m_geometry.blockSize, block);
+		}
+		else
+		{
+			result = GetBackupBlockData(m_backupStorage, backupId, partId, m_encryptionKey, partIndex, m_geometry.blockSize, block, &m_dictionaries);
+		}
+
+		if (result == 0 && is_page_block(block.data(), block.size()))
+		{
+			if (ReadPageBlock(block, buffer, sectorMask) != 0)
+			{
+				cout << "Block data error, backup: " << backupId << ", block: " << blockIndex << endl;
+
+				return ERROR_CODE;
+			}
+
+			continue;
+		}
+
+		if (result == 0)
+		{
+			sectorSize = parse_block_sectors(block.data(), block.size(), (UINT32)m_geometry.blockSize, runs);
+			kernels = find_granularity(sectorSize);
+		}
+
+		if (kernels == NULL)
+		{
+			cout << "Block data error, backup: " << backupId << ", block: " << blockIndex << endl;
+
+			return ERROR_CODE;
+		}
+
+		for (const sector_run& run : runs)
+		{
+			memcpy(buffer + (size_t)run.first_sector * sectorSize, run.data, (size_t)run.sector_count * sectorSize);
+
+			kernels->mark_sectors(sectorMask, run.first_sector, run.sector_count);
+		}
+	}
+
+	return 0;
+}
+
+int RestoreChain::ReadPageBlock(const vector<char>& block, char* buffer, vector<bool>& sectorMask) const
+{
+	page_block_view view;
+
+	if (!parse_page_block(block.data(), block.size(), view) || (UINT64)view.pages * DEDUP_PAGE_SIZE > m_geometry.blockSize)
+	{
+		return ERROR_CODE;
+	}
+
+	const granularity_kernels* kernels = find_granularity(DEDUP_PAGE_SIZE);
+	vector<char> source;
+
+	for (uint32_t page = 0; page < view.pages; page++)
+	{
+		uint32_t entry = page_block_entry(view, page);
+		char* ptr = buffer + (size_t)page * DEDUP_PAGE_SIZE;
+
+		if (entry == PAGE_ABSENT)
+		{
+			continue;
+		}
+
+		if (entry == PAGE_ZERO)
+		{
+			memset(ptr, 0, DEDUP_PAGE_SIZE);
+		}
+		else if ((entry & PAGE_REFERENCE_FLAG) == 0)
+		{
+			memcpy(ptr, view.page_data + (size_t)entry * DEDUP_PAGE_SIZE, DEDUP_PAGE_SIZE);
+		}
+		else
+		{
+			page_reference reference = page_block_reference(view, entry & ~PAGE_REFERENCE_FLAG);
+			page_block_view sourceView;
+
+			//referenced pages are always stored by the source block itself, never references again
+			if (GetPageSource(page_block_source(view, reference.source), reference.block_index, source) != 0 ||
+				!parse_page_block(source.data(), source.size(), sourceView) || reference.slot >= sourceView.stored)
+			{
+				return ERROR_CODE;
+			}
+
+			memcpy(ptr, sourceView.page_data + (size_t)reference.slot * DEDUP_PAGE_SIZE, DEDUP_PAGE_SIZE);
+		}
+
+		kernels->mark_sectors(sectorMask, page, 1);
+	}
+
+	return 0;
+}
+
+int RestoreChain::GetPageSource(const string& backupId, UINT64 blockIndex, vector<char>& block) const
+{
+	pair<string, UINT64> key(backupId, blockIndex);
+
+	{
+		lock_guard<mutex> lock(m_pageSourceMutex);
+
+		auto item = m_pageSources.find(key);
+
+		if (item != m_pageSources.end())
+		{
+			block = item->second;
+			return 0;
+		}
+	}
+
+	int result = GetBackupBlockData(m_backupStorage, backupId, m_geometry.PartitionOf(blockIndex), m_encryptionKey,
+									m_geometry.PartitionIndexOf(blockIndex), m_geometry.blockSize, block, &m_dictionaries);
+
+	if (result != 0)
+	{
+		cout << "Referenced page block not available, backup: " << backupId << ", block: " << blockIndex << endl;
+		return result;
+	}
+
+	lock_guard<mutex> lock(m_pageSourceMutex);
+
+	if (m_pageSources.size() >= PageSourceCacheBlocks)
+	{
+		m_pageSources.clear();
+	}
+
+	m_pageSources[key] = block;
+
+	return 0;
+}
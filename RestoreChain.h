@@ -0,0 +1,93 @@
+#ifndef RESTORECHAIN_H
+#define RESTORECHAIN_H
+
+#include <mutex>
+#include "BackupStorage.h"
+#include "VolumeDictionaries.h"
+
+using namespace std;
+
+//decodes a stored block of size bytes read into a buffer of cmpBufferSize bytes, blocks stored
+//before the envelope are assumed to fit that buffer
+int DecodeStoredBlock(const char* cmpBuffer, int size, size_t cmpBufferSize, vector<char>& block, VolumeDictionaries* dictionaries);
+
+//fetches a stored block and decodes it into block, sized to the raw length recorded with it,
+//dictionaries resolves the compression dictionary the block names, if any
+int GetBackupBlockData(BackupStorage *backupStorage, string backupId, UINT64 partId, string key, UINT64 partIndex, UINT64 blockSize, vector<char>& block, VolumeDictionaries* dictionaries);
+
+//same as GetBackupBlockData for a block stored in the client chunk store
+int GetChunkBlockData(BackupStorage *backupStorage, const chunk_id& chunkId, UINT64 blockSize, vector<char>& block);
+
+//concatenates the content defined chunks a block was cut into
+int GetChunkListBlockData(BackupStorage *backupStorage, const chunk_id* chunkIds, size_t count, UINT64 blockSize, vector<char>& block);
+
+//resolves every block of a restore point to the backups of its chain that hold data for it
+class RestoreChain
+{
+public:
+	//every backup of a chain shares the geometry of the full backup that started it
+	RestoreChain(BackupStorage* backupStorage, string encryptionKey, const VolumeGeometry& geometry);
+
+	RestoreChain(const RestoreChain&) = delete;
+	RestoreChain& operator = (const RestoreChain&) = delete;
+
+	//backups whose blocks make up the restore point, oldest first: the newest synthetic full backup
+	//merged from a restore point at or before backupId and the backups after that restore point,
+	//or every backup up to backupId when there is none
+	int ResolveChain(const VolumeMetaData& metadata, string backupId, vector<string>& chain) const;
+
+	//same as ResolveChain with the synthetic full backups of the volume already read, for resolving many restore points
+	static int ResolveChain(const VolumeMetaData& metadata, const vector<SyntheticFullInfo>& syntheticFulls, string backupId, vector<string>& chain);
+
+	//lists the block objects and chunk references of every backup from the start of the chain up to backupId
+	int Build(const VolumeMetaData& metadata, string backupId, UINT64 capacity);
+
+	//same as Build, limited to the given partitions
+	int BuildPartitions(const VolumeMetaData& metadata, string backupId, const vector<UINT64>& partIds);
+
+	//blocks written by the backups after the older and up to the newer of the two restore points
+	int GetBlocksChangedBetween(const VolumeMetaData& metadata, string firstBackupId, string secondBackupId, UINT64 capacity, vector<UINT64>& blockIndices) const;
+
+	bool ContainsBlock(UINT64 blockIndex) const;
+
+	const VolumeGeometry& GetGeometry() const { return m_geometry; }
+
+	//block index -> backup ids holding data for it, oldest first
+	const map<UINT64, vector<string>>& GetBlockIndex() const { return m_blocks; }
+
+	//content hash of every block at the restore point, taken from the newest backup holding it
+	int GetBlockHashes(map<UINT64, uint64_t>& blockHashes) const;
+
+	//chunk store references a backup of the chain holds for a block, false if it stored the block as its own object
+	bool GetChunkReferences(const string& backupId, UINT64 blockIndex, vector<chunk_id>& chunkIds, bool& chunkList) const;
+
+	//composes a whole block of the chain geometry by applying its versions in chain order,
+	//sectorMask marks the sectors that any backup of the chain has written
+	int ReadBlock(UINT64 blockIndex, char* buffer, vector<bool>& sectorMask) const;
+
+private:
+	//applies a page deduplicated block, pages it references are read from the blocks that store them
+	int ReadPageBlock(const vector<char>& block, char* buffer, vector<bool>& sectorMask) const;
+
+	//decoded block of another backup that stores referenced pages
+	int GetPageSource(const string& backupId, UINT64 blockIndex, vector<char>& block) const;
+
+	BackupStorage* m_backupStorage;
+	string m_encryptionKey;
+	VolumeGeometry m_geometry;
+
+	vector<string> m_backupIds;
+	map<UINT64, vector<string>> m_blocks;
+
+	//blocks a backup stored in the chunk store instead of its own block objects
+	map<string, BlockChunkTable> m_chunks;
+	map<string, BlockChunkListTable> m_chunkLists;
+
+	mutable VolumeDictionaries m_dictionaries;
+
+	//source blocks of referenced pages, neighbouring blocks tend to reference the same ones
+	mutable mutex m_pageSourceMutex;
+	mutable map<pair<string, UINT64>, vector<char>> m_pageSources;
+};
+
+#endif
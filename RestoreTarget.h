@@ -0,0 +1,28 @@
+#ifndef RESTORETARGET_H
+#define RESTORETARGET_H
+
+#include "CommonTypes.h"
+
+using namespace std;
+
+//abstract class, inherit from this class to implement custom restore target
+class RestoreTarget
+{
+public:
+	RestoreTarget() {};
+
+	virtual ~RestoreTarget() {};
+
+	//blockSize is the block size of the backup chain, every block passed in afterwards has that size
+	virtual int Open(InputParams& params, UINT64 capacity, UINT64 blockSize) = 0;
+
+	//buffer holds a whole block, sectorMask marks the sectors the restore point holds data for
+	virtual int WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask) = 0;
+
+	//reads back a whole block of the target, used to skip blocks that already match
+	virtual int ReadBlock(UINT64 blockIndex, char* buffer) { return ERROR_CODE; };
+
+	virtual int Close() = 0;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "VddkRestoreTarget.h"
+#include "RawImageRestoreTarget.h"
+#include "Qcow2RestoreTarget.h"
+#include "RangeFileRestoreTarget.h"
+
+class RestoreTargetFactory
+{
+public:
+	RestoreTargetFactory(string type)
+	{
+		if (type == "raw")
+		{
+			m_target = new RawImageRestoreTarget();
+		}
+		else if (type == "qcow2")
+		{
+			m_target = new Qcow2RestoreTarget();
+		}
+		else if (type == "extract")
+		{
+			m_target = new RangeFileRestoreTarget();
+		}
+		else
+		{
+			m_target = new VddkRestoreTarget();
+		}
+	}
+
+	RestoreTarget* GetTarget() { return m_target; }
+
+	~RestoreTargetFactory()
+	{
+		if (m_target)
+		{
+			delete m_target;
+			m_target = NULL;
+		}
+	}
+private:
+	RestoreTarget* m_target;
+};
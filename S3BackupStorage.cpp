@@ -1,13 +1,38 @@
 #include "S3BackupStorage.h"
+#include "MetaDataSerializer.h"
+#include <set>
 
 atomic_int upload_tasks_running(0);
+atomic_int upload_tasks_failed(0);
 SafeQueue<int> upload_queue;
 
+//storages of one process share the SDK and the upload slots, replication opens two
+atomic_int storage_instances(0);
+atomic_bool upload_slots_created(false);
+
 void PutObjectResultHandler(const S3Client* client, const PutObjectRequest& request, const PutObjectOutcome& outcome, const shared_ptr<const Client::AsyncCallerContext>& context)
 {
 	if (!outcome.IsSuccess())
 	{
 		cout << "Error: " << outcome.GetError().GetExceptionName() << " - " << outcome.GetError().GetMessage() << endl;
+
+		upload_tasks_failed++;
+	}
+
+	int index = stoi(context->GetUUID());
+
+	upload_queue.enqueue(index);
+
+	upload_tasks_running--;
+}
+
+void CopyObjectResultHandler(const S3Client* client, const CopyObjectRequest& request, const CopyObjectOutcome& outcome, const shared_ptr<const Client::AsyncCallerContext>& context)
+{
+	if (!outcome.IsSuccess())
+	{
+		cout << "Error: " << outcome.GetError().GetExceptionName() << " - " << outcome.GetError().GetMessage() << endl;
+
+		upload_tasks_failed++;
 	}
 
 	int index = stoi(context->GetUUID());
@@ -57,7 +82,9 @@ int GetDataBlock(string bucket, string region, string key, const char* item, cha
 
 S3BackupStorage::S3BackupStorage(string clientId,
 								 string volumeId,
-								 string region)
+								 string region,
+								 string catalogPath) :
+	m_catalog(catalogPath, clientId, volumeId)
 {
 	m_connectTimeoutMs = 30000;
 	m_requestTimeoutMs = 600000;
@@ -65,7 +92,10 @@ S3BackupStorage::S3BackupStorage(string clientId,
 	m_volumeId = volumeId;
 	m_region = region;
 
-	InitAPI(m_options);
+	if (storage_instances++ == 0)
+	{
+		InitAPI(m_options);
+	}
 
 	Client::ClientConfiguration config;
 	config.scheme = Http::Scheme::HTTPS;
@@ -76,9 +106,13 @@ S3BackupStorage::S3BackupStorage(string clientId,
 
 	m_s3Client = new S3Client(config);
 
-	for (int i = 0; i < UploadBatchSize; i++)
+	//slot indexes address the caller's buffer, so each index is queued once however many storages are open
+	if (!upload_slots_created.exchange(true))
 	{
-		upload_queue.enqueue(i);
+		for (int i = 0; i < UploadBatchSize; i++)
+		{
+			upload_queue.enqueue(i);
+		}
 	}
 }
 
@@ -89,128 +123,259 @@ S3BackupStorage::~S3BackupStorage()
 		delete m_s3Client;
 	}
 
-	ShutdownAPI(m_options);
+	if (--storage_instances == 0)
+	{
+		ShutdownAPI(m_options);
+	}
 }
 
 VolumeMetaData S3BackupStorage::GetVolumeMetaData(string volumeId)
 {
 	VolumeMetaData metadata;
 
-	Client::ClientConfiguration config;
-	config.scheme = Http::Scheme::HTTPS;
-	config.region = m_region.c_str();
-	config.connectTimeoutMs = m_connectTimeoutMs;
-	config.requestTimeoutMs = m_requestTimeoutMs;
-	S3Client s3_client(config);
-
 	string bucket = GetVolumeBucket() + "/metadata";
+	string data;
 
-	GetObjectRequest request;
-	request.WithBucket(bucket.c_str()).WithKey("metadata");
+	//the list changes with every backup, a cached copy is used once S3 confirms it
+	if (GetCatalogObjectData(bucket, "metadata", data, [](const string&) { return false; }, [](const string&) { return true; }) != 0 || data.size() < sizeof(uint32_t))
+	{
+		cout << "Error: volume metadata not found, volume: " << volumeId << endl;
+		return metadata;
+	}
 
-	auto outcome = s3_client.GetObject(request);
+	uint32_t num = *(uint32_t*)data.data();
+	uint32_t pos = sizeof(uint32_t);
 
-	if (outcome.IsSuccess())
+	for (uint32_t i = 0; i < num && pos + BACKUP_UUID_SIZE <= data.size(); i++)
 	{
-		auto size = outcome.GetResult().GetContentLength();
-		char* buffer = (char*)malloc(size);
-		std::streambuf* cbuf = outcome.GetResult().GetBody().rdbuf();
-		cbuf->sgetn(buffer, size);
+		string backupId = string(data.data() + pos, BACKUP_UUID_SIZE * sizeof(char));
+		metadata.backupIds.push_back(backupId);
+		pos += BACKUP_UUID_SIZE * sizeof(char);
+	}
 
-		uint32_t num = *(uint32_t*)buffer;
-		uint32_t pos = sizeof(uint32_t);
+	m_catalog.Prune(metadata);
 
-		for (uint32_t i = 0; i < num; i++)
-		{
-			string backupId = string(buffer + pos, BACKUP_UUID_SIZE * sizeof(char));
-			metadata.backupIds.push_back(backupId);
-			pos += BACKUP_UUID_SIZE * sizeof(char);
-		}
+	return metadata;
+}
 
-		free(buffer);
+int S3BackupStorage::UploadVolumeMetaData(const VolumeMetaData& metadata)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+
+	//[UINT32 count][count x BACKUP_UUID_SIZE chars]
+	uint32_t num = (uint32_t)metadata.backupIds.size();
+	string data((const char*)&num, sizeof(uint32_t));
+
+	for (const string& backupId : metadata.backupIds)
+	{
+		data.append(backupId, 0, BACKUP_UUID_SIZE);
 	}
-	else
+
+	return PutObjectData(bucket, "metadata", data.data(), data.size());
+}
+
+BackupMetaData S3BackupStorage::GetBackupMetaData(string backupId)
+{
+	BackupMetaData metadata;
+
+	if (LoadBackupMetaData(backupId, NULL, true, metadata) != 0)
 	{
-		cout << "Error: "
-			<< outcome.GetError().GetExceptionName() << " - "
-			<< outcome.GetError().GetMessage() << endl;
+		metadata.status = BackupStatus::Error;
 	}
 
 	return metadata;
 }
 
-BackupMetaData S3BackupStorage::GetBackupMetaData(string backupId)
+BackupMetaData S3BackupStorage::GetBackupMetaData(string backupId, const vector<UINT64>& partIds)
 {
 	BackupMetaData metadata;
 
-	Client::ClientConfiguration config;
-	config.scheme = Http::Scheme::HTTPS;
-	config.region = m_region.c_str();
-	config.connectTimeoutMs = m_connectTimeoutMs;
-	config.requestTimeoutMs = m_requestTimeoutMs;
-	S3Client s3_client(config);
+	if (LoadBackupMetaData(backupId, &partIds, true, metadata) != 0)
+	{
+		metadata.status = BackupStatus::Error;
+	}
+
+	return metadata;
+}
+
+int S3BackupStorage::GetBackupMetaData(string backupId, BackupMetaData& metadata)
+{
+	return LoadBackupMetaData(backupId, NULL, true, metadata);
+}
+
+int S3BackupStorage::GetBackupMetaData(string backupId, const vector<UINT64>& partIds, BackupMetaData& metadata)
+{
+	return LoadBackupMetaData(backupId, &partIds, true, metadata);
+}
 
+template <typename Table>
+int S3BackupStorage::LoadMetaDataShards(string backupId, string prefix, const vector<MetaDataShardInfo>& index, const set<uint64_t>* requested, Table& table,
+										bool (*deserialize)(const char*, size_t, Table&), uint64_t (*hash)(const Table&))
+{
 	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
 
-	GetObjectRequest request;
-	request.WithBucket(bucket.c_str()).WithKey("metadata");
+	//the index is sorted by partition, so appending shards keeps the table sorted
+	for (const MetaDataShardInfo& shard : index)
+	{
+		if (requested != NULL && requested->count(shard.partId) == 0)
+		{
+			continue;
+		}
 
-	auto outcome = s3_client.GetObject(request);
+		Table entries;
+		string data;
 
-	if (outcome.IsSuccess())
+		//shards are named in the root with the hash of their entries, a cached copy that matches is current
+		auto current = [&](const string& cached)
+		{
+			Table cachedEntries;
+			return deserialize(cached.data(), cached.size(), cachedEntries) && hash(cachedEntries) == shard.hash;
+		};
+
+		if (GetCatalogObjectData(bucket, prefix + to_string(shard.partId + 1), data, current, [](const string&) { return true; }) != 0 ||
+			!deserialize(data.data(), data.size(), entries) ||
+			hash(entries) != shard.hash)
+		{
+			cout << "Error: backup metadata shard is missing or corrupt, backup: " << backupId << ", shard: " << prefix << shard.partId + 1 << endl;
+			return ERROR_CODE;
+		}
+
+		table.AppendTable(entries);
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::LoadBackupMetaDataRoot(string backupId, BackupMetaData& metadata, MetaDataShardIndex& shards)
+{
+	string data;
+
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+
+	//backups running or failed may still be written, complete ones are final
+	auto complete = [](const string& cached)
 	{
-		auto size = outcome.GetResult().GetContentLength();
-		char* buffer = (char*)malloc(size);
-		std::streambuf* cbuf = outcome.GetResult().GetBody().rdbuf();
-		cbuf->sgetn(buffer, size);
+		BackupMetaData cachedMetadata;
+		MetaDataShardIndex cachedShards;
+		return DeserializeBackupMetaData(cached.data(), cached.size(), cachedMetadata, cachedShards) && cachedMetadata.status == BackupStatus::Complete;
+	};
 
-		metadata.status = (BackupStatus)(*(uint32_t*)buffer);
-		uint32_t pos = sizeof(uint32_t);
-		uint32_t num = *(uint32_t*)(buffer + pos);
-		pos += sizeof(uint32_t);
+	//the metadata of running backups and of tasks carries the key the job uses, it stays off the disk
+	auto keyless = [](const string& cached)
+	{
+		BackupMetaData cachedMetadata;
+		MetaDataShardIndex cachedShards;
+		return DeserializeBackupMetaData(cached.data(), cached.size(), cachedMetadata, cachedShards) && cachedMetadata.encryptionKey.empty();
+	};
 
-		uint32_t emptyBlocks = *(uint32_t*)(buffer + pos);
-		pos += sizeof(uint32_t);
+	if (GetCatalogObjectData(bucket, "metadata", data, complete, keyless) != 0)
+	{
+		cout << "Error: backup metadata not found, backup: " << backupId << endl;
+		return ERROR_CODE;
+	}
 
-		uint32_t encryptionKeyLength = *(uint32_t*)(buffer + pos);
-		pos += sizeof(uint32_t);
+	if (!DeserializeBackupMetaData(data.data(), data.size(), metadata, shards))
+	{
+		cout << "Error: backup metadata is corrupt, backup: " << backupId << endl;
+		metadata = BackupMetaData();
+		return ERROR_CODE;
+	}
+
+	if (metadata.status == BackupStatus::Complete)
+	{
+		lock_guard<mutex> lock(m_catalogMutex);
+		m_completeBackups.insert(backupId);
+	}
 
-		metadata.encryptionKey = string(buffer + pos, encryptionKeyLength * sizeof(char));
-		pos += encryptionKeyLength * sizeof(char);
+	return 0;
+}
 
-		for (uint32_t i = 0; i < num; i++)
-		{
-			uint32_t* keyPtr = (uint32_t*)(buffer + pos);
-			uint32_t key = *keyPtr;
+int S3BackupStorage::LoadBackupMetaData(string backupId, const vector<UINT64>* partIds, bool loadHashes, BackupMetaData& metadata)
+{
+	MetaDataShardIndex shards;
 
-			uint64_t* valuePtr = (uint64_t*)(buffer + pos + sizeof(uint32_t));
-			uint64_t value = *valuePtr;
+	if (LoadBackupMetaDataRoot(backupId, metadata, shards) != 0)
+	{
+		return ERROR_CODE;
+	}
 
-			metadata.blockHashTable[key] = value;
+	set<uint64_t> requested;
 
-			pos += (sizeof(uint32_t) + sizeof(uint64_t));
-		}
+	if (partIds != NULL)
+	{
+		requested.insert(partIds->begin(), partIds->end());
+	}
 
-		for (uint32_t j = 0; j < emptyBlocks; j++)
-		{
-			uint32_t* ptr = (uint32_t*)(buffer + pos);
-			uint32_t index = *ptr;
+	if (partIds != NULL && shards.Empty())
+	{
+		//monolithic metadata of older backups, keep the requested partitions only
+		KeepPartitions(metadata.blockHashTable, metadata.geometry, requested);
+		KeepPartitions(metadata.chunkTable, metadata.geometry, requested);
+		KeepPartitions(metadata.chunkListTable, metadata.geometry, requested);
+	}
 
-			metadata.emptyBlocks.push_back(index);
+	if (!loadHashes)
+	{
+		metadata.blockHashTable = BlockHashTable();
+		shards.hashes.clear();
+	}
 
-			pos += sizeof(uint32_t);
-		}
+	const set<uint64_t>* filter = partIds != NULL ? &requested : NULL;
 
-		free(buffer);
+	//a table missing partitions would restore and compare blocks of older backups in their place
+	if (LoadMetaDataShards(backupId, "shards/", shards.hashes, filter, metadata.blockHashTable, DeserializeBlockHashShard, GetBlockHashShardHash) != 0 ||
+		LoadMetaDataShards(backupId, "chunks/", shards.chunks, filter, metadata.chunkTable, DeserializeBlockChunkShard, GetBlockChunkShardHash) != 0 ||
+		LoadMetaDataShards(backupId, "chunklists/", shards.chunkLists, filter, metadata.chunkListTable, DeserializeBlockChunkListShard, GetBlockChunkListShardHash) != 0)
+	{
+		return ERROR_CODE;
 	}
-	else
+
+	return 0;
+}
+
+int S3BackupStorage::GetBackupChunkTable(string backupId, const vector<UINT64>& partIds, BlockChunkTable& chunks, BlockChunkListTable& chunkLists)
+{
+	BackupMetaData metadata;
+
+	if (LoadBackupMetaData(backupId, &partIds, false, metadata) != 0)
 	{
-		cout << "Error: "
-			<< outcome.GetError().GetExceptionName() << " - "
-			<< outcome.GetError().GetMessage() << endl;
+		return ERROR_CODE;
 	}
 
-	return metadata;
+	chunks = metadata.chunkTable;
+	chunkLists = metadata.chunkListTable;
+
+	return 0;
+}
+
+int S3BackupStorage::GetBackupChunkPartitions(string backupId, vector<UINT64>& partIds)
+{
+	BackupMetaData metadata;
+	MetaDataShardIndex shards;
+	set<uint64_t> found;
+
+	if (LoadBackupMetaDataRoot(backupId, metadata, shards) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//sharded metadata names the partitions in its index, the shards themselves stay unread
+	for (const MetaDataShardInfo& shard : shards.chunks)
+	{
+		found.insert(shard.partId);
+	}
+
+	for (const MetaDataShardInfo& shard : shards.chunkLists)
+	{
+		found.insert(shard.partId);
+	}
+
+	AddPartitions(metadata.chunkTable, metadata.geometry, found);
+	AddPartitions(metadata.chunkListTable, metadata.geometry, found);
+
+	partIds.assign(found.begin(), found.end());
+
+	return 0;
 }
 
 string S3BackupStorage::GetVolumeBucket() const
@@ -218,13 +383,13 @@ string S3BackupStorage::GetVolumeBucket() const
 	return m_clientId + "/" + m_volumeId;
 }
 
-int S3BackupStorage::GetBackupBlockData(string backupId, int partId, string key, const vector<int>& indices, char* buffer)
+int S3BackupStorage::GetBackupBlockData(string backupId, UINT64 partId, string key, const vector<UINT64>& indices, char* buffer)
 {
 	int size = 0;
 
-	for (int i = 0; i < indices.size(); i++)
+	for (size_t i = 0; i < indices.size(); i++)
 	{
-		int index = indices[i];
+		UINT64 index = indices[i];
 		string item = to_string(index + 1);
 
 		string bucket = GetVolumeBucket() + "/backups/" + backupId + "/blockdata/" + to_string(partId + 1);
@@ -234,7 +399,7 @@ int S3BackupStorage::GetBackupBlockData(string backupId, int partId, string key,
 	return size;
 }
 
-void S3BackupStorage::WaitForAllUploadTasksToComplete()
+int S3BackupStorage::WaitForAllUploadTasksToComplete()
 {
 	while (true)
 	{
@@ -247,6 +412,14 @@ void S3BackupStorage::WaitForAllUploadTasksToComplete()
 			this_thread::sleep_for(1s);
 		}
 	}
+
+	//failures are counted once, by the wait that sees them
+	return upload_tasks_failed.exchange(0) == 0 ? 0 : ERROR_CODE;
+}
+
+int S3BackupStorage::GetPendingUploadCount()
+{
+	return upload_tasks_running;
 }
 
 int S3BackupStorage::GetFreeBufferOffsetIndex()
@@ -257,12 +430,25 @@ int S3BackupStorage::GetFreeBufferOffsetIndex()
 }
 
 void S3BackupStorage::UploadBackupSectorDataAsync(string backupId, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/blockdata/";
+
+	PutObjectDataAsync(bucket, item, key, bufferOffset, bufferOffsetIndex, bufferSize);
+}
+
+void S3BackupStorage::UploadChunkDataAsync(const chunk_id& chunkId, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize)
+{
+	string bucket = m_clientId + "/chunks/";
+
+	PutObjectDataAsync(bucket, chunk_id_hex(chunkId), "", bufferOffset, bufferOffsetIndex, bufferSize);
+}
+
+void S3BackupStorage::PutObjectDataAsync(string bucket, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize)
 {
 	char *ptr = (char*)bufferOffset;
 	const char *cstr = item.c_str();
 	streambuf *buf = new membuf(ptr, ptr + bufferSize);
-	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/blockdata/";
-		
+
 	auto objectStream = MakeShared<IOStream>("BlockUpload", buf);
 	
 	PutObjectRequest request;
@@ -288,83 +474,130 @@ void S3BackupStorage::UploadBackupSectorDataAsync(string backupId, string item,
 	m_s3Client->PutObjectAsync(request, PutObjectResultHandler, context);
 }
 
-void S3BackupStorage::UploadBackupMetaData(string backupId, BackupMetaData &metadata)
+void S3BackupStorage::CopyBackupBlockDataAsync(string sourceBackupId, string backupId, UINT64 partId, UINT64 partIndex, string key)
 {
-	size_t size = 3 * sizeof(int) +
-		(sizeof(uint32_t) + sizeof(char) * metadata.encryptionKey.length()) +
-		(sizeof(uint32_t) + sizeof(uint64_t)) * metadata.blockHashTable.size() +
-		(sizeof(uint32_t) * metadata.emptyBlocks.size());
+	string item = to_string(partId + 1) + "/" + to_string(partIndex + 1);
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/blockdata/";
+	string source = GetVolumeBucket() + "/backups/" + sourceBackupId + "/blockdata/" + item;
 
-	char* buffer = (char*)malloc(size);
+	//no buffer is needed, the slot only bounds the requests in flight
+	int index = GetFreeBufferOffsetIndex();
 
-	long pos = 0;
+	CopyObjectRequest request;
+	request.WithBucket(bucket.c_str()).WithKey(item.c_str()).WithCopySource(source.c_str());
 
-	uint32_t status = (uint32_t)metadata.status;
-	memcpy(buffer, (void*)&status, sizeof(uint32_t));
-	pos += sizeof(uint32_t);
+	if (!key.empty())
+	{
+		auto keyEncoded = Aws::Utils::HashingUtils::Base64Encode(Aws::Utils::ByteBuffer((unsigned char*)key.c_str(), key.length()));
+		auto md5Encoded = Aws::Utils::HashingUtils::Base64Encode(Aws::Utils::HashingUtils::CalculateMD5(Aws::String(key.c_str())));
 
-	uint32_t num = (uint32_t)metadata.blockHashTable.size();
-	memcpy(buffer + pos, (void*)&num, sizeof(uint32_t));
-	pos += sizeof(uint32_t);
+		//every backup of a volume shares its key, the copy is decrypted and encrypted with the same one
+		request.SetSSECustomerAlgorithm("AES256");
+		request.SetSSECustomerKey(keyEncoded);
+		request.SetSSECustomerKeyMD5(md5Encoded);
+		request.SetCopySourceSSECustomerAlgorithm("AES256");
+		request.SetCopySourceSSECustomerKey(keyEncoded);
+		request.SetCopySourceSSECustomerKeyMD5(md5Encoded);
+	}
 
-	uint32_t emptyBlocks = (uint32_t)metadata.emptyBlocks.size();
-	memcpy(buffer + pos, (void*)&emptyBlocks, sizeof(uint32_t));
-	pos += sizeof(uint32_t);
+	shared_ptr<Client::AsyncCallerContext> context = MakeShared<Client::AsyncCallerContext>("CopyObjectAllocationTag");
+	context->SetUUID(to_string(index));
 
-	uint32_t keyLength = (uint32_t)metadata.encryptionKey.length();
-	memcpy(buffer + pos, (void*)&keyLength, sizeof(uint32_t));
-	pos += sizeof(uint32_t);
+	upload_tasks_running++;
 
-	if (keyLength > 0)
-	{
-		const char* ptr = metadata.encryptionKey.c_str();
-		memcpy(buffer + pos, (void*)ptr, keyLength * sizeof(char));
-		pos += keyLength * sizeof(char);
-	}
+	m_s3Client->CopyObjectAsync(request, CopyObjectResultHandler, context);
+}
 
-	for (auto iter = metadata.blockHashTable.begin(); iter != metadata.blockHashTable.end(); iter++)
-	{
-		memcpy(buffer + pos, (void*)&(iter->first), sizeof(uint32_t));
-		memcpy(buffer + pos + sizeof(uint32_t), (void*)&(iter->second), sizeof(uint64_t));
+template <typename Table>
+int S3BackupStorage::UploadMetaDataShards(string backupId, string prefix, const Table& table, const VolumeGeometry& geometry,
+										  string (*serialize)(const Table&), uint64_t (*hash)(const Table&), vector<MetaDataShardInfo>& index)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	map<string, uint64_t>& uploaded = m_uploadedShards[backupId];
+	map<uint64_t, Table> shards;
 
-		pos += (sizeof(uint32_t) + sizeof(uint64_t));
-	}
+	SplitBlockTable(table, geometry, shards);
 
-	for (size_t i = 0; i < metadata.emptyBlocks.size(); i++)
+	for (auto iter = shards.begin(); iter != shards.end(); iter++)
 	{
-		uint32_t index = metadata.emptyBlocks[i];
-		memcpy(buffer + pos, (void*)&index, sizeof(uint32_t));
+		MetaDataShardInfo shard;
+		shard.partId = iter->first;
+		shard.hash = hash(iter->second);
+		shard.entries = iter->second.Size();
 
-		pos += sizeof(uint32_t);
-	}
+		string key = prefix + to_string(shard.partId + 1);
+		auto previous = uploaded.find(key);
 
-	Client::ClientConfiguration config;
-	config.scheme = Http::Scheme::HTTPS;
-	config.region = m_region.c_str();
-	config.connectTimeoutMs = m_connectTimeoutMs;
-	config.requestTimeoutMs = m_requestTimeoutMs;
-	S3Client s3_client(config);
+		if (previous == uploaded.end() || previous->second != shard.hash)
+		{
+			string data = serialize(iter->second);
 
-	streambuf *buf = new membuf(buffer, buffer + size);
-	auto objectStream = MakeShared<IOStream>("BlockUpload", buf);
+			if (PutObjectData(bucket, key, data.data(), data.size()) != 0)
+			{
+				cout << "Error: backup metadata shard upload failed, backup: " << backupId << ", shard: " << key << endl;
+				return ERROR_CODE;
+			}
+
+			uploaded[key] = shard.hash;
+		}
+
+		index.push_back(shard);
+	}
+
+	return 0;
+}
 
+int S3BackupStorage::UploadBackupMetaData(string backupId, BackupMetaData &metadata)
+{
 	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
 
-	PutObjectRequest request;
-	request.WithBucket(bucket.c_str()).WithKey("metadata");
-	request.SetBody(objectStream);
-	request.SetContentLength(size);
+	if (m_uploadedShards.find(backupId) == m_uploadedShards.end())
+	{
+		//shards a previous run of this backup already uploaded
+		map<string, uint64_t>& uploaded = m_uploadedShards[backupId];
+		BackupMetaData previous;
+		MetaDataShardIndex previousShards;
+		string data;
 
-	auto outcome = s3_client.PutObject(request);
+		if (GetObjectData(bucket, "metadata", data) == 0 && DeserializeBackupMetaData(data.data(), data.size(), previous, previousShards))
+		{
+			for (const MetaDataShardInfo& shard : previousShards.hashes)
+			{
+				uploaded["shards/" + to_string(shard.partId + 1)] = shard.hash;
+			}
 
-	if (!outcome.IsSuccess())
+			for (const MetaDataShardInfo& shard : previousShards.chunks)
+			{
+				uploaded["chunks/" + to_string(shard.partId + 1)] = shard.hash;
+			}
+
+			for (const MetaDataShardInfo& shard : previousShards.chunkLists)
+			{
+				uploaded["chunklists/" + to_string(shard.partId + 1)] = shard.hash;
+			}
+		}
+	}
+
+	MetaDataShardIndex index;
+
+	//the root names every shard, one that is not stored must not be listed
+	if (UploadMetaDataShards(backupId, "shards/", metadata.blockHashTable, metadata.geometry, SerializeBlockHashShard, GetBlockHashShardHash, index.hashes) != 0 ||
+		UploadMetaDataShards(backupId, "chunks/", metadata.chunkTable, metadata.geometry, SerializeBlockChunkShard, GetBlockChunkShardHash, index.chunks) != 0 ||
+		UploadMetaDataShards(backupId, "chunklists/", metadata.chunkListTable, metadata.geometry, SerializeBlockChunkListShard, GetBlockChunkListShardHash, index.chunkLists) != 0)
 	{
-		cout << "Error: "
-			<< outcome.GetError().GetExceptionName() << " - "
-			<< outcome.GetError().GetMessage() << endl;
+		return ERROR_CODE;
 	}
 
-	free(buffer);
+	string data = SerializeBackupMetaDataRoot(metadata, index);
+	int result = PutObjectData(bucket, "metadata", data.data(), data.size());
+
+	//the next read takes the new status from S3
+	m_catalog.Remove("backups/" + backupId + "/metadata/metadata");
+
+	lock_guard<mutex> lock(m_catalogMutex);
+	m_completeBackups.erase(backupId);
+
+	return result;
 }
 
 RestoreTaskMetaData S3BackupStorage::GetRestoreTaskMetaData(string restoreId)
@@ -467,9 +700,23 @@ void S3BackupStorage::UploadRestoreTaskMetaData(const RestoreTaskMetaData &metad
 	free(buffer);
 }
 
-int S3BackupStorage::ListObjects(string backupId, int partId, vector<int>& objects)
+int S3BackupStorage::ListObjects(string backupId, UINT64 partId, vector<UINT64>& objects)
 {
-	int result = 0;
+	//block indexes of complete backups are cached as an array
+	string listingKey = "backups/" + backupId + "/blockdata/" + to_string(partId + 1);
+	bool complete = IsBackupComplete(backupId);
+	string listing;
+	string etag;
+
+	if (complete && m_catalog.Get(listingKey, listing, etag) == 0 && listing.size() % sizeof(UINT64) == 0)
+	{
+		objects.resize(listing.size() / sizeof(UINT64));
+		memcpy(objects.data(), listing.data(), listing.size());
+
+		return 0;
+	}
+
+	int result = 0;
 	Client::ClientConfiguration config;
 	config.scheme = Http::Scheme::HTTPS;
 	config.region = m_region.c_str();
@@ -511,7 +758,7 @@ int S3BackupStorage::ListObjects(string backupId, int partId, vector<int>& objec
 						key.erase(0, pos + prefix.length());
 					}
 
-					auto object = atoi(key.c_str()) - 1;
+					UINT64 object = strtoull(key.c_str(), NULL, 10) - 1;
 
 					if (std::find(objects.begin(), objects.end(), object) == objects.end())
 					{
@@ -528,5 +775,675 @@ int S3BackupStorage::ListObjects(string backupId, int partId, vector<int>& objec
 	}
 	while (outcome.GetResult().GetIsTruncated());
 
+	if (result == 0 && complete)
+	{
+		m_catalog.Put(listingKey, string((const char*)objects.data(), objects.size() * sizeof(UINT64)), "");
+	}
+
 	return result;
 }
+
+int S3BackupStorage::PutObjectData(string bucket, string key, const char* data, size_t size)
+{
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	streambuf *buf = new membuf((char*)data, (char*)data + size);
+	auto objectStream = MakeShared<IOStream>("MetadataUpload", buf);
+
+	PutObjectRequest request;
+	request.WithBucket(bucket.c_str()).WithKey(key.c_str());
+	request.SetBody(objectStream);
+	request.SetContentLength(size);
+
+	auto outcome = s3_client.PutObject(request);
+
+	delete buf;
+
+	if (!outcome.IsSuccess())
+	{
+		cout << "Error: "
+			<< outcome.GetError().GetExceptionName() << " - "
+			<< outcome.GetError().GetMessage() << endl;
+
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::GetObjectData(string bucket, string key, string& data)
+{
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	GetObjectRequest request;
+	request.WithBucket(bucket.c_str()).WithKey(key.c_str());
+
+	auto outcome = s3_client.GetObject(request);
+
+	if (!outcome.IsSuccess())
+	{
+		return ERROR_CODE;
+	}
+
+	auto size = outcome.GetResult().GetContentLength();
+	data.resize(size);
+
+	std::streambuf* cbuf = outcome.GetResult().GetBody().rdbuf();
+
+	return cbuf->sgetn(&data[0], size) == size ? 0 : ERROR_CODE;
+}
+
+int S3BackupStorage::GetObjectDataIfChanged(string bucket, string key, string& data, string& etag, bool& changed)
+{
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	GetObjectRequest request;
+	request.WithBucket(bucket.c_str()).WithKey(key.c_str());
+
+	if (!etag.empty())
+	{
+		request.SetIfNoneMatch(etag.c_str());
+	}
+
+	auto outcome = s3_client.GetObject(request);
+	changed = false;
+
+	if (!outcome.IsSuccess())
+	{
+		return !etag.empty() && outcome.GetError().GetResponseCode() == Http::HttpResponseCode::NOT_MODIFIED ? 0 : ERROR_CODE;
+	}
+
+	auto size = outcome.GetResult().GetContentLength();
+	data.resize(size);
+
+	std::streambuf* cbuf = outcome.GetResult().GetBody().rdbuf();
+
+	if (cbuf->sgetn(&data[0], size) != size)
+	{
+		return ERROR_CODE;
+	}
+
+	etag = outcome.GetResult().GetETag().c_str();
+	changed = true;
+
+	return 0;
+}
+
+int S3BackupStorage::GetCatalogObjectData(string bucket, string key, string& data, const function<bool(const string&)>& final, const function<bool(const string&)>& cacheable)
+{
+	if (!m_catalog.Enabled())
+	{
+		return GetObjectData(bucket, key, data);
+	}
+
+	//keys within the volume, as the catalog of the volume names its entries
+	string catalogKey = bucket.substr(GetVolumeBucket().size() + 1) + "/" + key;
+	string cached;
+	string etag;
+
+	//entries catalogs wrote before objects with keys were left out are dropped
+	if (m_catalog.Get(catalogKey, cached, etag) == 0 && cacheable(cached))
+	{
+		if (final(cached))
+		{
+			data.swap(cached);
+			return 0;
+		}
+	}
+	else
+	{
+		m_catalog.Remove(catalogKey);
+		etag.clear();
+	}
+
+	bool changed = false;
+
+	if (GetObjectDataIfChanged(bucket, key, data, etag, changed) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	if (!changed)
+	{
+		data.swap(cached);
+		return 0;
+	}
+
+	if (cacheable(data))
+	{
+		m_catalog.Put(catalogKey, data, etag);
+	}
+
+	return 0;
+}
+
+bool S3BackupStorage::IsBackupComplete(string backupId)
+{
+	if (!m_catalog.Enabled())
+	{
+		return false;
+	}
+
+	{
+		lock_guard<mutex> lock(m_catalogMutex);
+
+		if (m_completeBackups.count(backupId) > 0)
+		{
+			return true;
+		}
+	}
+
+	BackupMetaData metadata;
+	MetaDataShardIndex shards;
+	string data;
+	string etag;
+
+	if (m_catalog.Get("backups/" + backupId + "/metadata/metadata", data, etag) != 0 ||
+		!DeserializeBackupMetaData(data.data(), data.size(), metadata, shards) ||
+		metadata.status != BackupStatus::Complete)
+	{
+		return false;
+	}
+
+	lock_guard<mutex> lock(m_catalogMutex);
+	m_completeBackups.insert(backupId);
+
+	return true;
+}
+
+int S3BackupStorage::UploadVolumeDictionary(uint32_t dictionaryId, const string& dictionary)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+
+	int result = PutObjectData(bucket, "dictionaries/" + to_string(dictionaryId), dictionary.data(), dictionary.size());
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	//current dictionary: [UINT32 id][dictionary]
+	string current((const char*)&dictionaryId, sizeof(uint32_t));
+	current += dictionary;
+
+	return PutObjectData(bucket, "dictionary", current.data(), current.size());
+}
+
+int S3BackupStorage::GetVolumeDictionary(uint32_t& dictionaryId, string& dictionary)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+
+	if (dictionaryId != 0)
+	{
+		return GetObjectData(bucket, "dictionaries/" + to_string(dictionaryId), dictionary);
+	}
+
+	string current;
+
+	if (GetObjectData(bucket, "dictionary", current) != 0 || current.size() < sizeof(uint32_t))
+	{
+		return ERROR_CODE;
+	}
+
+	memcpy(&dictionaryId, current.data(), sizeof(uint32_t));
+	dictionary = current.substr(sizeof(uint32_t));
+
+	return 0;
+}
+
+int S3BackupStorage::UploadVolumeGeometry(const VolumeGeometry& geometry)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+
+	//[UINT64 block size][UINT64 blocks per partition]
+	uint64_t data[2] = { geometry.blockSize, geometry.partitionBlocks };
+
+	return PutObjectData(bucket, "geometry", (const char*)data, sizeof(data));
+}
+
+int S3BackupStorage::GetVolumeGeometry(VolumeGeometry& geometry)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+	string data;
+
+	if (GetObjectData(bucket, "geometry", data) != 0 || data.size() < 2 * sizeof(uint64_t))
+	{
+		return ERROR_CODE;
+	}
+
+	memcpy(&geometry.blockSize, data.data(), sizeof(uint64_t));
+	memcpy(&geometry.partitionBlocks, data.data() + sizeof(uint64_t), sizeof(uint64_t));
+
+	return geometry.IsValid() ? 0 : ERROR_CODE;
+}
+
+int S3BackupStorage::GetChunkData(const chunk_id& chunkId, char* buffer)
+{
+	string bucket = m_clientId + "/chunks";
+
+	return GetDataBlock(bucket, m_region, "", chunk_id_hex(chunkId).c_str(), buffer);
+}
+
+int S3BackupStorage::UploadChunkIndexSegment(string backupId, const vector<chunk_id>& chunkIds)
+{
+	string bucket = m_clientId + "/chunkindex";
+	string data = SerializeChunkIndexSegment(chunkIds);
+
+	return PutObjectData(bucket, m_volumeId + "-" + backupId, data.data(), data.size());
+}
+
+int S3BackupStorage::GetChunkIndex(ChunkIndex& index)
+{
+	vector<string> segments;
+
+	if (ListObjectKeys(m_clientId, "chunkindex/", segments) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	for (const string& segment : segments)
+	{
+		string data;
+		vector<chunk_id> chunkIds;
+
+		//a chunk missing from the index is only uploaded again, never lost
+		if (GetObjectData(m_clientId, segment, data) != 0 || !DeserializeChunkIndexSegment(data.data(), data.size(), chunkIds))
+		{
+			cout << "Error: chunk index segment is missing or corrupt: " << segment << endl;
+			continue;
+		}
+
+		index.Reserve(index.Size() + chunkIds.size());
+
+		for (const chunk_id& chunkId : chunkIds)
+		{
+			index.Insert(chunkId);
+		}
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::UploadPageIndexSegment(string backupId, const vector<page_index_entry>& pages, const vector<page_source_reference>& references)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data = SerializePageIndexSegment(pages, references);
+
+	return PutObjectData(bucket, "pages", data.data(), data.size());
+}
+
+int S3BackupStorage::GetPageIndexSegment(string backupId, vector<page_index_entry>& pages, vector<page_source_reference>& references)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data;
+
+	if (GetObjectData(bucket, "pages", data) != 0 || !DeserializePageIndexSegment(data.data(), data.size(), pages, references))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::UploadSyntheticFullBackups(const vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+	string data = SerializeSyntheticFulls(syntheticFulls);
+
+	return PutObjectData(bucket, "syntheticfulls", data.data(), data.size());
+}
+
+int S3BackupStorage::GetSyntheticFullBackups(vector<SyntheticFullInfo>& syntheticFulls)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+	string data;
+
+	syntheticFulls.clear();
+
+	//volumes without synthetic full backups have no list
+	if (GetObjectData(bucket, "syntheticfulls", data) != 0)
+	{
+		return 0;
+	}
+
+	if (!DeserializeSyntheticFulls(data.data(), data.size(), syntheticFulls))
+	{
+		cout << "Error: synthetic full backup list is corrupt" << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::GetBackupCompletedTime(string backupId, time_t& completedTime)
+{
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+
+	HeadObjectRequest request;
+	request.WithBucket(bucket.c_str()).WithKey("metadata");
+
+	auto outcome = s3_client.HeadObject(request);
+
+	if (!outcome.IsSuccess())
+	{
+		cout << "Error: " << outcome.GetError().GetExceptionName() << " - " << outcome.GetError().GetMessage() << endl;
+		return ERROR_CODE;
+	}
+
+	completedTime = (time_t)outcome.GetResult().GetLastModified().Seconds();
+
+	return 0;
+}
+
+int S3BackupStorage::UploadRecompressedBackups(const vector<RecompressedBackupInfo>& backups)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+	string data = SerializeRecompressedBackups(backups);
+
+	return PutObjectData(bucket, "recompressed", data.data(), data.size());
+}
+
+int S3BackupStorage::GetRecompressedBackups(vector<RecompressedBackupInfo>& backups)
+{
+	string bucket = GetVolumeBucket() + "/metadata";
+	string data;
+
+	backups.clear();
+
+	//volumes never recompressed have no list
+	if (GetObjectData(bucket, "recompressed", data) != 0)
+	{
+		return 0;
+	}
+
+	if (!DeserializeRecompressedBackups(data.data(), data.size(), backups))
+	{
+		cout << "Error: recompressed backup list is corrupt" << endl;
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::UploadMerkleTreeRoot(string backupId, const MerkleTreeRoot& root)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data = SerializeMerkleTreeRoot(root);
+
+	return PutObjectData(bucket, "merkle", data.data(), data.size());
+}
+
+int S3BackupStorage::GetMerkleTreeRoot(string backupId, MerkleTreeRoot& root)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data;
+
+	//trees are cached once their backup is complete, they are written before it is
+	int result = IsBackupComplete(backupId) ? GetCatalogObjectData(bucket, "merkle", data, [](const string&) { return true; }, [](const string&) { return true; }) : GetObjectData(bucket, "merkle", data);
+
+	if (result != 0 || !DeserializeMerkleTreeRoot(data.data(), data.size(), root))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::UploadMerkleTreeLeaves(string backupId, UINT64 partId, const vector<uint64_t>& leaves)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data = SerializeMerkleTreeLeaves(leaves);
+
+	return PutObjectData(bucket, "merkle/" + to_string(partId + 1), data.data(), data.size());
+}
+
+int S3BackupStorage::GetMerkleTreeLeaves(string backupId, UINT64 partId, vector<uint64_t>& leaves)
+{
+	string bucket = GetVolumeBucket() + "/backups/" + backupId + "/metadata";
+	string data;
+
+	string key = "merkle/" + to_string(partId + 1);
+	int result = IsBackupComplete(backupId) ? GetCatalogObjectData(bucket, key, data, [](const string&) { return true; }, [](const string&) { return true; }) : GetObjectData(bucket, key, data);
+
+	if (result != 0 || !DeserializeMerkleTreeLeaves(data.data(), data.size(), leaves))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+//keys below are relative to the client bucket, as ListObjectKeys returns them
+
+int S3BackupStorage::ListBackupObjectKeys(string backupId, vector<string>& keys)
+{
+	return ListObjectKeys(m_clientId, m_volumeId + "/backups/" + backupId + "/", keys);
+}
+
+int S3BackupStorage::HasPageIndexSegment(string backupId, bool& exists)
+{
+	vector<string> keys;
+	string key = m_volumeId + "/backups/" + backupId + "/metadata/pages";
+
+	if (ListObjectKeys(m_clientId, key, keys) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	exists = find(keys.begin(), keys.end(), key) != keys.end();
+
+	return 0;
+}
+
+string S3BackupStorage::GetBlockObjectKey(string backupId, UINT64 partId, UINT64 partIndex)
+{
+	return m_volumeId + "/backups/" + backupId + "/blockdata/" + to_string(partId + 1) + "/" + to_string(partIndex + 1);
+}
+
+string S3BackupStorage::GetChunkObjectKey(const chunk_id& chunkId)
+{
+	return "chunks/" + chunk_id_hex(chunkId);
+}
+
+string S3BackupStorage::GetChunkIndexSegmentKey(string backupId)
+{
+	return "chunkindex/" + m_volumeId + "-" + backupId;
+}
+
+int S3BackupStorage::DeleteObjects(const vector<string>& keys)
+{
+	//catalog entries of backups losing objects would name them still
+	string backupsPrefix = m_volumeId + "/backups/";
+	set<string> backupIds;
+
+	for (const string& key : keys)
+	{
+		if (key.compare(0, backupsPrefix.size(), backupsPrefix) == 0 && key.size() >= backupsPrefix.size() + BACKUP_UUID_SIZE)
+		{
+			backupIds.insert(key.substr(backupsPrefix.size(), BACKUP_UUID_SIZE));
+		}
+	}
+
+	for (const string& backupId : backupIds)
+	{
+		m_catalog.RemoveBackup(backupId);
+
+		lock_guard<mutex> lock(m_catalogMutex);
+		m_completeBackups.erase(backupId);
+	}
+
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	//a single request deletes at most this many keys
+	const size_t MaxDeleteKeys = 1000;
+
+	for (size_t offset = 0; offset < keys.size(); offset += MaxDeleteKeys)
+	{
+		Delete batch;
+		batch.WithQuiet(true);
+
+		for (size_t i = offset; i < min(keys.size(), offset + MaxDeleteKeys); i++)
+		{
+			batch.AddObjects(ObjectIdentifier().WithKey(keys[i].c_str()));
+		}
+
+		DeleteObjectsRequest request;
+		request.WithBucket(m_clientId.c_str()).WithDelete(batch);
+
+		auto outcome = s3_client.DeleteObjects(request);
+
+		if (!outcome.IsSuccess())
+		{
+			cout << "Error: " << outcome.GetError().GetExceptionName() << " - " << outcome.GetError().GetMessage() << endl;
+			return ERROR_CODE;
+		}
+
+		//quiet batches succeed as a request and list only the keys that were not deleted
+		int result = 0;
+
+		for (const auto& error : outcome.GetResult().GetErrors())
+		{
+			if (error.GetCode() != "NoSuchKey")
+			{
+				cout << "Error: object not deleted: " << error.GetKey() << " - " << error.GetCode() << " - " << error.GetMessage() << endl;
+				result = ERROR_CODE;
+			}
+		}
+
+		if (result != 0)
+		{
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::ListChunkIndexSegments(vector<pair<string, string>>& segments)
+{
+	vector<string> keys;
+	string prefix = "chunkindex/";
+
+	if (ListObjectKeys(m_clientId, prefix, keys) != 0)
+	{
+		return ERROR_CODE;
+	}
+
+	//segments are named <volume id>-<backup id>, volume ids may contain dashes themselves
+	for (const string& key : keys)
+	{
+		if (key.size() > prefix.size() + BACKUP_UUID_SIZE + 1)
+		{
+			size_t volumeLength = key.size() - prefix.size() - BACKUP_UUID_SIZE - 1;
+			segments.push_back(make_pair(key.substr(prefix.size(), volumeLength), key.substr(key.size() - BACKUP_UUID_SIZE)));
+		}
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::GetChunkIndexSegment(string volumeId, string backupId, vector<chunk_id>& chunkIds)
+{
+	string data;
+
+	if (GetObjectData(m_clientId, "chunkindex/" + volumeId + "-" + backupId, data) != 0 || !DeserializeChunkIndexSegment(data.data(), data.size(), chunkIds))
+	{
+		return ERROR_CODE;
+	}
+
+	return 0;
+}
+
+int S3BackupStorage::UploadCollectorObject(string name, const string& data)
+{
+	return PutObjectData(GetVolumeBucket() + "/gc", name, data.data(), data.size());
+}
+
+int S3BackupStorage::GetCollectorObject(string volumeId, string name, string& data)
+{
+	return GetObjectData(m_clientId + "/" + volumeId + "/gc", name, data);
+}
+
+string S3BackupStorage::GetCollectorObjectKey(string name)
+{
+	return m_volumeId + "/gc/" + name;
+}
+
+int S3BackupStorage::UploadReplicationObject(string name, const string& data)
+{
+	return PutObjectData(GetVolumeBucket() + "/replication", name, data.data(), data.size());
+}
+
+int S3BackupStorage::GetReplicationObject(string name, string& data)
+{
+	return GetObjectData(GetVolumeBucket() + "/replication", name, data);
+}
+
+int S3BackupStorage::ListObjectKeys(string bucket, string prefix, vector<string>& keys)
+{
+	Client::ClientConfiguration config;
+	config.scheme = Http::Scheme::HTTPS;
+	config.region = m_region.c_str();
+	config.connectTimeoutMs = m_connectTimeoutMs;
+	config.requestTimeoutMs = m_requestTimeoutMs;
+	S3Client s3_client(config);
+
+	ListObjectsRequest request;
+	request.WithBucket(bucket.c_str()).WithPrefix(prefix.c_str());
+
+	ListObjectsOutcome outcome;
+
+	do
+	{
+		outcome = s3_client.ListObjects(request);
+
+		if (!outcome.IsSuccess())
+		{
+			cout << "Error: " << outcome.GetError().GetExceptionName() << " - " << outcome.GetError().GetMessage() << endl;
+			return ERROR_CODE;
+		}
+
+		auto objects = outcome.GetResult().GetContents();
+
+		for (auto iter = objects.begin(); iter != objects.end(); iter++)
+		{
+			keys.push_back(iter->GetKey().c_str());
+		}
+
+		//without a delimiter S3 leaves the next marker out, the last key is the marker then
+		if (!objects.empty())
+		{
+			request.SetMarker(objects.back().GetKey());
+		}
+	}
+	while (outcome.GetResult().GetIsTruncated());
+
+	return 0;
+}
@@ -1,15 +1,23 @@
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
 #include <aws/core/Aws.h>
 #include <aws/core/utils/threading/Executor.h>
 #include <aws/core/utils/HashingUtils.h>
 #include <aws/core/client/DefaultRetryStrategy.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/CopyObjectRequest.h>
+#include <aws/s3/model/DeleteObjectsRequest.h>
 #include <aws/s3/model/ListObjectsRequest.h>
 #include "core/membuf.h"
 #include "core/thread_safe_queue.h"
 #include "BackupStorage.h"
+#include "MetaDataSerializer.h"
+#include "MetaDataCatalog.h"
 
 using namespace Aws;
 using namespace S3;
@@ -18,7 +26,8 @@ using namespace S3::Model;
 class S3BackupStorage : public BackupStorage
 {
 public:
-	S3BackupStorage(string clientId, string volumeId, string region);
+	//catalogPath names the directory of the proxy's metadata catalog, empty to read every object from S3
+	S3BackupStorage(string clientId, string volumeId, string region, string catalogPath);
 
 	S3BackupStorage() = delete;
 	S3BackupStorage(const S3BackupStorage&) = delete;
@@ -32,25 +41,145 @@ public:
 
 	void UploadBackupSectorDataAsync(string backupId, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) override;
 
-	void WaitForAllUploadTasksToComplete() override;
+	int WaitForAllUploadTasksToComplete() override;
 
-	void UploadBackupMetaData(string backupId, BackupMetaData &metadata) override;
+	int GetPendingUploadCount() override;
+
+	int UploadBackupMetaData(string backupId, BackupMetaData &metadata) override;
 
 	VolumeMetaData GetVolumeMetaData(string volumeId) override;
 
+	int UploadVolumeMetaData(const VolumeMetaData& metadata) override;
+
 	BackupMetaData GetBackupMetaData(string backupId) override;
 
+	BackupMetaData GetBackupMetaData(string backupId, const vector<UINT64>& partIds) override;
+
+	int GetBackupMetaData(string backupId, BackupMetaData& metadata) override;
+
+	int GetBackupMetaData(string backupId, const vector<UINT64>& partIds, BackupMetaData& metadata) override;
+
+	int GetBackupChunkTable(string backupId, const vector<UINT64>& partIds, BlockChunkTable& chunks, BlockChunkListTable& chunkLists) override;
+
+	int GetBackupChunkPartitions(string backupId, vector<UINT64>& partIds) override;
+
 	void UploadRestoreTaskMetaData(const RestoreTaskMetaData &metadata) override;
 
 	RestoreTaskMetaData GetRestoreTaskMetaData(string restoreId) override;
 
-	int GetBackupBlockData(string backupId, int partId, string key, const vector<int>& indices, char* buffer) override;
+	int GetBackupBlockData(string backupId, UINT64 partId, string key, const vector<UINT64>& indices, char* buffer) override;
+
+	int ListObjects(string backupId, UINT64 partId, vector<UINT64>& objects) override;
+
+	int UploadVolumeDictionary(uint32_t dictionaryId, const string& dictionary) override;
+
+	int GetVolumeDictionary(uint32_t& dictionaryId, string& dictionary) override;
+
+	int UploadVolumeGeometry(const VolumeGeometry& geometry) override;
+
+	int GetVolumeGeometry(VolumeGeometry& geometry) override;
+
+	void UploadChunkDataAsync(const chunk_id& chunkId, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize) override;
+
+	int GetChunkData(const chunk_id& chunkId, char* buffer) override;
+
+	int UploadChunkIndexSegment(string backupId, const vector<chunk_id>& chunkIds) override;
+
+	int GetChunkIndex(ChunkIndex& index) override;
+
+	int UploadPageIndexSegment(string backupId, const vector<page_index_entry>& pages, const vector<page_source_reference>& references) override;
+
+	int GetPageIndexSegment(string backupId, vector<page_index_entry>& pages, vector<page_source_reference>& references) override;
+
+	void CopyBackupBlockDataAsync(string sourceBackupId, string backupId, UINT64 partId, UINT64 partIndex, string key) override;
+
+	int UploadSyntheticFullBackups(const vector<SyntheticFullInfo>& syntheticFulls) override;
+
+	int GetSyntheticFullBackups(vector<SyntheticFullInfo>& syntheticFulls) override;
+
+	int GetBackupCompletedTime(string backupId, time_t& completedTime) override;
+
+	int UploadRecompressedBackups(const vector<RecompressedBackupInfo>& backups) override;
+
+	int GetRecompressedBackups(vector<RecompressedBackupInfo>& backups) override;
+
+	int UploadMerkleTreeRoot(string backupId, const MerkleTreeRoot& root) override;
 
-	int ListObjects(string backupId, int partId, vector<int>& objects) override;
+	int GetMerkleTreeRoot(string backupId, MerkleTreeRoot& root) override;
+
+	int UploadMerkleTreeLeaves(string backupId, UINT64 partId, const vector<uint64_t>& leaves) override;
+
+	int GetMerkleTreeLeaves(string backupId, UINT64 partId, vector<uint64_t>& leaves) override;
+
+	int ListBackupObjectKeys(string backupId, vector<string>& keys) override;
+
+	int HasPageIndexSegment(string backupId, bool& exists) override;
+
+	string GetBlockObjectKey(string backupId, UINT64 partId, UINT64 partIndex) override;
+
+	string GetChunkObjectKey(const chunk_id& chunkId) override;
+
+	string GetChunkIndexSegmentKey(string backupId) override;
+
+	int DeleteObjects(const vector<string>& keys) override;
+
+	int ListChunkIndexSegments(vector<pair<string, string>>& segments) override;
+
+	int GetChunkIndexSegment(string volumeId, string backupId, vector<chunk_id>& chunkIds) override;
+
+	int UploadCollectorObject(string name, const string& data) override;
+
+	int GetCollectorObject(string volumeId, string name, string& data) override;
+
+	string GetCollectorObjectKey(string name) override;
+
+	int UploadReplicationObject(string name, const string& data) override;
+
+	int GetReplicationObject(string name, string& data) override;
 
 private:
 	string GetVolumeBucket() const;
 
+	void PutObjectDataAsync(string bucket, string item, string key, const char* bufferOffset, int bufferOffsetIndex, size_t bufferSize);
+	int PutObjectData(string bucket, string key, const char* data, size_t size);
+	int GetObjectData(string bucket, string key, string& data);
+	int ListObjectKeys(string bucket, string prefix, vector<string>& keys);
+
+	//reads the object unless it still has the entity tag etag, which is updated when it was read
+	int GetObjectDataIfChanged(string bucket, string key, string& data, string& etag, bool& changed);
+
+	//reads an object of the volume through the catalog. Cached copies final accepts are used as they
+	//are, others once S3 confirms their entity tag, objects read from S3 are cached when cacheable accepts them.
+	int GetCatalogObjectData(string bucket, string key, string& data, const function<bool(const string&)>& final, const function<bool(const string&)>& cacheable);
+
+	//backups whose metadata the catalog holds as complete, their metadata, block listings and
+	//Merkle trees no longer change and cached copies are used without asking S3
+	bool IsBackupComplete(string backupId);
+
+	//the root object of the backup metadata with the index of its shards
+	int LoadBackupMetaDataRoot(string backupId, BackupMetaData& metadata, MetaDataShardIndex& shards);
+
+	//hashes stay unloaded when only chunk references are needed
+	int LoadBackupMetaData(string backupId, const vector<UINT64>* partIds, bool loadHashes, BackupMetaData& metadata);
+
+	//appends the shards of the requested partitions, every listed shard when requested is NULL,
+	//fails at the first shard missing or corrupt
+	template <typename Table>
+	int LoadMetaDataShards(string backupId, string prefix, const vector<MetaDataShardInfo>& index, const set<uint64_t>* requested, Table& table,
+						   bool (*deserialize)(const char*, size_t, Table&), uint64_t (*hash)(const Table&));
+
+	//uploads the shards that changed since the last upload of the backup and appends all of them to index
+	template <typename Table>
+	int UploadMetaDataShards(string backupId, string prefix, const Table& table, const VolumeGeometry& geometry,
+							 string (*serialize)(const Table&), uint64_t (*hash)(const Table&), vector<MetaDataShardInfo>& index);
+
+	//shard hashes last uploaded per backup by object key, so later uploads of the same backup skip unchanged shards
+	map<string, map<string, uint64_t>> m_uploadedShards;
+
+	MetaDataCatalog m_catalog;
+	set<string> m_completeBackups;
+	mutex m_catalogMutex;
+
 	long m_connectTimeoutMs;
 	long m_requestTimeoutMs;
 
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <algorithm>
+#include "StandbyReplica.h"
+#include "RestoreTargetFactory.h"
+
+StandbyReplica::StandbyReplica(BackupStorage* backupStorage, string standbyId) :
+	m_backupStorage(backupStorage),
+	m_objectName("standby-" + standbyId),
+	m_targetFactory(NULL),
+	m_target(NULL)
+{
+}
+
+StandbyReplica::~StandbyReplica()
+{
+	AbortApply();
+}
+
+int StandbyReplica::Load(const InputParams& params)
+{
+	//qcow2 images are not updated in place, range files hold no disk
+	if (params.standbyType == "qcow2" || params.standbyType == "extract")
+	{
+		cout << "Standby disks are raw images or VMDKs: " << params.standbyType << endl;
+
+		return ERROR_CODE;
+	}
+
+	string data;
+
+	//no state yet is the first update of the standby
+	if (m_backupStorage->GetReplicationObject(m_objectName, data) == 0 && !DeserializeStandbyState(data.data(), data.size(), m_state))
+	{
+		cout << "Standby state is corrupt, the standby is written anew" << endl;
+	}
+
+	if (m_state.targetType != params.standbyType || m_state.targetPath != params.standbyPath)
+	{
+		m_state = StandbyState();
+		m_state.targetType = params.standbyType;
+		m_state.targetPath = params.standbyPath;
+	}
+
+	return 0;
+}
+
+bool StandbyReplica::HoldsParentOf(const VolumeMetaData& volume, string backupId) const
+{
+	auto self = find(volume.backupIds.begin(), volume.backupIds.end(), backupId);
+
+	if (m_state.currentBackupId.empty() || !m_state.applyingBackupIds.empty() || self == volume.backupIds.end() || self == volume.backupIds.begin())
+	{
+		return false;
+	}
+
+	return *(self - 1) == m_state.currentBackupId;
+}
+
+int StandbyReplica::BeginApply(const InputParams& params, string backupId, UINT64 capacity, UINT64 blockSize, bool inPlace)
+{
+	InputParams targetParams = TargetParams(params);
+	targetParams.currentBackupId = inPlace ? m_state.currentBackupId : "";
+
+	//written anew, nothing applied before is left on the disk
+	if (!inPlace)
+	{
+		m_state.currentBackupId = "";
+		m_state.applyingBackupIds.clear();
+	}
+
+	if (find(m_state.applyingBackupIds.begin(), m_state.applyingBackupIds.end(), backupId) == m_state.applyingBackupIds.end())
+	{
+		m_state.applyingBackupIds.push_back(backupId);
+	}
+
+	m_applyingBackupId = backupId;
+
+	if (SaveState() != 0)
+	{
+		cout << "Standby state upload failed" << endl;
+
+		return ERROR_CODE;
+	}
+
+	m_targetFactory = new RestoreTargetFactory(targetParams.targetType);
+	m_target = m_targetFactory->GetTarget();
+
+	int result = m_target->Open(targetParams, capacity, blockSize);
+
+	if (result != 0)
+	{
+		AbortApply();
+
+		return result;
+	}
+
+	m_blockMask.assign(blockSize / VIXDISKLIB_SECTOR_SIZE, true);
+
+	return 0;
+}
+
+int StandbyReplica::WriteBlock(UINT64 blockIndex, const char* blockImage)
+{
+	if (m_target == NULL)
+	{
+		return ERROR_CODE;
+	}
+
+	return m_target->WriteBlock(blockIndex, blockImage, m_blockMask);
+}
+
+int StandbyReplica::CompleteApply()
+{
+	if (m_target == NULL)
+	{
+		return ERROR_CODE;
+	}
+
+	int result = m_target->Close();
+
+	delete m_targetFactory;
+	m_targetFactory = NULL;
+	m_target = NULL;
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	m_state.currentBackupId = m_applyingBackupId;
+	m_state.applyingBackupIds.clear();
+
+	return SaveState();
+}
+
+void StandbyReplica::AbortApply()
+{
+	if (m_target != NULL)
+	{
+		m_target->Close();
+	}
+
+	delete m_targetFactory;
+	m_targetFactory = NULL;
+	m_target = NULL;
+}
+
+InputParams StandbyReplica::TargetParams(const InputParams& params)
+{
+	InputParams targetParams = params;
+	targetParams.targetType = params.standbyType;
+	targetParams.targetPath = params.standbyPath;
+	targetParams.compareTarget = false;
+	targetParams.currentBackupId = "";
+	targetParams.restoreRanges.clear();
+
+	//VMDK targets open the disk the job names
+	if (params.standbyType != "raw")
+	{
+		targetParams.vmdk = params.standbyPath;
+	}
+
+	return targetParams;
+}
+
+int StandbyReplica::SaveState()
+{
+	string data = SerializeStandbyState(m_state);
+
+	return m_backupStorage->UploadReplicationObject(m_objectName, data);
+}
@@ -0,0 +1,67 @@
+#ifndef STANDBYREPLICA_H
+#define STANDBYREPLICA_H
+
+#include "BackupStorage.h"
+#include "MetaDataSerializer.h"
+#include "RestoreTarget.h"
+
+using namespace std;
+
+class RestoreTargetFactory;
+
+//a disk, raw image or VMDK, kept at the newest restore point of a volume so failing over to it needs
+//no restore. Every backup moves it forward by the blocks it changed: incrementals write them to
+//image files while they read the disk, catch up runs after the backup, or as a job of its own, write
+//the blocks that differ between the restore point the standby holds and the newest one. The standby's
+//restore point is kept with the volume in the replication object standby-<id>.
+class StandbyReplica
+{
+public:
+	StandbyReplica(BackupStorage* backupStorage, string standbyId);
+
+	~StandbyReplica();
+
+	StandbyReplica(const StandbyReplica&) = delete;
+	StandbyReplica& operator = (const StandbyReplica&) = delete;
+
+	//a standby recorded for another disk starts over on this one
+	int Load(const InputParams& params);
+
+	const StandbyState& GetState() const { return m_state; }
+
+	//true when the disk holds the restore point before backupId and nothing is being applied to it
+	bool HoldsParentOf(const VolumeMetaData& volume, string backupId) const;
+
+	//opens the disk for applying backupId, recorded before the first block is written. inPlace keeps
+	//what the disk holds and the backups partly applied over it, otherwise image files are created anew.
+	int BeginApply(const InputParams& params, string backupId, UINT64 capacity, UINT64 blockSize, bool inPlace);
+
+	//writes a whole block image of the backup being applied
+	int WriteBlock(UINT64 blockIndex, const char* blockImage);
+
+	RestoreTarget* GetTarget() { return m_target; }
+
+	//closes the disk, which holds the backup applied once that is recorded
+	int CompleteApply();
+
+	//closes the disk, the backup stays listed as being applied so catch up rewrites its blocks too
+	void AbortApply();
+
+	//job params for the standby disk instead of the restore target or the disk backed up
+	static InputParams TargetParams(const InputParams& params);
+
+private:
+	int SaveState();
+
+	BackupStorage* m_backupStorage;
+	string m_objectName;
+
+	StandbyState m_state;
+	string m_applyingBackupId;
+
+	RestoreTargetFactory* m_targetFactory;
+	RestoreTarget* m_target;
+	vector<bool> m_blockMask;
+};
+
+#endif
@@ -1,13 +1,20 @@
 #include "S3BackupStorage.h"
+#include "LocalBackupStorage.h"
 
 class BackupStorageFactory
 {
 public:
-	BackupStorageFactory(string type, string clientId, string volumeId, string region)
+	//region and catalogPath, the proxy's metadata catalog, apply to S3 storage, path is the root directory of local storage
+	BackupStorageFactory(string type, string clientId, string volumeId, string region, string path, string catalogPath) :
+		m_storage(NULL)
 	{
 		if (type == "s3" || type == "glacier")
 		{
-			m_storage = new S3BackupStorage(clientId, volumeId, region);
+			m_storage = new S3BackupStorage(clientId, volumeId, region, catalogPath);
+		}
+		else if (type == "local")
+		{
+			m_storage = new LocalBackupStorage(clientId, volumeId, path);
 		}
 	}
 
@@ -0,0 +1,136 @@
+#include <iostream>
+#include "VddkRestoreTarget.h"
+
+using namespace std;
+
+VddkRestoreTarget::VddkRestoreTarget() :
+	m_connection(NULL),
+	m_handle(NULL),
+	m_initialized(false),
+	m_blockSize(MB_BLOCK_SIZE)
+{
+}
+
+VddkRestoreTarget::~VddkRestoreTarget()
+{
+	Close();
+}
+
+int VddkRestoreTarget::Open(InputParams& params, UINT64 capacity, UINT64 blockSize)
+{
+	m_blockSize = blockSize;
+
+	VixError vixError = VixDiskLib_InitEx(VIXDISKLIB_VERSION_MAJOR,
+										  VIXDISKLIB_VERSION_MINOR,
+										  NULL, NULL, NULL,
+										  params.libDir.c_str(),
+										  params.cfgFile.c_str());
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib init error, code: " << vixError << endl;
+
+		return (int)vixError;
+	}
+
+	m_initialized = true;
+
+	vixError = VixDiskLib_Connect(&params.cnxParams, &m_connection);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib connect error, code: " << vixError << endl;
+		Close();
+
+		return (int)vixError;
+	}
+
+	uint32 flags = VIXDISKLIB_FLAG_OPEN_UNBUFFERED;
+
+	vixError = VixDiskLib_Open(m_connection, params.vmdk.c_str(), flags, &m_handle);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib open error, code: " << vixError << endl;
+		Close();
+
+		return (int)vixError;
+	}
+
+	return 0;
+}
+
+int VddkRestoreTarget::WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask)
+{
+	UINT64 blockSectorStart = blockIndex * (m_blockSize / VIXDISKLIB_SECTOR_SIZE);
+	size_t sector = 0;
+
+	while (sector < sectorMask.size())
+	{
+		if (!sectorMask[sector])
+		{
+			sector++;
+			continue;
+		}
+
+		size_t startSector = sector;
+
+		while (sector < sectorMask.size() && sectorMask[sector])
+		{
+			sector++;
+		}
+
+		const char* ptr = buffer + startSector * VIXDISKLIB_SECTOR_SIZE;
+		lock_guard<mutex> lock(m_handleMutex);
+		VixError vixError = VixDiskLib_Write(m_handle, blockSectorStart + startSector, sector - startSector, (uint8 *)ptr);
+
+		if (vixError != VIX_OK)
+		{
+			cout << "VixDiskLib_Write block error, code: " << vixError << endl;
+
+			return (int)vixError;
+		}
+	}
+
+	return 0;
+}
+
+int VddkRestoreTarget::ReadBlock(UINT64 blockIndex, char* buffer)
+{
+	UINT64 sectorsInBlock = m_blockSize / VIXDISKLIB_SECTOR_SIZE;
+	lock_guard<mutex> lock(m_handleMutex);
+
+	VixError vixError = VixDiskLib_Read(m_handle, blockIndex * sectorsInBlock, sectorsInBlock, (uint8 *)buffer);
+
+	if (vixError != VIX_OK)
+	{
+		cout << "VixDiskLib_Read block error, code: " << vixError << endl;
+
+		return (int)vixError;
+	}
+
+	return 0;
+}
+
+int VddkRestoreTarget::Close()
+{
+	if (m_handle != NULL)
+	{
+		VixDiskLib_Close(m_handle);
+		m_handle = NULL;
+	}
+
+	if (m_connection != NULL)
+	{
+		VixDiskLib_Disconnect(m_connection);
+		m_connection = NULL;
+	}
+
+	if (m_initialized)
+	{
+		VixDiskLib_Exit();
+		m_initialized = false;
+	}
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef VDDKRESTORETARGET_H
+#define VDDKRESTORETARGET_H
+
+#include <mutex>
+#include "RestoreTarget.h"
+
+using namespace std;
+
+//writes restored sectors to a VMDK through VixDiskLib
+class VddkRestoreTarget : public RestoreTarget
+{
+public:
+	VddkRestoreTarget();
+
+	VddkRestoreTarget(const VddkRestoreTarget&) = delete;
+	VddkRestoreTarget& operator =(const VddkRestoreTarget&) = delete;
+
+	~VddkRestoreTarget();
+
+	int Open(InputParams& params, UINT64 capacity, UINT64 blockSize) override;
+
+	int WriteBlock(UINT64 blockIndex, const char* buffer, const vector<bool>& sectorMask) override;
+
+	int ReadBlock(UINT64 blockIndex, char* buffer) override;
+
+	int Close() override;
+
+private:
+	VixDiskLibConnection m_connection;
+	VixDiskLibHandle m_handle;
+	mutex m_handleMutex;
+
+	bool m_initialized;
+	UINT64 m_blockSize;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include <iostream>
+#include "VolumeDictionaries.h"
+#include "core/dictionary.h"
+
+VolumeDictionaries::VolumeDictionaries(BackupStorage* backupStorage) :
+	m_backupStorage(backupStorage)
+{
+}
+
+const block_dictionary* VolumeDictionaries::Get(uint32_t dictionaryId)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	auto item = m_dictionaries.find(dictionaryId);
+
+	if (item != m_dictionaries.end())
+	{
+		return &item->second;
+	}
+
+	string data;
+	uint32_t id = dictionaryId;
+
+	if (m_backupStorage->GetVolumeDictionary(id, data) != 0 || dictionary_id(data.data(), data.size()) != dictionaryId)
+	{
+		cout << "Compression dictionary not available: " << dictionaryId << endl;
+		return NULL;
+	}
+
+	m_data[dictionaryId] = data;
+
+	const string& stored = m_data[dictionaryId];
+	block_dictionary dictionary = { dictionaryId, stored.data(), stored.size() };
+
+	return &(m_dictionaries[dictionaryId] = dictionary);
+}
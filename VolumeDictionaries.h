@@ -0,0 +1,30 @@
+#ifndef VOLUMEDICTIONARIES_H
+#define VOLUMEDICTIONARIES_H
+
+#include <mutex>
+#include "BackupStorage.h"
+#include "core/block_envelope.h"
+
+using namespace std;
+
+//loads the compression dictionaries stored blocks refer to, once per id, shared by reader threads
+class VolumeDictionaries
+{
+public:
+	VolumeDictionaries(BackupStorage* backupStorage);
+
+	VolumeDictionaries(const VolumeDictionaries&) = delete;
+	VolumeDictionaries& operator = (const VolumeDictionaries&) = delete;
+
+	//returns NULL if the dictionary is missing or does not match its id
+	const block_dictionary* Get(uint32_t dictionaryId);
+
+private:
+	BackupStorage* m_backupStorage;
+
+	mutex m_mutex;
+	map<uint32_t, string> m_data;
+	map<uint32_t, block_dictionary> m_dictionaries;
+};
+
+#endif
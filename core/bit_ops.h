@@ -0,0 +1,115 @@
+#ifndef BIT_OPS_H
+#define BIT_OPS_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Word-at-a-time helpers for bitmaps stored as uint64_t arrays, bit k lives in word k / 64 at position k % 64.
+
+inline uint32_t count_trailing_zeros64(uint64_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index = 0;
+	_BitScanForward64(&index, value);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctzll(value);
+#endif
+}
+
+inline uint32_t count_bits64(uint64_t value)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)__popcnt64(value);
+#else
+	return (uint32_t)__builtin_popcountll(value);
+#endif
+}
+
+inline uint32_t bitmap_words(uint32_t bit_count)
+{
+	return (bit_count + 63) / 64;
+}
+
+inline uint32_t count_bitmap_bits(const uint64_t *words, uint32_t bit_count)
+{
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < bitmap_words(bit_count); i++)
+	{
+		count += count_bits64(words[i]);
+	}
+
+	return count;
+}
+
+// Sets bits [first, first + count), whole words are filled at once.
+inline void set_bitmap_range(uint64_t *words, uint32_t first, uint32_t count)
+{
+	uint32_t end = first + count;
+
+	while (first < end)
+	{
+		uint32_t offset = first % 64;
+		uint32_t span = 64 - offset;
+
+		if (span > end - first)
+		{
+			span = end - first;
+		}
+
+		uint64_t mask = (span == 64) ? ~0ULL : (((1ULL << span) - 1) << offset);
+		words[first / 64] |= mask;
+		first += span;
+	}
+}
+
+// Finds the next run of set bits starting at or after position, skipping empty and full words
+// without visiting their bits. Bits at or past bit_count must be clear.
+inline bool next_bitmap_run(const uint64_t *words, uint32_t bit_count, uint32_t position, uint32_t &run_first, uint32_t &run_count)
+{
+	uint32_t word_count = bitmap_words(bit_count);
+	uint32_t index = position / 64;
+
+	if (position >= bit_count)
+	{
+		return false;
+	}
+
+	uint64_t bits = words[index] & (~0ULL << (position % 64));
+
+	while (bits == 0)
+	{
+		if (++index >= word_count)
+		{
+			return false;
+		}
+
+		bits = words[index];
+	}
+
+	run_first = index * 64 + count_trailing_zeros64(bits);
+
+	uint64_t clear = ~words[index] & (~0ULL << (run_first % 64));
+
+	while (clear == 0)
+	{
+		if (++index >= word_count)
+		{
+			run_count = bit_count - run_first;
+			return true;
+		}
+
+		clear = ~words[index];
+	}
+
+	uint32_t run_end = index * 64 + count_trailing_zeros64(clear);
+	run_count = (run_end < bit_count ? run_end : bit_count) - run_first;
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef BLOCK_ENVELOPE_H
+#define BLOCK_ENVELOPE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "codec.h"
+#include "crc32.h"
+
+// Stored block envelope, every field little endian, the payload follows the header:
+// [UINT32 magic][UINT8 version][UINT8 codec][UINT16 header size]
+// [UINT32 raw length][UINT32 stored length][UINT32 CRC32C of the payload]
+// version 2 appends [UINT32 dictionary id], 0 when the payload was compressed without one.
+// Blocks written before the envelope are bare zlib streams, whose first byte can never match the magic.
+
+const uint32_t BLOCK_ENVELOPE_MAGIC = 0x4B424456; // "VDBK"
+const uint8_t BLOCK_ENVELOPE_VERSION = 2;
+const size_t BLOCK_ENVELOPE_SIZE = 6 * sizeof(uint32_t);
+const size_t BLOCK_ENVELOPE_V1_SIZE = 5 * sizeof(uint32_t);
+
+struct block_envelope
+{
+	uint8_t version;
+	uint8_t codec;
+	uint16_t header_size;
+	uint32_t raw_length;
+	uint32_t stored_length;
+	uint32_t checksum;
+	uint32_t dictionary_id;
+};
+
+// Dictionary shared by the blocks of a volume, the id is derived from its content
+struct block_dictionary
+{
+	uint32_t id;
+	const char *data;
+	size_t size;
+};
+
+// A payload is only kept compressed when it is smaller than the raw block
+inline size_t block_envelope_bound(size_t raw_length)
+{
+	return BLOCK_ENVELOPE_SIZE + raw_length;
+}
+
+inline void write_block_envelope(char *stored, const block_envelope &envelope)
+{
+	memcpy(stored, &BLOCK_ENVELOPE_MAGIC, sizeof(uint32_t));
+	stored[4] = (char)envelope.version;
+	stored[5] = (char)envelope.codec;
+	memcpy(stored + 6, &envelope.header_size, sizeof(uint16_t));
+	memcpy(stored + 8, &envelope.raw_length, sizeof(uint32_t));
+	memcpy(stored + 12, &envelope.stored_length, sizeof(uint32_t));
+	memcpy(stored + 16, &envelope.checksum, sizeof(uint32_t));
+	memcpy(stored + 20, &envelope.dictionary_id, sizeof(uint32_t));
+}
+
+// Returns false if the data does not start with an envelope header this version understands.
+inline bool read_block_envelope(const char *stored, size_t stored_size, block_envelope &envelope)
+{
+	uint32_t magic = 0;
+
+	if (stored_size < BLOCK_ENVELOPE_V1_SIZE)
+	{
+		return false;
+	}
+
+	memcpy(&magic, stored, sizeof(uint32_t));
+
+	if (magic != BLOCK_ENVELOPE_MAGIC)
+	{
+		return false;
+	}
+
+	envelope.version = (uint8_t)stored[4];
+	envelope.codec = (uint8_t)stored[5];
+	memcpy(&envelope.header_size, stored + 6, sizeof(uint16_t));
+	memcpy(&envelope.raw_length, stored + 8, sizeof(uint32_t));
+	memcpy(&envelope.stored_length, stored + 12, sizeof(uint32_t));
+	memcpy(&envelope.checksum, stored + 16, sizeof(uint32_t));
+	envelope.dictionary_id = 0;
+
+	if (envelope.version == 1)
+	{
+		return envelope.header_size >= BLOCK_ENVELOPE_V1_SIZE;
+	}
+
+	if (envelope.version != BLOCK_ENVELOPE_VERSION || envelope.header_size < BLOCK_ENVELOPE_SIZE || stored_size < BLOCK_ENVELOPE_SIZE)
+	{
+		return false;
+	}
+
+	memcpy(&envelope.dictionary_id, stored + 20, sizeof(uint32_t));
+
+	return true;
+}
+
+inline bool is_block_envelope(const char *stored, size_t stored_size)
+{
+	uint32_t magic = 0;
+
+	if (stored_size < sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	memcpy(&magic, stored, sizeof(uint32_t));
+
+	return magic == BLOCK_ENVELOPE_MAGIC;
+}
+
+// Raw length recorded in the envelope, legacy_length for bare streams whose size is unknown
+inline size_t stored_block_raw_length(const char *stored, size_t stored_size, size_t legacy_length)
+{
+	block_envelope envelope;
+
+	if (!read_block_envelope(stored, stored_size, envelope))
+	{
+		return legacy_length;
+	}
+
+	return envelope.raw_length;
+}
+
+// Dictionary the block was compressed with, 0 for none or for blocks without an envelope
+inline uint32_t stored_block_dictionary_id(const char *stored, size_t stored_size)
+{
+	block_envelope envelope;
+
+	if (!read_block_envelope(stored, stored_size, envelope))
+	{
+		return 0;
+	}
+
+	return envelope.dictionary_id;
+}
+
+// Compresses raw into an envelope, falling back to the raw codec when compression does not shrink it.
+// Returns the stored size, or 0 if out_capacity is below block_envelope_bound(raw_length).
+inline size_t seal_block(const char *raw, size_t raw_length, char *out, size_t out_capacity, const block_codec *codec, int level, const block_dictionary *dictionary = NULL)
+{
+	if (out_capacity < block_envelope_bound(raw_length))
+	{
+		return 0;
+	}
+
+	block_envelope envelope;
+	envelope.version = BLOCK_ENVELOPE_VERSION;
+	envelope.codec = codec->id;
+	envelope.header_size = (uint16_t)BLOCK_ENVELOPE_SIZE;
+	envelope.raw_length = (uint32_t)raw_length;
+	envelope.dictionary_id = dictionary != NULL ? dictionary->id : 0;
+
+	const char *dictionary_data = dictionary != NULL ? dictionary->data : NULL;
+	size_t dictionary_size = dictionary != NULL ? dictionary->size : 0;
+	char *payload = out + BLOCK_ENVELOPE_SIZE;
+	size_t stored_length = 0;
+
+	if (codec->id == BLOCK_CODEC_RAW || !codec->compress(raw, raw_length, payload, raw_length, stored_length, level, dictionary_data, dictionary_size) || stored_length >= raw_length)
+	{
+		envelope.codec = BLOCK_CODEC_RAW;
+		envelope.dictionary_id = 0;
+		stored_length = raw_length;
+		memcpy(payload, raw, raw_length);
+	}
+
+	envelope.stored_length = (uint32_t)stored_length;
+	envelope.checksum = sse42_crc32c(payload, stored_length);
+
+	write_block_envelope(out, envelope);
+
+	return BLOCK_ENVELOPE_SIZE + stored_length;
+}
+
+// Verifies and decodes a stored block, returns its raw length or -1 if it is corrupt,
+// uses a codec missing from this build, needs a dictionary other than the one given
+// or does not fit in out_capacity bytes.
+inline long open_block(const char *stored, size_t stored_size, char *out, size_t out_capacity, const block_dictionary *dictionary = NULL)
+{
+	if (!is_block_envelope(stored, stored_size))
+	{
+		return decompress_raw_data(stored, stored_size, out, out_capacity, true);
+	}
+
+	block_envelope envelope;
+
+	if (!read_block_envelope(stored, stored_size, envelope) ||
+		(size_t)envelope.header_size + envelope.stored_length > stored_size ||
+		envelope.raw_length > out_capacity)
+	{
+		return -1;
+	}
+
+	const char *payload = stored + envelope.header_size;
+
+	if (sse42_crc32c(payload, envelope.stored_length) != envelope.checksum)
+	{
+		return -1;
+	}
+
+	if (envelope.dictionary_id != 0 && (dictionary == NULL || dictionary->id != envelope.dictionary_id))
+	{
+		return -1;
+	}
+
+	const char *dictionary_data = envelope.dictionary_id != 0 ? dictionary->data : NULL;
+	size_t dictionary_size = envelope.dictionary_id != 0 ? dictionary->size : 0;
+	const block_codec *codec = find_codec(envelope.codec);
+
+	if (codec == NULL || codec->decompress(payload, envelope.stored_length, out, envelope.raw_length, dictionary_data, dictionary_size) != (long)envelope.raw_length)
+	{
+		return -1;
+	}
+
+	return envelope.raw_length;
+}
+
+#endif
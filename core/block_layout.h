@@ -0,0 +1,316 @@
+#ifndef BLOCK_LAYOUT_H
+#define BLOCK_LAYOUT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "bit_ops.h"
+
+using namespace std;
+
+// Legacy uncompressed block layout:
+// [UINT16 sector size][UINT16 sector count][sector indices, UINT16 each][packed sector data]
+// The index table always has room for every sector of the block, data follows it
+// in the same order as the indices.
+//
+// Compact layout, written by BackupData. The marker takes the place of the legacy sector size,
+// which is never anything but a small power of two, so the first UINT16 tells both layouts apart:
+// [UINT16 marker][UINT8 version][UINT8 map type][UINT16 sector size][UINT16 sector count]
+// [UINT16 sectors per block][UINT16 map size][sector map][packed sector data]
+// The map is a list of [UINT16 first sector][UINT16 sector count] extents or a bitmap with one bit
+// per sector of the block (bit k in byte k / 8), whichever is smaller. Data follows in sector order.
+// A sector here is the tracking granule of the backup. Version 3 stores the base 2 logarithm of
+// the sector size so 64 KB granules fit, version 2 stored the size itself and is still read.
+
+const uint16_t BLOCK_LAYOUT_MARKER = 0xB10C;
+const uint8_t BLOCK_LAYOUT_VERSION = 3;
+const uint8_t BLOCK_LAYOUT_SIZE_VERSION = 2;
+const uint8_t SECTOR_MAP_EXTENTS = 1;
+const uint8_t SECTOR_MAP_BITMAP = 2;
+const size_t COMPACT_HEADER_FIXED_SIZE = 6 * sizeof(uint16_t);
+const size_t SECTOR_EXTENT_SIZE = 2 * sizeof(uint16_t);
+
+struct sector_run
+{
+	uint32_t first_sector;
+	uint32_t sector_count;
+	const char *data;
+};
+
+inline bool is_zero_data(const char *data, size_t size)
+{
+	const uint64_t *ptr = (const uint64_t*)data;
+
+	for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+	{
+		if (ptr[i] != 0)
+		{
+			return false;
+		}
+	}
+
+	for (size_t i = size / sizeof(uint64_t) * sizeof(uint64_t); i < size; i++)
+	{
+		if (data[i] != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+inline size_t block_header_size(uint32_t block_size, uint16_t sector_size)
+{
+	return 2 * sizeof(uint16_t) + (block_size / sector_size) * sizeof(uint16_t);
+}
+
+inline size_t sector_bitmap_size(uint32_t sectors_per_block)
+{
+	return (sectors_per_block + 7) / 8;
+}
+
+// Upper bound of the compact header, extents are only chosen when smaller than the bitmap.
+inline size_t compact_block_header_max_size(uint32_t sectors_per_block)
+{
+	return COMPACT_HEADER_FIXED_SIZE + sector_bitmap_size(sectors_per_block);
+}
+
+// Writes the compact header for the sectors set in sector_map, returns the header size.
+inline size_t encode_block_header(char *block, uint32_t sector_size, uint32_t sectors_per_block, const uint64_t *sector_map)
+{
+	size_t bitmap_size = sector_bitmap_size(sectors_per_block);
+	uint16_t sector_count = (uint16_t)count_bitmap_bits(sector_map, sectors_per_block);
+	size_t extent_count = 0;
+	uint32_t position = 0;
+	uint32_t run_first = 0;
+	uint32_t run_count = 0;
+
+	while (extent_count * SECTOR_EXTENT_SIZE < bitmap_size && next_bitmap_run(sector_map, sectors_per_block, position, run_first, run_count))
+	{
+		extent_count++;
+		position = run_first + run_count;
+	}
+
+	uint8_t map_type = extent_count * SECTOR_EXTENT_SIZE < bitmap_size ? SECTOR_MAP_EXTENTS : SECTOR_MAP_BITMAP;
+	uint16_t map_size = (uint16_t)(map_type == SECTOR_MAP_EXTENTS ? extent_count * SECTOR_EXTENT_SIZE : bitmap_size);
+	uint16_t block_sectors = (uint16_t)sectors_per_block;
+	uint16_t sector_shift = (uint16_t)count_trailing_zeros64(sector_size);
+	char *map = block + COMPACT_HEADER_FIXED_SIZE;
+
+	memcpy(block, &BLOCK_LAYOUT_MARKER, sizeof(uint16_t));
+	block[2] = (char)BLOCK_LAYOUT_VERSION;
+	block[3] = (char)map_type;
+	memcpy(block + 4, &sector_shift, sizeof(uint16_t));
+	memcpy(block + 6, &sector_count, sizeof(uint16_t));
+	memcpy(block + 8, &block_sectors, sizeof(uint16_t));
+	memcpy(block + 10, &map_size, sizeof(uint16_t));
+
+	if (map_type == SECTOR_MAP_BITMAP)
+	{
+		memcpy(map, sector_map, bitmap_size);
+	}
+	else
+	{
+		position = 0;
+
+		while (next_bitmap_run(sector_map, sectors_per_block, position, run_first, run_count))
+		{
+			uint16_t first = (uint16_t)run_first;
+			uint16_t count = (uint16_t)run_count;
+
+			memcpy(map, &first, sizeof(uint16_t));
+			memcpy(map + sizeof(uint16_t), &count, sizeof(uint16_t));
+
+			map += SECTOR_EXTENT_SIZE;
+			position = run_first + run_count;
+		}
+	}
+
+	return COMPACT_HEADER_FIXED_SIZE + map_size;
+}
+
+inline uint32_t parse_compact_block_sectors(const char *block, size_t block_length, uint32_t block_size, vector<sector_run> &runs)
+{
+	uint8_t version = block_length >= COMPACT_HEADER_FIXED_SIZE ? (uint8_t)block[2] : 0;
+
+	if (version != BLOCK_LAYOUT_VERSION && version != BLOCK_LAYOUT_SIZE_VERSION)
+	{
+		return 0;
+	}
+
+	uint8_t map_type = (uint8_t)block[3];
+	uint16_t sector_field = 0;
+	uint16_t sector_count = 0;
+	uint16_t sectors_per_block = 0;
+	uint16_t map_size = 0;
+	memcpy(&sector_field, block + 4, sizeof(uint16_t));
+	memcpy(&sector_count, block + 6, sizeof(uint16_t));
+	memcpy(&sectors_per_block, block + 8, sizeof(uint16_t));
+	memcpy(&map_size, block + 10, sizeof(uint16_t));
+
+	uint32_t sector_size = sector_field;
+
+	if (version == BLOCK_LAYOUT_VERSION)
+	{
+		sector_size = sector_field < 32 ? 1U << sector_field : 0;
+	}
+
+	if (sector_size == 0 || (uint64_t)sectors_per_block * sector_size != block_size || sector_count > sectors_per_block)
+	{
+		return 0;
+	}
+
+	size_t header_size = COMPACT_HEADER_FIXED_SIZE + map_size;
+
+	if (block_length < header_size + (size_t)sector_count * sector_size)
+	{
+		return 0;
+	}
+
+	const char *map = block + COMPACT_HEADER_FIXED_SIZE;
+	const char *data = block + header_size;
+	uint32_t total = 0;
+
+	if (map_type == SECTOR_MAP_EXTENTS)
+	{
+		if (map_size % SECTOR_EXTENT_SIZE != 0)
+		{
+			return 0;
+		}
+
+		uint32_t next_free = 0;
+
+		for (size_t offset = 0; offset < map_size; offset += SECTOR_EXTENT_SIZE)
+		{
+			uint16_t first = 0;
+			uint16_t count = 0;
+			memcpy(&first, map + offset, sizeof(uint16_t));
+			memcpy(&count, map + offset + sizeof(uint16_t), sizeof(uint16_t));
+
+			if (count == 0 || first < next_free || (uint32_t)first + count > sectors_per_block)
+			{
+				return 0;
+			}
+
+			sector_run run;
+			run.first_sector = first;
+			run.sector_count = count;
+			run.data = data + (size_t)total * sector_size;
+
+			runs.push_back(run);
+
+			total += count;
+			next_free = (uint32_t)first + count;
+		}
+	}
+	else if (map_type == SECTOR_MAP_BITMAP)
+	{
+		if (map_size != sector_bitmap_size(sectors_per_block))
+		{
+			return 0;
+		}
+
+		vector<uint64_t> sector_map(bitmap_words(sectors_per_block), 0);
+		memcpy(sector_map.data(), map, map_size);
+
+		if (sectors_per_block % 64 != 0)
+		{
+			sector_map.back() &= (1ULL << (sectors_per_block % 64)) - 1;
+		}
+
+		uint32_t position = 0;
+		uint32_t run_first = 0;
+		uint32_t run_count = 0;
+
+		while (next_bitmap_run(sector_map.data(), sectors_per_block, position, run_first, run_count))
+		{
+			sector_run run;
+			run.first_sector = run_first;
+			run.sector_count = run_count;
+			run.data = data + (size_t)total * sector_size;
+
+			runs.push_back(run);
+
+			total += run_count;
+			position = run_first + run_count;
+		}
+	}
+	else
+	{
+		return 0;
+	}
+
+	if (total != sector_count)
+	{
+		runs.clear();
+		return 0;
+	}
+
+	return sector_size;
+}
+
+// Splits a decompressed block of either layout into runs of adjacent sectors, returns the sector size
+// or 0 if the header is inconsistent with the decompressed length.
+inline uint32_t parse_block_sectors(const char *block, size_t block_length, uint32_t block_size, vector<sector_run> &runs)
+{
+	runs.clear();
+
+	if (block_length < 2 * sizeof(uint16_t))
+	{
+		return 0;
+	}
+
+	uint16_t sector_size = 0;
+	uint16_t sector_count = 0;
+	memcpy(&sector_size, block, sizeof(uint16_t));
+	memcpy(&sector_count, block + sizeof(uint16_t), sizeof(uint16_t));
+
+	if (sector_size == BLOCK_LAYOUT_MARKER)
+	{
+		return parse_compact_block_sectors(block, block_length, block_size, runs);
+	}
+
+	if (sector_size == 0 || sector_count > block_size / sector_size)
+	{
+		return 0;
+	}
+
+	if (sector_count == 0)
+	{
+		return sector_size;
+	}
+
+	size_t header_size = block_header_size(block_size, sector_size);
+
+	if (block_length < header_size + (size_t)sector_count * sector_size)
+	{
+		return 0;
+	}
+
+	const char *indices = block + 2 * sizeof(uint16_t);
+	const char *data = block + header_size;
+
+	for (uint32_t k = 0; k < sector_count; k++)
+	{
+		uint16_t sector = 0;
+		memcpy(&sector, indices + k * sizeof(uint16_t), sizeof(uint16_t));
+
+		if (!runs.empty() && runs.back().first_sector + runs.back().sector_count == sector)
+		{
+			runs.back().sector_count++;
+			continue;
+		}
+
+		sector_run run;
+		run.first_sector = sector;
+		run.sector_count = 1;
+		run.data = data + (size_t)k * sector_size;
+
+		runs.push_back(run);
+	}
+
+	return sector_size;
+}
+
+#endif
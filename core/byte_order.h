@@ -0,0 +1,59 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+
+// Big-endian (network order) field helpers for on-wire and on-disk formats
+
+inline void store_be16(char *ptr, uint16_t value)
+{
+	ptr[0] = (char)(value >> 8);
+	ptr[1] = (char)value;
+}
+
+inline void store_be32(char *ptr, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		ptr[i] = (char)(value >> (24 - 8 * i));
+	}
+}
+
+inline void store_be64(char *ptr, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		ptr[i] = (char)(value >> (56 - 8 * i));
+	}
+}
+
+inline uint16_t load_be16(const char *ptr)
+{
+	return (uint16_t)(((uint8_t)ptr[0] << 8) | (uint8_t)ptr[1]);
+}
+
+inline uint32_t load_be32(const char *ptr)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		value = (value << 8) | (uint8_t)ptr[i];
+	}
+
+	return value;
+}
+
+inline uint64_t load_be64(const char *ptr)
+{
+	uint64_t value = 0;
+
+	for (int i = 0; i < 8; i++)
+	{
+		value = (value << 8) | (uint8_t)ptr[i];
+	}
+
+	return value;
+}
+
+#endif
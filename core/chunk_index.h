@@ -0,0 +1,220 @@
+#ifndef CHUNK_INDEX_H
+#define CHUNK_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "sha256.h"
+
+using namespace std;
+
+// Content addressed chunks are named by the SHA-256 of their content, the all zero id
+// never names a chunk and marks empty slots of the index.
+
+struct chunk_id
+{
+	uint8_t bytes[SHA256_DIGEST_SIZE];
+};
+
+inline bool operator ==(const chunk_id &a, const chunk_id &b)
+{
+	return memcmp(a.bytes, b.bytes, SHA256_DIGEST_SIZE) == 0;
+}
+
+inline bool operator !=(const chunk_id &a, const chunk_id &b)
+{
+	return !(a == b);
+}
+
+inline bool operator <(const chunk_id &a, const chunk_id &b)
+{
+	return memcmp(a.bytes, b.bytes, SHA256_DIGEST_SIZE) < 0;
+}
+
+inline chunk_id compute_chunk_id(const void *data, size_t size)
+{
+	chunk_id id;
+	sha256(data, size, id.bytes);
+
+	return id;
+}
+
+inline bool is_null_chunk_id(const chunk_id &id)
+{
+	static const chunk_id null_id = { { 0 } };
+
+	return id == null_id;
+}
+
+// Object name of a chunk
+inline string chunk_id_hex(const chunk_id &id)
+{
+	static const char digits[] = "0123456789abcdef";
+	string hex(2 * SHA256_DIGEST_SIZE, '0');
+
+	for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+	{
+		hex[2 * i] = digits[id.bytes[i] >> 4];
+		hex[2 * i + 1] = digits[id.bytes[i] & 15];
+	}
+
+	return hex;
+}
+
+inline uint64_t chunk_id_word(const chunk_id &id, size_t word)
+{
+	uint64_t value;
+	memcpy(&value, id.bytes + word * sizeof(uint64_t), sizeof(uint64_t));
+
+	return value;
+}
+
+// In memory set of chunk ids: a flat open addressing table with linear probing, fronted by a
+// blocked Bloom filter. The filter is a thirty second of the table and sets every bit of an id
+// in one cache line, so the lookups of chunks the store does not hold yet, the common case for
+// volumes that are not clones, are mostly answered without touching the table.
+// The ids are uniformly distributed already, their words are used as hashes directly.
+class ChunkIndex
+{
+public:
+	ChunkIndex() : m_count(0)
+	{
+		Resize(MinSlots);
+	}
+
+	size_t Size() const { return m_count; }
+
+	bool Contains(const chunk_id &id) const
+	{
+		if (!MayContain(id))
+		{
+			return false;
+		}
+
+		size_t mask = m_slots.size() - 1;
+
+		for (size_t slot = chunk_id_word(id, 0) & mask; !is_null_chunk_id(m_slots[slot]); slot = (slot + 1) & mask)
+		{
+			if (m_slots[slot] == id)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Returns false if the id was already present
+	bool Insert(const chunk_id &id)
+	{
+		if (is_null_chunk_id(id) || Contains(id))
+		{
+			return false;
+		}
+
+		// at most half full, probe sequences stay short
+		if (2 * (m_count + 1) > m_slots.size())
+		{
+			Resize(2 * m_slots.size());
+		}
+
+		Place(id);
+		m_count++;
+
+		return true;
+	}
+
+	void Reserve(size_t count)
+	{
+		size_t slots = m_slots.size();
+
+		while (2 * count > slots)
+		{
+			slots *= 2;
+		}
+
+		if (slots != m_slots.size())
+		{
+			Resize(slots);
+		}
+	}
+
+private:
+	static const size_t MinSlots = 1024;
+	static const size_t SlotsPerFilterBlock = 64;
+	static const size_t FilterBlockWords = 8;
+	static const int FilterHashes = 6;
+
+	// bit positions of an id inside its 512 bit filter block
+	static size_t FilterBit(const chunk_id &id, int i)
+	{
+		return (size_t)(chunk_id_word(id, 2) >> (9 * i)) & 511;
+	}
+
+	size_t FilterBlock(const chunk_id &id) const
+	{
+		return (size_t)(chunk_id_word(id, 1) & (m_filter.size() / FilterBlockWords - 1)) * FilterBlockWords;
+	}
+
+	bool MayContain(const chunk_id &id) const
+	{
+		const uint64_t *block = m_filter.data() + FilterBlock(id);
+
+		for (int i = 0; i < FilterHashes; i++)
+		{
+			size_t bit = FilterBit(id, i);
+
+			if ((block[bit / 64] & (1ULL << (bit % 64))) == 0)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Place(const chunk_id &id)
+	{
+		size_t mask = m_slots.size() - 1;
+		size_t slot = chunk_id_word(id, 0) & mask;
+
+		while (!is_null_chunk_id(m_slots[slot]))
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		m_slots[slot] = id;
+
+		uint64_t *block = m_filter.data() + FilterBlock(id);
+
+		for (int i = 0; i < FilterHashes; i++)
+		{
+			size_t bit = FilterBit(id, i);
+			block[bit / 64] |= 1ULL << (bit % 64);
+		}
+	}
+
+	// slots is a power of two, the filter is rebuilt along with the table
+	void Resize(size_t slots)
+	{
+		vector<chunk_id> previous(slots);
+		previous.swap(m_slots);
+
+		m_filter.assign(slots / SlotsPerFilterBlock * FilterBlockWords, 0);
+
+		for (const chunk_id &id : previous)
+		{
+			if (!is_null_chunk_id(id))
+			{
+				Place(id);
+			}
+		}
+	}
+
+	vector<chunk_id> m_slots;
+	vector<uint64_t> m_filter;
+	size_t m_count;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "compression.h"
+
+// LZ4 and Zstandard are linked only when the build defines VDTOOL_WITH_LZ4 / VDTOOL_WITH_ZSTD,
+// blocks written with a codec that is not compiled in fail to decode instead of being misread.
+// vdtool.vcxproj defines both and restores the libraries from the vcpkg manifest vcpkg.json.
+#if defined(VDTOOL_WITH_LZ4)
+	#include <lz4.h>
+	#include <lz4hc.h>
+#endif
+
+#if defined(VDTOOL_WITH_ZSTD)
+	#include <zstd.h>
+#endif
+
+using namespace std;
+
+// Codec ids are stored in every block envelope, never renumber them.
+const uint8_t BLOCK_CODEC_RAW = 0;
+const uint8_t BLOCK_CODEC_ZLIB = 1;
+const uint8_t BLOCK_CODEC_LZ4 = 2;
+const uint8_t BLOCK_CODEC_ZSTD = 3;
+
+// Higher levels compress harder on every codec, compress returns false when the output
+// does not fit in out_capacity bytes, decompress returns the decoded size or -1.
+// A non-empty dictionary primes both directions and must be identical on both sides.
+struct block_codec
+{
+	uint8_t id;
+	const char *name;
+	int min_level;
+	int default_level;
+	int max_level;
+	bool (*compress)(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level, const char *dictionary, size_t dictionary_size);
+	long (*decompress)(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, const char *dictionary, size_t dictionary_size);
+};
+
+inline bool raw_codec_compress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level, const char *dictionary, size_t dictionary_size)
+{
+	if (in_data_size > out_data_capacity)
+	{
+		return false;
+	}
+
+	memcpy(out_data, in_data, in_data_size);
+	out_data_size = in_data_size;
+
+	return true;
+}
+
+inline long raw_codec_decompress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, const char *dictionary, size_t dictionary_size)
+{
+	if (in_data_size > out_data_size)
+	{
+		return -1;
+	}
+
+	memcpy(out_data, in_data, in_data_size);
+
+	return (long)in_data_size;
+}
+
+inline bool zlib_codec_compress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level, const char *dictionary, size_t dictionary_size)
+{
+	return compress_raw_data(in_data, in_data_size, out_data, out_data_capacity, out_data_size, level, dictionary, dictionary_size);
+}
+
+inline long zlib_codec_decompress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, const char *dictionary, size_t dictionary_size)
+{
+	return decompress_raw_data(in_data, in_data_size, out_data, out_data_size, false, dictionary, dictionary_size);
+}
+
+#if defined(VDTOOL_WITH_LZ4)
+// level 1 is the fast LZ4 compressor, higher levels switch to LZ4HC
+inline bool lz4_codec_compress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level, const char *dictionary, size_t dictionary_size)
+{
+	int size = 0;
+
+	if (level <= 1 && dictionary_size == 0)
+	{
+		size = LZ4_compress_default((const char*)in_data, (char*)out_data, (int)in_data_size, (int)out_data_capacity);
+	}
+	else if (level <= 1)
+	{
+		LZ4_stream_t *stream = LZ4_createStream();
+		LZ4_loadDict(stream, dictionary, (int)dictionary_size);
+		size = LZ4_compress_fast_continue(stream, (const char*)in_data, (char*)out_data, (int)in_data_size, (int)out_data_capacity, 1);
+		LZ4_freeStream(stream);
+	}
+	else if (dictionary_size == 0)
+	{
+		size = LZ4_compress_HC((const char*)in_data, (char*)out_data, (int)in_data_size, (int)out_data_capacity, level);
+	}
+	else
+	{
+		LZ4_streamHC_t *stream = LZ4_createStreamHC();
+		LZ4_setCompressionLevel(stream, level);
+		LZ4_loadDictHC(stream, dictionary, (int)dictionary_size);
+		size = LZ4_compress_HC_continue(stream, (const char*)in_data, (char*)out_data, (int)in_data_size, (int)out_data_capacity);
+		LZ4_freeStreamHC(stream);
+	}
+
+	out_data_size = size > 0 ? size : 0;
+
+	return size > 0;
+}
+
+inline long lz4_codec_decompress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, const char *dictionary, size_t dictionary_size)
+{
+	int size = LZ4_decompress_safe_usingDict((const char*)in_data, (char*)out_data, (int)in_data_size, (int)out_data_size, dictionary, (int)dictionary_size);
+
+	return size < 0 ? -1 : size;
+}
+#endif
+
+#if defined(VDTOOL_WITH_ZSTD)
+inline bool zstd_codec_compress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level, const char *dictionary, size_t dictionary_size)
+{
+	ZSTD_CCtx *context = ZSTD_createCCtx();
+	size_t size = ZSTD_compress_usingDict(context, out_data, out_data_capacity, in_data, in_data_size, dictionary, dictionary_size, level);
+	ZSTD_freeCCtx(context);
+
+	out_data_size = ZSTD_isError(size) ? 0 : size;
+
+	return !ZSTD_isError(size);
+}
+
+inline long zstd_codec_decompress(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, const char *dictionary, size_t dictionary_size)
+{
+	ZSTD_DCtx *context = ZSTD_createDCtx();
+	size_t size = ZSTD_decompress_usingDict(context, out_data, out_data_size, in_data, in_data_size, dictionary, dictionary_size);
+	ZSTD_freeDCtx(context);
+
+	return ZSTD_isError(size) ? -1 : (long)size;
+}
+#endif
+
+inline const block_codec *codec_table(size_t &count)
+{
+	static const block_codec codecs[] =
+	{
+		{ BLOCK_CODEC_RAW, "none", 0, 0, 0, raw_codec_compress, raw_codec_decompress },
+		{ BLOCK_CODEC_ZLIB, "zlib", 1, 6, 9, zlib_codec_compress, zlib_codec_decompress },
+#if defined(VDTOOL_WITH_LZ4)
+		{ BLOCK_CODEC_LZ4, "lz4", 1, 1, LZ4HC_CLEVEL_MAX, lz4_codec_compress, lz4_codec_decompress },
+#endif
+#if defined(VDTOOL_WITH_ZSTD)
+		{ BLOCK_CODEC_ZSTD, "zstd", 1, 3, 19, zstd_codec_compress, zstd_codec_decompress },
+#endif
+	};
+
+	count = sizeof(codecs) / sizeof(codecs[0]);
+
+	return codecs;
+}
+
+// Returns NULL for codecs this build does not include
+inline const block_codec *find_codec(uint8_t id)
+{
+	size_t count = 0;
+	const block_codec *codecs = codec_table(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (codecs[i].id == id)
+		{
+			return &codecs[i];
+		}
+	}
+
+	return NULL;
+}
+
+inline const block_codec *find_codec(const string &name)
+{
+	size_t count = 0;
+	const block_codec *codecs = codec_table(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (name == codecs[i].name)
+		{
+			return &codecs[i];
+		}
+	}
+
+	return NULL;
+}
+
+// level 0 selects the codec default, anything else is clamped to the codec range
+inline int codec_level(const block_codec *codec, int level)
+{
+	if (level == 0)
+	{
+		return codec->default_level;
+	}
+
+	return level < codec->min_level ? codec->min_level : (level > codec->max_level ? codec->max_level : level);
+}
+
+#endif
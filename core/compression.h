@@ -1,27 +1,46 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
 #include <stdio.h>
 #include <string>
 #include <zlib.h>
 
-void compress_raw_data(void *in_data, size_t in_data_size, void *out_data, size_t &out_data_size)
+// Returns false when the compressed stream does not fit in out_data_capacity bytes,
+// a dictionary primes the window and is required again to decompress.
+inline bool compress_raw_data(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_capacity, size_t &out_data_size, int level = Z_DEFAULT_COMPRESSION, const char *dictionary = NULL, size_t dictionary_size = 0)
 {
 	z_stream zs;
-	zs.zalloc = 0;
-	zs.zfree = 0;
+	memset(&zs, 0, sizeof(zs));
+
 	zs.next_in = (Bytef*)in_data;
 	zs.avail_in = (uInt)in_data_size;
 	zs.next_out = (Bytef*)out_data;
-	zs.avail_out = (uInt)in_data_size;
+	zs.avail_out = (uInt)out_data_capacity;
+
+	if (deflateInit(&zs, level) != Z_OK)
+	{
+		return false;
+	}
 
-	deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+	if (dictionary_size > 0 && deflateSetDictionary(&zs, (const Bytef*)dictionary, (uInt)dictionary_size) != Z_OK)
+	{
+		deflateEnd(&zs);
+		return false;
+	}
 
-	deflate(&zs, Z_FINISH);
+	int result = deflate(&zs, Z_FINISH);
 
 	deflateEnd(&zs);
 
 	out_data_size = zs.total_out;
+
+	return result == Z_STREAM_END;
 }
 
-long decompress_raw_data(void *in_data, size_t in_data_size, void *out_data, size_t out_data_size)
+// Returns the decompressed size, or -1 if the stream is corrupt or does not fit in out_data_size bytes.
+// allow_truncated accepts a stream that ends early, as written for incompressible blocks before the
+// block envelope existed.
+inline long decompress_raw_data(const void *in_data, size_t in_data_size, void *out_data, size_t out_data_size, bool allow_truncated = false, const char *dictionary = NULL, size_t dictionary_size = 0)
 {
 	z_stream zs;
 	memset(&zs, 0, sizeof(zs));
@@ -31,11 +50,26 @@ long decompress_raw_data(void *in_data, size_t in_data_size, void *out_data, siz
 	zs.next_out = (Bytef*)(out_data);
 	zs.avail_out = (uInt)out_data_size;
 
-	inflateInit(&zs);
+	if (inflateInit(&zs) != Z_OK)
+	{
+		return -1;
+	}
+
+	int result = inflate(&zs, Z_FINISH);
 
-	inflate(&zs, Z_NO_FLUSH);
+	if (result == Z_NEED_DICT && dictionary_size > 0 && inflateSetDictionary(&zs, (const Bytef*)dictionary, (uInt)dictionary_size) == Z_OK)
+	{
+		result = inflate(&zs, Z_FINISH);
+	}
 
 	inflateEnd(&zs);
 
-	return zs.total_out;
+	if (result == Z_STREAM_END || (allow_truncated && result == Z_BUF_ERROR && zs.avail_in == 0))
+	{
+		return zs.total_out;
+	}
+
+	return -1;
 }
+
+#endif
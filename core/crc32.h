@@ -1,4 +1,8 @@
+#ifndef CRC32_H
+#define CRC32_H
+
 #include <stdint.h>
+#include <string.h>
 
 #if defined(__GNUC__)
 	#include <x86intrin.h>
@@ -6,7 +10,7 @@
 	#include <intrin.h>
 #endif
 
-uint64_t sse42_crc32(const uint64_t *buffer, size_t len)
+inline uint64_t sse42_crc32(const uint64_t *buffer, size_t len)
 {
 	uint64_t hash = 0;
 
@@ -17,3 +21,28 @@ uint64_t sse42_crc32(const uint64_t *buffer, size_t len)
 
 	return hash;
 }
+
+// Standard CRC32C (Castagnoli) of any length, crc continues a previous result
+inline uint32_t sse42_crc32c(const void *data, size_t len, uint32_t crc = 0)
+{
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint64_t hash = (uint32_t)~crc;
+
+	for (; len >= 8; len -= 8, ptr += 8)
+	{
+		uint64_t value;
+		memcpy(&value, ptr, sizeof(value));
+		hash = _mm_crc32_u64(hash, value);
+	}
+
+	uint32_t tail = (uint32_t)hash;
+
+	for (; len > 0; len--, ptr++)
+	{
+		tail = _mm_crc32_u8(tail, *ptr);
+	}
+
+	return ~tail;
+}
+
+#endif
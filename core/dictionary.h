@@ -0,0 +1,100 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "hash.h"
+#include "block_layout.h"
+
+using namespace std;
+
+// Raw content dictionary trainer. Disk blocks share structure at aligned offsets (filesystem
+// records, page headers, template files), so the trainer counts aligned segments across the
+// sample blocks and keeps the ones found in the most blocks. Every codec accepts raw content
+// dictionaries, zlib only looks at the last 32 KB of it.
+
+const size_t DICTIONARY_SEGMENT_SIZE = 64;
+const size_t DICTIONARY_MAX_SIZE = 32 * 1024;
+
+struct dictionary_segment
+{
+	uint32_t blocks;
+	uint32_t last_block;
+	const char *data;
+};
+
+inline uint32_t dictionary_id(const char *data, size_t size)
+{
+	uint32_t id = (uint32_t)xxhash64(data, size);
+
+	// 0 is reserved for blocks compressed without a dictionary
+	return id != 0 ? id : 1;
+}
+
+// samples holds sample_count blocks of sample_size bytes each, returns an empty dictionary
+// when no segment repeats across blocks
+inline string train_dictionary(const char *samples, size_t sample_count, size_t sample_size, size_t dictionary_size = DICTIONARY_MAX_SIZE)
+{
+	unordered_map<uint64_t, dictionary_segment> segments;
+
+	for (size_t i = 0; i < sample_count; i++)
+	{
+		const char *block = samples + i * sample_size;
+
+		for (size_t offset = 0; offset + DICTIONARY_SEGMENT_SIZE <= sample_size; offset += DICTIONARY_SEGMENT_SIZE)
+		{
+			const char *segment = block + offset;
+
+			if (is_zero_data(segment, DICTIONARY_SEGMENT_SIZE))
+			{
+				continue;
+			}
+
+			dictionary_segment &entry = segments[xxhash64(segment, DICTIONARY_SEGMENT_SIZE)];
+
+			if (entry.data == NULL)
+			{
+				entry.data = segment;
+				entry.last_block = (uint32_t)i;
+				entry.blocks = 1;
+			}
+			else if (entry.last_block != (uint32_t)i)
+			{
+				entry.last_block = (uint32_t)i;
+				entry.blocks++;
+			}
+		}
+	}
+
+	vector<const dictionary_segment*> common;
+
+	for (auto iter = segments.begin(); iter != segments.end(); iter++)
+	{
+		if (iter->second.blocks > 1)
+		{
+			common.push_back(&iter->second);
+		}
+	}
+
+	sort(common.begin(), common.end(), [](const dictionary_segment *a, const dictionary_segment *b)
+	{
+		return a->blocks != b->blocks ? a->blocks > b->blocks : a->data < b->data;
+	});
+
+	size_t count = min(common.size(), dictionary_size / DICTIONARY_SEGMENT_SIZE);
+	string dictionary(count * DICTIONARY_SEGMENT_SIZE, '\0');
+
+	// most common segments last, codecs reach the end of the dictionary with the shortest distances
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(&dictionary[(count - 1 - i) * DICTIONARY_SEGMENT_SIZE], common[i]->data, DICTIONARY_SEGMENT_SIZE);
+	}
+
+	return dictionary;
+}
+
+#endif
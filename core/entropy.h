@@ -0,0 +1,66 @@
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Cheap compressibility estimate: a byte histogram over a few slices spread across the data.
+// Encrypted and already compressed content sits close to 8 bits per byte, anything a
+// general purpose codec can shrink noticeably lands well below the threshold.
+
+const size_t ENTROPY_SAMPLE_SLICES = 8;
+const size_t ENTROPY_SLICE_SIZE = 512;
+const double ENTROPY_INCOMPRESSIBLE_BITS = 7.5;
+
+// Shannon entropy of the sampled bytes in bits per byte
+inline double sample_entropy(const char *data, size_t size)
+{
+	uint32_t histogram[256] = { 0 };
+	size_t sampled = 0;
+	size_t slice = size < ENTROPY_SLICE_SIZE ? size : ENTROPY_SLICE_SIZE;
+	size_t stride = (size - slice) / (ENTROPY_SAMPLE_SLICES - 1);
+
+	for (size_t i = 0; i < ENTROPY_SAMPLE_SLICES; i++)
+	{
+		const uint8_t *ptr = (const uint8_t*)data + i * stride;
+
+		for (size_t k = 0; k < slice; k++)
+		{
+			histogram[ptr[k]]++;
+		}
+
+		sampled += slice;
+	}
+
+	if (sampled == 0)
+	{
+		return 0;
+	}
+
+	double entropy = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (histogram[i] != 0)
+		{
+			double p = (double)histogram[i] / sampled;
+			entropy -= p * log2(p);
+		}
+	}
+
+	return entropy;
+}
+
+// Data too small to sample is always treated as compressible, the codec decides for it.
+inline bool is_likely_compressible(const char *data, size_t size)
+{
+	if (size < ENTROPY_SAMPLE_SLICES * ENTROPY_SLICE_SIZE)
+	{
+		return true;
+	}
+
+	return sample_entropy(data, size) < ENTROPY_INCOMPRESSIBLE_BITS;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+// Sorts more fixed size records than fit in memory: records are buffered up to memory_limit bytes,
+// each full buffer is sorted and spilled to a temporary file as a run, and the runs are merged
+// while reading back. T is copied as raw bytes and ordered by its operator <.
+template <typename T>
+class ExternalSorter
+{
+public:
+	explicit ExternalSorter(size_t memory_limit) :
+		m_capacity(max(memory_limit / sizeof(T), (size_t)1)),
+		m_count(0),
+		m_merging(false),
+		m_position(0),
+		m_failed(false)
+	{
+	}
+
+	ExternalSorter(const ExternalSorter &) = delete;
+	ExternalSorter &operator =(const ExternalSorter &) = delete;
+
+	~ExternalSorter()
+	{
+		for (FILE *run : m_runs)
+		{
+			fclose(run);
+		}
+	}
+
+	// False once a run could not be written, the sorted output is incomplete then
+	bool Add(const T &value)
+	{
+		m_buffer.push_back(value);
+		m_count++;
+
+		if (m_buffer.size() >= m_capacity)
+		{
+			Spill();
+		}
+
+		return !m_failed;
+	}
+
+	// Records added, duplicates included
+	uint64_t Count() const { return m_count; }
+
+	size_t Runs() const { return m_runs.size(); }
+
+	bool Failed() const { return m_failed; }
+
+	// Next record in order with duplicates skipped, no record may be added once reading started
+	bool Next(T &value)
+	{
+		if (!m_merging)
+		{
+			StartMerge();
+		}
+
+		while (Pop(value))
+		{
+			if (!m_hasLast || m_last < value)
+			{
+				m_last = value;
+				m_hasLast = true;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+private:
+	struct head
+	{
+		T value;
+		size_t run;
+
+		// the queue returns its largest element first
+		bool operator <(const head &other) const
+		{
+			return other.value < value;
+		}
+	};
+
+	void Spill()
+	{
+		FILE *run = tmpfile();
+
+		sort(m_buffer.begin(), m_buffer.end());
+
+		if (run == NULL || fwrite(m_buffer.data(), sizeof(T), m_buffer.size(), run) != m_buffer.size())
+		{
+			m_failed = true;
+
+			if (run != NULL)
+			{
+				fclose(run);
+			}
+		}
+		else
+		{
+			rewind(run);
+			m_runs.push_back(run);
+		}
+
+		m_buffer.clear();
+	}
+
+	// a single run is read from memory, more are merged through a queue holding the head of each
+	void StartMerge()
+	{
+		m_merging = true;
+		m_hasLast = false;
+
+		if (m_runs.empty())
+		{
+			sort(m_buffer.begin(), m_buffer.end());
+			return;
+		}
+
+		if (!m_buffer.empty())
+		{
+			Spill();
+		}
+
+		m_buffer = vector<T>();
+
+		for (size_t run = 0; run < m_runs.size(); run++)
+		{
+			Refill(run);
+		}
+	}
+
+	void Refill(size_t run)
+	{
+		head next;
+		next.run = run;
+
+		if (fread(&next.value, sizeof(T), 1, m_runs[run]) == 1)
+		{
+			m_heads.push(next);
+		}
+		else if (ferror(m_runs[run]))
+		{
+			// A run cut short by a read error would drop values without notice
+			m_failed = true;
+		}
+	}
+
+	bool Pop(T &value)
+	{
+		if (m_runs.empty())
+		{
+			if (m_position >= m_buffer.size())
+			{
+				return false;
+			}
+
+			value = m_buffer[m_position++];
+			return true;
+		}
+
+		if (m_heads.empty())
+		{
+			return false;
+		}
+
+		head top = m_heads.top();
+		m_heads.pop();
+
+		value = top.value;
+		Refill(top.run);
+
+		return true;
+	}
+
+	vector<T> m_buffer;
+	size_t m_capacity;
+	uint64_t m_count;
+	vector<FILE *> m_runs;
+	priority_queue<head> m_heads;
+	bool m_merging;
+	size_t m_position;
+	bool m_failed;
+	bool m_hasLast;
+	T m_last;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef FASTCDC_H
+#define FASTCDC_H
+
+#include <stdint.h>
+#include <string.h>
+
+// FastCDC content defined chunking. A gear hash rolls over the data and a chunk ends where
+// the masked hash is zero, so boundaries follow content and realign right after data is
+// inserted or removed. The first min_size bytes of a chunk are never hashed, a stricter mask
+// is used before avg_size and a looser one after it, which keeps chunk sizes close to the
+// average. Chunk boundaries decide which chunks deduplicate, the gear table and the masks
+// must never change.
+
+const size_t FASTCDC_MIN_AVG_SIZE = 4 * 1024;
+const size_t FASTCDC_DEFAULT_AVG_SIZE = 64 * 1024;
+
+struct fastcdc_gear_table
+{
+	uint64_t gear[256];
+	// gear shifted left by one, rolls two bytes per step with a single shift
+	uint64_t gear_ls[256];
+
+	fastcdc_gear_table()
+	{
+		// splitmix64 from a fixed seed
+		uint64_t state = 0x6766617374636463ULL;
+
+		for (int i = 0; i < 256; i++)
+		{
+			state += 0x9E3779B97F4A7C15ULL;
+
+			uint64_t z = state;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+			gear[i] = z ^ (z >> 31);
+			gear_ls[i] = gear[i] << 1;
+		}
+	}
+};
+
+inline const fastcdc_gear_table &fastcdc_gear()
+{
+	static const fastcdc_gear_table table;
+
+	return table;
+}
+
+struct fastcdc_params
+{
+	size_t min_size;
+	size_t avg_size;
+	size_t max_size;
+	uint64_t mask_s;
+	uint64_t mask_l;
+};
+
+// mask with bits ones spread over bits 15 to 62, bit 15 of the hash depends on the last 16 bytes.
+// Bit 63 stays clear so the shifted mask of the two byte roll tests the same bits.
+inline uint64_t fastcdc_mask(int bits)
+{
+	uint64_t mask = 0;
+
+	for (int i = 0; i < bits; i++)
+	{
+		mask |= 1ULL << (62 - i * 47 / bits);
+	}
+
+	return mask;
+}
+
+// avg_size is rounded down to a power of two and should be at least FASTCDC_MIN_AVG_SIZE,
+// chunks are between a quarter of it and four times it
+inline fastcdc_params fastcdc_setup(size_t avg_size)
+{
+	int bits = 0;
+
+	while (((size_t)2 << bits) <= avg_size)
+	{
+		bits++;
+	}
+
+	fastcdc_params params;
+	params.avg_size = (size_t)1 << bits;
+	params.min_size = params.avg_size / 4;
+	params.max_size = params.avg_size * 4;
+	params.mask_s = fastcdc_mask(bits + 2);
+	params.mask_l = fastcdc_mask(bits - 2);
+
+	return params;
+}
+
+// Length of the chunk that starts at data, the remaining size when no boundary is found
+inline size_t fastcdc_cut(const uint8_t *data, size_t size, const fastcdc_params &params)
+{
+	if (size <= params.min_size)
+	{
+		return size;
+	}
+
+	const fastcdc_gear_table &table = fastcdc_gear();
+	size_t end = size < params.max_size ? size : params.max_size;
+	size_t normal = end < params.avg_size ? end : params.avg_size;
+	uint64_t mask_s_ls = params.mask_s << 1;
+	uint64_t mask_l_ls = params.mask_l << 1;
+	uint64_t fp = 0;
+	size_t i = params.min_size;
+
+	// (fp << 2) + (gear << 1) is the hash after the first byte shifted left by one,
+	// testing it against the shifted mask tests the hash after that byte
+	for (; i + 2 <= normal; i += 2)
+	{
+		fp = (fp << 2) + table.gear_ls[data[i]];
+
+		if ((fp & mask_s_ls) == 0)
+		{
+			return i + 1;
+		}
+
+		fp += table.gear[data[i + 1]];
+
+		if ((fp & params.mask_s) == 0)
+		{
+			return i + 2;
+		}
+	}
+
+	for (; i < normal; i++)
+	{
+		fp = (fp << 1) + table.gear[data[i]];
+
+		if ((fp & params.mask_s) == 0)
+		{
+			return i + 1;
+		}
+	}
+
+	for (; i + 2 <= end; i += 2)
+	{
+		fp = (fp << 2) + table.gear_ls[data[i]];
+
+		if ((fp & mask_l_ls) == 0)
+		{
+			return i + 1;
+		}
+
+		fp += table.gear[data[i + 1]];
+
+		if ((fp & params.mask_l) == 0)
+		{
+			return i + 2;
+		}
+	}
+
+	for (; i < end; i++)
+	{
+		fp = (fp << 1) + table.gear[data[i]];
+
+		if ((fp & params.mask_l) == 0)
+		{
+			return i + 1;
+		}
+	}
+
+	return end;
+}
+
+#endif
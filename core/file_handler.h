@@ -1,17 +1,26 @@
+#ifndef FILE_HANDLER_H
+#define FILE_HANDLER_H
+
 #if defined(_MSC_VER)
 	#include <windows.h>
 #endif
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <string>
+#include <iostream>
 
 #if defined(__GNUC__)
 	#include <unistd.h>
 	#include <sys/types.h>
 	#include <sys/stat.h>
 	#include <fcntl.h>
+	#include <linux/falloc.h>
 #endif
 
+using namespace std;
+
 struct file_handler
 {
 	int file_descriptor;
@@ -25,7 +34,7 @@ struct file_handler
 	}
 };
 
-void log_error()
+inline void log_error()
 {
 #if defined(_MSC_VER)
 	DWORD errorMessageId = GetLastError();
@@ -45,21 +54,21 @@ void log_error()
 #endif
 }
 
-file_handler open_file_data(const char *file, const char *mode)
+inline file_handler open_file_data(const char *file, const char *mode)
 {
 	file_handler handler;
 
 #if defined(__GNUC__)
-	if (mode == "rb")
+	if (strcmp(mode, "rb") == 0)
 	{
 		handler.file_descriptor = open(file, O_RDONLY);
 	}
-	else if (mode == "wb")
+	else if (strcmp(mode, "wb") == 0)
 	{
 		handler.file_descriptor = open(file, O_RDWR);
 	}
 #else
-	BOOL readonly = mode == "rb";
+	BOOL readonly = strcmp(mode, "rb") == 0;
 	DWORD dwDesiredAccess = readonly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
 	DWORD dwSharedMode = readonly ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE;
 
@@ -90,7 +99,57 @@ file_handler open_file_data(const char *file, const char *mode)
 	return handler;
 }
 
-void seek_file(file_handler *handler, long offset)
+inline file_handler create_file_data(const char *file)
+{
+	file_handler handler;
+
+#if defined(__GNUC__)
+	handler.file_descriptor = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+#else
+	handler.handle = CreateFileA(file, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	log_error();
+
+	DWORD dwBytesReturned;
+	DeviceIoControl(handler.handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwBytesReturned, NULL);
+#endif
+
+	return handler;
+}
+
+// Fails when the file exists, so files holding data of an earlier run are never truncated
+inline file_handler create_new_file_data(const char *file)
+{
+	file_handler handler;
+
+#if defined(__GNUC__)
+	handler.file_descriptor = open(file, O_RDWR | O_CREAT | O_EXCL, 0644);
+#else
+	handler.handle = CreateFileA(file, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	log_error();
+
+	DWORD dwBytesReturned;
+
+	if (handler.handle != INVALID_HANDLE_VALUE)
+	{
+		DeviceIoControl(handler.handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwBytesReturned, NULL);
+	}
+#endif
+
+	return handler;
+}
+
+inline bool is_file_open(file_handler *handler)
+{
+#if defined(__GNUC__)
+	return handler->file_descriptor >= 0;
+#else
+	return handler->handle != INVALID_HANDLE_VALUE;
+#endif
+}
+
+inline void seek_file(file_handler *handler, long offset)
 {
 int result = 0;
 
@@ -107,7 +166,7 @@ int result = 0;
 #endif
 }
 
-int read_file_data(file_handler *handler, void *data, int size)
+inline int read_file_data(file_handler *handler, void *data, int size)
 {
 	int result = 0;
 
@@ -125,7 +184,7 @@ int read_file_data(file_handler *handler, void *data, int size)
 	return result;
 }
 
-int write_file_data(file_handler *handler, void *data, int size)
+inline int write_file_data(file_handler *handler, void *data, int size)
 {
 	int result = 0;
 
@@ -143,11 +202,106 @@ int write_file_data(file_handler *handler, void *data, int size)
 	return result;
 }
 
-void close_file(file_handler* handler)
+inline int read_file_data_at(file_handler *handler, void *data, int size, uint64_t offset)
+{
+	int result = 0;
+
+#if defined(__GNUC__)
+	result = (int)pread(handler->file_descriptor, data, size, (off_t)offset);
+#else
+	OVERLAPPED overlapped = { 0 };
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD nRead = 0;
+	BOOL res = ReadFile(handler->handle, data, size, &nRead, &overlapped);
+	result = (int)nRead;
+
+	log_error();
+
+#endif
+
+	return result;
+}
+
+inline int write_file_data_at(file_handler *handler, const void *data, int size, uint64_t offset)
+{
+	int result = 0;
+
+#if defined(__GNUC__)
+	result = (int)pwrite(handler->file_descriptor, data, size, (off_t)offset);
+#else
+	OVERLAPPED overlapped = { 0 };
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD nWritten = 0;
+	BOOL res = WriteFile(handler->handle, data, size, &nWritten, &overlapped);
+	result = (int)nWritten;
+
+	log_error();
+
+#endif
+
+	return result;
+}
+
+inline int set_file_size(file_handler *handler, uint64_t size)
+{
+#if defined(__GNUC__)
+	return ftruncate(handler->file_descriptor, (off_t)size);
+#else
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG)size;
+
+	if (!SetFilePointerEx(handler->handle, position, NULL, FILE_BEGIN) || !SetEndOfFile(handler->handle))
+	{
+		log_error();
+		return 1;
+	}
+
+	return 0;
+#endif
+}
+
+// Deallocates a range of a sparse file, the range reads back as zeros
+inline int punch_hole(file_handler *handler, uint64_t offset, uint64_t length)
+{
+#if defined(__GNUC__)
+	return fallocate(handler->file_descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)length);
+#else
+	FILE_ZERO_DATA_INFORMATION zeroData;
+	zeroData.FileOffset.QuadPart = (LONGLONG)offset;
+	zeroData.BeyondFinalZero.QuadPart = (LONGLONG)(offset + length);
+
+	DWORD dwBytesReturned;
+
+	if (!DeviceIoControl(handler->handle, FSCTL_SET_ZERO_DATA, &zeroData, sizeof(zeroData), NULL, 0, &dwBytesReturned, NULL))
+	{
+		log_error();
+		return 1;
+	}
+
+	return 0;
+#endif
+}
+
+inline void flush_file(file_handler *handler)
+{
+#if defined(__GNUC__)
+	fsync(handler->file_descriptor);
+#else
+	FlushFileBuffers(handler->handle);
+#endif
+}
+
+inline void close_file(file_handler* handler)
 {
 #if defined(__GNUC__)
 	close(handler->file_descriptor);
 #else
 	CloseHandle(handler->handle);
 #endif
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
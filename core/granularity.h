@@ -0,0 +1,97 @@
+#ifndef GRANULARITY_H
+#define GRANULARITY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "bit_ops.h"
+
+using namespace std;
+
+// Change tracking granularity. Blocks are tracked, packed and restored in granules of 512 bytes,
+// 4 KB or 64 KB, the granule is stored as the sector size of each block so it may differ between
+// backups of a chain. Kernels are instantiated per granule size: divisions become shifts and the
+// per granule loops have a fixed trip count the compiler unrolls and vectorises.
+
+const uint32_t TRACKING_SECTOR_SIZE = 512;
+
+// Marks the granules overlapping the byte range [start, end) of the block at block_offset,
+// returns them as first and count relative to the block.
+template <uint32_t GRANULE_SIZE>
+inline void mark_granule_range(uint64_t *granule_map, uint64_t block_offset, uint64_t start, uint64_t end, uint32_t &first, uint32_t &count)
+{
+	uint64_t first_granule = (start - block_offset) / GRANULE_SIZE;
+	uint64_t end_granule = (end - block_offset + GRANULE_SIZE - 1) / GRANULE_SIZE;
+
+	first = (uint32_t)first_granule;
+	count = (uint32_t)(end_granule - first_granule);
+
+	set_bitmap_range(granule_map, first, count);
+}
+
+// Copies the marked granules out of a positional block image, returns the number of bytes packed.
+template <uint32_t GRANULE_SIZE>
+inline size_t pack_granules(char *data, const char *image, const uint64_t *granule_map, uint32_t granules_per_block)
+{
+	size_t packed = 0;
+	uint32_t position = 0;
+	uint32_t run_first = 0;
+	uint32_t run_count = 0;
+
+	while (next_bitmap_run(granule_map, granules_per_block, position, run_first, run_count))
+	{
+		size_t length = (size_t)run_count * GRANULE_SIZE;
+
+		memcpy(data + packed, image + (size_t)run_first * GRANULE_SIZE, length);
+
+		packed += length;
+		position = run_first + run_count;
+	}
+
+	return packed;
+}
+
+// Sets the 512 byte sectors of a run of granules in a restore sector mask
+template <uint32_t GRANULE_SIZE>
+inline void mark_granule_sectors(vector<bool> &sector_mask, uint32_t first_granule, uint32_t granule_count)
+{
+	const size_t sectors = GRANULE_SIZE / TRACKING_SECTOR_SIZE;
+
+	fill(sector_mask.begin() + first_granule * sectors, sector_mask.begin() + (first_granule + granule_count) * sectors, true);
+}
+
+struct granularity_kernels
+{
+	uint32_t granule_size;
+	void (*mark_range)(uint64_t *granule_map, uint64_t block_offset, uint64_t start, uint64_t end, uint32_t &first, uint32_t &count);
+	size_t (*pack)(char *data, const char *image, const uint64_t *granule_map, uint32_t granules_per_block);
+	void (*mark_sectors)(vector<bool> &sector_mask, uint32_t first_granule, uint32_t granule_count);
+};
+
+#define GRANULARITY_KERNELS(size) { size, mark_granule_range<size>, pack_granules<size>, mark_granule_sectors<size> }
+
+// Returns NULL for granule sizes without kernels, blocks written with one can't be restored
+inline const granularity_kernels *find_granularity(uint32_t granule_size)
+{
+	static const granularity_kernels kernels[] =
+	{
+		GRANULARITY_KERNELS(512),
+		GRANULARITY_KERNELS(4096),
+		GRANULARITY_KERNELS(65536),
+	};
+
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+	{
+		if (kernels[i].granule_size == granule_size)
+		{
+			return &kernels[i];
+		}
+	}
+
+	return NULL;
+}
+
+#undef GRANULARITY_KERNELS
+
+#endif
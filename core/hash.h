@@ -0,0 +1,114 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// XXH64 (xxHash, 64-bit variant), used to fingerprint whole blocks
+
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t xxh_rotl64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t xxh_read64(const uint8_t *ptr)
+{
+	uint64_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+inline uint32_t xxh_read32(const uint8_t *ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh_rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+inline uint64_t xxh_merge_round(uint64_t acc, uint64_t value)
+{
+	acc ^= xxh_round(0, value);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+inline uint64_t xxhash64(const void *data, size_t len, uint64_t seed = 0)
+{
+	const uint8_t *ptr = (const uint8_t*)data;
+	const uint8_t *end = ptr + len;
+	uint64_t hash;
+
+	if (len >= 32)
+	{
+		const uint8_t *limit = end - 32;
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+
+		do
+		{
+			v1 = xxh_round(v1, xxh_read64(ptr));
+			v2 = xxh_round(v2, xxh_read64(ptr + 8));
+			v3 = xxh_round(v3, xxh_read64(ptr + 16));
+			v4 = xxh_round(v4, xxh_read64(ptr + 24));
+			ptr += 32;
+		}
+		while (ptr <= limit);
+
+		hash = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+		hash = xxh_merge_round(hash, v1);
+		hash = xxh_merge_round(hash, v2);
+		hash = xxh_merge_round(hash, v3);
+		hash = xxh_merge_round(hash, v4);
+	}
+	else
+	{
+		hash = seed + XXH_PRIME64_5;
+	}
+
+	hash += (uint64_t)len;
+
+	while (ptr + 8 <= end)
+	{
+		hash ^= xxh_round(0, xxh_read64(ptr));
+		hash = xxh_rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		ptr += 8;
+	}
+
+	if (ptr + 4 <= end)
+	{
+		hash ^= (uint64_t)xxh_read32(ptr) * XXH_PRIME64_1;
+		hash = xxh_rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		ptr += 4;
+	}
+
+	while (ptr < end)
+	{
+		hash ^= (*ptr) * XXH_PRIME64_5;
+		hash = xxh_rotl64(hash, 11) * XXH_PRIME64_1;
+		ptr++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "hash.h"
+
+using namespace std;
+
+// Binary Merkle tree over 64-bit block hashes. levels[0] holds the leaves, every level above
+// hashes pairs of the one below and a node left without a sibling at the end of a level is
+// hashed alone, so the shape follows from the leaf count. Nodes are XXH64 like the block hashes
+// they cover: the tree finds changes and corruption, it is not meant to withstand forgery.
+
+const uint64_t MERKLE_NODE_SEED = 0x4D45524B4C450001ULL;
+
+inline uint64_t merkle_node_hash(const uint64_t *children, size_t count)
+{
+	return xxhash64(children, count * sizeof(uint64_t), MERKLE_NODE_SEED);
+}
+
+inline void merkle_build_levels(const vector<uint64_t> &leaves, vector<vector<uint64_t>> &levels)
+{
+	levels.assign(1, leaves);
+
+	while (levels.back().size() > 1)
+	{
+		const vector<uint64_t> &below = levels.back();
+		vector<uint64_t> level((below.size() + 1) / 2);
+
+		for (size_t i = 0; i < level.size(); i++)
+		{
+			level[i] = merkle_node_hash(&below[2 * i], min((size_t)2, below.size() - 2 * i));
+		}
+
+		levels.push_back(level);
+	}
+}
+
+// Root of a tree without leaves is 0
+inline uint64_t merkle_root(const vector<vector<uint64_t>> &levels)
+{
+	return levels.back().empty() ? 0 : levels.back()[0];
+}
+
+inline uint64_t merkle_root(const vector<uint64_t> &leaves)
+{
+	vector<vector<uint64_t>> levels;
+	merkle_build_levels(leaves, levels);
+
+	return merkle_root(levels);
+}
+
+// Leaves whose hashes differ between two trees with the same leaf count, in ascending order.
+// Only subtrees whose roots differ are descended into, equal subtrees are skipped whole.
+inline void merkle_diff(const vector<vector<uint64_t>> &a, const vector<vector<uint64_t>> &b, vector<uint64_t> &leaves)
+{
+	leaves.clear();
+
+	if (a.size() != b.size() || a[0].size() != b[0].size() || a[0].empty())
+	{
+		return;
+	}
+
+	vector<uint64_t> nodes(1, 0);
+
+	for (size_t level = a.size() - 1; level > 0; level--)
+	{
+		vector<uint64_t> below;
+
+		for (uint64_t node : nodes)
+		{
+			if (a[level][node] == b[level][node])
+			{
+				continue;
+			}
+
+			for (uint64_t child = 2 * node; child < min(2 * node + 2, (uint64_t)a[level - 1].size()); child++)
+			{
+				below.push_back(child);
+			}
+		}
+
+		nodes.swap(below);
+	}
+
+	for (uint64_t node : nodes)
+	{
+		if (a[0][node] != b[0][node])
+		{
+			leaves.push_back(node);
+		}
+	}
+}
+
+// Hashes besides leaves [first, first + count) that recompute the root, lowest level first
+inline void merkle_range_proof(const vector<vector<uint64_t>> &levels, uint64_t first, uint64_t count, vector<uint64_t> &proof)
+{
+	proof.clear();
+
+	uint64_t lo = first;
+	uint64_t hi = first + count - 1;
+
+	for (size_t level = 0; level + 1 < levels.size(); level++)
+	{
+		if (lo % 2 == 1)
+		{
+			proof.push_back(levels[level][lo - 1]);
+		}
+
+		if (hi % 2 == 0 && hi + 1 < levels[level].size())
+		{
+			proof.push_back(levels[level][hi + 1]);
+		}
+
+		lo /= 2;
+		hi /= 2;
+	}
+}
+
+// Root of a tree of leaf_count leaves recomputed from leaves [first, first + count) and their proof,
+// false if the proof does not fit the range
+inline bool merkle_range_root(const uint64_t *leaves, uint64_t count, uint64_t first, uint64_t leaf_count, const vector<uint64_t> &proof, uint64_t &root)
+{
+	if (count == 0 || first + count > leaf_count)
+	{
+		return false;
+	}
+
+	vector<uint64_t> nodes(leaves, leaves + count);
+	uint64_t lo = first;
+	uint64_t hi = first + count - 1;
+	uint64_t size = leaf_count;
+	size_t used = 0;
+
+	while (size > 1)
+	{
+		if (lo % 2 == 1)
+		{
+			if (used >= proof.size())
+			{
+				return false;
+			}
+
+			nodes.insert(nodes.begin(), proof[used++]);
+			lo--;
+		}
+
+		if (hi % 2 == 0 && hi + 1 < size)
+		{
+			if (used >= proof.size())
+			{
+				return false;
+			}
+
+			nodes.push_back(proof[used++]);
+			hi++;
+		}
+
+		vector<uint64_t> above((nodes.size() + 1) / 2);
+
+		for (size_t i = 0; i < above.size(); i++)
+		{
+			above[i] = merkle_node_hash(&nodes[2 * i], min((size_t)2, nodes.size() - 2 * i));
+		}
+
+		nodes.swap(above);
+		lo /= 2;
+		hi /= 2;
+		size = (size + 1) / 2;
+	}
+
+	root = nodes[0];
+
+	return used == proof.size();
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef METADATA_FORMAT_H
+#define METADATA_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "compression.h"
+#include "crc32.h"
+
+using namespace std;
+
+// Metadata container, every field little endian:
+// [UINT32 magic][UINT16 version][UINT16 header size][UINT32 flags][UINT32 CRC32C of the stored body]
+// [UINT64 body length][UINT64 stored body length][stored body]
+// The body is a sequence of sections, each [UINT32 id][UINT32 reserved][UINT64 length][data],
+// data padded to 8 bytes so arrays inside a decoded body are aligned and can be searched in place.
+// Newer writers may only append header fields and sections, readers skip what they do not know.
+
+const uint32_t METADATA_MAGIC = 0x444D4456; // "VDMD"
+const uint16_t METADATA_VERSION = 1;
+const size_t METADATA_HEADER_SIZE = 2 * sizeof(uint64_t) + 4 * sizeof(uint32_t);
+const size_t METADATA_SECTION_HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+const uint32_t METADATA_FLAG_COMPRESSED = 1;
+const uint32_t METADATA_KNOWN_FLAGS = METADATA_FLAG_COMPRESSED;
+
+// Deflate never inflates data by more than this, the header is outside the checksum so
+// a body length beyond it is corrupt and must not be allocated
+const uint64_t METADATA_MAX_INFLATE_RATIO = 1032;
+
+inline void append_metadata_section(string &body, uint32_t id, const void *data, size_t length)
+{
+	char header[METADATA_SECTION_HEADER_SIZE] = { 0 };
+	uint64_t section_length = length;
+
+	memcpy(header, &id, sizeof(uint32_t));
+	memcpy(header + 2 * sizeof(uint32_t), &section_length, sizeof(uint64_t));
+
+	body.append(header, sizeof(header));
+	body.append((const char*)data, length);
+	body.append((8 - length % 8) % 8, '\0');
+}
+
+// Locates a section of a decoded body, returns false if it is absent or truncated
+inline bool find_metadata_section(const string &body, uint32_t id, const char *&data, size_t &length)
+{
+	size_t pos = 0;
+
+	while (pos + METADATA_SECTION_HEADER_SIZE <= body.size())
+	{
+		uint32_t section_id = 0;
+		uint64_t section_length = 0;
+
+		memcpy(&section_id, body.data() + pos, sizeof(uint32_t));
+		memcpy(&section_length, body.data() + pos + 2 * sizeof(uint32_t), sizeof(uint64_t));
+
+		pos += METADATA_SECTION_HEADER_SIZE;
+
+		if (section_length > body.size() - pos)
+		{
+			return false;
+		}
+
+		if (section_id == id)
+		{
+			data = body.data() + pos;
+			length = (size_t)section_length;
+
+			return true;
+		}
+
+		pos += (size_t)(section_length + (8 - section_length % 8) % 8);
+	}
+
+	return false;
+}
+
+inline bool is_metadata_container(const char *data, size_t size)
+{
+	uint32_t magic = 0;
+
+	if (size < sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	memcpy(&magic, data, sizeof(uint32_t));
+
+	return magic == METADATA_MAGIC;
+}
+
+// Wraps a body in the container, compressing it when that makes it smaller
+inline string seal_metadata(const string &body)
+{
+	string stored(body.size(), '\0');
+	size_t stored_length = 0;
+	uint32_t flags = METADATA_FLAG_COMPRESSED;
+
+	if (!compress_raw_data(body.data(), body.size(), &stored[0], stored.size(), stored_length) || stored_length >= body.size())
+	{
+		stored = body;
+		stored_length = body.size();
+		flags = 0;
+	}
+
+	stored.resize(stored_length);
+
+	uint16_t version = METADATA_VERSION;
+	uint16_t header_size = (uint16_t)METADATA_HEADER_SIZE;
+	uint32_t checksum = sse42_crc32c(stored.data(), stored.size());
+	uint64_t raw_length = body.size();
+	uint64_t stored_size = stored.size();
+
+	char header[METADATA_HEADER_SIZE];
+	memcpy(header, &METADATA_MAGIC, sizeof(uint32_t));
+	memcpy(header + 4, &version, sizeof(uint16_t));
+	memcpy(header + 6, &header_size, sizeof(uint16_t));
+	memcpy(header + 8, &flags, sizeof(uint32_t));
+	memcpy(header + 12, &checksum, sizeof(uint32_t));
+	memcpy(header + 16, &raw_length, sizeof(uint64_t));
+	memcpy(header + 24, &stored_size, sizeof(uint64_t));
+
+	return string(header, sizeof(header)) + stored;
+}
+
+// Verifies the container and decodes its body, returns false if it is corrupt or uses flags this reader does not know
+inline bool open_metadata(const char *data, size_t size, string &body)
+{
+	if (!is_metadata_container(data, size) || size < METADATA_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	uint16_t header_size = 0;
+	uint32_t flags = 0;
+	uint32_t checksum = 0;
+	uint64_t raw_length = 0;
+	uint64_t stored_length = 0;
+
+	memcpy(&header_size, data + 6, sizeof(uint16_t));
+	memcpy(&flags, data + 8, sizeof(uint32_t));
+	memcpy(&checksum, data + 12, sizeof(uint32_t));
+	memcpy(&raw_length, data + 16, sizeof(uint64_t));
+	memcpy(&stored_length, data + 24, sizeof(uint64_t));
+
+	if (header_size < METADATA_HEADER_SIZE || header_size > size || (flags & ~METADATA_KNOWN_FLAGS) != 0 || stored_length > size - header_size)
+	{
+		return false;
+	}
+
+	const char *stored = data + header_size;
+	bool compressed = (flags & METADATA_FLAG_COMPRESSED) != 0;
+
+	if (compressed ? raw_length / METADATA_MAX_INFLATE_RATIO > stored_length : stored_length != raw_length)
+	{
+		return false;
+	}
+
+	if (sse42_crc32c(stored, (size_t)stored_length) != checksum)
+	{
+		return false;
+	}
+
+	body.assign((size_t)raw_length, '\0');
+
+	if (!compressed)
+	{
+		memcpy(&body[0], stored, (size_t)raw_length);
+
+		return true;
+	}
+
+	return decompress_raw_data(stored, (size_t)stored_length, &body[0], body.size()) == (long)raw_length;
+}
+
+#endif
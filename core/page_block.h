@@ -0,0 +1,191 @@
+#ifndef PAGE_BLOCK_H
+#define PAGE_BLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Page deduplicated block layout, written instead of the compact layout of block_layout.h when
+// page deduplication is on. Every field little endian:
+// [UINT16 marker][UINT8 version][UINT8 reserved][UINT16 source count][UINT16 reserved]
+// [UINT32 pages in block][UINT32 stored pages][UINT32 references]
+// [source count x PAGE_SOURCE_ID_SIZE byte backup ids]
+// [pages in block x UINT32 page entry][references x page_reference][stored pages x DEDUP_PAGE_SIZE]
+// A page entry is PAGE_ABSENT for pages the backup did not write, PAGE_ZERO, the slot of a page
+// stored in this block, or PAGE_REFERENCE_FLAG with the index of a reference to a page stored
+// by another block. A reference names the backup by its index in the source table, the block
+// and the slot of the page in that block. The marker is never a legacy sector size nor the
+// compact layout marker, so the first UINT16 tells all layouts apart.
+
+const uint16_t PAGE_BLOCK_MARKER = 0xB10D;
+const uint8_t PAGE_BLOCK_VERSION = 1;
+const size_t PAGE_BLOCK_HEADER_SIZE = 4 * sizeof(uint16_t) + 3 * sizeof(uint32_t);
+const size_t DEDUP_PAGE_SIZE = 4096;
+const size_t PAGE_SOURCE_ID_SIZE = 32;
+
+const uint32_t PAGE_ABSENT = 0xFFFFFFFF;
+const uint32_t PAGE_ZERO = 0xFFFFFFFE;
+const uint32_t PAGE_REFERENCE_FLAG = 0x80000000;
+
+struct page_reference
+{
+	uint64_t block_index;
+	uint32_t slot;
+	uint32_t source;
+};
+
+// Upper bound of a page block, every page stored or every page referencing a different backup
+inline size_t page_block_max_size(uint32_t pages)
+{
+	return PAGE_BLOCK_HEADER_SIZE + (size_t)pages * (PAGE_SOURCE_ID_SIZE + sizeof(uint32_t) + sizeof(page_reference) + DEDUP_PAGE_SIZE);
+}
+
+// sources holds PAGE_SOURCE_ID_SIZE bytes per backup, stored_pages the stored pages in slot order.
+// Returns the layout size, out must have room for page_block_max_size(pages).
+inline size_t write_page_block(char *out, uint32_t pages, const uint32_t *entries, const string &sources, const vector<page_reference> &references, const char *stored_pages, uint32_t stored)
+{
+	uint16_t source_count = (uint16_t)(sources.size() / PAGE_SOURCE_ID_SIZE);
+	uint32_t reference_count = (uint32_t)references.size();
+	char *ptr = out;
+
+	memset(ptr, 0, PAGE_BLOCK_HEADER_SIZE);
+	memcpy(ptr, &PAGE_BLOCK_MARKER, sizeof(uint16_t));
+	ptr[2] = (char)PAGE_BLOCK_VERSION;
+	memcpy(ptr + 4, &source_count, sizeof(uint16_t));
+	memcpy(ptr + 8, &pages, sizeof(uint32_t));
+	memcpy(ptr + 12, &stored, sizeof(uint32_t));
+	memcpy(ptr + 16, &reference_count, sizeof(uint32_t));
+	ptr += PAGE_BLOCK_HEADER_SIZE;
+
+	memcpy(ptr, sources.data(), (size_t)source_count * PAGE_SOURCE_ID_SIZE);
+	ptr += (size_t)source_count * PAGE_SOURCE_ID_SIZE;
+
+	memcpy(ptr, entries, (size_t)pages * sizeof(uint32_t));
+	ptr += (size_t)pages * sizeof(uint32_t);
+
+	memcpy(ptr, references.data(), references.size() * sizeof(page_reference));
+	ptr += references.size() * sizeof(page_reference);
+
+	memcpy(ptr, stored_pages, (size_t)stored * DEDUP_PAGE_SIZE);
+	ptr += (size_t)stored * DEDUP_PAGE_SIZE;
+
+	return ptr - out;
+}
+
+// Sections of a parsed page block, pointers into the decoded block
+struct page_block_view
+{
+	uint32_t pages;
+	uint32_t stored;
+	uint32_t references;
+	uint16_t sources;
+	const char *source_ids;
+	const char *entries;
+	const char *reference_data;
+	const char *page_data;
+};
+
+inline bool is_page_block(const char *block, size_t block_length)
+{
+	uint16_t marker = 0;
+
+	if (block_length < sizeof(uint16_t))
+	{
+		return false;
+	}
+
+	memcpy(&marker, block, sizeof(uint16_t));
+
+	return marker == PAGE_BLOCK_MARKER;
+}
+
+// Returns false if the header is inconsistent with the decoded length or an entry points past its table
+inline bool parse_page_block(const char *block, size_t block_length, page_block_view &view)
+{
+	if (!is_page_block(block, block_length) || block_length < PAGE_BLOCK_HEADER_SIZE || (uint8_t)block[2] != PAGE_BLOCK_VERSION)
+	{
+		return false;
+	}
+
+	memcpy(&view.sources, block + 4, sizeof(uint16_t));
+	memcpy(&view.pages, block + 8, sizeof(uint32_t));
+	memcpy(&view.stored, block + 12, sizeof(uint32_t));
+	memcpy(&view.references, block + 16, sizeof(uint32_t));
+
+	uint64_t size = PAGE_BLOCK_HEADER_SIZE + (uint64_t)view.sources * PAGE_SOURCE_ID_SIZE + (uint64_t)view.pages * sizeof(uint32_t) +
+					(uint64_t)view.references * sizeof(page_reference) + (uint64_t)view.stored * DEDUP_PAGE_SIZE;
+
+	if (size != block_length)
+	{
+		return false;
+	}
+
+	view.source_ids = block + PAGE_BLOCK_HEADER_SIZE;
+	view.entries = view.source_ids + (size_t)view.sources * PAGE_SOURCE_ID_SIZE;
+	view.reference_data = view.entries + (size_t)view.pages * sizeof(uint32_t);
+	view.page_data = view.reference_data + (size_t)view.references * sizeof(page_reference);
+
+	for (uint32_t i = 0; i < view.pages; i++)
+	{
+		uint32_t entry = 0;
+		memcpy(&entry, view.entries + i * sizeof(uint32_t), sizeof(uint32_t));
+
+		if (entry == PAGE_ABSENT || entry == PAGE_ZERO)
+		{
+			continue;
+		}
+
+		if ((entry & PAGE_REFERENCE_FLAG) != 0 ? (entry & ~PAGE_REFERENCE_FLAG) >= view.references : entry >= view.stored)
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < view.references; i++)
+	{
+		page_reference reference;
+		memcpy(&reference, view.reference_data + i * sizeof(page_reference), sizeof(page_reference));
+
+		if (reference.source >= view.sources)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+inline uint32_t page_block_entry(const page_block_view &view, uint32_t page)
+{
+	uint32_t entry = 0;
+	memcpy(&entry, view.entries + page * sizeof(uint32_t), sizeof(uint32_t));
+
+	return entry;
+}
+
+inline page_reference page_block_reference(const page_block_view &view, uint32_t index)
+{
+	page_reference reference;
+	memcpy(&reference, view.reference_data + index * sizeof(page_reference), sizeof(page_reference));
+
+	return reference;
+}
+
+// Backup ids shorter than PAGE_SOURCE_ID_SIZE are padded with zeros
+inline string page_block_source(const page_block_view &view, uint32_t index)
+{
+	const char *id = view.source_ids + (size_t)index * PAGE_SOURCE_ID_SIZE;
+	size_t length = 0;
+
+	while (length < PAGE_SOURCE_ID_SIZE && id[length] != '\0')
+	{
+		length++;
+	}
+
+	return string(id, length);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef PAGE_INDEX_H
+#define PAGE_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "hash.h"
+#include "page_block.h"
+
+using namespace std;
+
+// Pages are matched by 128 bits made of two differently seeded XXH64 of the page. A false
+// match would restore the wrong page, 64 bits leave that within reach on large volumes,
+// a cryptographic hash costs more than the page compression it saves.
+
+struct page_key
+{
+	uint64_t lo;
+	uint64_t hi;
+};
+
+inline page_key page_hash(const char *page)
+{
+	page_key key;
+	key.lo = xxhash64(page, DEDUP_PAGE_SIZE, 0);
+	key.hi = xxhash64(page, DEDUP_PAGE_SIZE, XXH_PRIME64_3);
+
+	// the all zero key marks empty slots of the index
+	if (key.lo == 0 && key.hi == 0)
+	{
+		key.lo = 1;
+	}
+
+	return key;
+}
+
+// A page a backup stored, persisted per backup so later backups of the volume can reference it
+struct page_index_entry
+{
+	page_key key;
+	uint64_t block_index;
+	uint32_t slot;
+	uint32_t reserved;
+};
+
+// A page a backup references in a block of another backup, persisted per backup so garbage collection
+// keeps the blocks later backups still read pages from. block_index is the referencing block.
+struct page_source_reference
+{
+	char source_id[PAGE_SOURCE_ID_SIZE];
+	uint64_t source_block;
+	uint64_t block_index;
+	uint32_t slot;
+	uint32_t reserved;
+};
+
+// Ordered by source backup, source block and slot, so the references into one block are adjacent
+inline bool operator <(const page_source_reference &a, const page_source_reference &b)
+{
+	int order = memcmp(a.source_id, b.source_id, PAGE_SOURCE_ID_SIZE);
+
+	if (order != 0)
+	{
+		return order < 0;
+	}
+
+	if (a.source_block != b.source_block)
+	{
+		return a.source_block < b.source_block;
+	}
+
+	if (a.slot != b.slot)
+	{
+		return a.slot < b.slot;
+	}
+
+	return a.block_index < b.block_index;
+}
+
+inline bool operator ==(const page_source_reference &a, const page_source_reference &b)
+{
+	return !(a < b) && !(b < a);
+}
+
+// Where a page is stored: the backup, as an index into the caller's table of backups,
+// the block and the slot of the page in that block
+struct page_location
+{
+	uint64_t block_index;
+	uint32_t slot;
+	uint32_t source;
+};
+
+// Flat open addressing table of page keys with linear probing, bounded so the index of a large
+// volume cannot outgrow memory. Once full, new pages are still stored, just no longer indexed.
+class PageIndex
+{
+public:
+	explicit PageIndex(size_t limit) : m_limit(limit), m_count(0)
+	{
+		m_slots.resize(MinSlots);
+	}
+
+	size_t Size() const { return m_count; }
+
+	bool IsFull() const { return m_count >= m_limit; }
+
+	bool Find(const page_key &key, page_location &location) const
+	{
+		size_t mask = m_slots.size() - 1;
+
+		for (size_t slot = key.lo & mask; !IsEmpty(m_slots[slot]); slot = (slot + 1) & mask)
+		{
+			if (m_slots[slot].key.lo == key.lo && m_slots[slot].key.hi == key.hi)
+			{
+				location = m_slots[slot].location;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Returns false if the key is already present or the index is full
+	bool Insert(const page_key &key, const page_location &location)
+	{
+		page_location existing;
+
+		if (IsFull() || Find(key, existing))
+		{
+			return false;
+		}
+
+		// at most half full, probe sequences stay short
+		if (2 * (m_count + 1) > m_slots.size())
+		{
+			Grow();
+		}
+
+		Place(key, location);
+		m_count++;
+
+		return true;
+	}
+
+private:
+	static const size_t MinSlots = 1024;
+
+	struct entry
+	{
+		page_key key;
+		page_location location;
+	};
+
+	static bool IsEmpty(const entry &slot)
+	{
+		return slot.key.lo == 0 && slot.key.hi == 0;
+	}
+
+	void Place(const page_key &key, const page_location &location)
+	{
+		size_t mask = m_slots.size() - 1;
+		size_t slot = key.lo & mask;
+
+		while (!IsEmpty(m_slots[slot]))
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		m_slots[slot].key = key;
+		m_slots[slot].location = location;
+	}
+
+	void Grow()
+	{
+		vector<entry> previous(2 * m_slots.size());
+		previous.swap(m_slots);
+
+		for (const entry &slot : previous)
+		{
+			if (!IsEmpty(slot))
+			{
+				Place(slot.key, slot.location);
+			}
+		}
+	}
+
+	vector<entry> m_slots;
+	size_t m_limit;
+	size_t m_count;
+};
+
+#endif
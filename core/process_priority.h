@@ -0,0 +1,23 @@
+#ifndef PROCESS_PRIORITY_H
+#define PROCESS_PRIORITY_H
+
+#if defined(_MSC_VER)
+	#include <windows.h>
+#endif
+
+#if defined(__GNUC__)
+	#include <sys/resource.h>
+#endif
+
+// Moves the process behind interactive work and the backup jobs sharing the proxy. On Windows
+// background mode lowers CPU, disk and memory priority together, elsewhere only CPU is lowered.
+inline bool lower_process_priority()
+{
+#if defined(_MSC_VER)
+	return SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN) != 0;
+#else
+	return setpriority(PRIO_PROCESS, 0, 10) == 0;
+#endif
+}
+
+#endif
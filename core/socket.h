@@ -0,0 +1,202 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#if defined(_MSC_VER)
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#include <afunix.h>
+	#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <iostream>
+
+#if defined(__GNUC__)
+	#include <errno.h>
+	#include <unistd.h>
+	#include <sys/types.h>
+	#include <sys/select.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <arpa/inet.h>
+#endif
+
+using namespace std;
+
+#if defined(_MSC_VER)
+	typedef SOCKET socket_handle;
+	#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#else
+	typedef int socket_handle;
+	#define INVALID_SOCKET_HANDLE (-1)
+#endif
+
+inline int init_sockets()
+{
+#if defined(_MSC_VER)
+	WSADATA wsaData;
+	return WSAStartup(MAKEWORD(2, 2), &wsaData);
+#else
+	return 0;
+#endif
+}
+
+inline void cleanup_sockets()
+{
+#if defined(_MSC_VER)
+	WSACleanup();
+#endif
+}
+
+inline void close_socket(socket_handle handle)
+{
+#if defined(_MSC_VER)
+	closesocket(handle);
+#else
+	close(handle);
+#endif
+}
+
+// Listens on a unix domain socket when a path is given, otherwise on localhost:port
+inline socket_handle listen_socket(const char *unix_path, int port)
+{
+	socket_handle handle = INVALID_SOCKET_HANDLE;
+	int result = 0;
+
+	if (unix_path != NULL && unix_path[0] != '\0')
+	{
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, unix_path, sizeof(address.sun_path) - 1);
+
+		handle = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (handle == INVALID_SOCKET_HANDLE)
+		{
+			cout << "Socket create error" << endl;
+			return INVALID_SOCKET_HANDLE;
+		}
+
+#if defined(_MSC_VER)
+		DeleteFileA(unix_path);
+#else
+		unlink(unix_path);
+#endif
+
+		result = ::bind(handle, (sockaddr*)&address, sizeof(address));
+	}
+	else
+	{
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		handle = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (handle == INVALID_SOCKET_HANDLE)
+		{
+			cout << "Socket create error" << endl;
+			return INVALID_SOCKET_HANDLE;
+		}
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		result = ::bind(handle, (sockaddr*)&address, sizeof(address));
+	}
+
+	if (result != 0 || listen(handle, 1) != 0)
+	{
+		cout << "Socket bind error" << endl;
+		close_socket(handle);
+
+		return INVALID_SOCKET_HANDLE;
+	}
+
+	return handle;
+}
+
+inline socket_handle accept_socket(socket_handle handle)
+{
+	socket_handle client = accept(handle, NULL, NULL);
+
+	if (client != INVALID_SOCKET_HANDLE)
+	{
+		int nodelay = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+	}
+
+	return client;
+}
+
+// Waits for the socket to become readable, returns 1 when it is, 0 on timeout or interruption and -1 on error
+inline int wait_socket(socket_handle handle, int timeout_ms)
+{
+	fd_set handles;
+	FD_ZERO(&handles);
+	FD_SET(handle, &handles);
+
+	timeval timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+	int result = select((int)handle + 1, &handles, NULL, NULL, &timeout);
+
+#if defined(__GNUC__)
+	if (result < 0 && errno == EINTR)
+	{
+		return 0;
+	}
+#endif
+
+	return result < 0 ? -1 : (result > 0 ? 1 : 0);
+}
+
+inline bool send_all(socket_handle handle, const void *data, size_t size)
+{
+	const char *ptr = (const char*)data;
+
+	while (size > 0)
+	{
+		int bytes = (int)send(handle, ptr, (int)size, 0);
+
+		if (bytes <= 0)
+		{
+			return false;
+		}
+
+		ptr += bytes;
+		size -= bytes;
+	}
+
+	return true;
+}
+
+inline bool recv_all(socket_handle handle, void *data, size_t size)
+{
+	char *ptr = (char*)data;
+
+	while (size > 0)
+	{
+		int bytes = (int)recv(handle, ptr, (int)size, 0);
+
+		if (bytes <= 0)
+		{
+			return false;
+		}
+
+		ptr += bytes;
+		size -= bytes;
+	}
+
+	return true;
+}
+
+#endif
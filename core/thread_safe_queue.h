@@ -1,3 +1,6 @@
+#ifndef THREAD_SAFE_QUEUE_H
+#define THREAD_SAFE_QUEUE_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <queue>
@@ -46,4 +49,6 @@ private:
     std::queue<T> q;
     mutable std::mutex m;
     std::condition_variable c;
-};
\ No newline at end of file
+};
+
+#endif
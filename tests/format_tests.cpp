@@ -0,0 +1,1019 @@
+#include <iostream>
+#include <vector>
+#include "../MetaDataSerializer.h"
+#include "../core/metadata_format.h"
+#include "../core/block_layout.h"
+#include "../core/granularity.h"
+#include "../core/block_envelope.h"
+#include "../core/fastcdc.h"
+#include "../core/merkle_tree.h"
+
+using namespace std;
+
+//round trips, older layouts and damaged input of the formats vdtool stores. A failed check prints
+//where it failed and the run exits with ERROR_CODE. Damaged input is handed to the readers in
+//buffers of its exact size, run the tests under AddressSanitizer so reads past the end fail too.
+
+int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) \
+	{ \
+		cout << __FILE__ << ":" << __LINE__ << ": " << #condition << endl; \
+		failures++; \
+	}
+
+//offset of the UINT16 version in the metadata container header
+const size_t MetaDataVersionOffset = 4;
+
+uint64_t next_random(uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+
+	return state;
+}
+
+string RandomData(size_t size, uint64_t seed)
+{
+	string data(size, '\0');
+
+	for (size_t i = 0; i < size; i++)
+	{
+		data[i] = (char)next_random(seed);
+	}
+
+	return data;
+}
+
+//every shorter prefix and every single flipped byte of a metadata container must be rejected
+template <typename Parse>
+bool RejectsDamage(const string& data, Parse parse)
+{
+	for (size_t length = 0; length < data.size(); length++)
+	{
+		vector<char> prefix(data.begin(), data.begin() + length);
+
+		if (parse(prefix.data(), prefix.size()))
+		{
+			cout << "prefix of " << length << " bytes of " << data.size() << " accepted" << endl;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		//readers go by the header size and the flags and accept any version, since newer
+		//writers only append header fields and sections, so a damaged version goes unnoticed
+		if (i >= MetaDataVersionOffset && i < MetaDataVersionOffset + sizeof(uint16_t))
+		{
+			continue;
+		}
+
+		vector<char> damaged(data.begin(), data.end());
+		damaged[i] ^= 0x41;
+
+		if (parse(damaged.data(), damaged.size()))
+		{
+			cout << "byte " << i << " of " << data.size() << " flipped and accepted" << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void TestMetaDataContainer()
+{
+	string compressible(4096, 'v');
+	string incompressible = RandomData(4096, 1);
+	string body;
+
+	for (const string& data : { compressible, incompressible })
+	{
+		string sealed = seal_metadata(data);
+
+		CHECK(open_metadata(sealed.data(), sealed.size(), body) && body == data);
+	}
+
+	CHECK(seal_metadata(compressible).size() < compressible.size());
+
+	string sealed = seal_metadata(incompressible.substr(0, 256));
+
+	CHECK(RejectsDamage(sealed, [&](const char* data, size_t size) { return open_metadata(data, size, body); }));
+	CHECK(RejectsDamage(seal_metadata(compressible), [&](const char* data, size_t size) { return open_metadata(data, size, body); }));
+
+	//flags of a newer writer this reader cannot decode
+	string flagged = sealed;
+	uint32_t flags = 0x80;
+	memcpy(&flagged[8], &flags, sizeof(uint32_t));
+
+	CHECK(!open_metadata(flagged.data(), flagged.size(), body));
+
+	//header fields a newer writer appended are skipped
+	string extended = sealed;
+	uint16_t header_size = (uint16_t)(METADATA_HEADER_SIZE + 8);
+	memcpy(&extended[6], &header_size, sizeof(uint16_t));
+	extended.insert(METADATA_HEADER_SIZE, 8, '\x7f');
+
+	CHECK(open_metadata(extended.data(), extended.size(), body) && body == incompressible.substr(0, 256));
+
+	//a header larger than the object
+	string oversized = sealed;
+	header_size = 0xFFFF;
+	memcpy(&oversized[6], &header_size, sizeof(uint16_t));
+
+	CHECK(!open_metadata(oversized.data(), oversized.size(), body));
+
+	//unknown sections are skipped, sections running past the body are not found
+	string sections;
+	const char* found = NULL;
+	size_t length = 0;
+	append_metadata_section(sections, 1000, "new", 3);
+	append_metadata_section(sections, 7, "known", 5);
+
+	CHECK(sections.size() % 8 == 0);
+	CHECK(find_metadata_section(sections, 7, found, length) && string(found, length) == "known");
+	CHECK(!find_metadata_section(sections, 8, found, length));
+
+	string cut = sections.substr(0, sections.size() - 8);
+
+	CHECK(!find_metadata_section(cut, 7, found, length));
+}
+
+BackupMetaData MakeBackupMetaData()
+{
+	BackupMetaData metadata;
+	metadata.status = Complete;
+	metadata.encryptionKey = "key";
+
+	for (uint64_t block = 0; block < 2000; block += 3)
+	{
+		metadata.blockHashTable.Set(block, block * 0x9E3779B97F4A7C15ULL);
+	}
+
+	metadata.emptyBlocks.push_back(1);
+	metadata.emptyBlocks.push_back(1999);
+
+	return metadata;
+}
+
+bool SameBackupMetaData(const BackupMetaData& a, const BackupMetaData& b)
+{
+	return a.status == b.status && a.encryptionKey == b.encryptionKey && a.geometry == b.geometry && a.emptyBlocks == b.emptyBlocks &&
+		   a.blockHashTable.keys == b.blockHashTable.keys && a.blockHashTable.values == b.blockHashTable.values &&
+		   a.chunkTable.keys == b.chunkTable.keys && equal(a.chunkTable.values.begin(), a.chunkTable.values.end(), b.chunkTable.values.begin(), b.chunkTable.values.end()) &&
+		   a.chunkListTable.keys == b.chunkListTable.keys && a.chunkListTable.ends == b.chunkListTable.ends &&
+		   equal(a.chunkListTable.chunks.begin(), a.chunkListTable.chunks.end(), b.chunkListTable.chunks.begin(), b.chunkListTable.chunks.end());
+}
+
+bool RoundTrips(const BackupMetaData& metadata)
+{
+	BackupMetaData read;
+	BackupMetaData damaged;
+	MetaDataShardIndex shards;
+	string stored = SerializeBackupMetaData(metadata);
+
+	return DeserializeBackupMetaData(stored.data(), stored.size(), read, shards) && SameBackupMetaData(metadata, read) && shards.Empty() &&
+		   RejectsDamage(stored, [&](const char* data, size_t size) { return DeserializeBackupMetaData(data, size, damaged); });
+}
+
+void TestBackupMetaData()
+{
+	BackupMetaData metadata = MakeBackupMetaData();
+
+	CHECK(RoundTrips(metadata));
+
+	metadata.status = Error;
+	metadata.encryptionKey = "";
+	metadata.blockHashTable = BlockHashTable();
+	metadata.emptyBlocks.clear();
+
+	CHECK(RoundTrips(metadata));
+}
+
+void TestLegacyBackupMetaData()
+{
+	//unversioned layout: [status][entry count][empty block count][key length], UINT32 each,
+	//the key, [UINT32 block][UINT64 hash] entries and UINT32 empty block ids
+	uint32_t header[4] = { (uint32_t)Complete, 2, 1, 3 };
+	string legacy((const char*)header, sizeof(header));
+	legacy.append("abc");
+
+	uint32_t blocks[2] = { 4, 10 };
+	uint64_t hashes[2] = { 0x1111, 0x2222 };
+
+	for (int i = 0; i < 2; i++)
+	{
+		legacy.append((const char*)&blocks[i], sizeof(uint32_t));
+		legacy.append((const char*)&hashes[i], sizeof(uint64_t));
+	}
+
+	uint32_t empty = 7;
+	legacy.append((const char*)&empty, sizeof(uint32_t));
+
+	BackupMetaData read;
+	MetaDataShardIndex shards;
+
+	CHECK(DeserializeBackupMetaData(legacy.data(), legacy.size(), read, shards) && shards.Empty());
+	CHECK(read.status == Complete && read.encryptionKey == "abc" && read.geometry == VolumeGeometry());
+	CHECK(read.blockHashTable.keys == vector<uint64_t>({ 4, 10 }) && read.blockHashTable.values == vector<uint64_t>({ 0x1111, 0x2222 }));
+	CHECK(read.emptyBlocks == vector<uint64_t>({ 7 }));
+
+	for (size_t length = 0; length < legacy.size(); length++)
+	{
+		vector<char> prefix(legacy.begin(), legacy.begin() + length);
+
+		CHECK(!DeserializeBackupMetaData(prefix.data(), prefix.size(), read));
+	}
+
+	//a count larger than the data must not be trusted
+	uint32_t count = 0x10000000;
+	string inflated = legacy;
+	memcpy(&inflated[sizeof(uint32_t)], &count, sizeof(uint32_t));
+
+	CHECK(!DeserializeBackupMetaData(inflated.data(), inflated.size(), read));
+}
+
+
+//checks the runs a block parses into against the sectors of the image they were packed from
+bool MatchesImage(const vector<sector_run>& runs, const uint64_t* sector_map, uint32_t sectors_per_block, uint32_t sector_size, const string& image)
+{
+	uint32_t position = 0;
+	uint32_t run_first = 0;
+	uint32_t run_count = 0;
+	size_t index = 0;
+
+	while (next_bitmap_run(sector_map, sectors_per_block, position, run_first, run_count))
+	{
+		if (index >= runs.size() || runs[index].first_sector != run_first || runs[index].sector_count != run_count ||
+			memcmp(runs[index].data, image.data() + (size_t)run_first * sector_size, (size_t)run_count * sector_size) != 0)
+		{
+			return false;
+		}
+
+		index++;
+		position = run_first + run_count;
+	}
+
+	return index == runs.size();
+}
+
+void TestBlockLayout()
+{
+	const uint32_t sector_size = 512;
+	const uint32_t sectors_per_block = 256;
+	const uint32_t block_size = sector_size * sectors_per_block;
+	string image = RandomData(block_size, 2);
+	vector<sector_run> runs;
+
+	//a few runs are written as extents, scattered sectors as a bitmap
+	vector<uint64_t> extents_map(bitmap_words(sectors_per_block), 0);
+	vector<uint64_t> bitmap_map(bitmap_words(sectors_per_block), 0);
+
+	for (uint32_t sector : { 0, 1, 2, 40, 41, 255 })
+	{
+		set_bitmap_range(extents_map.data(), sector, 1);
+	}
+
+	for (uint32_t sector = 0; sector < sectors_per_block; sector += 2)
+	{
+		set_bitmap_range(bitmap_map.data(), sector, 1);
+	}
+
+	for (const vector<uint64_t>* sector_map : { &extents_map, &bitmap_map })
+	{
+		string block(compact_block_header_max_size(sectors_per_block) + block_size, '\0');
+		size_t header_size = encode_block_header(&block[0], sector_size, sectors_per_block, sector_map->data());
+		size_t packed = find_granularity(sector_size)->pack(&block[header_size], image.data(), sector_map->data(), sectors_per_block);
+		block.resize(header_size + packed);
+
+		CHECK((uint8_t)block[3] == (sector_map == &extents_map ? SECTOR_MAP_EXTENTS : SECTOR_MAP_BITMAP));
+		CHECK(parse_block_sectors(block.data(), block.size(), block_size, runs) == sector_size);
+		CHECK(MatchesImage(runs, sector_map->data(), sectors_per_block, sector_size, image));
+
+		for (size_t length = 0; length < block.size(); length++)
+		{
+			CHECK(parse_block_sectors(block.data(), length, block_size, runs) == 0);
+		}
+
+		//version 2 stored the sector size itself
+		string sized = block;
+		uint16_t size_field = (uint16_t)sector_size;
+		sized[2] = (char)BLOCK_LAYOUT_SIZE_VERSION;
+		memcpy(&sized[4], &size_field, sizeof(uint16_t));
+
+		CHECK(parse_block_sectors(sized.data(), sized.size(), block_size, runs) == sector_size);
+		CHECK(MatchesImage(runs, sector_map->data(), sectors_per_block, sector_size, image));
+
+		//a block of another size, a version this reader does not know or a sector shift past 32 bits
+		CHECK(parse_block_sectors(block.data(), block.size(), block_size * 2, runs) == 0);
+
+		string damaged = block;
+		damaged[2] = (char)(BLOCK_LAYOUT_VERSION + 1);
+
+		CHECK(parse_block_sectors(damaged.data(), damaged.size(), block_size, runs) == 0);
+
+		damaged = block;
+		damaged[4] = 40;
+
+		CHECK(parse_block_sectors(damaged.data(), damaged.size(), block_size, runs) == 0);
+
+		//a sector count the map does not add up to
+		damaged = block;
+		uint16_t sector_count = 1;
+		memcpy(&damaged[6], &sector_count, sizeof(uint16_t));
+
+		CHECK(parse_block_sectors(damaged.data(), damaged.size(), block_size, runs) == 0 && runs.empty());
+	}
+
+	//extents must be ascending, disjoint and inside the block
+	string block(compact_block_header_max_size(sectors_per_block) + block_size, '\0');
+	size_t header_size = encode_block_header(&block[0], sector_size, sectors_per_block, extents_map.data());
+	block.resize(header_size + 6 * sector_size);
+
+	string damaged = block;
+	uint16_t first = 1;
+	memcpy(&damaged[COMPACT_HEADER_FIXED_SIZE + SECTOR_EXTENT_SIZE], &first, sizeof(uint16_t));
+
+	CHECK(parse_block_sectors(damaged.data(), damaged.size(), block_size, runs) == 0);
+
+	damaged = block;
+	uint16_t count = 2;
+	memcpy(&damaged[COMPACT_HEADER_FIXED_SIZE + 2 * SECTOR_EXTENT_SIZE + sizeof(uint16_t)], &count, sizeof(uint16_t));
+
+	CHECK(parse_block_sectors(damaged.data(), damaged.size(), block_size, runs) == 0);
+
+	//legacy layout: sector size, sector count, an index table with room for every sector, the data
+	uint16_t legacy_header[2] = { (uint16_t)sector_size, 3 };
+	uint16_t indices[sectors_per_block] = { 3, 4, 9 };
+	string legacy((const char*)legacy_header, sizeof(legacy_header));
+	legacy.append((const char*)indices, sizeof(indices));
+	legacy.append(image, 3 * sector_size, 2 * sector_size);
+	legacy.append(image, 9 * sector_size, sector_size);
+
+	CHECK(legacy.size() == block_header_size(block_size, sector_size) + 3 * sector_size);
+	CHECK(parse_block_sectors(legacy.data(), legacy.size(), block_size, runs) == sector_size && runs.size() == 2);
+	CHECK(runs.size() == 2 && runs[0].first_sector == 3 && runs[0].sector_count == 2 && runs[1].first_sector == 9 && runs[1].sector_count == 1);
+	CHECK(runs.size() == 2 && memcmp(runs[1].data, image.data() + 9 * sector_size, sector_size) == 0);
+	CHECK(parse_block_sectors(legacy.data(), legacy.size() - 1, block_size, runs) == 0);
+
+	uint16_t too_many = sectors_per_block + 1;
+	memcpy(&legacy[sizeof(uint16_t)], &too_many, sizeof(uint16_t));
+
+	CHECK(parse_block_sectors(legacy.data(), legacy.size(), block_size, runs) == 0);
+}
+
+string CompressibleBlock()
+{
+	string block(65536, '\0');
+
+	for (size_t i = 0; i < 200; i++)
+	{
+		memcpy(&block[i * 300], "vdtool block ", 13);
+	}
+
+	return block;
+}
+
+string SealBlock(const string& raw, const block_codec* codec, int level, const block_dictionary* dictionary = NULL)
+{
+	string stored(block_envelope_bound(raw.size()), '\0');
+	stored.resize(seal_block(raw.data(), raw.size(), &stored[0], stored.size(), codec, level, dictionary));
+
+	return stored;
+}
+
+//every shorter prefix that still holds the magic and every flipped byte past the header must be rejected
+bool RejectsBlockDamage(const string& stored, const block_dictionary* dictionary)
+{
+	string out(65536, '\0');
+
+	for (size_t length = sizeof(uint32_t); length < stored.size(); length++)
+	{
+		vector<char> prefix(stored.begin(), stored.begin() + length);
+
+		if (open_block(prefix.data(), prefix.size(), &out[0], out.size(), dictionary) != -1)
+		{
+			cout << "prefix of " << length << " bytes of " << stored.size() << " accepted" << endl;
+			return false;
+		}
+	}
+
+	for (size_t i = BLOCK_ENVELOPE_SIZE; i < stored.size(); i++)
+	{
+		vector<char> damaged(stored.begin(), stored.end());
+		damaged[i] ^= 0x41;
+
+		if (open_block(damaged.data(), damaged.size(), &out[0], out.size(), dictionary) != -1)
+		{
+			cout << "byte " << i << " of " << stored.size() << " flipped and accepted" << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void TestBlockEnvelope()
+{
+	string compressible = CompressibleBlock();
+	string incompressible = RandomData(65536, 3);
+	string out(65536, '\0');
+	const block_codec* zlib = find_codec(BLOCK_CODEC_ZLIB);
+
+	for (const string& raw : { compressible, incompressible })
+	{
+		string stored = SealBlock(raw, zlib, 6);
+
+		CHECK(!stored.empty() && open_block(stored.data(), stored.size(), &out[0], out.size()) == (long)raw.size() && out == raw);
+		CHECK(stored_block_raw_length(stored.data(), stored.size(), 0) == raw.size());
+		CHECK(RejectsBlockDamage(stored, NULL));
+	}
+
+	CHECK(seal_block(compressible.data(), compressible.size(), &out[0], compressible.size(), zlib, 1) == 0);
+
+	//incompressible data is kept raw
+	string stored = SealBlock(incompressible, zlib, 1);
+
+	CHECK((uint8_t)stored[5] == BLOCK_CODEC_RAW && stored.size() == BLOCK_ENVELOPE_SIZE + incompressible.size());
+
+	//a raw length past the output, a version or codec this reader does not know
+	string sealed = SealBlock(compressible, zlib, 6);
+
+	CHECK(open_block(sealed.data(), sealed.size(), &out[0], compressible.size() - 1) == -1);
+
+	string damaged = sealed;
+	damaged[4] = 9;
+
+	CHECK(open_block(damaged.data(), damaged.size(), &out[0], out.size()) == -1);
+
+	damaged = sealed;
+	damaged[5] = 0x7f;
+
+	CHECK(open_block(damaged.data(), damaged.size(), &out[0], out.size()) == -1);
+
+	//version 1 envelopes have no dictionary id
+	string v1 = sealed.substr(0, BLOCK_ENVELOPE_V1_SIZE) + sealed.substr(BLOCK_ENVELOPE_SIZE);
+	uint16_t v1_header_size = (uint16_t)BLOCK_ENVELOPE_V1_SIZE;
+	v1[4] = 1;
+	memcpy(&v1[6], &v1_header_size, sizeof(uint16_t));
+
+	CHECK(open_block(v1.data(), v1.size(), &out[0], out.size()) == (long)compressible.size() && out == compressible);
+
+	//blocks written before the envelope are bare zlib streams
+	string bare(compressible.size(), '\0');
+	size_t bare_size = 0;
+
+	CHECK(compress_raw_data(compressible.data(), compressible.size(), &bare[0], bare.size(), bare_size));
+
+	bare.resize(bare_size);
+
+	CHECK(!is_block_envelope(bare.data(), bare.size()));
+	CHECK(stored_block_raw_length(bare.data(), bare.size(), 12345) == 12345);
+	CHECK(open_block(bare.data(), bare.size(), &out[0], out.size()) == (long)compressible.size() && out == compressible);
+}
+
+void TestCodecs()
+{
+	string compressible = CompressibleBlock();
+	string incompressible = RandomData(65536, 3);
+	string out(65536, '\0');
+	size_t count = 0;
+	const block_codec* codecs = codec_table(count);
+
+	//every codec of the build at its default level and at the ends of its range
+	for (size_t c = 0; c < count; c++)
+	{
+		CHECK(find_codec(codecs[c].id) == &codecs[c] && find_codec(string(codecs[c].name)) == &codecs[c]);
+
+		for (int level : { 0, -100, 100 })
+		{
+			for (const string& raw : { compressible, incompressible })
+			{
+				string stored = SealBlock(raw, &codecs[c], codec_level(&codecs[c], level));
+
+				CHECK(!stored.empty() && open_block(stored.data(), stored.size(), &out[0], out.size()) == (long)raw.size() && out == raw);
+			}
+		}
+
+		CHECK(RejectsBlockDamage(SealBlock(compressible, &codecs[c], codec_level(&codecs[c], 0)), NULL));
+	}
+
+	CHECK(find_codec((uint8_t)0x7f) == NULL && find_codec(string("lzma")) == NULL);
+}
+
+void TestDictionaries()
+{
+	string compressible = CompressibleBlock();
+	string dictionary_data = RandomData(1024, 4);
+	block_dictionary dictionary = { 77, dictionary_data.data(), dictionary_data.size() };
+	block_dictionary other = { 78, dictionary_data.data(), dictionary_data.size() };
+	string out(65536, '\0');
+
+	//blocks compressed with a dictionary need the same one to open
+	string sealed = SealBlock(compressible, find_codec(BLOCK_CODEC_ZLIB), 6, &dictionary);
+
+	CHECK(stored_block_dictionary_id(sealed.data(), sealed.size()) == 77);
+	CHECK(open_block(sealed.data(), sealed.size(), &out[0], out.size(), &dictionary) == (long)compressible.size() && out == compressible);
+	CHECK(open_block(sealed.data(), sealed.size(), &out[0], out.size()) == -1);
+	CHECK(open_block(sealed.data(), sealed.size(), &out[0], out.size(), &other) == -1);
+	CHECK(RejectsBlockDamage(sealed, &dictionary));
+
+	//blocks kept raw and blocks without an envelope name no dictionary
+	string raw = SealBlock(RandomData(65536, 3), find_codec(BLOCK_CODEC_ZLIB), 6, &dictionary);
+
+	CHECK(stored_block_dictionary_id(raw.data(), raw.size()) == 0);
+	CHECK(open_block(raw.data(), raw.size(), &out[0], out.size()) == 65536);
+	CHECK(stored_block_dictionary_id(compressible.data(), compressible.size()) == 0);
+}
+
+//the root of sharded metadata and one hash shard per partition, joined back the way restores read them
+bool ShardedRoundTrips(const BackupMetaData& metadata)
+{
+	map<uint64_t, BlockHashTable> hashShards;
+	MetaDataShardIndex index;
+	BackupMetaData joined;
+	bool matched = true;
+
+	SplitBlockTable(metadata.blockHashTable, metadata.geometry, hashShards);
+
+	for (auto iter = hashShards.begin(); iter != hashShards.end(); iter++)
+	{
+		MetaDataShardInfo info = { iter->first, GetBlockHashShardHash(iter->second), iter->second.Size() };
+		string shard = SerializeBlockHashShard(iter->second);
+		BlockHashTable table;
+		BlockHashTable damaged;
+
+		matched = matched && DeserializeBlockHashShard(shard.data(), shard.size(), table) && GetBlockHashShardHash(table) == info.hash &&
+				  RejectsDamage(shard, [&](const char* data, size_t size) { return DeserializeBlockHashShard(data, size, damaged); });
+
+		joined.blockHashTable.AppendTable(table);
+		index.hashes.push_back(info);
+	}
+
+	BackupMetaData read;
+	BackupMetaData damaged;
+	MetaDataShardIndex shards;
+	MetaDataShardIndex damagedShards;
+	string root = SerializeBackupMetaDataRoot(metadata, index);
+
+	if (!matched || !DeserializeBackupMetaData(root.data(), root.size(), read, shards) || read.blockHashTable.Size() != 0 ||
+		shards.hashes.size() != index.hashes.size() || !RejectsDamage(root, [&](const char* data, size_t size) { return DeserializeBackupMetaData(data, size, damaged, damagedShards); }))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < index.hashes.size(); i++)
+	{
+		if (shards.hashes[i].partId != index.hashes[i].partId || shards.hashes[i].hash != index.hashes[i].hash || shards.hashes[i].entries != index.hashes[i].entries)
+		{
+			return false;
+		}
+	}
+
+	joined.status = read.status;
+	joined.encryptionKey = read.encryptionKey;
+	joined.geometry = read.geometry;
+	joined.emptyBlocks = read.emptyBlocks;
+
+	return SameBackupMetaData(metadata, joined);
+}
+
+void TestShardedBackupMetaData()
+{
+	BackupMetaData metadata = MakeBackupMetaData();
+	metadata.geometry.partitionBlocks = 512;
+
+	CHECK(ShardedRoundTrips(metadata));
+
+	//shards of equal content hash equal, so unchanged partitions are not uploaded again
+	BlockHashTable changed = metadata.blockHashTable;
+	changed.values[0]++;
+
+	CHECK(GetBlockHashShardHash(metadata.blockHashTable) == GetBlockHashShardHash(BlockHashTable(metadata.blockHashTable)));
+	CHECK(GetBlockHashShardHash(metadata.blockHashTable) != GetBlockHashShardHash(changed));
+}
+
+void TestGeometry()
+{
+	BackupMetaData metadata = MakeBackupMetaData();
+	metadata.geometry.blockSize = 4 * MB_BLOCK_SIZE;
+	metadata.geometry.partitionBlocks = 512;
+
+	//block ids past 32 bits
+	metadata.blockHashTable.Set(5000000000ULL, 0x3333);
+	metadata.emptyBlocks.push_back(5000000001ULL);
+
+	CHECK(metadata.geometry.IsValid());
+	CHECK(RoundTrips(metadata));
+	CHECK(ShardedRoundTrips(metadata));
+
+	map<uint64_t, BlockHashTable> shards;
+	SplitBlockTable(metadata.blockHashTable, metadata.geometry, shards);
+
+	CHECK(shards.size() == 5 && shards.rbegin()->first == 5000000000ULL / 512 && shards.rbegin()->second.keys == vector<uint64_t>({ 5000000000ULL }));
+}
+
+chunk_id MakeChunkId(uint8_t value)
+{
+	chunk_id id;
+	memset(id.bytes, value, sizeof(id.bytes));
+
+	return id;
+}
+
+void TestChunkTables()
+{
+	BackupMetaData metadata = MakeBackupMetaData();
+	metadata.geometry.partitionBlocks = 512;
+	metadata.chunkTable.Set(6, MakeChunkId(6));
+	metadata.chunkTable.Set(9000, MakeChunkId(90));
+
+	CHECK(RoundTrips(metadata));
+
+	map<uint64_t, BlockChunkTable> chunkShards;
+	MetaDataShardIndex index;
+	BlockChunkTable joined;
+	SplitBlockTable(metadata.chunkTable, metadata.geometry, chunkShards);
+
+	for (auto iter = chunkShards.begin(); iter != chunkShards.end(); iter++)
+	{
+		MetaDataShardInfo info = { iter->first, GetBlockChunkShardHash(iter->second), iter->second.Size() };
+		string shard = SerializeBlockChunkShard(iter->second);
+		BlockChunkTable table;
+		BlockChunkTable damaged;
+
+		CHECK(DeserializeBlockChunkShard(shard.data(), shard.size(), table) && GetBlockChunkShardHash(table) == info.hash);
+		CHECK(RejectsDamage(shard, [&](const char* data, size_t size) { return DeserializeBlockChunkShard(data, size, damaged); }));
+
+		joined.AppendTable(table);
+		index.chunks.push_back(info);
+	}
+
+	CHECK(chunkShards.size() == 2 && joined.keys == metadata.chunkTable.keys);
+
+	BackupMetaData read;
+	MetaDataShardIndex shards;
+	string root = SerializeBackupMetaDataRoot(metadata, index);
+
+	CHECK(DeserializeBackupMetaData(root.data(), root.size(), read, shards) && read.chunkTable.Size() == 0);
+	CHECK(shards.chunks.size() == 2 && shards.chunks[1].partId == 9000 / 512 && shards.chunks[1].hash == index.chunks[1].hash);
+
+	vector<chunk_id> chunkIds = { MakeChunkId(1), MakeChunkId(2) };
+	vector<chunk_id> readIds;
+	string segment = SerializeChunkIndexSegment(chunkIds);
+
+	CHECK(DeserializeChunkIndexSegment(segment.data(), segment.size(), readIds) && readIds.size() == 2 && readIds[1] == chunkIds[1]);
+	CHECK(RejectsDamage(segment, [&](const char* data, size_t size) { return DeserializeChunkIndexSegment(data, size, readIds); }));
+}
+
+void TestChunkLists()
+{
+	BackupMetaData metadata = MakeBackupMetaData();
+	metadata.geometry.partitionBlocks = 512;
+
+	chunk_id list[3] = { MakeChunkId(1), MakeChunkId(2), MakeChunkId(3) };
+	metadata.chunkListTable.Append(12, list, 2);
+	metadata.chunkListTable.Append(700, list + 1, 2);
+	metadata.chunkListTable.Append(701, list, 3);
+
+	CHECK(RoundTrips(metadata));
+
+	map<uint64_t, BlockChunkListTable> chunkListShards;
+	MetaDataShardIndex index;
+	BlockChunkListTable joined;
+	SplitBlockTable(metadata.chunkListTable, metadata.geometry, chunkListShards);
+
+	for (auto iter = chunkListShards.begin(); iter != chunkListShards.end(); iter++)
+	{
+		MetaDataShardInfo info = { iter->first, GetBlockChunkListShardHash(iter->second), iter->second.Size() };
+		string shard = SerializeBlockChunkListShard(iter->second);
+		BlockChunkListTable table;
+		BlockChunkListTable damaged;
+
+		CHECK(DeserializeBlockChunkListShard(shard.data(), shard.size(), table) && GetBlockChunkListShardHash(table) == info.hash);
+		CHECK(RejectsDamage(shard, [&](const char* data, size_t size) { return DeserializeBlockChunkListShard(data, size, damaged); }));
+
+		for (size_t i = 0; i < table.keys.size(); i++)
+		{
+			uint64_t begin = i > 0 ? table.ends[i - 1] : 0;
+			joined.Append(table.keys[i], table.chunks.data() + begin, (size_t)(table.ends[i] - begin));
+		}
+
+		index.chunkLists.push_back(info);
+	}
+
+	CHECK(chunkListShards.size() == 2 && joined.keys == metadata.chunkListTable.keys && joined.ends == metadata.chunkListTable.ends);
+	CHECK(equal(joined.chunks.begin(), joined.chunks.end(), metadata.chunkListTable.chunks.begin(), metadata.chunkListTable.chunks.end()));
+
+	BackupMetaData read;
+	MetaDataShardIndex shards;
+	string root = SerializeBackupMetaDataRoot(metadata, index);
+
+	CHECK(DeserializeBackupMetaData(root.data(), root.size(), read, shards) && read.chunkListTable.Size() == 0);
+	CHECK(shards.chunkLists.size() == 2 && shards.chunkLists[1].partId == 1 && shards.chunkLists[1].entries == 2);
+}
+
+vector<size_t> ChunkBoundaries(const string& data, const fastcdc_params& params)
+{
+	vector<size_t> boundaries;
+
+	for (size_t pos = 0; pos < data.size();)
+	{
+		pos += fastcdc_cut((const uint8_t*)data.data() + pos, data.size() - pos, params);
+		boundaries.push_back(pos);
+	}
+
+	return boundaries;
+}
+
+void TestFastCdc()
+{
+	fastcdc_params params = fastcdc_setup(FASTCDC_MIN_AVG_SIZE + 1000);
+
+	CHECK(params.avg_size == FASTCDC_MIN_AVG_SIZE && params.min_size == params.avg_size / 4 && params.max_size == params.avg_size * 4);
+	CHECK(fastcdc_setup(FASTCDC_DEFAULT_AVG_SIZE).avg_size == FASTCDC_DEFAULT_AVG_SIZE);
+
+	string data = RandomData(1024 * 1024, 6);
+	vector<size_t> boundaries = ChunkBoundaries(data, params);
+
+	CHECK(boundaries == ChunkBoundaries(data, params));
+	CHECK(boundaries.back() == data.size());
+	CHECK(boundaries.size() > data.size() / params.max_size && boundaries.size() < data.size() / params.min_size);
+
+	for (size_t i = 0; i + 1 < boundaries.size(); i++)
+	{
+		size_t length = boundaries[i] - (i > 0 ? boundaries[i - 1] : 0);
+
+		CHECK(length > params.min_size && length <= params.max_size);
+	}
+
+	//data up to the smallest chunk size is never hashed
+	CHECK(fastcdc_cut((const uint8_t*)data.data(), params.min_size, params) == params.min_size);
+
+	//inserted bytes move the boundaries after them only until the chunking realigns
+	const size_t offset = 300000;
+	string inserted = data.substr(0, offset) + RandomData(100, 7) + data.substr(offset);
+	vector<size_t> shifted = ChunkBoundaries(inserted, params);
+	set<size_t> original;
+
+	for (size_t boundary : boundaries)
+	{
+		if (boundary < offset)
+		{
+			CHECK(find(shifted.begin(), shifted.end(), boundary) != shifted.end());
+		}
+		else
+		{
+			original.insert(boundary + 100);
+		}
+	}
+
+	size_t realigned = 0;
+
+	for (size_t boundary : shifted)
+	{
+		if (boundary > offset && original.count(boundary) > 0)
+		{
+			realigned = boundary;
+			break;
+		}
+	}
+
+	CHECK(realigned > 0 && realigned < offset + 100 + 4 * params.max_size);
+
+	for (size_t boundary : shifted)
+	{
+		if (boundary >= realigned)
+		{
+			CHECK(original.count(boundary) > 0);
+		}
+	}
+}
+
+//section id of MetaDataSerializer.cpp
+const uint32_t RetiredBackupsSection = 34;
+
+//the container as a writer that does not know the section would have sealed it
+string DropSection(const string& data, uint32_t id)
+{
+	string body;
+	string kept;
+
+	if (!open_metadata(data.data(), data.size(), body))
+	{
+		return "";
+	}
+
+	for (size_t pos = 0; pos + METADATA_SECTION_HEADER_SIZE <= body.size();)
+	{
+		uint32_t section_id = 0;
+		uint64_t section_length = 0;
+
+		memcpy(&section_id, body.data() + pos, sizeof(uint32_t));
+		memcpy(&section_length, body.data() + pos + 2 * sizeof(uint32_t), sizeof(uint64_t));
+
+		size_t next = pos + METADATA_SECTION_HEADER_SIZE + (size_t)(section_length + (8 - section_length % 8) % 8);
+
+		if (section_id != id)
+		{
+			kept.append(body, pos, next - pos);
+		}
+
+		pos = next;
+	}
+
+	return seal_metadata(kept);
+}
+
+void TestCollectorState()
+{
+	CollectorState collector;
+	collector.generation = 9;
+	collector.planParts = 3;
+	collector.nextPlanPart = 1;
+	collector.chunkReferenceParts = 4;
+	collector.pendingChunkParts = 2;
+	collector.publishedAt = 1700000000;
+	collector.pendingSince = 1600000000;
+	collector.retiredBackupIds = { "b1", "b2" };
+
+	PinnedBackupInfo pinned;
+	pinned.backupId = "b0";
+	pinned.geometry.partitionBlocks = 64;
+	collector.pinnedBackups.push_back(pinned);
+
+	CollectorState read;
+	string data = SerializeCollectorState(collector);
+
+	CHECK(DeserializeCollectorState(data.data(), data.size(), read));
+	CHECK(read.generation == 9 && read.planParts == 3 && read.nextPlanPart == 1 && read.chunkReferenceParts == 4);
+	CHECK(read.pendingChunkParts == 2 && read.publishedAt == 1700000000 && read.pendingSince == 1600000000);
+	CHECK(read.retiredBackupIds == collector.retiredBackupIds);
+	CHECK(read.pinnedBackups.size() == 1 && read.pinnedBackups[0].backupId == "b0" && read.pinnedBackups[0].geometry == pinned.geometry);
+	CHECK(RejectsDamage(data, [&](const char* state, size_t size) { return DeserializeCollectorState(state, size, read); }));
+
+	//states written before retired backups were remembered
+	string older = DropSection(data, RetiredBackupsSection);
+
+	CHECK(older.size() < data.size());
+	CHECK(DeserializeCollectorState(older.data(), older.size(), read) && read.retiredBackupIds.empty() && read.generation == 9);
+
+	vector<string> keys = { "one", "", "three" };
+	vector<string> readKeys;
+	string list = SerializeKeyList(keys);
+
+	CHECK(DeserializeKeyList(list.data(), list.size(), readKeys) && readKeys == keys);
+	CHECK(RejectsDamage(list, [&](const char* stored, size_t size) { return DeserializeKeyList(stored, size, readKeys); }));
+}
+
+void TestMerkleTree()
+{
+	vector<uint64_t> leaves;
+	uint64_t seed = 5;
+
+	for (int i = 0; i < 13; i++)
+	{
+		leaves.push_back(next_random(seed));
+	}
+
+	vector<vector<uint64_t>> levels;
+	merkle_build_levels(leaves, levels);
+
+	CHECK(merkle_root(levels) == merkle_root(leaves) && merkle_root(vector<uint64_t>()) == 0);
+	CHECK(levels.size() == 5 && levels.back().size() == 1);
+
+	vector<uint64_t> changed = leaves;
+	changed[0]++;
+	changed[7]++;
+	changed[12]++;
+
+	vector<vector<uint64_t>> changed_levels;
+	vector<uint64_t> diff;
+	merkle_build_levels(changed, changed_levels);
+	merkle_diff(levels, changed_levels, diff);
+
+	CHECK(merkle_root(changed) != merkle_root(leaves));
+	CHECK(diff == vector<uint64_t>({ 0, 7, 12 }));
+
+	merkle_diff(levels, levels, diff);
+
+	CHECK(diff.empty());
+
+	//every range recomputes the root from its proof, a changed leaf or a proof that does not fit does not
+	for (uint64_t first = 0; first < leaves.size(); first++)
+	{
+		for (uint64_t count = 1; first + count <= leaves.size(); count++)
+		{
+			vector<uint64_t> proof;
+			vector<uint64_t> range(leaves.begin() + first, leaves.begin() + first + count);
+			uint64_t root = 0;
+			merkle_range_proof(levels, first, count, proof);
+
+			CHECK(merkle_range_root(range.data(), count, first, leaves.size(), proof, root) && root == merkle_root(levels));
+
+			range[count - 1]++;
+
+			CHECK(merkle_range_root(range.data(), count, first, leaves.size(), proof, root) && root != merkle_root(levels));
+
+			range[count - 1]--;
+			proof.push_back(1);
+
+			CHECK(!merkle_range_root(range.data(), count, first, leaves.size(), proof, root));
+
+			proof.pop_back();
+
+			if (!proof.empty())
+			{
+				proof.pop_back();
+
+				CHECK(!merkle_range_root(range.data(), count, first, leaves.size(), proof, root));
+			}
+		}
+	}
+
+	vector<uint64_t> proof;
+	uint64_t root = 0;
+
+	CHECK(!merkle_range_root(leaves.data(), 2, 12, leaves.size(), proof, root));
+	CHECK(!merkle_range_root(leaves.data(), 0, 0, leaves.size(), proof, root));
+}
+
+void TestReplicationState()
+{
+	ReplicationState replication;
+	replication.replicatedBackupIds = { "a", "b" };
+	replication.currentBackupId = "c";
+	replication.nextPartId = 17;
+	replication.pageSourceBlocks = { "x/4" };
+	replication.dictionaryIds = { 5, 6 };
+
+	ReplicationState read;
+	string data = SerializeReplicationState(replication);
+
+	CHECK(DeserializeReplicationState(data.data(), data.size(), read));
+	CHECK(read.replicatedBackupIds == replication.replicatedBackupIds && read.currentBackupId == "c" && read.nextPartId == 17);
+	CHECK(read.pageSourceBlocks == replication.pageSourceBlocks && read.dictionaryIds == replication.dictionaryIds);
+	CHECK(RejectsDamage(data, [&](const char* state, size_t size) { return DeserializeReplicationState(state, size, read); }));
+}
+
+void TestStandbyState()
+{
+	StandbyState standby;
+	standby.targetType = "raw";
+	standby.targetPath = "/dev/sdb";
+	standby.currentBackupId = "a";
+	standby.applyingBackupIds = { "b" };
+
+	StandbyState read;
+	string data = SerializeStandbyState(standby);
+
+	CHECK(DeserializeStandbyState(data.data(), data.size(), read));
+	CHECK(read.targetType == "raw" && read.targetPath == "/dev/sdb" && read.currentBackupId == "a" && read.applyingBackupIds == standby.applyingBackupIds);
+	CHECK(RejectsDamage(data, [&](const char* state, size_t size) { return DeserializeStandbyState(state, size, read); }));
+}
+
+void TestCatalogEntry()
+{
+	string etag;
+	string object;
+	string stored = SerializeBackupMetaData(MakeBackupMetaData());
+	string entry = SerializeCatalogEntry("\"etag\"", stored);
+
+	CHECK(DeserializeCatalogEntry(entry.data(), entry.size(), etag, object) && etag == "\"etag\"" && object == stored);
+	CHECK(RejectsDamage(entry, [&](const char* data, size_t size) { return DeserializeCatalogEntry(data, size, etag, object); }));
+}
+
+int main()
+{
+	TestMetaDataContainer();
+	TestBackupMetaData();
+	TestLegacyBackupMetaData();
+	TestBlockLayout();
+	TestBlockEnvelope();
+	TestCodecs();
+	TestDictionaries();
+	TestShardedBackupMetaData();
+	TestGeometry();
+	TestChunkTables();
+	TestChunkLists();
+	TestFastCdc();
+	TestCollectorState();
+	TestMerkleTree();
+	TestReplicationState();
+	TestStandbyState();
+	TestCatalogEntry();
+
+	if (failures > 0)
+	{
+		cout << failures << " checks failed" << endl;
+
+		return ERROR_CODE;
+	}
+
+	cout << "All checks passed" << endl;
+
+	return 0;
+}
@@ -1,5 +1,9 @@
 #include "StorageFactory.h"
 #include "BackupProcessor.h"
+#include "GarbageCollector.h"
+#include "ColdTierRecompressor.h"
+#include "BackupReplicator.h"
+#include "core/fastcdc.h"
 #include <aws/core/utils/json/JsonSerializer.h>
 
 using namespace Aws::Utils::Json;
@@ -48,28 +52,408 @@ int main(int argc, char* argv[])
 	params.restore = values["restore"].AsBool();
 	params.volumeSize = values["volumeSize"].AsInteger();
 
+	//block and partition sizes in bytes for a chain a full backup starts, 0 keeps the default
+	params.blockSize = 0;
+	params.partitionSize = 0;
+
+	if (v.ValueExists("geometry"))
+	{
+		auto geometryValues = values["geometry"].GetAllObjects();
+
+		params.blockSize = (UINT64)geometryValues["blockSize"].AsInt64();
+		params.partitionSize = (UINT64)geometryValues["partitionSize"].AsInt64();
+	}
+
 	params.vmdk = values["vmdk"].AsString();
 
+	//bytes per tracked granule: 512, 4096 or 65536
+	params.trackingGranularity = v.ValueExists("trackingGranularity") ? values["trackingGranularity"].AsInteger() : VIXDISKLIB_SECTOR_SIZE;
+
+	params.targetType = v.ValueExists("targetType") ? values["targetType"].AsString() : "vmdk";
+	params.targetPath = values["targetPath"].AsString();
+	params.compareTarget = values["compareTarget"].AsBool();
+
+	if (v.ValueExists("restoreRanges"))
+	{
+		auto ranges = values["restoreRanges"].AsArray();
+
+		for (size_t i = 0; i < ranges.GetLength(); i++)
+		{
+			auto rangeValues = ranges[i].GetAllObjects();
+
+			ByteRange range;
+			range.offset = (UINT64)rangeValues["offset"].AsInt64();
+			range.length = (UINT64)rangeValues["length"].AsInt64();
+			params.restoreRanges.push_back(range);
+		}
+	}
+
+	params.instantRestore = v.ValueExists("instantRestore");
+
+	if (params.instantRestore)
+	{
+		auto nbdValues = values["instantRestore"].GetAllObjects();
+
+		params.nbdSocket = nbdValues["socket"].AsString();
+		params.nbdPort = nbdValues["port"].AsInteger();
+		params.overlayFile = nbdValues["overlayFile"].AsString();
+		params.cacheBlocks = nbdValues["cacheBlocks"].AsInteger();
+		params.prefetchBlocks = nbdValues["prefetchBlocks"].AsInteger();
+	}
+
 	auto s3values = values["s3"].GetAllObjects();
 
 	string clientId = s3values["clientId"].AsString();
 	string volumeId = s3values["volumeId"].AsString();
 	string backupId = s3values["backupId"].AsString();
 	string restoreId = s3values["restoreId"].AsString();
+	params.currentBackupId = s3values["currentBackupId"].AsString();
 	string region = s3values["region"].AsString();
 
-	auto factory = new BackupStorageFactory("s3", clientId, volumeId, region);
+	//directory on the proxy caching the volume's metadata between jobs, none when empty
+	string catalogPath = s3values["catalogPath"].AsString();
+
+	//job-wide codec, optionally overridden for this volume under compression.volumes.<volumeId>
+	params.codec = "zlib";
+	params.codecLevel = 0;
+	params.skipIncompressible = true;
+	params.adaptiveCompression = false;
+	params.minCodecLevel = 0;
+	params.maxCodecLevel = 0;
+	params.useDictionary = false;
+	params.dictionarySamples = 0;
+
+	if (v.ValueExists("compression"))
+	{
+		auto compression = values["compression"];
+		auto compressionValues = compression.GetAllObjects();
+
+		if (compression.ValueExists("volumes") && compressionValues["volumes"].ValueExists(volumeId))
+		{
+			compression = compressionValues["volumes"].GetObject(volumeId);
+			compressionValues = compression.GetAllObjects();
+		}
+
+		if (compression.ValueExists("codec"))
+		{
+			params.codec = compressionValues["codec"].AsString();
+		}
+
+		params.codecLevel = compressionValues["level"].AsInteger();
+
+		if (compression.ValueExists("skipIncompressible"))
+		{
+			params.skipIncompressible = compressionValues["skipIncompressible"].AsBool();
+		}
+
+		params.adaptiveCompression = compressionValues["adaptive"].AsBool();
+		params.minCodecLevel = compressionValues["minLevel"].AsInteger();
+		params.maxCodecLevel = compressionValues["maxLevel"].AsInteger();
+		params.useDictionary = compressionValues["dictionary"].AsBool();
+		params.dictionarySamples = compressionValues["dictionarySamples"].AsInteger();
+	}
+
+	//blocks go to the content addressed store shared by every volume of clientId
+	params.chunkStore = v.ValueExists("chunkStore") && values["chunkStore"].AsBool();
+
+	//"fixed" stores every block as one chunk, "cdc" cuts content defined chunks of about averageChunkSize bytes
+	params.chunking = "fixed";
+	params.averageChunkSize = FASTCDC_DEFAULT_AVG_SIZE;
+
+	if (v.ValueExists("chunking"))
+	{
+		auto chunking = values["chunking"];
+		auto chunkingValues = chunking.GetAllObjects();
+
+		if (chunking.ValueExists("mode"))
+		{
+			params.chunking = chunkingValues["mode"].AsString();
+		}
+
+		if (chunking.ValueExists("averageChunkSize"))
+		{
+			params.averageChunkSize = chunkingValues["averageChunkSize"].AsInt64();
+		}
+	}
+
+	//blocks are stored as 4 KB pages, pages an earlier backup of the volume stored are referenced,
+	//at most indexEntries pages of the newest backups are kept in memory to match against
+	params.pageDedup = v.ValueExists("pageDedup");
+	params.pageIndexEntries = 4 * 1024 * 1024;
+
+	if (params.pageDedup)
+	{
+		auto pageDedup = values["pageDedup"];
+
+		if (pageDedup.ValueExists("indexEntries"))
+		{
+			params.pageIndexEntries = pageDedup.GetAllObjects()["indexEntries"].AsInt64();
+		}
+	}
+
+	//merges the chain up to sourceBackupId into backupId, at most concurrency blocks are composed at once
+	params.syntheticFull = v.ValueExists("syntheticFull");
+	params.syntheticConcurrency = 0;
+
+	if (params.syntheticFull)
+	{
+		auto syntheticValues = values["syntheticFull"].GetAllObjects();
+
+		params.syntheticSourceId = syntheticValues["sourceBackupId"].AsString();
+		params.syntheticConcurrency = syntheticValues["concurrency"].AsInteger();
+	}
+
+	//deletes what the expired backups leave unreferenced, page blocks kept for retained backups are
+	//rewritten below compactBelow live pages, memoryLimit in MB bounds the sorted reference lists
+	params.collectGarbage = v.ValueExists("gc");
+	params.compactBelow = 0.25;
+	params.deleteBatchSize = 1000;
+	params.deleteConcurrency = 4;
+	params.collectorMemoryLimit = 256;
+
+	if (params.collectGarbage)
+	{
+		auto gc = values["gc"];
+		auto gcValues = gc.GetAllObjects();
+
+		if (gc.ValueExists("expire"))
+		{
+			auto expired = gcValues["expire"].AsArray();
+
+			for (size_t i = 0; i < expired.GetLength(); i++)
+			{
+				params.expiredBackupIds.push_back(expired[i].AsString());
+			}
+		}
+
+		if (gc.ValueExists("compactBelow"))
+		{
+			params.compactBelow = gcValues["compactBelow"].AsDouble();
+		}
+
+		if (gc.ValueExists("batchSize"))
+		{
+			params.deleteBatchSize = gcValues["batchSize"].AsInteger();
+		}
+
+		if (gc.ValueExists("concurrency"))
+		{
+			params.deleteConcurrency = gcValues["concurrency"].AsInteger();
+		}
+
+		if (gc.ValueExists("memoryLimit"))
+		{
+			params.collectorMemoryLimit = (UINT64)gcValues["memoryLimit"].AsInt64();
+		}
+	}
+
+	//recompresses the backups completed more than afterDays ago with codec at level, 0 selecting its
+	//strongest level, concurrency blocks at once and reading at most maxMBps, 0 for no limit
+	params.recompress = v.ValueExists("recompress");
+	params.recompressAfterDays = 30;
+	params.recompressCodec = "zstd";
+	params.recompressLevel = 0;
+	params.recompressConcurrency = 4;
+	params.recompressMaxMBps = 0;
+
+	if (params.recompress)
+	{
+		auto recompress = values["recompress"];
+		auto recompressValues = recompress.GetAllObjects();
+
+		if (recompress.ValueExists("afterDays"))
+		{
+			params.recompressAfterDays = recompressValues["afterDays"].AsInteger();
+		}
+
+		if (recompress.ValueExists("codec"))
+		{
+			params.recompressCodec = recompressValues["codec"].AsString();
+		}
+
+		if (recompress.ValueExists("level"))
+		{
+			params.recompressLevel = recompressValues["level"].AsInteger();
+		}
+
+		if (recompress.ValueExists("concurrency"))
+		{
+			params.recompressConcurrency = recompressValues["concurrency"].AsInteger();
+		}
+
+		if (recompress.ValueExists("maxMBps"))
+		{
+			params.recompressMaxMBps = recompressValues["maxMBps"].AsInteger();
+		}
+	}
+
+	//checks blocks [firstBlock, firstBlock + blocks) of the restore point against the root of its Merkle tree,
+	//blocks 0 for every block from firstBlock on, rootHash in hex for a root recorded elsewhere
+	params.verifyRange = v.ValueExists("verify");
+	params.verifyFirstBlock = 0;
+	params.verifyBlocks = 0;
+
+	if (params.verifyRange)
+	{
+		auto verify = values["verify"];
+		auto verifyValues = verify.GetAllObjects();
+
+		if (verify.ValueExists("firstBlock"))
+		{
+			params.verifyFirstBlock = (UINT64)verifyValues["firstBlock"].AsInt64();
+		}
+
+		if (verify.ValueExists("blocks"))
+		{
+			params.verifyBlocks = (UINT64)verifyValues["blocks"].AsInt64();
+		}
+
+		if (verify.ValueExists("rootHash"))
+		{
+			params.verifyRootHash = verifyValues["rootHash"].AsString();
+		}
+	}
+
+	//copies the restore points the replica lacks to clientId and volumeId, by default those of the source, in
+	//storage of type s3 in region or of type local in the directory path, reading concurrency objects at once
+	params.replicate = v.ValueExists("replicate");
+	params.replicaType = "s3";
+	params.replicaClientId = clientId;
+	params.replicaVolumeId = volumeId;
+	params.replicaRegion = region;
+	params.replicaConcurrency = 16;
+
+	if (params.replicate)
+	{
+		auto replicate = values["replicate"];
+		auto replicateValues = replicate.GetAllObjects();
+
+		if (replicate.ValueExists("type"))
+		{
+			params.replicaType = replicateValues["type"].AsString();
+		}
+
+		if (replicate.ValueExists("clientId"))
+		{
+			params.replicaClientId = replicateValues["clientId"].AsString();
+		}
+
+		if (replicate.ValueExists("volumeId"))
+		{
+			params.replicaVolumeId = replicateValues["volumeId"].AsString();
+		}
+
+		if (replicate.ValueExists("region"))
+		{
+			params.replicaRegion = replicateValues["region"].AsString();
+		}
+
+		if (replicate.ValueExists("path"))
+		{
+			params.replicaPath = replicateValues["path"].AsString();
+		}
+
+		if (replicate.ValueExists("concurrency"))
+		{
+			params.replicaConcurrency = replicateValues["concurrency"].AsInteger();
+		}
+	}
+
+	//keeps the raw image or VMDK path at the newest restore point, backups apply their blocks to it, update
+	//applies the backups missed meanwhile as a job of its own. id names the standby among those of the volume.
+	params.standby = v.ValueExists("standby");
+	params.standbyUpdate = false;
+	params.standbyId = "standby";
+	params.standbyType = "raw";
+
+	if (params.standby)
+	{
+		auto standby = values["standby"];
+		auto standbyValues = standby.GetAllObjects();
+
+		if (standby.ValueExists("id"))
+		{
+			params.standbyId = standbyValues["id"].AsString();
+		}
+
+		if (standby.ValueExists("type"))
+		{
+			params.standbyType = standbyValues["type"].AsString();
+		}
+
+		params.standbyPath = standbyValues["path"].AsString();
+		params.standbyUpdate = standbyValues["update"].AsBool();
+	}
+
+	params.benchmarkCodecs = v.ValueExists("benchmarkCodecs");
+
+	if (params.benchmarkCodecs)
+	{
+		params.benchmarkBlocks = values["benchmarkCodecs"].GetAllObjects()["blocks"].AsInteger();
+	}
+
+	auto factory = new BackupStorageFactory("s3", clientId, volumeId, region, "", catalogPath);
 	auto backupProcessor = new BackupProcessor(factory->GetStorage(), backupId);
 
 	int result = 0;
 
-	if (params.restore)
+	if (params.benchmarkCodecs)
+	{
+		result = backupProcessor->BenchmarkCodecs(params);
+	}
+	else if (params.syntheticFull)
+	{
+		result = backupProcessor->SynthesizeFullBackup(params, volumeId);
+	}
+	else if (params.collectGarbage)
+	{
+		GarbageCollector collector(factory->GetStorage(), backupId);
+		result = collector.Collect(params, volumeId);
+	}
+	else if (params.recompress)
+	{
+		ColdTierRecompressor recompressor(factory->GetStorage(), backupId);
+		result = recompressor.Recompress(params, volumeId);
+	}
+	else if (params.replicate)
+	{
+		BackupStorageFactory replicaFactory(params.replicaType, params.replicaClientId, params.replicaVolumeId, params.replicaRegion, params.replicaPath, "");
+
+		if (replicaFactory.GetStorage() == NULL)
+		{
+			cout << "Replica storage type is not supported: " << params.replicaType << endl;
+			result = ERROR_CODE;
+		}
+		else if (params.replicaType == "local" && params.replicaPath.empty())
+		{
+			cout << "Local replica storage requires a path" << endl;
+			result = ERROR_CODE;
+		}
+		else
+		{
+			BackupReplicator replicator(factory->GetStorage(), replicaFactory.GetStorage(), backupId);
+			result = replicator.Replicate(params, volumeId);
+		}
+	}
+	else if (params.standbyUpdate)
+	{
+		result = backupProcessor->UpdateStandby(params, volumeId);
+	}
+	else if (params.verifyRange)
+	{
+		result = backupProcessor->VerifyRestorePoint(params, volumeId, restoreId);
+	}
+	else if (params.instantRestore)
+	{
+		result = backupProcessor->ExportRestorePoint(params, volumeId, restoreId);
+	}
+	else if (params.restore)
 	{
 		result = backupProcessor->RestoreData(params, volumeId, restoreId);
 	}
 	else
 	{
-		result = backupProcessor->BackupData(params);
+		result = backupProcessor->BackupData(params, volumeId);
 	}
 
 	delete backupProcessor;